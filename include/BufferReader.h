@@ -80,11 +80,13 @@ class BufferReader {
   void readBytes(err_code_t& err, size_t len, TokenData& tokenData);
   void expectBytes(err_code_t& err, const char* str, size_t str_size);
   void skipBytes(err_code_t& err, size_t str_size);
+  size_t readPiece(size_t len, const char*& data);
   void setNextPreferedDataBlockSize(size_t n);
   size_t getNextPreferedDataBlockSize();
 
  protected:
   const char charAtCursor(DataCursor& cur) const;
+  void recycleBlock(DataBlockListIterator it);
 
   DataBlockList m_dataBlockList;
   size_t m_capacity;
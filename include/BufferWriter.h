@@ -23,6 +23,7 @@ class BufferWriter {
   void reserve(size_t n);
   void takeBuffer(const char* const buf, size_t buf_len);
   void takeNumber(int64_t val);
+  void takeCopy(const char* const buf, size_t buf_len);
 #ifdef __APPLE__
   const struct iovec* const getReadPtr(int &n);
 #else
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include "Export.h"
 #include "Result.h"
@@ -23,6 +24,16 @@ class Client : public ConnectionPool {
 DECL_RETRIEVAL_CMD(get)
 DECL_RETRIEVAL_CMD(gets)
 #undef DECL_RETRIEVAL_CMD
+  err_code_t gat(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                 const exptime_t exptime, retrieval_result_t*** results, size_t* nResults);
+  err_code_t gats(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                  const exptime_t exptime, retrieval_result_t*** results, size_t* nResults);
+  err_code_t getStream(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                       value_sink_t sink, void* ctx,
+                       retrieval_result_t*** results, size_t* nResults);
+  err_code_t getInto(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                     char* arena, const size_t* offsets, const size_t* sizes,
+                     retrieval_result_t*** results, size_t* nResults);
 
   // storage commands
   void destroyMessageResult();
@@ -40,6 +51,19 @@ DECL_RETRIEVAL_CMD(gets)
   DECL_STORAGE_CMD(prepend);
   DECL_STORAGE_CMD(cas);
 #undef DECL_STORAGE_CMD
+  // the same with an exptime per item
+#define DECL_STORAGE_MULTI_CMD(M) \
+  err_code_t M##Multi(const char* const* keys, const size_t* key_lens, \
+           const flags_t* flags, const exptime_t* exptimes, \
+           const cas_unique_t* cas_uniques, const bool noreply, \
+           const char* const* vals, const size_t* val_lens, \
+           size_t nItems, message_result_t*** results, size_t* nResults)
+
+  DECL_STORAGE_MULTI_CMD(set);
+  DECL_STORAGE_MULTI_CMD(add);
+  DECL_STORAGE_MULTI_CMD(replace);
+  DECL_STORAGE_MULTI_CMD(cas);
+#undef DECL_STORAGE_MULTI_CMD
   err_code_t _delete(const char* const* keys, const size_t* key_lens,
                const bool noreply, size_t nItems,
                message_result_t*** results, size_t* nResults);
@@ -55,6 +79,9 @@ DECL_RETRIEVAL_CMD(gets)
   err_code_t touch(const char* const* keys, const size_t* keyLens,
              const exptime_t exptime, const bool noreply, size_t nItems,
              message_result_t*** results, size_t* nResults);
+  err_code_t touchMulti(const char* const* keys, const size_t* keyLens,
+                        const exptime_t* exptimes, const bool noreply, size_t nItems,
+                        message_result_t*** results, size_t* nResults);
 
   // incr / decr
   void destroyUnsignedResult();
@@ -64,6 +91,21 @@ DECL_RETRIEVAL_CMD(gets)
   err_code_t decr(const char* key, const size_t keyLen, const uint64_t delta,
            const bool noreply,
            unsigned_result_t** result, size_t* nResults);
+  // many keys at once, pipelined to each server. The results are of the keys
+  // found, SEE getKeyStatuses for which ones
+  err_code_t incrMulti(const char* const* keys, const size_t* keyLens,
+                       const uint64_t* deltas, const bool noreply, size_t nItems,
+                       unsigned_result_t*** results, size_t* nResults);
+  err_code_t decrMulti(const char* const* keys, const size_t* keyLens,
+                       const uint64_t* deltas, const bool noreply, size_t nItems,
+                       unsigned_result_t*** results, size_t* nResults);
+
+  // SEE ConnectionPool::getKeyStatuses, of the keys as passed when values
+  // are split
+  void getKeyStatuses(key_status_t** statuses, size_t* nKeys);
+
+    // metrics, valid until the next call
+  void getMetrics(server_metrics_t** metrics, size_t* nServers);
 
   void _sleep(uint32_t seconds); // check GIL in Python
 
@@ -72,11 +114,51 @@ DECL_RETRIEVAL_CMD(gets)
   void collectMessageResult(message_result_t*** results, size_t* nResults);
   void collectBroadcastResult(broadcast_result_t** results, size_t* nHosts);
   void collectUnsignedResult(unsigned_result_t** results, size_t* nResults);
+  void collectMultiUnsignedResult(unsigned_result_t*** results, size_t* nResults);
+
+  err_code_t retrieve(op_code_t op, const char* const* keys, const size_t* keyLens,
+                      size_t nKeys, const exptime_t exptime,
+                      retrieval_result_t*** results, size_t* nResults);
+  err_code_t store(op_code_t op, const char* const* keys, const size_t* key_lens,
+                   const flags_t* flags, const exptime_t exptime,
+                   const exptime_t* exptimes, const cas_unique_t* cas_uniques,
+                   const bool noreply, const char* const* vals,
+                   const size_t* val_lens, size_t nItems,
+                   message_result_t*** results, size_t* nResults);
+  err_code_t splitLargeValues(const char* const* keys, const size_t* key_lens,
+                              const flags_t* flags, const exptime_t exptime,
+                              const exptime_t* exptimes, const bool noreply,
+                              const char* const* vals, const size_t* val_lens,
+                              size_t nItems, message_result_t*** results,
+                              size_t* nResults);
+  err_code_t joinChunkedValues(op_code_t op, const char* const* keys,
+                               const size_t* keyLens, size_t nKeys,
+                               const exptime_t exptime, err_code_t rv,
+                               retrieval_result_t*** results, size_t* nResults);
+  void addChunkKeys(const char* key, size_t keyLen, size_t nChunks);
+  void fixChunkKeys();
+  void suspendKeyPrefix(std::string& prefix);
+  void resumeKeyPrefix(const std::string& prefix);
+
+  // store values larger than MC_CHUNK_SIZE as chunks, SEE Client::splitLargeValues
+  bool m_splittingLargeValues;
+  // chunk keys of the current command, in m_chunkKeyBuffer once complete
+  std::string m_chunkKeyBuffer;
+  std::vector<size_t> m_chunkKeyOffsets;
+  std::vector<const char*> m_chunkKeys;
+  std::vector<size_t> m_chunkKeyLens;
+  // results of a command that took two rounds, own copies of the first
+  // round ones, SEE Client::joinChunkedValues
+  std::string m_joinedBuffer;
+  std::vector<retrieval_result_t> m_joinedResults;
+  std::vector<message_result_t> m_joinedMessages;
+  std::vector<key_status_t> m_joinedStatuses;
 
   std::vector<retrieval_result_t*> m_outRetrievalResultPtrs;
   std::vector<message_result_t*> m_outMessageResultPtrs;
   std::vector<broadcast_result_t> m_outBroadcastResultPtrs;
   std::vector<unsigned_result_t*> m_outUnsignedResultPtrs;
+  std::vector<server_metrics_t> m_outMetrics;
 };
 
 } // namespace mc
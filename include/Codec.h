@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include "Common.h"
+#include "Export.h"
+
+namespace douban {
+namespace mc {
+
+// Value compression of a client, each codec is compiled in only if its
+// library is found at build time (MC_USE_ZLIB, MC_USE_LZ4, MC_USE_ZSTD).
+//
+// A compressed value is marked by the flag bit of its codec, so that it is
+// decompressed on retrieval whatever codec the reading client is set to:
+//   zlib: a zlib stream, compatible with _FLAG_COMPRESS of the Python binding
+//   lz4:  the uncompressed size (4B, little endian) then an LZ4 block
+//   zstd: a zstd frame, with the dictionary if one is set
+class Codec {
+ public:
+  Codec();
+  ~Codec();
+  static bool isAvailable(compress_codec_options_t codec);
+  // return false and keep the current codec if the codec is not compiled in
+  bool setCodec(compress_codec_options_t codec);
+  void setThreshold(size_t threshold);
+  // a dictionary trained on the values (e.g. `zstd --train`), zstd only,
+  // pass NULL to clear it
+  err_code_t setDictionary(const char* dict, size_t len);
+  bool enabled() const;
+
+  // append the compressed val to out and return true, or return false if
+  // val should be stored as is: below the threshold, compressed already by
+  // the caller, or not shrinking
+  bool compress(const char* val, size_t len, flags_t flags, std::string& out,
+                flags_t& outFlags);
+  // return a new[]-ed decompressed val, or NULL if val is not compressed by
+  // an available codec or is corrupted
+  char* decompress(const char* val, size_t len, flags_t flags, size_t& outLen,
+                   flags_t& outFlags);
+
+ protected:
+  compress_codec_options_t m_codec;
+  size_t m_threshold;
+  std::string m_dict;
+  void* m_cctx; // ZSTD_CCtx
+  void* m_dctx; // ZSTD_DCtx
+  void* m_cdict; // ZSTD_CDict
+  void* m_ddict; // ZSTD_DDict
+};
+
+} // namespace mc
+} // namespace douban
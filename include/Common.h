@@ -9,11 +9,37 @@
 #include <cstdlib>
 #include <cerrno>
 
+#include "Logger.h"
+
 #define PROJECT_NAME "libmc"
 #define MC_DEFAULT_PORT 11211
 #define MC_DEFAULT_POLL_TIMEOUT 300
 #define MC_DEFAULT_CONNECT_TIMEOUT 10
 #define MC_DEFAULT_RETRY_TIMEOUT 5
+#define MC_DEFAULT_MAX_RETRY_TIMEOUT 60
+#define MC_DEFAULT_REQUEST_TIMEOUT 0
+#define MC_DEFAULT_MAINTAIN_INTERVAL 0
+#define MC_DEFAULT_KEEPALIVE_IDLE 0
+#define MC_KEEPALIVE_PROBES 3
+#define MC_DEFAULT_SEND_WINDOW 0
+#define MC_DEFAULT_MAX_GET_KEYS 0
+#define MC_DEFAULT_MAX_GET_BYTES 0
+#define MC_DEFAULT_CONNS_PER_SERVER 1
+#define MC_MAX_CONNS_PER_SERVER 64
+#define MC_DEFAULT_COMPRESS_THRESHOLD 1024
+// refuse to inflate a value beyond, against corrupted or hostile headers
+#define MC_MAX_DECOMPRESSED_SIZE (128 << 20)
+// values split into chunks, the same as _DOUBAN_CHUNK_SIZE of the Python binding
+#define MC_CHUNK_SIZE 1000000
+#define MC_MAX_CHUNKS 10
+#define MC_MAX_CHUNKED_KEY_LENGTH 200
+// receiving buffer of a value streamed to a sink, SEE PacketParser::streamValue
+#define MC_SINK_BLOCK_SIZE (64 << 10)
+
+// error-rate based tripping of a connection, SEE Connection::markDead
+#define MC_HEALTH_WINDOW_SIZE 32
+#define MC_HEALTH_MIN_REQUESTS 8
+#define MC_HEALTH_MAX_ERROR_PERCENT 50
 
 
 #ifdef UIO_MAXIOV
@@ -56,6 +82,7 @@
 
 
 #define _mc_clean_errno() (errno == 0 ? "None" : strerror(errno))
+// synchronous, only for assertion failures which must never be dropped
 #define _mc_output_stderr(LEVEL, FORMAT, ...) ( \
   fprintf( \
     stderr, \
@@ -65,14 +92,17 @@
   __VOID_CAST(0) \
 )
 
-void printBacktrace();
+// goes through the log sink, never blocks, SEE douban::mc::logging::log
+#define _mc_log(LEVEL, FORMAT, ...) ( \
+  douban::mc::logging::enabled(LEVEL) ? \
+  douban::mc::logging::log(LEVEL, __FILE__, __LINE__, FORMAT, ##__VA_ARGS__) : \
+  __VOID_CAST(0) \
+)
 
-#define MC_LOG_LEVEL_ERROR 1
-#define MC_LOG_LEVEL_WARNING 2
-#define MC_LOG_LEVEL_INFO 3
-#define MC_LOG_LEVEL_DEBUG 4
+void printBacktrace();
 
-#define MC_LOG_LEVEL MC_LOG_LEVEL_ERROR
+// levels compiled in, those above douban::mc::logging::level() are dropped at runtime
+#define MC_LOG_LEVEL MC_LOG_LEVEL_INFO
 
 #ifdef NDEBUG
 #define debug(M, ...) __VOID_CAST(0)
@@ -86,7 +116,7 @@ void printBacktrace();
 
 #if MC_LOG_LEVEL >= MC_LOG_LEVEL_DEBUG
 #define debug(M, ...) ( \
-  _mc_output_stderr(DEBUG, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
+  _mc_log(MC_LOG_LEVEL_DEBUG, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
   __VOID_CAST(0) \
 )
 #else
@@ -110,7 +140,7 @@ void printBacktrace();
 
 #if MC_LOG_LEVEL >= MC_LOG_LEVEL_INFO
 #define log_info(M, ...) ( \
-  _mc_output_stderr(INFO, M, ##__VA_ARGS__), \
+  _mc_log(MC_LOG_LEVEL_INFO, M, ##__VA_ARGS__), \
   __VOID_CAST(0) \
 )
 #else
@@ -119,7 +149,7 @@ void printBacktrace();
 
 #if MC_LOG_LEVEL >= MC_LOG_LEVEL_WARNING
 #define log_warn(M, ...) ( \
-  _mc_output_stderr(WARN, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
+  _mc_log(MC_LOG_LEVEL_WARNING, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
   __VOID_CAST(0) \
 )
 #else
@@ -128,7 +158,7 @@ void printBacktrace();
 
 #if MC_LOG_LEVEL >= MC_LOG_LEVEL_ERROR
 #define log_err(M, ...) ( \
-  _mc_output_stderr(ERROR, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
+  _mc_log(MC_LOG_LEVEL_ERROR, "[E: %s] " M, _mc_clean_errno(), ##__VA_ARGS__), \
   __VOID_CAST(0) \
 )
 #else
@@ -185,6 +215,9 @@ typedef enum {
   // key(s) ->
   GET_OP,
   GETS_OP,
+  // exptime_t -> key(s) -> key_val(s)
+  GAT_OP,
+  GATS_OP,
 
   // modify commands -> key -> uint64_t -> uint64_t_or_not_found
   INCR_OP,
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <netdb.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <ctime>
 
@@ -16,6 +17,14 @@
 namespace douban {
 namespace mc {
 
+// circuit breaker state of a connection
+typedef enum {
+  HEALTH_CLOSED, // healthy, requests flow through
+  HEALTH_OPEN, // tripped, no request until m_deadUntil
+  HEALTH_HALF_OPEN, // reconnected, the next request is a probe
+} health_state_t;
+
+
 class Connection {
 
  public:
@@ -26,7 +35,13 @@ class Connection {
     void close();
     const bool alive();
     bool tryReconnect();
+    bool reconnect();
+    void setManaged(bool managed);
     void markDead(const char* reason, int delay = 0);
+    void markAlive();
+    void abandon(const char* reason);
+    const health_state_t health();
+    const int64_t deadUntil();
     int socketFd() const;
 
     const char* name();
@@ -38,10 +53,22 @@ class Connection {
     void addRequestKey(const char* const key, const size_t len);
     size_t requestKeyCount();
     void setParserMode(ParserMode md);
+    void setValueSink(value_sink_t sink, void* ctx);
+    void setValueBuffer(value_buffer_t buffer, void* ctx);
+    void setKeyPrefixLen(size_t len);
+    void setDecodingKeys(bool enabled);
+    void setEndCount(size_t n);
     void takeNumber(int64_t val);
+    void takeCopy(const char* const buf, size_t buf_len);
     ssize_t send();
     ssize_t recv();
     void process(err_code_t& err);
+    void setOutcome(err_code_t err);
+    err_code_t outcome();
+    server_metrics_t* metrics();
+    void countError(err_code_t err);
+    void snapshotMetrics(server_metrics_t* out);
+    void resetMetrics();
     types::RetrievalResultList* getRetrievalResults();
     types::MessageResultList* getMessageResults();
     types::LineResultList* getLineResults();
@@ -53,35 +80,61 @@ class Connection {
     void reset();
     void setRetryTimeout(int timeout);
     const int getRetryTimeout();
+    void setMaxRetryTimeout(int timeout);
     void setConnectTimeout(int timeout);
+    void setKeepaliveIdle(int idle);
+    void setSendWindow(int window);
+    void setTraceHook(trace_hook_t hook, void* ctx);
 
     size_t m_counter;
 
  protected:
     int connectPoll(int fd, struct addrinfo* ai_ptr);
+    int64_t nextBackoff();
+    void recordOutcome(bool failed);
 
     char m_name[MC_NI_MAXHOST + 1 + MC_NI_MAXSERV];
     char m_host[MC_NI_MAXHOST];
     uint32_t m_port;
 
     int m_socketFd;
-    bool m_alive;
+    bool m_alive; // SEE Connection::alive
     bool m_hasAlias;
-    time_t m_deadUntil;
+    bool m_managed; // reconnected by a background maintainer
+    pthread_mutex_t m_healthLock; // guards the socket and the fields below
+    health_state_t m_health;
+    int64_t m_deadUntil; // ms, SEE utility::getCurrentMonotonicMs
+    uint32_t m_nConsecutiveFailures;
+    uint32_t m_nWindowRequests;
+    uint32_t m_nWindowErrors;
+    unsigned int m_jitterSeed;
     io::BufferWriter* m_buffer_writer; // for send
     io::BufferReader* m_buffer_reader; // for recv
     PacketParser m_parser;
+    err_code_t m_outcome; // of the current request, SEE ConnectionPool::getKeyStatuses
+    server_metrics_t m_metrics;
 
     int m_connectTimeout;
     int m_retryTimeout;
+    int m_maxRetryTimeout;
+    int m_keepaliveIdle;
+    int m_sendWindow; // bytes, SEE ConnectionPool::setSendWindow
+    trace_hook_t m_traceHook; // SEE ConnectionPool::setTraceHook
+    void* m_traceCtx;
 
  private:
     Connection(const Connection& conn);
 };
 
 
+// may be read while a background maintainer reconnects the connection,
+// the acquire pairs with the release in Connection::connect
 inline const bool Connection::alive() {
-  return m_alive;
+  return __atomic_load_n(&m_alive, __ATOMIC_ACQUIRE);
+}
+
+inline server_metrics_t* Connection::metrics() {
+  return &m_metrics;
 }
 
 inline const char* Connection::name() {
@@ -104,6 +157,14 @@ inline const int Connection::getRetryTimeout() {
   return m_retryTimeout;
 }
 
+inline const health_state_t Connection::health() {
+  return m_health;
+}
+
+inline const int64_t Connection::deadUntil() {
+  return m_deadUntil;
+}
+
 
 } // namespace mc
 } // namespace douban
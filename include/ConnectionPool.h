@@ -1,7 +1,10 @@
 #pragma once
 
+#include <pthread.h>
+#include <string>
 #include <vector>
 #include "Common.h"
+#include "Codec.h"
 #include "Connection.h"
 #include "hashkit/ketama.h"
 
@@ -19,44 +22,138 @@ class ConnectionPool {
   const char* getRealtimeServerAddressByKey(const char* key, size_t keyLen);
   void enableConsistentFailover();
   void disableConsistentFailover();
+  // exptime is of gat/gats only
   void dispatchRetrieval(op_code_t op, const char* const* keys, const size_t* keyLens,
-                    size_t n_keys);
+                    size_t n_keys, const exptime_t exptime = 0);
+  // exptimes, if not NULL, are of each item instead of exptime
   void dispatchStorage(op_code_t op,
                         const char* const* keys, const size_t* keyLens,
                         const flags_t* flags, const exptime_t exptime,
+                        const exptime_t* exptimes,
                         const cas_unique_t* cas_uniques, const bool noreply,
                         const char* const* vals, const size_t* val_lens,
                         size_t nItems);
   void dispatchDeletion(const char* const* keys, const size_t* keyLens,
                        const bool noreply, size_t nItems);
   void dispatchTouch(const char* const* keys, const size_t* keyLens,
-                     const exptime_t exptime, const bool noreply, size_t nItems);
+                     const exptime_t exptime, const exptime_t* exptimes,
+                     const bool noreply, size_t nItems);
   void dispatchIncrDecr(op_code_t op, const char* key, const size_t keyLen,
                         const uint64_t delta, const bool noreply);
-  void broadcastCommand(const char * const cmd, const size_t cmdLens);
+  void dispatchIncrDecr(op_code_t op, const char* const* keys, const size_t* keyLens,
+                        const uint64_t* deltas, const bool noreply, size_t nItems);
+  // to a connection of each server, or to every connection if everyConn
+  void broadcastCommand(const char * const cmd, const size_t cmdLens, bool everyConn = false);
 
   err_code_t waitPoll();
 
-  void collectRetrievalResult(std::vector<retrieval_result_t*>& results);
+  void collectRetrievalResult(std::vector<retrieval_result_t*>& results,
+                              bool decoding = true);
   void collectMessageResult(std::vector<message_result_t*>& results);
   void collectBroadcastResult(std::vector<broadcast_result_t>& results);
   void collectUnsignedResult(std::vector<unsigned_result_t*>& results);
+  void collectMultiUnsignedResult(std::vector<unsigned_result_t*>& results);
+  void getKeyStatuses(key_status_t** statuses, size_t* nKeys);
+  void collectMetrics(std::vector<server_metrics_t>& metrics);
+  void resetMetrics();
   void reset();
   void setPollTimeout(int timeout);
   void setConnectTimeout(int timeout);
   void setRetryTimeout(int timeout);
+  void setMaxRetryTimeout(int timeout);
+  void setKeepaliveIdle(int idle);
+  void setSendWindow(int window);
+  void setMaxGetSize(int maxKeys, int maxBytes);
+  void setConnsPerServer(int n);
+  void setMaintainInterval(int interval);
+  void setRequestTimeout(int timeout);
+  void setDeadline(int timeout);
+  void clearDeadline();
+  void setTraceHook(trace_hook_t hook, void* ctx);
+  void setValueSink(value_sink_t sink, void* ctx);
+  void setValueBuffer(value_buffer_t buffer, void* ctx);
+  void setCompressCodec(compress_codec_options_t codec);
+  void setCompressThreshold(int threshold);
+  err_code_t setCompressDictionary(const char* dict, size_t len);
+  err_code_t setKeyPrefix(const char* prefix, size_t len);
+  void setBinarySafeKeys(bool enabled);
 
  protected:
-  void markDeadAll(pollfd_t* pollfds, const char*);
-  void markDeadConn(Connection* conn, const char* reason, pollfd_t* fd_ptr);
+  void markDeadAll(pollfd_t* pollfds, const bool* started, err_code_t err,
+                   const char* reason);
+  void markDeadConn(Connection* conn, err_code_t err, const char* reason, pollfd_t* fd_ptr);
+  void abandonAll(pollfd_t* pollfds, const bool* started, const char* reason);
+  void beginKeys(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                 bool retrieval, bool noreply);
+  Connection* routeKey(const char* key, size_t keyLen, size_t* wireLen = NULL);
+  Connection* spreadKey(Connection* conn, const char* key, size_t keyLen);
+  void configConn(Connection* conn);
+  const char* wireKey(const char* key, size_t& keyLen, char* buf, bool validating = true);
+  bool needsEncoding(const char* key, size_t keyLen);
+  void takeKey(Connection* conn, const char* key, size_t keyLen);
+  void trace(trace_phase_t phase, const char* server, int64_t start, int64_t end,
+             size_t nKeys, err_code_t err);
+  void traceConn(Connection* conn, int64_t waitStart, int64_t sentAt, int64_t firstByteAt,
+                 int64_t doneAt);
+  void compressValues(const flags_t*& flags, const char* const*& vals,
+                      const size_t*& val_lens, size_t nItems);
+  void startMaintainer();
+  void stopMaintainer();
+  void maintain();
+  static void* maintainerLoop(void* pool);
 
   uint32_t m_nActiveConn; // wait for poll
   uint32_t m_nInvalidKey;
   std::vector<Connection*> m_activeConns;
+
+  // keys of the current multi-key command, SEE ConnectionPool::getKeyStatuses
+  const char* const* m_keys;
+  const size_t* m_keyLens;
+  bool m_keysRetrieval;
+  bool m_keysNoreply;
+  std::vector<Connection*> m_keyConns; // NULL if the key is not sent
+  std::vector<key_status_t> m_keyStatuses;
+  int64_t m_dispatchStart; // us, SEE utility::getCurrentMonotonicUs
   hashkit::KetamaSelector m_connSelector;
+  // the connections of server i are m_conns[i * m_connsPerServer] (the one
+  // the server is hashed by) and the ones after, SEE setConnsPerServer
   Connection *m_conns;
   size_t m_nConns;
+  size_t m_connsPerServer;
   int m_pollTimeout;
+  int m_connectTimeout;
+  int m_retryTimeout;
+  int m_maxRetryTimeout;
+  int m_keepaliveIdle;
+  int m_sendWindow;
+  // bounds of a retrieval command to a server, 0 means none, SEE setMaxGetSize
+  size_t m_maxGetKeys;
+  size_t m_maxGetBytes;
+  // keys and bytes of the last command, and number of commands, of each server
+  std::vector<size_t> m_getKeys;
+  std::vector<size_t> m_getBytes;
+  std::vector<size_t> m_getCommands;
+  int m_requestTimeout; // ms, 0 means no deadline
+  int64_t m_deadline; // ms, SEE utility::getCurrentMonotonicMs, 0 means none
+  trace_hook_t m_traceHook; // NULL means no tracing
+  void* m_traceCtx;
+  std::string m_keyPrefix; // SEE ConnectionPool::setKeyPrefix
+  bool m_binarySafeKeys; // SEE ConnectionPool::setBinarySafeKeys
+
+  Codec m_codec;
+  // the values of the current storage command once compressed, SEE compressValues
+  std::string m_compressBuffer;
+  std::vector<const char*> m_compressedVals;
+  std::vector<size_t> m_compressedLens;
+  std::vector<flags_t> m_compressedFlags;
+
+  // background reconnecting, SEE ConnectionPool::setMaintainInterval
+  int m_maintainInterval; // ms, 0 means reconnecting on the request path
+  bool m_maintainerRunning;
+  bool m_maintainerStopping;
+  pthread_t m_maintainer;
+  pthread_mutex_t m_maintainerLock;
+  pthread_cond_t m_maintainerCond;
 };
 
 } // namespace mc
@@ -12,7 +12,19 @@ typedef enum {
   CFG_POLL_TIMEOUT,
   CFG_CONNECT_TIMEOUT,
   CFG_RETRY_TIMEOUT,
-  CFG_HASH_FUNCTION
+  CFG_HASH_FUNCTION,
+  CFG_MAX_RETRY_TIMEOUT,
+  CFG_MAINTAIN_INTERVAL,
+  CFG_KEEPALIVE_IDLE,
+  CFG_REQUEST_TIMEOUT,
+  CFG_COMPRESS_CODEC,
+  CFG_COMPRESS_THRESHOLD,
+  CFG_SPLIT_LARGE_VALUES,
+  CFG_BINARY_SAFE_KEYS,
+  CFG_SEND_WINDOW,
+  CFG_MAX_GET_KEYS,
+  CFG_MAX_GET_BYTES,
+  CFG_CONNS_PER_SERVER
 } config_options_t;
 
 
@@ -24,6 +36,34 @@ typedef enum {
 } hash_function_options_t;
 
 
+// codecs of values compressed by the client, SEE douban::mc::Codec
+typedef enum {
+  OPT_COMPRESS_NONE,
+  OPT_COMPRESS_ZLIB,
+  OPT_COMPRESS_LZ4,
+  OPT_COMPRESS_ZSTD,
+} compress_codec_options_t;
+
+// the flag bits marking a compressed value, zlib is the _FLAG_COMPRESS of
+// the Python binding
+#define MC_FLAG_COMPRESS_ZLIB (1 << 4)
+#define MC_FLAG_COMPRESS_LZ4 (1 << 8)
+#define MC_FLAG_COMPRESS_ZSTD (1 << 9)
+#define MC_FLAG_COMPRESS_MASK \
+  (MC_FLAG_COMPRESS_ZLIB | MC_FLAG_COMPRESS_LZ4 | MC_FLAG_COMPRESS_ZSTD)
+// the flag bit of the header of a value split into chunks, the
+// _FLAG_DOUBAN_CHUNKED of the Python binding, SEE Client::splitLargeValues
+#define MC_FLAG_CHUNKED (1 << 12)
+// the flag bits marking how a value is serialized, those of the Python
+// binding, SEE douban::mc::serializer
+#define MC_FLAG_PICKLE (1 << 0)
+#define MC_FLAG_INTEGER (1 << 1)
+#define MC_FLAG_LONG (1 << 2)
+#define MC_FLAG_BOOL (1 << 3)
+#define MC_FLAG_MARSHAL (1 << 5)
+#define MC_FLAG_MSGPACK (1 << 6)
+
+
 typedef enum {
   RET_SEND_ERR = -9,
   RET_RECV_ERR = -8,
@@ -38,6 +78,17 @@ typedef enum {
 } err_code_t;
 
 
+// status of each key of a multi-key command
+typedef enum {
+  KEY_HIT, // found, or stored / deleted / touched (sent, for noreply commands)
+  KEY_MISS, // not found, or not stored / exists
+  KEY_SERVER_ERR, // the server failed before responding
+  KEY_TIMEOUT_ERR, // the server didn't respond in time
+  KEY_INVALID_ERR, // malformed key, not sent
+  KEY_DEAD_SERVER_ERR // no server available for the key, not sent
+} key_status_t;
+
+
 typedef int64_t exptime_t;
 typedef uint32_t flags_t;
 typedef uint64_t cas_unique_t;
@@ -84,3 +135,114 @@ typedef struct {
   size_t key_len;
   uint64_t value;
 } unsigned_result_t;
+
+
+// log2 buckets of microseconds: buckets[0] counts [0, 2) us, buckets[i]
+// counts [2^i, 2^(i+1)) us, and the last one everything above
+#define MC_LATENCY_BUCKETS 24
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t buckets[MC_LATENCY_BUCKETS];
+} latency_histogram_t;
+
+
+// counters of a server since the client is created or the metrics reset
+typedef struct {
+  char* host;
+  uint64_t requests; // batches sent to the server
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t poll_wakeups; // the server's socket being ready
+  uint64_t connects;
+  uint64_t connect_failures;
+  // why the connection was marked dead
+  uint64_t send_errors;
+  uint64_t recv_errors;
+  uint64_t conn_poll_errors;
+  uint64_t poll_timeouts;
+  uint64_t poll_errors;
+  uint64_t server_errors;
+  uint64_t parse_errors;
+  uint64_t abandons; // deadline misses, SEE ConnectionPool::setDeadline
+  // latencies of a batch, dispatch is measured from the first dispatch to
+  // the start of waiting, the others from the start of waiting
+  latency_histogram_t dispatch;
+  latency_histogram_t send;
+  latency_histogram_t first_byte;
+  latency_histogram_t complete;
+} server_metrics_t;
+
+
+// phases of a request, SEE ConnectionPool::setTraceHook
+typedef enum {
+  TRACE_ROUTE, // validating and routing the keys, building the requests
+  TRACE_CONNECT, // (re)connecting a server
+  TRACE_SEND, // from the start of waiting until the request is sent to the server
+  TRACE_WAIT, // from then until the first byte of the response
+  TRACE_PARSE, // from then until the response is received and parsed
+  TRACE_COLLECT, // gathering the results
+} trace_phase_t;
+
+typedef struct {
+  trace_phase_t phase;
+  const char* server; // NULL unless the span is of a single server
+  int64_t start_us; // CLOCK_MONOTONIC
+  int64_t end_us;
+  size_t n_keys;
+  err_code_t err;
+} trace_span_t;
+
+// span is only valid during the call
+typedef void (*trace_hook_t)(void* ctx, const trace_span_t* span);
+
+
+// receives a value piece by piece as it arrives, SEE Client::getStream.
+// header holds the key, flags, cas_unique and bytes of the value, with a
+// NULL data_block; data is the piece at offset of the value, the last one
+// ends at header->bytes and an empty value comes as one empty piece. Both
+// are only valid during the call.
+typedef void (*value_sink_t)(void* ctx, const retrieval_result_t* header, size_t offset,
+                             const char* data, size_t len);
+
+typedef enum {
+  VALUE_NIL,
+  VALUE_BOOL,
+  VALUE_INT,
+  VALUE_UINT, // above INT64_MAX, in integer as is
+  VALUE_FLOAT,
+  VALUE_STR,
+  VALUE_BIN,
+  VALUE_ARRAY,
+  VALUE_MAP,
+} value_type_t;
+
+// a node of a serialized value, in pre-order: an array is followed by its
+// items, a map by each of its keys then value, SEE douban::mc::serializer
+typedef struct {
+  value_type_t type;
+  uint32_t size; // the bytes of a str or bin, the items of an array, the pairs of a map
+  int64_t integer; // bool, int or uint
+  double real;
+  const char* data; // str or bin
+} value_node_t;
+
+
+// picks a buffer of header->bytes bytes to read a value into, or returns
+// NULL to have it buffered by libmc, SEE Client::getInto. header is only
+// valid during the call.
+typedef char* (*value_buffer_t)(void* ctx, const retrieval_result_t* header);
+
+
+#define MC_LOG_LEVEL_ERROR 1
+#define MC_LOG_LEVEL_WARNING 2
+#define MC_LOG_LEVEL_INFO 3
+#define MC_LOG_LEVEL_DEBUG 4
+
+// receives the log messages of libmc, SEE douban::mc::logging::setSink,
+// called from a dedicated logger thread, msg is NUL-terminated and
+// only valid during the call
+typedef void (*log_sink_t)(void* ctx, int level, const char* file, unsigned int line,
+                           const char* msg);
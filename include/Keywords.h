@@ -13,6 +13,8 @@ static const char kSPACE[] = " ";
 
 static const char kGET[] = "get";
 static const char kGETS[] = "gets";
+static const char kGAT_[] = "gat ";
+static const char kGATS_[] = "gats ";
 
 static const char kSET_[] = "set ";
 static const char kADD_[] = "add ";
@@ -42,6 +44,7 @@ static const char kSERVER_ERROR[] = "server_error";
 static const char kCONN_POLL_ERROR[] = "conn_poll_error";
 static const char kPOLL_TIMEOUT[] = "poll_timeout";
 static const char kPOLL_ERROR[] = "poll_error";
+static const char kDEADLINE_EXCEEDED[] = "deadline_exceeded";
 static const char kPROGRAMMING_ERROR[] = "programming_error";
 
 } // namespace keywords
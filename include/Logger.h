@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include "Export.h"
+
+// a log message longer than this is truncated
+#define MC_LOG_MESSAGE_SIZE 512
+// messages queued for the logger thread, more are dropped
+#define MC_LOG_RING_SIZE 256
+// messages of a single call site allowed per second, more are suppressed
+#define MC_LOG_RATE_LIMIT 10
+#define MC_LOG_RATE_SLOTS 64
+
+namespace douban {
+namespace mc {
+namespace logging {
+
+extern int g_level;
+
+inline bool enabled(int level) {
+  return level <= __atomic_load_n(&g_level, __ATOMIC_RELAXED);
+}
+
+// Queue a message for the logger thread, which hands it to the sink.
+// Never blocks: the message is dropped if the queue is busy or full,
+// or if the call site has logged more than MC_LOG_RATE_LIMIT messages
+// within the current second. The dropped ones are reported in summary.
+void log(int level, const char* file, unsigned int line, const char* format, ...)
+  __attribute__((format(printf, 4, 5)));
+
+// process-wide, NULL restores the default sink writing to stderr
+void setSink(log_sink_t sink, void* ctx);
+// messages above the level are dropped, defaults to MC_LOG_LEVEL_ERROR
+void setLevel(int level);
+int level();
+// wait until the queued messages are handed to the sink
+void flush();
+
+} // namespace logging
+} // namespace mc
+} // namespace douban
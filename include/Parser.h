@@ -25,11 +25,16 @@ class PacketParser {
   ~PacketParser();
   void setBufferReader(io::BufferReader* reader);
   void setMode(ParserMode md);
+  void setEndCount(size_t n);
   void addRequestKey(const char* const key, const size_t len);
   std::queue<struct iovec>* getRequestKeys();
   size_t requestKeyCount();
   void process_packets(err_code_t &err);
   void reset();
+  void setValueSink(value_sink_t sink, void* ctx);
+  void setValueBuffer(value_buffer_t buffer, void* ctx);
+  void setKeyPrefixLen(size_t len);
+  void setDecodingKeys(bool enabled);
 
   types::RetrievalResultList* getRetrievalResults();
   types::MessageResultList* getMessageResults();
@@ -41,6 +46,7 @@ class PacketParser {
   bool canEndParse();
   void processMessageResult(message_result_type tp);
   void processLineResult(err_code_t& err);
+  void streamValue(err_code_t& err);
 
 
   std::queue<struct ::iovec> m_requestKeys;
@@ -48,6 +54,13 @@ class PacketParser {
   parser_state_t m_state;
   ParserMode m_mode;
   size_t m_expectedResultCount;
+  size_t m_nEnds; // END lines to parse in MODE_END_STATE, SEE setEndCount
+  value_sink_t m_valueSink; // NULL unless values are streamed
+  void* m_valueSinkCtx;
+  value_buffer_t m_valueBuffer; // NULL unless values are read into the caller's buffers
+  void* m_valueBufferCtx;
+  uint8_t m_keyPrefixLen; // stripped from the keys of the values
+  bool m_decodingKeys; // SEE ConnectionPool::setBinarySafeKeys
 
   types::RetrievalResultList m_retrievalResults;
   types::MessageResultList m_messageResults;
@@ -25,9 +25,18 @@ class RetrievalResult {
   uint32_t bytes; // 4B
   flags_t flags; // 4B
   uint8_t key_len; // 1B
+  uint8_t prefix_len; // 1B. stripped from the key, SEE ConnectionPool::setKeyPrefix
+  bool decoding_key; // 1B. SEE ConnectionPool::setBinarySafeKeys
   retrieval_result_t* inner();
+  // replace the data block by a new[]-ed decompressed one, after inner()
+  void setDecoded(char* data, uint32_t bytes, flags_t flags);
+  // read the value into a buffer of the caller, SEE PacketParser::streamValue
+  void setExternal(char* data);
  protected:
+  void decodeKey();
   retrieval_result_t m_inner;
+  char* m_decoded;
+  char* m_external;
 };
 
 
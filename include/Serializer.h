@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "Export.h"
+
+namespace douban {
+namespace mc {
+namespace serializer {
+
+// A serializer converts a value between its bytes and a list of value nodes
+// (SEE value_node_t), and is picked by its flag bit, so that the values
+// cached by a service read the same from any binding:
+//   raw:     no flag bit, the bytes as is, a single bin
+//   integer: MC_FLAG_INTEGER or MC_FLAG_LONG, an int in decimal
+//   bool:    MC_FLAG_BOOL, "1" or "0"
+//   msgpack: MC_FLAG_MSGPACK, a MessagePack document, without extensions
+// pickle (MC_FLAG_PICKLE) and marshal (MC_FLAG_MARSHAL) are Python only,
+// they are registered but not serializable here.
+typedef struct {
+  flags_t flag;
+  const char* name;
+  // append the serialized nodes to out, return false if they can't be
+  // serialized this way
+  bool (*serialize)(const value_node_t* nodes, size_t nNodes, std::string& out);
+  // append the nodes of val to nodes, the data of str and bin nodes point
+  // into val. return false if val is malformed
+  bool (*deserialize)(const char* val, size_t len, std::vector<value_node_t>& nodes);
+} serializer_t;
+
+// the serializer of the first registered flag bit set in flags, ignoring
+// the compression and chunked bits, the raw one if none is set, or NULL
+const serializer_t* find(flags_t flags);
+
+// register a serializer of a single flag bit that isn't taken yet, not
+// thread-safe, register before any client is in use
+bool add(const serializer_t& serializer);
+
+// serialize / deserialize with the serializer of flag(s), false if there
+// is none, it's Python only, or it fails. A compressed value is not
+// deserialized.
+bool serialize(flags_t flag, const value_node_t* nodes, size_t nNodes, std::string& out);
+bool deserialize(const char* val, size_t len, flags_t flags, std::vector<value_node_t>& nodes);
+
+} // namespace serializer
+} // namespace mc
+} // namespace douban
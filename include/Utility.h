@@ -1,11 +1,15 @@
 #pragma once
 
 #include <stdint.h>
+#include <time.h>
 #include <cstddef>
 #include <cstdio>
 #include "rapidjson/itoa.h"
+#include "Export.h"
 
 #define MC_MAX_KEY_LENGTH 250
+// leads an encoded key, SEE ConnectionPool::setBinarySafeKeys
+#define MC_ENCODED_KEY_MARKER '%'
 
 namespace douban {
 namespace mc {
@@ -17,9 +21,47 @@ inline int int64ToCharArray(int64_t n, char s[]) {
   return static_cast<int>(end - s);
 }
 
+// milliseconds elapsed since an arbitrary point, never goes backwards
+inline int64_t getCurrentMonotonicMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// microseconds elapsed since the same point as getCurrentMonotonicMs
+inline int64_t getCurrentMonotonicUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline void recordLatency(latency_histogram_t* histogram, int64_t us) {
+  uint64_t v = us > 0 ? static_cast<uint64_t>(us) : 0;
+  size_t bucket = v < 2 ? 0 : 63 - __builtin_clzll(v);
+  if (bucket >= MC_LATENCY_BUCKETS) {
+    bucket = MC_LATENCY_BUCKETS - 1;
+  }
+  ++histogram->buckets[bucket];
+  ++histogram->count;
+  histogram->sum_us += v;
+  if (v > histogram->max_us) {
+    histogram->max_us = v;
+  }
+}
+
 // credit to The New Page of Injections Book:
 // Memcached Injections @ blackhat2014 [pdf](http://t.cn/RP0J10Z)
 bool isValidKey(const char* key, const size_t keylen);
+// the offset of the first byte not allowed in a key, or keylen if none
+size_t findInvalidKeyByte(const char* key, const size_t keylen);
+
+// base64url without padding, out has room for base64Length(len) bytes.
+// decoding may be in place, or to before src, false if src is malformed
+inline size_t base64Length(size_t len) {
+  return (len * 4 + 2) / 3;
+}
+size_t base64Encode(const char* src, size_t len, char* out);
+bool base64Decode(const char* src, size_t len, char* out, size_t& outLen);
 void fprintBuffer(std::FILE* file, const char *data_buffer_, const unsigned int length);
 
 } // namespace utility
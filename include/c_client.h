@@ -13,6 +13,8 @@ extern "C" {
   void client_init(void* client, const char* const * hosts, const uint32_t* ports,
                    size_t n, const char* const * aliases, const int failover);
   void client_config(void* client, config_options_t opt, int val);
+  void client_set_deadline(void* client, int timeout);
+  void client_clear_deadline(void* client);
   void client_destroy(void* client);
 
   const char* client_get_server_address_by_key(void* client, const char* key, size_t key_len);
@@ -29,6 +31,20 @@ extern "C" {
   DECL_RETRIEVAL_CMD(gets);
 #undef DECL_RETRIEVAL_CMD
 
+#define DECL_TOUCHING_RETRIEVAL_CMD(M) \
+  int client_##M(void* client, const char* const* keys, const size_t* key_lens, \
+                 size_t n_keys, const exptime_t exptime, \
+                 retrieval_result_t*** results, size_t* n_results)
+  DECL_TOUCHING_RETRIEVAL_CMD(gat);
+  DECL_TOUCHING_RETRIEVAL_CMD(gats);
+#undef DECL_TOUCHING_RETRIEVAL_CMD
+
+  int client_get_stream(void* client, const char* const* keys, const size_t* key_lens,
+                        size_t n_keys, value_sink_t sink, void* ctx,
+                        retrieval_result_t*** results, size_t* n_results);
+  int client_get_into(void* client, const char* const* keys, const size_t* key_lens,
+                      size_t n_keys, char* arena, const size_t* offsets, const size_t* sizes,
+                      retrieval_result_t*** results, size_t* n_results);
   void client_destroy_retrieval_result(void* client);
 
 #define DECL_STORAGE_CMD(M) \
@@ -45,11 +61,28 @@ extern "C" {
   DECL_STORAGE_CMD(cas);
 #undef DECL_STORAGE_CMD
 
+#define DECL_STORAGE_MULTI_CMD(M) \
+  int client_##M##_multi(void* client, const char* const* keys, const size_t* key_lens, \
+                         const flags_t* flags, const exptime_t* exptimes, \
+                         const cas_unique_t* cas_uniques, const bool noreply, \
+                         const char* const* vals, const size_t* val_lens, \
+                         size_t nItems, message_result_t*** results, size_t* n_results)
+  DECL_STORAGE_MULTI_CMD(set);
+  DECL_STORAGE_MULTI_CMD(add);
+  DECL_STORAGE_MULTI_CMD(replace);
+  DECL_STORAGE_MULTI_CMD(cas);
+#undef DECL_STORAGE_MULTI_CMD
+
   int client_touch(void* client, const char* const* keys, const size_t* key_lens,
                    const exptime_t exptime, const bool noreply, size_t n_items,
                    message_result_t*** results, size_t* n_results);
+  int client_touch_multi(void* client, const char* const* keys, const size_t* key_lens,
+                         const exptime_t* exptimes, const bool noreply, size_t n_items,
+                         message_result_t*** results, size_t* n_results);
   void client_destroy_message_result(void* client);
 
+  void client_get_key_statuses(void* client, key_status_t** statuses, size_t* n_keys);
+
   int client_delete(void*client, const char* const* keys, const size_t* key_lens,
                     const bool noreply, size_t n_items,
                     message_result_t*** results, size_t* n_results);
@@ -60,10 +93,37 @@ extern "C" {
   int client_decr(void* client, const char* key, const size_t keyLen,
                   const uint64_t delta, const bool noreply,
                   unsigned_result_t** results, size_t* n_results);
+  int client_incr_multi(void* client, const char* const* keys, const size_t* key_lens,
+                        const uint64_t* deltas, const bool noreply, size_t n_items,
+                        unsigned_result_t*** results, size_t* n_results);
+  int client_decr_multi(void* client, const char* const* keys, const size_t* key_lens,
+                        const uint64_t* deltas, const bool noreply, size_t n_items,
+                        unsigned_result_t*** results, size_t* n_results);
   void client_destroy_unsigned_result(void* client);
 
   int client_stats(void* client, broadcast_result_t** results, size_t* n_servers);
+  void client_get_metrics(void* client, server_metrics_t** metrics, size_t* n_servers);
+  void client_reset_metrics(void* client);
+  void client_set_trace_hook(void* client, trace_hook_t hook, void* ctx);
+  int client_set_compress_dict(void* client, const char* dict, size_t len);
+  int client_set_key_prefix(void* client, const char* prefix, size_t len);
   int client_quit(void* client);
+
+  // process-wide, shared by all the clients
+  void mc_set_log_sink(log_sink_t sink, void* ctx);
+  void mc_set_log_level(int level);
+  void mc_flush_log();
+  // the clock of trace spans, SEE client_set_trace_hook
+  int64_t mc_monotonic_us();
+  bool mc_compress_codec_available(compress_codec_options_t codec);
+  // SEE douban::mc::serializer, the name is NULL for unknown flags. out
+  // and nodes are malloc-ed, free them after use, the data of the nodes
+  // point into val
+  const char* mc_serializer_name(flags_t flags);
+  bool mc_serialize(flags_t flag, const value_node_t* nodes, size_t n_nodes,
+                    char** out, size_t* out_len);
+  bool mc_deserialize(const char* val, size_t len, flags_t flags,
+                      value_node_t** nodes, size_t* n_nodes);
 #ifdef __cplusplus
 }
 #endif
@@ -32,7 +32,8 @@ class KetamaSelector {
   void disableFailover();
 
   void reset();
-  void addServers(douban::mc::Connection* conns, size_t nConns);
+  // the servers are conns[0], conns[stride], ... of nConns servers
+  void addServers(douban::mc::Connection* conns, size_t nConns, size_t stride = 1);
 
   int getServer(const char* key, size_t key_len, bool check_alive = true);
   douban::mc::Connection* getConn(const char* key, size_t key_len, bool check_alive = true);
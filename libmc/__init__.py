@@ -3,17 +3,36 @@ from ._client import (
     PyClient, ThreadUnsafe,
     encode_value,
     decode_value,
+    set_logger,
+    flush_log,
 
     MC_DEFAULT_EXPTIME,
     MC_POLL_TIMEOUT,
     MC_CONNECT_TIMEOUT,
     MC_RETRY_TIMEOUT,
+    MC_MAX_RETRY_TIMEOUT,
+    MC_MAINTAIN_INTERVAL,
+    MC_KEEPALIVE_IDLE,
+    MC_REQUEST_TIMEOUT,
+    MC_COMPRESS_CODEC,
+    MC_COMPRESS_THRESHOLD,
+    MC_SPLIT_LARGE_VALUES,
+    MC_BINARY_SAFE_KEYS,
+    MC_SEND_WINDOW,
+    MC_MAX_GET_KEYS,
+    MC_MAX_GET_BYTES,
+    MC_CONNS_PER_SERVER,
 
     MC_HASH_MD5,
     MC_HASH_FNV1_32,
     MC_HASH_FNV1A_32,
     MC_HASH_CRC_32,
 
+    MC_COMPRESS_NONE,
+    MC_COMPRESS_ZLIB,
+    MC_COMPRESS_LZ4,
+    MC_COMPRESS_ZSTD,
+
     MC_RETURN_SEND_ERR,
     MC_RETURN_RECV_ERR,
     MC_RETURN_CONN_POLL_ERR,
@@ -24,6 +43,25 @@ from ._client import (
     MC_RETURN_INVALID_KEY_ERR,
     MC_RETURN_INCOMPLETE_BUFFER_ERR,
     MC_RETURN_OK,
+
+    MC_KEY_HIT,
+    MC_KEY_MISS,
+    MC_KEY_SERVER_ERR,
+    MC_KEY_TIMEOUT_ERR,
+    MC_KEY_INVALID_ERR,
+    MC_KEY_DEAD_SERVER_ERR,
+
+    MC_TRACE_ROUTE,
+    MC_TRACE_CONNECT,
+    MC_TRACE_SEND,
+    MC_TRACE_WAIT,
+    MC_TRACE_PARSE,
+    MC_TRACE_COLLECT,
+
+    MC_LOG_ERROR,
+    MC_LOG_WARNING,
+    MC_LOG_INFO,
+    MC_LOG_DEBUG,
     __file__ as _libmc_so_file
 )
 
@@ -43,15 +81,32 @@ DYNAMIC_LIBRARIES = [os.path.abspath(_libmc_so_file)]
 
 __all__ = [
     'Client', 'ThreadUnsafe', '__VERSION__', 'encode_value', 'decode_value',
+    'set_logger', 'flush_log',
 
     'MC_DEFAULT_EXPTIME', 'MC_POLL_TIMEOUT', 'MC_CONNECT_TIMEOUT',
-    'MC_RETRY_TIMEOUT',
+    'MC_RETRY_TIMEOUT', 'MC_MAX_RETRY_TIMEOUT', 'MC_MAINTAIN_INTERVAL',
+    'MC_KEEPALIVE_IDLE', 'MC_REQUEST_TIMEOUT', 'MC_COMPRESS_CODEC',
+    'MC_COMPRESS_THRESHOLD', 'MC_SPLIT_LARGE_VALUES', 'MC_BINARY_SAFE_KEYS',
+    'MC_SEND_WINDOW', 'MC_MAX_GET_KEYS', 'MC_MAX_GET_BYTES', 'MC_CONNS_PER_SERVER',
 
     'MC_HASH_MD5', 'MC_HASH_FNV1_32', 'MC_HASH_FNV1A_32', 'MC_HASH_CRC_32',
 
+    'MC_COMPRESS_NONE', 'MC_COMPRESS_ZLIB', 'MC_COMPRESS_LZ4',
+    'MC_COMPRESS_ZSTD',
+
     'MC_RETURN_SEND_ERR', 'MC_RETURN_RECV_ERR', 'MC_RETURN_CONN_POLL_ERR',
     'MC_RETURN_POLL_TIMEOUT_ERR', 'MC_RETURN_POLL_ERR',
     'MC_RETURN_MC_SERVER_ERR', 'MC_RETURN_PROGRAMMING_ERR',
     'MC_RETURN_INVALID_KEY_ERR', 'MC_RETURN_INCOMPLETE_BUFFER_ERR',
-    'MC_RETURN_OK', 'DYNAMIC_LIBRARIES'
+    'MC_RETURN_OK',
+
+    'MC_KEY_HIT', 'MC_KEY_MISS', 'MC_KEY_SERVER_ERR', 'MC_KEY_TIMEOUT_ERR',
+    'MC_KEY_INVALID_ERR', 'MC_KEY_DEAD_SERVER_ERR',
+
+    'MC_TRACE_ROUTE', 'MC_TRACE_CONNECT', 'MC_TRACE_SEND', 'MC_TRACE_WAIT',
+    'MC_TRACE_PARSE', 'MC_TRACE_COLLECT',
+
+    'MC_LOG_ERROR', 'MC_LOG_WARNING', 'MC_LOG_INFO', 'MC_LOG_DEBUG',
+
+    'DYNAMIC_LIBRARIES'
 ]
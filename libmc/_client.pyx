@@ -3,12 +3,16 @@
 # cython: profile=False, c_string_type=unicode, c_string_encoding=utf8
 
 from libc.stdint cimport uint8_t, uint32_t, uint64_t, int64_t
+from libc.string cimport memcpy
 from libcpp cimport bool as bool_t
 from libcpp.string cimport string
 from libcpp.vector cimport vector
 from cpython.mem cimport PyMem_Malloc, PyMem_Free
 from cpython.version cimport PY_MAJOR_VERSION
 from cpython cimport Py_INCREF, Py_DECREF, PyInt_AsLong, PyInt_FromLong
+from cpython.bytes cimport PyBytes_FromStringAndSize, PyBytes_AS_STRING
+from cpython.unicode cimport PyUnicode_DecodeUTF8
+from libc.string cimport memset
 
 if PY_MAJOR_VERSION < 3:
     from cpython cimport PyString_AsStringAndSize, PyString_AsString
@@ -18,6 +22,8 @@ else:
     import pickle
 
 import os
+import atexit
+import time
 import traceback
 import threading
 import zlib
@@ -50,6 +56,18 @@ cdef extern from "Export.h":
         CFG_CONNECT_TIMEOUT
         CFG_RETRY_TIMEOUT
         CFG_HASH_FUNCTION
+        CFG_MAX_RETRY_TIMEOUT
+        CFG_MAINTAIN_INTERVAL
+        CFG_KEEPALIVE_IDLE
+        CFG_REQUEST_TIMEOUT
+        CFG_COMPRESS_CODEC
+        CFG_COMPRESS_THRESHOLD
+        CFG_SPLIT_LARGE_VALUES
+        CFG_BINARY_SAFE_KEYS
+        CFG_SEND_WINDOW
+        CFG_MAX_GET_KEYS
+        CFG_MAX_GET_BYTES
+        CFG_CONNS_PER_SERVER
 
     ctypedef enum hash_function_options_t:
         OPT_HASH_MD5
@@ -57,6 +75,12 @@ cdef extern from "Export.h":
         OPT_HASH_FNV1A_32
         OPT_HASH_CRC_32
 
+    ctypedef enum compress_codec_options_t:
+        OPT_COMPRESS_NONE
+        OPT_COMPRESS_ZLIB
+        OPT_COMPRESS_LZ4
+        OPT_COMPRESS_ZSTD
+
     ctypedef int64_t exptime_t
     ctypedef uint32_t flags_t
     ctypedef uint64_t cas_unique_t
@@ -102,22 +126,132 @@ cdef extern from "Export.h":
         RET_INCOMPLETE_BUFFER_ERR
         RET_OK
 
+    ctypedef enum key_status_t:
+        KEY_HIT
+        KEY_MISS
+        KEY_SERVER_ERR
+        KEY_TIMEOUT_ERR
+        KEY_INVALID_ERR
+        KEY_DEAD_SERVER_ERR
+
+    ctypedef enum value_type_t:
+        VALUE_NIL
+        VALUE_BOOL
+        VALUE_INT
+        VALUE_UINT
+        VALUE_FLOAT
+        VALUE_STR
+        VALUE_BIN
+        VALUE_ARRAY
+        VALUE_MAP
+
+    ctypedef struct value_node_t:
+        value_type_t type
+        uint32_t size
+        int64_t integer
+        double real
+        const char* data
+
     ctypedef struct unsigned_result_t:
         char* key
         size_t key_len
         uint64_t value
 
+    enum: MC_LATENCY_BUCKETS
+
+    ctypedef struct latency_histogram_t:
+        uint64_t count
+        uint64_t sum_us
+        uint64_t max_us
+        uint64_t buckets[MC_LATENCY_BUCKETS]
+
+    ctypedef struct server_metrics_t:
+        char* host
+        uint64_t requests
+        uint64_t bytes_sent
+        uint64_t bytes_received
+        uint64_t poll_wakeups
+        uint64_t connects
+        uint64_t connect_failures
+        uint64_t send_errors
+        uint64_t recv_errors
+        uint64_t conn_poll_errors
+        uint64_t poll_timeouts
+        uint64_t poll_errors
+        uint64_t server_errors
+        uint64_t parse_errors
+        uint64_t abandons
+        latency_histogram_t dispatch
+        latency_histogram_t send
+        latency_histogram_t first_byte
+        latency_histogram_t complete
+
+    ctypedef enum trace_phase_t:
+        TRACE_ROUTE
+        TRACE_CONNECT
+        TRACE_SEND
+        TRACE_WAIT
+        TRACE_PARSE
+        TRACE_COLLECT
+
+    ctypedef struct trace_span_t:
+        trace_phase_t phase
+        const char* server
+        int64_t start_us
+        int64_t end_us
+        size_t n_keys
+        err_code_t err
+
+    ctypedef void (*trace_hook_t)(void* ctx, const trace_span_t* span)
+
+    enum:
+        MC_LOG_LEVEL_ERROR
+        MC_LOG_LEVEL_WARNING
+        MC_LOG_LEVEL_INFO
+        MC_LOG_LEVEL_DEBUG
+
+    ctypedef void (*log_sink_t)(void* ctx, int level, const char* file, unsigned int line,
+                                const char* msg)
+
+
+cdef extern from "Utility.h" namespace "douban::mc::utility":
+    int64_t getCurrentMonotonicUs() nogil
+
+
+cdef extern from "Logger.h" namespace "douban::mc::logging":
+    void setSink(log_sink_t sink, void* ctx) nogil
+    void setLevel(int level) nogil
+    void flush() nogil
+
+
+cdef extern from "Codec.h" namespace "douban::mc":
+    cdef cppclass Codec:
+        Codec()
+        bool_t setCodec(compress_codec_options_t codec) nogil
+        void setThreshold(size_t threshold) nogil
+        bool_t compress(const char* val, size_t len, flags_t flags, string& out,
+                        flags_t& outFlags) nogil
+
+
+cdef extern from "Serializer.h" namespace "douban::mc::serializer":
+    bool_t serialize(flags_t flag, const value_node_t* nodes, size_t nNodes, string& out) nogil
+    bool_t deserialize(const char* val, size_t len, flags_t flags,
+                       vector[value_node_t]& nodes) nogil
+
 
 cdef extern from "Client.h" namespace "douban::mc":
     cdef cppclass Client:
         Client()
         void config(config_options_t opt, int val) nogil
+        void setDeadline(int timeout) nogil
+        void clearDeadline() nogil
         int init(const char* const * hosts, const uint32_t* ports, size_t n,
                  const char* const * aliases) nogil
         char* getServerAddressByKey(const char* key, size_t keyLen) nogil
         char* getRealtimeServerAddressByKey(const char* key, size_t keyLen) nogil
         void enableConsistentFailover() nogil
         void disableConsistentFailover() nogil
+        err_code_t setKeyPrefix(const char* prefix, size_t len) nogil
         err_code_t get(
             const char* const* keys, const size_t* keyLens, size_t nKeys,
             retrieval_result_t*** results, size_t* nResults
@@ -126,6 +260,10 @@ cdef extern from "Client.h" namespace "douban::mc":
             const char* const* keys, const size_t* keyLens, size_t nKeys,
             retrieval_result_t*** results, size_t* nResults
         ) nogil
+        err_code_t gat(
+            const char* const* keys, const size_t* keyLens, size_t nKeys,
+            const exptime_t exptime, retrieval_result_t*** results, size_t* nResults
+        ) nogil
         void destroyRetrievalResult() nogil
 
         err_code_t set(
@@ -135,6 +273,13 @@ cdef extern from "Client.h" namespace "douban::mc":
             const char* const* vals, const size_t* val_lens,
             size_t n_items, message_result_t*** results, size_t* nResults
         ) nogil
+        err_code_t setMulti(
+            const char* const* keys, const size_t* key_lens,
+            const flags_t* flags, const exptime_t* exptimes,
+            const cas_unique_t* cas_uniques, const bool_t noreply,
+            const char* const* vals, const size_t* val_lens,
+            size_t n_items, message_result_t*** results, size_t* nResults
+        ) nogil
         err_code_t add(
             const char* const* keys, const size_t* key_lens,
             const flags_t* flags, const exptime_t exptime,
@@ -180,7 +325,16 @@ cdef extern from "Client.h" namespace "douban::mc":
             const exptime_t exptime, const bool_t noreply, size_t nItems,
             message_result_t*** results, size_t* nResults
         ) nogil
+        err_code_t touchMulti(
+            const char* const* keys, const size_t* keyLens,
+            const exptime_t* exptimes, const bool_t noreply, size_t nItems,
+            message_result_t*** results, size_t* nResults
+        ) nogil
         void destroyMessageResult() nogil
+        void getKeyStatuses(key_status_t** statuses, size_t* nKeys) nogil
+        void getMetrics(server_metrics_t** metrics, size_t* nServers) nogil
+        void resetMetrics() nogil
+        void setTraceHook(trace_hook_t hook, void* ctx) nogil
 
         err_code_t version(broadcast_result_t** results, size_t* nHosts) nogil
         err_code_t quit() nogil
@@ -197,6 +351,16 @@ cdef extern from "Client.h" namespace "douban::mc":
             const bool_t noreply, unsigned_result_t** results,
             size_t* nResults
         ) nogil
+        err_code_t incrMulti(
+            const char* const* keys, const size_t* keyLens,
+            const uint64_t* deltas, const bool_t noreply, size_t nItems,
+            unsigned_result_t*** results, size_t* nResults
+        ) nogil
+        err_code_t decrMulti(
+            const char* const* keys, const size_t* keyLens,
+            const uint64_t* deltas, const bool_t noreply, size_t nItems,
+            unsigned_result_t*** results, size_t* nResults
+        ) nogil
         void destroyUnsignedResult() nogil
         void _sleep(uint32_t ms) nogil
 
@@ -208,6 +372,12 @@ cdef flags_t _FLAG_LONG = 1 << 2
 cdef flags_t _FLAG_BOOL = 1 << 3
 cdef flags_t _FLAG_COMPRESS = 1 << 4
 cdef flags_t _FLAG_MARSHAL = 1 << 5
+cdef flags_t _FLAG_MSGPACK = 1 << 6
+# deeper values are pickled, as is any recursive one
+cdef int _MSGPACK_MAX_DEPTH = 512
+cdef object _NO_KEY = object()
+cdef object _INT64_LIMIT = 0x8000000000000000
+cdef object _UINT64_LIMIT = 0x10000000000000000
 cdef exptime_t DEFAULT_EXPTIME = 0
 cdef cas_unique_t DEFAULT_CAS_UNIQUE = 0
 
@@ -219,6 +389,18 @@ MC_DEFAULT_EXPTIME = PyInt_FromLong(DEFAULT_EXPTIME)
 MC_POLL_TIMEOUT = PyInt_FromLong(CFG_POLL_TIMEOUT)
 MC_CONNECT_TIMEOUT = PyInt_FromLong(CFG_CONNECT_TIMEOUT)
 MC_RETRY_TIMEOUT = PyInt_FromLong(CFG_RETRY_TIMEOUT)
+MC_MAX_RETRY_TIMEOUT = PyInt_FromLong(CFG_MAX_RETRY_TIMEOUT)
+MC_MAINTAIN_INTERVAL = PyInt_FromLong(CFG_MAINTAIN_INTERVAL)
+MC_KEEPALIVE_IDLE = PyInt_FromLong(CFG_KEEPALIVE_IDLE)
+MC_REQUEST_TIMEOUT = PyInt_FromLong(CFG_REQUEST_TIMEOUT)
+MC_COMPRESS_CODEC = PyInt_FromLong(CFG_COMPRESS_CODEC)
+MC_COMPRESS_THRESHOLD = PyInt_FromLong(CFG_COMPRESS_THRESHOLD)
+MC_SPLIT_LARGE_VALUES = PyInt_FromLong(CFG_SPLIT_LARGE_VALUES)
+MC_BINARY_SAFE_KEYS = PyInt_FromLong(CFG_BINARY_SAFE_KEYS)
+MC_SEND_WINDOW = PyInt_FromLong(CFG_SEND_WINDOW)
+MC_MAX_GET_KEYS = PyInt_FromLong(CFG_MAX_GET_KEYS)
+MC_MAX_GET_BYTES = PyInt_FromLong(CFG_MAX_GET_BYTES)
+MC_CONNS_PER_SERVER = PyInt_FromLong(CFG_CONNS_PER_SERVER)
 
 
 MC_HASH_MD5 = PyInt_FromLong(OPT_HASH_MD5)
@@ -227,6 +409,12 @@ MC_HASH_FNV1A_32 = PyInt_FromLong(OPT_HASH_FNV1A_32)
 MC_HASH_CRC_32 = PyInt_FromLong(OPT_HASH_CRC_32)
 
 
+MC_COMPRESS_NONE = PyInt_FromLong(OPT_COMPRESS_NONE)
+MC_COMPRESS_ZLIB = PyInt_FromLong(OPT_COMPRESS_ZLIB)
+MC_COMPRESS_LZ4 = PyInt_FromLong(OPT_COMPRESS_LZ4)
+MC_COMPRESS_ZSTD = PyInt_FromLong(OPT_COMPRESS_ZSTD)
+
+
 MC_RETURN_SEND_ERR = PyInt_FromLong(RET_SEND_ERR)
 MC_RETURN_RECV_ERR = PyInt_FromLong(RET_RECV_ERR)
 MC_RETURN_CONN_POLL_ERR = PyInt_FromLong(RET_CONN_POLL_ERR)
@@ -238,6 +426,25 @@ MC_RETURN_INVALID_KEY_ERR = PyInt_FromLong(RET_INVALID_KEY_ERR)
 MC_RETURN_INCOMPLETE_BUFFER_ERR = PyInt_FromLong(RET_INCOMPLETE_BUFFER_ERR)
 MC_RETURN_OK = PyInt_FromLong(RET_OK)
 
+MC_KEY_HIT = PyInt_FromLong(KEY_HIT)
+MC_KEY_MISS = PyInt_FromLong(KEY_MISS)
+MC_KEY_SERVER_ERR = PyInt_FromLong(KEY_SERVER_ERR)
+MC_KEY_TIMEOUT_ERR = PyInt_FromLong(KEY_TIMEOUT_ERR)
+MC_KEY_INVALID_ERR = PyInt_FromLong(KEY_INVALID_ERR)
+MC_KEY_DEAD_SERVER_ERR = PyInt_FromLong(KEY_DEAD_SERVER_ERR)
+
+MC_TRACE_ROUTE = PyInt_FromLong(TRACE_ROUTE)
+MC_TRACE_CONNECT = PyInt_FromLong(TRACE_CONNECT)
+MC_TRACE_SEND = PyInt_FromLong(TRACE_SEND)
+MC_TRACE_WAIT = PyInt_FromLong(TRACE_WAIT)
+MC_TRACE_PARSE = PyInt_FromLong(TRACE_PARSE)
+MC_TRACE_COLLECT = PyInt_FromLong(TRACE_COLLECT)
+
+MC_LOG_ERROR = PyInt_FromLong(MC_LOG_LEVEL_ERROR)
+MC_LOG_WARNING = PyInt_FromLong(MC_LOG_LEVEL_WARNING)
+MC_LOG_INFO = PyInt_FromLong(MC_LOG_LEVEL_INFO)
+MC_LOG_DEBUG = PyInt_FromLong(MC_LOG_LEVEL_DEBUG)
+
 
 cdef dict ERROR_CODE_TO_STR = {
     MC_RETURN_SEND_ERR: 'send_error',
@@ -253,7 +460,133 @@ cdef dict ERROR_CODE_TO_STR = {
 }
 
 
-cdef bytes _encode_value(object val, int comp_threshold, flags_t *flags):
+cdef bytes _encode_msgpack(object val):
+    # walk val into value nodes in pre-order, SEE value_node_t
+    cdef vector[value_node_t] nodes
+    cdef value_node_t node
+    cdef list refs = []  # the str of the nodes
+    cdef list stack = [(val, 0)]
+    cdef char* c_data = NULL
+    cdef Py_ssize_t c_len = 0
+    cdef int depth
+    cdef string out
+    cdef bool_t ok
+    while stack:
+        obj, depth = stack.pop()
+        if depth > _MSGPACK_MAX_DEPTH:
+            return None
+        memset(&node, 0, sizeof(value_node_t))
+        type_ = type(obj)
+        if obj is None:
+            node.type = VALUE_NIL
+        elif type_ is bool:
+            node.type = VALUE_BOOL
+            node.integer = 1 if obj else 0
+        elif type_ is int or type_ is long:
+            if -_INT64_LIMIT <= obj < _INT64_LIMIT:
+                node.type = VALUE_INT
+                node.integer = obj
+            elif 0 <= obj < _UINT64_LIMIT:
+                node.type = VALUE_UINT
+                node.integer = <int64_t><uint64_t>obj
+            else:
+                return None
+        elif type_ is float:
+            node.type = VALUE_FLOAT
+            node.real = obj
+        elif type_ is unicode or type_ is bytes:
+            if type_ is unicode:
+                node.type = VALUE_STR
+                obj = obj.encode('utf8')
+            else:
+                node.type = VALUE_BIN
+            refs.append(obj)
+            PyString_AsStringAndSize(obj, &c_data, &c_len)
+            if c_len > 0xffffffff:
+                return None
+            node.data = c_data
+            node.size = c_len
+        elif type_ is list or type_ is tuple:
+            node.type = VALUE_ARRAY
+            node.size = len(obj)
+            for item in reversed(obj):
+                stack.append((item, depth + 1))
+        elif type_ is dict:
+            node.type = VALUE_MAP
+            node.size = len(obj)
+            for k, v in reversed(list(obj.items())):
+                stack.append((v, depth + 1))
+                stack.append((k, depth + 1))
+        else:
+            return None
+        nodes.push_back(node)
+
+    with nogil:
+        ok = serialize(_FLAG_MSGPACK, nodes.data(), nodes.size(), out)
+    if not ok:
+        return None
+    return PyBytes_FromStringAndSize(<char*>out.data(), out.size())
+
+
+cdef object _decode_msgpack(bytes val):
+    cdef vector[value_node_t] nodes
+    cdef value_node_t* node = NULL
+    cdef char* c_val = NULL
+    cdef Py_ssize_t c_len = 0
+    cdef bool_t ok
+    PyString_AsStringAndSize(val, &c_val, &c_len)
+    with nogil:
+        ok = deserialize(c_val, c_len, _FLAG_MSGPACK, nodes)
+    if not ok:
+        return None
+
+    # the containers being filled: [container, items left, key of a map]
+    cdef list stack = []
+    cdef list top
+    cdef size_t i
+    root = None
+    for i in range(nodes.size()):
+        node = &nodes[i]
+        if node.type == VALUE_NIL:
+            obj = None
+        elif node.type == VALUE_BOOL:
+            obj = node.integer != 0
+        elif node.type == VALUE_INT:
+            obj = node.integer
+        elif node.type == VALUE_UINT:
+            obj = <uint64_t>node.integer
+        elif node.type == VALUE_FLOAT:
+            obj = node.real
+        elif node.type == VALUE_STR:
+            obj = PyUnicode_DecodeUTF8(<char*>node.data, node.size, NULL)
+        elif node.type == VALUE_BIN:
+            obj = PyBytes_FromStringAndSize(<char*>node.data, node.size)
+        elif node.type == VALUE_ARRAY:
+            obj = []
+        else:
+            obj = {}
+
+        if not stack:
+            root = obj
+        else:
+            top = stack[-1]
+            if type(top[0]) is list:
+                top[0].append(obj)
+                top[1] -= 1
+            elif top[2] is _NO_KEY:
+                top[2] = obj
+            else:
+                top[0][top[2]] = obj
+                top[2] = _NO_KEY
+                top[1] -= 1
+            while stack and stack[-1][1] == 0:
+                stack.pop()
+        if (node.type == VALUE_ARRAY or node.type == VALUE_MAP) and node.size > 0:
+            stack.append([obj, node.size, _NO_KEY])
+    return root
+
+
+cdef bytes _encode_value(object val, int comp_threshold, flags_t *flags, bool_t msgpack=False):
     type_ = type(val)
     cdef bytes enc_val = None
     if type_ is bytes:
@@ -272,15 +605,19 @@ cdef bytes _encode_value(object val, int comp_threshold, flags_t *flags):
         enc_val = pickle.dumps(val, -1)
         flags[0] = _FLAG_PICKLE
     else:
-        try:
-            enc_val = marshal.dumps(val, 2)
-            flags[0] = _FLAG_MARSHAL
-        except:
+        if msgpack:
+            enc_val = _encode_msgpack(val)
+            flags[0] = _FLAG_MSGPACK
+        if enc_val is None:
             try:
-                enc_val = pickle.dumps(val, -1)
-                flags[0] = _FLAG_PICKLE
+                enc_val = marshal.dumps(val, 2)
+                flags[0] = _FLAG_MARSHAL
             except:
-                pass
+                try:
+                    enc_val = pickle.dumps(val, -1)
+                    flags[0] = _FLAG_PICKLE
+                except:
+                    pass
 
     if comp_threshold > 0 and enc_val is not None and len(enc_val) > comp_threshold:
         enc_val = zlib.compress(enc_val)
@@ -289,9 +626,9 @@ cdef bytes _encode_value(object val, int comp_threshold, flags_t *flags):
     return enc_val
 
 
-def encode_value(object val, int comp_threshold):
+def encode_value(object val, int comp_threshold, bool_t msgpack=False):
     cdef flags_t flags
-    cdef bytes buf = _encode_value(val, comp_threshold, &flags)
+    cdef bytes buf = _encode_value(val, comp_threshold, &flags, msgpack)
     return buf, flags
 
 
@@ -321,19 +658,124 @@ cpdef object decode_value(bytes val, flags_t flags):
             dec_val = pickle.loads(dec_val)
         except:
             dec_val = None
+    elif flags & _FLAG_MSGPACK:
+        try:
+            dec_val = _decode_msgpack(dec_val)
+        except:
+            dec_val = None
     return dec_val
 
 
+cdef dict _histogram_to_dict(latency_histogram_t* h):
+    return {
+        'count': h.count,
+        'sum_us': h.sum_us,
+        'max_us': h.max_us,
+        'buckets': [h.buckets[i] for i in range(MC_LATENCY_BUCKETS)],
+    }
+
+
+cdef object _logger = None
+cdef bint _logger_reset_at_exit = False
+
+
+cdef void _log_sink(void* ctx, int level, const char* file, unsigned int line,
+                    const char* msg) with gil:
+    py_file = file
+    py_msg = msg
+    if PY_MAJOR_VERSION > 2:
+        py_file = py_file.decode('utf8', 'replace')
+        py_msg = py_msg.decode('utf8', 'replace')
+    try:
+        (<object>ctx)(level, py_file, line, py_msg)
+    except:
+        traceback.print_exc()
+
+
+def set_logger(logger, int level=MC_LOG_LEVEL_ERROR):
+    """Replace the log sink shared by all the clients with
+    ``logger(level, file, line, msg)``, which is called from a dedicated
+    logger thread. The messages above ``level`` are dropped, and so are
+    the ones beyond the rate limit, instead of blocking a request.
+    ``None`` restores writing to stderr.
+    """
+    global _logger, _logger_reset_at_exit
+    cdef log_sink_t sink = NULL
+    cdef void* ctx = NULL
+    if logger is not None:
+        sink = _log_sink
+        ctx = <void*>logger
+        if not _logger_reset_at_exit:
+            # no calling into the interpreter once it's finalized
+            atexit.register(set_logger, None)
+            _logger_reset_at_exit = True
+    # the previous logger is kept until the logger thread is done with it
+    previous = _logger
+    _logger = logger
+    with nogil:
+        # waits for the logger thread, which may need the GIL
+        setSink(sink, ctx)
+        setLevel(level)
+    previous = None
+
+
+def flush_log():
+    with nogil:
+        flush()
+
+
+cdef void _trace_hook(void* ctx, const trace_span_t* span) with gil:
+    cdef PyClient client = <PyClient>ctx
+    if client._tracer is None:
+        return
+    # spans are timed by CLOCK_MONOTONIC, translate to the wall clock
+    cdef int64_t now_us = getCurrentMonotonicUs()
+    now = time.time()
+    server = None
+    if span.server != NULL:
+        server = span.server
+        if PY_MAJOR_VERSION > 2:
+            server = server.decode('utf8')
+    try:
+        client._tracer({
+            'phase': span.phase,
+            'server': server,
+            'start': now - (now_us - span.start_us) / 1e6,
+            'end': now - (now_us - span.end_us) / 1e6,
+            'n_keys': span.n_keys,
+            'error': ERROR_CODE_TO_STR.get(span.err, '') if span.err != RET_OK else None,
+        })
+    except:
+        traceback.print_exc()
+
+
 class ThreadUnsafe(Exception):
     pass
 
 
+class _Deadline(object):
+
+    def __init__(self, mc, timeout):
+        self.mc = mc
+        self.timeout = timeout
+
+    def __enter__(self):
+        self.mc.set_deadline(self.timeout)
+        return self.mc
+
+    def __exit__(self, exc_type, exc_value, tb):
+        self.mc.clear_deadline()
+
+
 cdef class PyClient:
     cdef readonly list servers
     cdef readonly int comp_threshold
+    cdef readonly bool_t core_compression
     cdef Client* _imp
+    cdef Codec* _codec
     cdef bool_t do_split
     cdef bool_t noreply
+    cdef bool_t msgpack
     cdef bytes prefix
     cdef hash_function_options_t hash_fn
     cdef bool_t failover
@@ -341,10 +783,11 @@ cdef class PyClient:
     cdef int last_error
     cdef object _thread_ident
     cdef object _created_stack
+    cdef object _tracer
 
     def __cinit__(self, list servers, bool_t do_split=True, int comp_threshold=0, noreply=False,
                   basestring prefix=None, hash_function_options_t hash_fn=OPT_HASH_MD5, failover=False,
-                  encoding='utf8'):
+                  encoding='utf8', msgpack=False):
         self.servers = servers
         cdef size_t n = len(servers)
         cdef char** c_hosts = <char**>PyMem_Malloc(n * sizeof(char*))
@@ -394,12 +837,29 @@ cdef class PyClient:
         PyMem_Free(c_aliases)
         self.do_split = do_split
         self.comp_threshold = comp_threshold
+        # set_multi compresses a batch in C++ without the GIL, zlib streams as
+        # _FLAG_COMPRESS, which the core decompresses on retrieval. Both need
+        # libmc built with MC_USE_ZLIB (setup.py does), or zlib.compress and
+        # decode_value do it in Python.
+        self._codec = NULL
+        if comp_threshold > 0:
+            self._codec = new Codec()
+            if self._codec.setCodec(OPT_COMPRESS_ZLIB):
+                self._codec.setThreshold(comp_threshold + 1)
+            else:
+                del self._codec
+                self._codec = NULL
+        self.core_compression = self._codec != NULL
         self.noreply = noreply
         self.hash_fn = hash_fn
         self.failover = failover
         self.encoding = encoding
+        self.msgpack = msgpack
         if prefix:
             self.prefix = bytes(prefix) if isinstance(prefix, bytes) else prefix.encode(self.encoding)
+            # the core sends the keys with the prefix, and strips it from
+            # the keys of the values
+            self._imp.setKeyPrefix(self.prefix, len(self.prefix))
         else:
             self.prefix = None
         Py_DECREF(servers_)
@@ -409,14 +869,38 @@ cdef class PyClient:
         self._created_stack = traceback.extract_stack()
 
     def __dealloc__(self):
+        if self._tracer is not None:
+            with nogil:
+                self._imp.setTraceHook(NULL, NULL)
         del self._imp
+        if self._codec != NULL:
+            del self._codec
 
     def __reduce__(self):
-        return (PyClient, (self.servers, self.do_split, self.comp_threshold, self.noreply, self.prefix, self.hash_fn, self.failover, self.encoding))
+        return (PyClient, (self.servers, self.do_split, self.comp_threshold, self.noreply, self.prefix, self.hash_fn, self.failover, self.encoding, self.msgpack))
 
     def config(self, int opt, int val):
         self._imp.config(<config_options_t>opt, val)
 
+    def set_deadline(self, timeout):
+        """
+        Requests issued from now on must complete within `timeout` seconds.
+        The servers which miss it are given up, and whatever the others
+        returned is returned, with get_last_error() being
+        MC_RETURN_POLL_TIMEOUT_ERR.
+        """
+        self._imp.setDeadline(int(timeout * 1000))
+
+    def clear_deadline(self):
+        self._imp.clearDeadline()
+
+    def deadline(self, timeout):
+        """
+        with mc.deadline(0.05):
+            rv = mc.get_multi(keys)
+        """
+        return _Deadline(self, timeout)
+
     def get_host_by_key(self, basestring key):
         cdef bytes key2 = self.normalize_key(key)
         cdef char* c_key = NULL
@@ -451,12 +935,6 @@ cdef class PyClient:
             key = raw_key.encode(self.encoding)
         else:
             key = bytes(raw_key)
-
-        if self.prefix:
-            if key[0] == b'?'[0]:
-                key = b'?' + self.prefix + key[1:]
-            else:
-                key = self.prefix + key
         return key
 
     cdef _get_raw(self, op_code_t op, bytes key, flags_t* flags_ptr, cas_unique_t* cas_unique_ptr):
@@ -485,15 +963,31 @@ cdef class PyClient:
             self._imp.destroyRetrievalResult()
         return py_value
 
-    def _get_large_raw(self, bytes key, int n_splits, flags_t chuncked_flags):
+    cdef bytes _chunk_key_base(self, bytes key):
+        # the chunks of a value under a prefix are stored as
+        # "~<len><prefix><key>/<i>", and sent without the prefix of the core
+        if not self.prefix:
+            return key
+        if key[:1] == b'?':
+            return b'?' + self.prefix + key[1:]
+        return self.prefix + key
 
+    def _get_large_raw(self, bytes key, int n_splits, flags_t chuncked_flags, exptime=None):
+
+        key = self._chunk_key_base(key)
         cdef size_t len_key = len(key)
         if n_splits > 10 or len_key > 200:
             return (None, 0)
 
         cdef list keys = [b'~%d%s/%d' % (len_key, key, i) for i in range(n_splits)]
 
-        cdef dict dct = self._get_multi_raw(n_splits, keys)
+        if self.prefix:
+            self._imp.setKeyPrefix(b'', 0)
+        try:
+            dct = self._get_multi_raw(n_splits, keys, exptime=exptime)
+        finally:
+            if self.prefix:
+                self._imp.setKeyPrefix(self.prefix, len(self.prefix))
         if len(dct) != n_splits:
             return (None, 0)
         return (b''.join(dct[key][0] for key in keys), chuncked_flags & ~_FLAG_DOUBAN_CHUNKED)
@@ -538,7 +1032,8 @@ cdef class PyClient:
 
         return decode_value(py_value, flags), cas_unique
 
-    def _get_multi_raw(self, size_t n, list keys):
+    def _get_multi_raw(self, size_t n, list keys, dict statuses=None, exptime=None,
+                       bool_t as_memoryview=False):
         cdef size_t n_res = 0
         cdef char** c_keys = <char**>PyMem_Malloc(n * sizeof(char*))
         cdef size_t* c_key_lens = <size_t*>PyMem_Malloc(n * sizeof(size_t))
@@ -548,18 +1043,49 @@ cdef class PyClient:
 
         cdef retrieval_result_t** results = NULL
         cdef retrieval_result_t *r = NULL
+        cdef bool_t touching = exptime is not None
+        cdef exptime_t c_exptime = exptime if touching else 0
         with nogil:
-            self.last_error = self._imp.get(c_keys, c_key_lens, n, &results, &n_res)
+            if touching:
+                self.last_error = self._imp.gat(c_keys, c_key_lens, n, c_exptime, &results, &n_res)
+            else:
+                self.last_error = self._imp.get(c_keys, c_key_lens, n, &results, &n_res)
 
         cdef dict rv = {}
         cdef bytes py_key
         cdef bytes py_value
+        cdef size_t j, total = 0, offset = 0
+        cdef bytes arena
+        cdef char* c_arena = NULL
+        if as_memoryview:
+            # copy all the values into one buffer, and slice views of it
+            for j in range(n_res):
+                total += results[j].bytes
+            arena = PyBytes_FromStringAndSize(NULL, total)
+            c_arena = PyBytes_AS_STRING(arena)
+            with nogil:
+                for j in range(n_res):
+                    if results[j].bytes > 0:
+                        memcpy(c_arena + offset, results[j].data_block, results[j].bytes)
+                    offset += results[j].bytes
+            view = memoryview(arena)
+            offset = 0
         for i in range(n_res):
             r = results[i]
             py_key = r.key[:r.key_len]
-            py_value = r.data_block[:r.bytes]
             flags = r.flags
-            rv[py_key] = (py_value, flags)
+            if as_memoryview:
+                rv[py_key] = (view[offset:offset + r.bytes], flags)
+                offset += r.bytes
+            else:
+                py_value = r.data_block[:r.bytes]
+                rv[py_key] = (py_value, flags)
+        cdef key_status_t* c_statuses = NULL
+        cdef size_t n_statuses = 0
+        if statuses is not None:
+            self._imp.getKeyStatuses(&c_statuses, &n_statuses)
+            for i in range(n_statuses):
+                statuses[keys[i]] = c_statuses[i]
         PyMem_Free(c_keys)
         PyMem_Free(c_key_lens)
         Py_DECREF(keys)
@@ -567,11 +1093,43 @@ cdef class PyClient:
             self._imp.destroyRetrievalResult()
         return rv
 
-    def get_multi(self, keys):
+    def get_multi(self, keys, as_memoryview=False):
+        """
+        as_memoryview returns the bytes values as read-only memoryviews into
+        one buffer of the whole batch, rather than a bytes object each.
+        """
+        return self._get_multi(keys, None, as_memoryview=as_memoryview)
+
+    def get_multi_with_status(self, keys):
+        """
+        Like get_multi, but also returns the status of each key, one of
+        MC_KEY_HIT, MC_KEY_MISS, MC_KEY_SERVER_ERR, MC_KEY_TIMEOUT_ERR,
+        MC_KEY_INVALID_ERR and MC_KEY_DEAD_SERVER_ERR, so that a miss can be
+        told from an error.
+        """
+        cdef dict raw_statuses = {}
+        dct = self._get_multi(keys, raw_statuses)
+        statuses = {}
+        for key in keys:
+            statuses[key] = raw_statuses.get(self.normalize_key(key), MC_KEY_INVALID_ERR)
+        return dct, statuses
+
+    def gat_multi(self, keys, exptime_t exptime):
+        """
+        Like get_multi, and set the expiration time of the keys found to
+        exptime, in the same round trip.
+        """
+        return self._get_multi(keys, None, exptime)
+
+    def gat(self, basestring key, exptime_t exptime):
+        return self.gat_multi([key], exptime).get(key)
+
+    def _get_multi(self, keys, dict statuses, exptime=None, bool_t as_memoryview=False):
         self._record_thread_ident()
         cdef list normalized_keys = [self.normalize_key(key) for key in keys]
         cdef size_t n_keys = len(normalized_keys)
-        cdef dict multi_raw = self._get_multi_raw(n_keys, normalized_keys)
+        cdef dict multi_raw = self._get_multi_raw(n_keys, normalized_keys, statuses, exptime,
+                                                  as_memoryview)
         cdef dict dct = dict()
         cdef int n_splits = 0
         for i in range(n_keys):
@@ -581,10 +1139,15 @@ cdef class PyClient:
             raw_bytes, flags = multi_raw[normalized_keys[i]]
 
             if raw_bytes is not None and self.do_split and (flags & _FLAG_DOUBAN_CHUNKED):
-                n_splits = int(raw_bytes.decode('ascii'))
-                raw_bytes, flags  = self._get_large_raw(normalized_keys[i], n_splits, flags)
+                n_splits = int(bytes(raw_bytes).decode('ascii'))
+                raw_bytes, flags  = self._get_large_raw(normalized_keys[i], n_splits, flags, exptime)
             if raw_bytes is None:
                 continue
+            if as_memoryview and type(raw_bytes) is not bytes:
+                if flags == _FLAG_EMPTY:
+                    dct[keys[i]] = raw_bytes
+                    continue
+                raw_bytes = bytes(raw_bytes)
             dct[keys[i]] = decode_value(raw_bytes, flags)
 
         return dct
@@ -642,20 +1205,27 @@ cdef class PyClient:
         if not self.do_split or c_val_len <= _DOUBAN_CHUNK_SIZE:
             return self._store_raw(SET_OP, key, flags, exptime, val, DEFAULT_CAS_UNIQUE)
 
-        len_key = len(key)
+        chunk_key = self._chunk_key_base(key)
+        len_key = len(chunk_key)
         #  split large value
         if c_val_len > 10 * _DOUBAN_CHUNK_SIZE or len_key > 200:
             return False
 
         a, b = divmod(c_val_len, _DOUBAN_CHUNK_SIZE)
         cdef int n_splits = a + (0 if b == 0 else 1)
-        keys = [b'~%d%s/%d' % (len_key, key, i) for i in range(n_splits)]
+        keys = [b'~%d%s/%d' % (len_key, chunk_key, i) for i in range(n_splits)]
         vals = [val[i:i+_DOUBAN_CHUNK_SIZE] for i in range(0, c_val_len, _DOUBAN_CHUNK_SIZE)]
         cdef flags_t* splits_flags = <flags_t*>PyMem_Malloc(n_splits * sizeof(flags_t))
         for i in range(n_splits):
             splits_flags[i] = flags
-        rv = self._store_multi_raw(SET_OP, n_splits, keys, vals, splits_flags, exptime, return_failure=False)
-        PyMem_Free(splits_flags)
+        if self.prefix:
+            self._imp.setKeyPrefix(b'', 0)
+        try:
+            rv = self._store_multi_raw(SET_OP, n_splits, keys, vals, splits_flags, exptime, return_failure=False)
+        finally:
+            if self.prefix:
+                self._imp.setKeyPrefix(self.prefix, len(self.prefix))
+            PyMem_Free(splits_flags)
         if rv is False:
             return False
         return self._store_raw(SET_OP, key, flags | _FLAG_DOUBAN_CHUNKED, exptime, str(n_splits).encode('ascii'), DEFAULT_CAS_UNIQUE)
@@ -669,7 +1239,7 @@ cdef class PyClient:
     def set(self, basestring key, object val, exptime_t time=DEFAULT_EXPTIME, bool_t compress=True):
         cdef flags_t flags
         comp_threshold = self.comp_threshold if compress else 0
-        cdef bytes enc_val = _encode_value(val, comp_threshold, &flags)
+        cdef bytes enc_val = _encode_value(val, comp_threshold, &flags, self.msgpack)
         if enc_val is not None:
             return self.set_raw(key, enc_val, time, flags)
         else:
@@ -680,7 +1250,7 @@ cdef class PyClient:
         self._check_thread_ident()
         cdef bytes key2 = self.normalize_key(key)
         cdef flags_t flags
-        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags)
+        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags, self.msgpack)
         return self._store_raw(ADD_OP, key2, flags, time, enc_val, DEFAULT_CAS_UNIQUE)
 
     def replace(self, basestring key, object val, exptime_t time=DEFAULT_EXPTIME):
@@ -688,7 +1258,7 @@ cdef class PyClient:
         self._check_thread_ident()
         cdef bytes key2 = self.normalize_key(key)
         cdef flags_t flags
-        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags)
+        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags, self.msgpack)
         return self._store_raw(REPLACE_OP, key2, flags, time, enc_val, DEFAULT_CAS_UNIQUE)
 
     def prepend(self, basestring key, bytes val, compress=False):
@@ -739,10 +1309,10 @@ cdef class PyClient:
         self._check_thread_ident()
         cdef bytes key2 = self.normalize_key(key)
         cdef flags_t flags
-        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags)
+        cdef bytes enc_val = _encode_value(val, self.comp_threshold, &flags, self.msgpack)
         return self._store_raw(CAS_OP, key2, flags, exptime, enc_val, cas_unique)
 
-    cdef _store_multi_raw(self, op_code_t op, size_t n, list keys, list vals, flags_t* c_flags, exptime_t c_exptime, bool_t return_failure):
+    cdef _store_multi_raw(self, op_code_t op, size_t n, list keys, list vals, flags_t* c_flags, exptime_t c_exptime, bool_t return_failure, exptime_t* c_exptimes=NULL):
         Py_INCREF(keys)
         Py_INCREF(vals)
         cdef size_t n_rst = 0
@@ -757,7 +1327,10 @@ cdef class PyClient:
 
         cdef message_result_t** results = NULL
         with nogil:
-            if op == SET_OP:
+            if op == SET_OP and c_exptimes != NULL:
+                self.last_error = self._imp.setMulti(c_keys, c_key_lens, <const flags_t*>c_flags, <const exptime_t*>c_exptimes, NULL,
+                                   self.noreply, c_vals, c_val_lens, n, &results, &n_rst)
+            elif op == SET_OP:
                 self.last_error = self._imp.set(c_keys, c_key_lens, <const flags_t*>c_flags, c_exptime, NULL,
                                    self.noreply, c_vals, c_val_lens, n, &results, &n_rst)
             elif op == PREPEND_OP:
@@ -786,28 +1359,73 @@ cdef class PyClient:
         Py_DECREF(vals)
         return (is_succeed, failed_keys) if return_failure else is_succeed
 
+    cdef _compress_multi(self, size_t n, list vals, flags_t* c_flags):
+        # compress the values above comp_threshold in place, the whole batch
+        # with the GIL released
+        cdef char** c_vals = <char**>PyMem_Malloc(n * sizeof(char*))
+        cdef size_t* c_val_lens = <size_t*>PyMem_Malloc(n * sizeof(size_t))
+        cdef size_t* c_offsets = <size_t*>PyMem_Malloc((n + 1) * sizeof(size_t))
+        cdef bool_t* c_compressed = <bool_t*>PyMem_Malloc(n * sizeof(bool_t))
+        cdef string buf
+        cdef size_t i
+        for i in range(n):
+            PyString_AsStringAndSize(vals[i], &c_vals[i], <Py_ssize_t*>&c_val_lens[i])
+        with nogil:
+            for i in range(n):
+                c_offsets[i] = buf.size()
+                c_compressed[i] = self._codec.compress(c_vals[i], c_val_lens[i], c_flags[i],
+                                                       buf, c_flags[i])
+            c_offsets[n] = buf.size()
+        for i in range(n):
+            if c_compressed[i]:
+                vals[i] = PyBytes_FromStringAndSize(<char*>buf.data() + c_offsets[i],
+                                                    c_offsets[i + 1] - c_offsets[i])
+        PyMem_Free(c_vals)
+        PyMem_Free(c_val_lens)
+        PyMem_Free(c_offsets)
+        PyMem_Free(c_compressed)
+
     def set_multi(self, dict dct, time=DEFAULT_EXPTIME, compress=True, return_failure=False):
+        """
+        time is the expiration time of all the keys, or a dict of the
+        expiration time of each key, DEFAULT_EXPTIME for the keys not in it.
+        """
         self._record_thread_ident()
         self._check_thread_ident()
         cdef size_t n = len(dct)
         cdef flags_t* c_flags = <flags_t*>PyMem_Malloc(n * sizeof(flags_t))
+        cdef exptime_t* c_exptimes = NULL
+        cdef exptime_t c_exptime = DEFAULT_EXPTIME
+        if isinstance(time, dict):
+            c_exptimes = <exptime_t*>PyMem_Malloc(n * sizeof(exptime_t))
+            for i, key in enumerate(dct.iterkeys()):
+                c_exptimes[i] = time.get(key, DEFAULT_EXPTIME)
+        else:
+            c_exptime = time
         cdef list keys = [self.normalize_key(key) for key in dct.iterkeys()]
-        comp_threshold = self.comp_threshold if compress else 0
-        cdef list vals = [_encode_value(val, comp_threshold, &(c_flags[i]))
+        comp_threshold = self.comp_threshold if compress and self._codec == NULL else 0
+        cdef list vals = [_encode_value(val, comp_threshold, &(c_flags[i]), self.msgpack)
                           for i, val in enumerate(dct.itervalues())]
 
         cdef list failed_keys = []
         if None in vals:  # 1 or more val(s) in vals is(are) not pickable
             PyMem_Free(c_flags)
+            PyMem_Free(c_exptimes)
             failed_keys = keys
             return (False, failed_keys) if return_failure else False
+        if compress and self._codec != NULL:
+            self._compress_multi(n, vals, c_flags)
 
         if not self.do_split or all(len(val) <= _DOUBAN_CHUNK_SIZE for val in vals):
-            rv = self._store_multi_raw(SET_OP, n, keys, vals, c_flags, time, return_failure=return_failure)
+            rv = self._store_multi_raw(SET_OP, n, keys, vals, c_flags, c_exptime, return_failure, c_exptimes)
             PyMem_Free(c_flags)
+            PyMem_Free(c_exptimes)
             return rv
 
         cdef flags_t* c_flags_small = <flags_t*>PyMem_Malloc(n * sizeof(flags_t))
+        cdef exptime_t* c_exptimes_small = NULL
+        if c_exptimes != NULL:
+            c_exptimes_small = <exptime_t*>PyMem_Malloc(n * sizeof(exptime_t))
         cdef list keys_small = []
         cdef list vals_small = []
 
@@ -818,15 +1436,19 @@ cdef class PyClient:
                 keys_small.append(keys[i])
                 vals_small.append(vals[i])
                 c_flags_small[j_small] = c_flags[i]
+                if c_exptimes != NULL:
+                    c_exptimes_small[j_small] = c_exptimes[i]
                 j_small += 1
             else:
-                is_single_succeed = self._set(keys[i], vals[i], c_flags[i], time)
+                is_single_succeed = self._set(keys[i], vals[i], c_flags[i],
+                                              c_exptimes[i] if c_exptimes != NULL else c_exptime)
                 if not is_single_succeed and return_failure:
                     failed_keys.append(keys[i])
                 is_succeed = is_succeed and is_single_succeed
 
         if j_small > 0U:
-            rv2 = self._store_multi_raw(SET_OP, j_small, keys_small, vals_small, c_flags_small, time, return_failure=return_failure)
+            rv2 = self._store_multi_raw(SET_OP, j_small, keys_small, vals_small, c_flags_small, c_exptime,
+                                        return_failure, c_exptimes_small)
             if return_failure:
                 is_succeed = is_succeed and rv2[0]
                 failed_keys.extend(rv2[1])
@@ -835,6 +1457,8 @@ cdef class PyClient:
 
         PyMem_Free(c_flags)
         PyMem_Free(c_flags_small)
+        PyMem_Free(c_exptimes)
+        PyMem_Free(c_exptimes_small)
         return (is_succeed, failed_keys) if return_failure else is_succeed
 
 
@@ -921,6 +1545,57 @@ cdef class PyClient:
         self._check_thread_ident()
         return self._touch_raw(self.normalize_key(key), exptime)
 
+    cdef _touch_multi_raw(self, list keys, exptime_t exptime, exptime_t* c_exptimes, return_failure):
+        cdef size_t n = len(keys), n_res = 0
+        cdef char** c_keys = <char**>PyMem_Malloc(n * sizeof(char*))
+        cdef size_t* c_key_lens = <size_t*>PyMem_Malloc(n * sizeof(size_t))
+        Py_INCREF(keys)
+        for i in range(n):
+            PyString_AsStringAndSize(keys[i], &c_keys[i], <Py_ssize_t*>&c_key_lens[i])
+
+        cdef message_result_t** results = NULL
+
+        with nogil:
+            if c_exptimes != NULL:
+                self.last_error = self._imp.touchMulti(c_keys, c_key_lens, c_exptimes, self.noreply, n, &results, &n_res)
+            else:
+                self.last_error = self._imp.touch(c_keys, c_key_lens, exptime, self.noreply, n, &results, &n_res)
+
+        touched_keys = [results[i][0].key[:results[i][0].key_len]
+                        for i in range(n_res) if results[i][0].type_ == MSG_TOUCHED]
+        is_succeed = self.last_error == 0 and (self.noreply or len(touched_keys) == n)
+        cdef list failed_keys = []
+        if not is_succeed and return_failure:
+            failed_keys = list(set(keys) - set(touched_keys))
+
+        with nogil:
+            self._imp.destroyMessageResult()
+        PyMem_Free(c_key_lens)
+        PyMem_Free(c_keys)
+        Py_DECREF(keys)
+        return (is_succeed, failed_keys) if return_failure else is_succeed
+
+    def touch_multi(self, keys, exptime, return_failure=False):
+        """
+        Set the expiration time of the keys, pipelined to each server.
+        exptime is of all the keys, or a dict of the expiration time of each
+        key. A missing key fails, like in touch.
+        """
+        self._record_thread_ident()
+        self._check_thread_ident()
+        keys = list(keys)
+        cdef list normalized_keys = [self.normalize_key(key) for key in keys]
+        cdef size_t n = len(normalized_keys)
+        cdef exptime_t* c_exptimes = NULL
+        if isinstance(exptime, dict):
+            c_exptimes = <exptime_t*>PyMem_Malloc(n * sizeof(exptime_t))
+            for i, key in enumerate(keys):
+                c_exptimes[i] = exptime.get(key, DEFAULT_EXPTIME)
+            exptime = DEFAULT_EXPTIME
+        rv = self._touch_multi_raw(normalized_keys, exptime, c_exptimes, return_failure)
+        PyMem_Free(c_exptimes)
+        return rv
+
     def version(self):
         self._record_thread_ident()
         cdef broadcast_result_t* rst = NULL
@@ -1013,6 +1688,62 @@ cdef class PyClient:
         self._check_thread_ident()
         return self._incr_decr_raw(DECR_OP, self.normalize_key(key), delta)
 
+    cdef _incr_decr_multi_raw(self, op_code_t op, list keys, uint64_t delta):
+        cdef size_t n = len(keys), n_res = 0
+        cdef char** c_keys = <char**>PyMem_Malloc(n * sizeof(char*))
+        cdef size_t* c_key_lens = <size_t*>PyMem_Malloc(n * sizeof(size_t))
+        cdef uint64_t* c_deltas = <uint64_t*>PyMem_Malloc(n * sizeof(uint64_t))
+        Py_INCREF(keys)
+        for i in range(n):
+            PyString_AsStringAndSize(keys[i], &c_keys[i], <Py_ssize_t*>&c_key_lens[i])
+            c_deltas[i] = delta
+
+        cdef unsigned_result_t** results = NULL
+        with nogil:
+            if op == INCR_OP:
+                self.last_error = self._imp.incrMulti(c_keys, c_key_lens, c_deltas, self.noreply,
+                                                      n, &results, &n_res)
+            elif op == DECR_OP:
+                self.last_error = self._imp.decrMulti(c_keys, c_key_lens, c_deltas, self.noreply,
+                                                      n, &results, &n_res)
+            else:
+                pass
+
+        cdef dict rv = {}
+        for i in range(n_res):
+            rv[results[i][0].key[:results[i][0].key_len]] = results[i][0].value
+        with nogil:
+            self._imp.destroyUnsignedResult()
+        PyMem_Free(c_deltas)
+        PyMem_Free(c_key_lens)
+        PyMem_Free(c_keys)
+        Py_DECREF(keys)
+        return rv
+
+    def _incr_decr_multi(self, op_code_t op, keys, uint64_t delta):
+        self._record_thread_ident()
+        self._check_thread_ident()
+        cdef list normalized_keys = [self.normalize_key(key) for key in keys]
+        cdef dict raw = self._incr_decr_multi_raw(op, normalized_keys, delta)
+        cdef dict dct = {}
+        for key, normalized_key in zip(keys, normalized_keys):
+            if normalized_key in raw:
+                dct[key] = raw[normalized_key]
+        return dct
+
+    def incr_multi(self, keys, delta=1):
+        """
+        Like incr on each of the keys, pipelined to each server. Returns a
+        dict of the new values of the keys found.
+        """
+        return self._incr_decr_multi(INCR_OP, keys, delta)
+
+    def decr_multi(self, keys, delta=1):
+        """
+        Like decr on each of the keys, see incr_multi.
+        """
+        return self._incr_decr_multi(DECR_OP, keys, delta)
+
     def _sleep(self, uint32_t seconds, release_gil=False):
         if release_gil:
             with nogil:
@@ -1048,5 +1779,63 @@ cdef class PyClient:
     def get_last_error(self):
         return self.last_error
 
+    def get_metrics(self):
+        """
+        Client side metrics of each server, keyed by server name. Latency
+        histograms count microseconds in log2 buckets: buckets[0] counts
+        [0, 2) us, buckets[i] counts [2^i, 2^(i+1)) us.
+        """
+        cdef server_metrics_t* metrics = NULL
+        cdef server_metrics_t* m = NULL
+        cdef size_t n = 0
+        self._imp.getMetrics(&metrics, &n)
+        rv = {}
+        for i in range(n):
+            m = &metrics[i]
+            host = m.host
+            if PY_MAJOR_VERSION > 2:
+                host = host.decode('utf8')
+            rv[host] = {
+                'requests': m.requests,
+                'bytes_sent': m.bytes_sent,
+                'bytes_received': m.bytes_received,
+                'poll_wakeups': m.poll_wakeups,
+                'connects': m.connects,
+                'connect_failures': m.connect_failures,
+                'send_errors': m.send_errors,
+                'recv_errors': m.recv_errors,
+                'conn_poll_errors': m.conn_poll_errors,
+                'poll_timeouts': m.poll_timeouts,
+                'poll_errors': m.poll_errors,
+                'server_errors': m.server_errors,
+                'parse_errors': m.parse_errors,
+                'abandons': m.abandons,
+                'dispatch': _histogram_to_dict(&m.dispatch),
+                'send': _histogram_to_dict(&m.send),
+                'first_byte': _histogram_to_dict(&m.first_byte),
+                'complete': _histogram_to_dict(&m.complete),
+            }
+        return rv
+
+    def reset_metrics(self):
+        self._imp.resetMetrics()
+
+    def set_tracer(self, tracer):
+        """
+        Call ``tracer(span)`` with each phase of the requests, ``span`` is a
+        dict of ``phase`` (``MC_TRACE_*``), ``server`` (``None`` unless the
+        span is of a single server), ``start``, ``end`` (``time.time()``
+        based), ``n_keys`` and ``error``. It's called synchronously and
+        must never call the client. ``None`` disables tracing.
+        """
+        cdef trace_hook_t hook = NULL
+        if tracer is not None:
+            hook = _trace_hook
+            self._tracer = tracer
+        with nogil:
+            # may wait for the maintainer thread, which may need the GIL
+            self._imp.setTraceHook(hook, <void*>self)
+        self._tracer = tracer
+
     def get_last_strerror(self):
         return ERROR_CODE_TO_STR.get(self.last_error, '')
@@ -0,0 +1,162 @@
+#!/usr/bin/env python
+# encoding: utf-8
+
+"""Capture the raw response streams of a memcached into a replayable corpus.
+
+Every response is stored in its own ``<name>.corpus`` file: a header line
+``libmc-corpus <mode> <count>\\n`` followed by the bytes exactly as received.
+``mode`` is ``end`` for responses terminated by END (get, gets, stats),
+``counting`` for a pipeline of ``count`` one line replies (storage, delete,
+touch). tests/benchmark/bench_corpus.cpp replays these files through
+PacketParser.
+
+Usage::
+
+    python misc/capture_corpus.py --server 127.0.0.1:11211 --out corpus
+"""
+
+import os
+import socket
+import argparse
+
+KEY_PREFIX = 'libmc:corpus:'
+VALUE_SIZES = (10, 100, 1000, 10000, 100000, 1000000)
+BATCH_SIZES = (1, 10, 100, 1000)
+PIPELINE_SIZE = 100
+
+
+class Capturer(object):
+
+    def __init__(self, host, port, out):
+        self.sock = socket.create_connection((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.out = out
+        self.files = []
+
+    def close(self):
+        self.sock.close()
+
+    def _recv_until(self, is_complete):
+        buf = b''
+        while not is_complete(buf):
+            data = self.sock.recv(65536)
+            if not data:
+                raise IOError('connection closed by the server')
+            buf += data
+        return buf
+
+    def request(self, cmd):
+        self.sock.sendall(cmd)
+
+    def request_end(self, cmd):
+        self.request(cmd)
+        return self._recv_until(
+            lambda buf: buf == b'END\r\n' or buf.endswith(b'\r\nEND\r\n')
+        )
+
+    def request_counting(self, cmd, count):
+        self.request(cmd)
+        return self._recv_until(lambda buf: buf.count(b'\r\n') >= count)
+
+    def save(self, name, mode, count, response):
+        path = os.path.join(self.out, name + '.corpus')
+        with open(path, 'wb') as f:
+            f.write(('libmc-corpus %s %d\n' % (mode, count)).encode('ascii'))
+            f.write(response)
+        self.files.append((path, len(response)))
+
+
+def key(i):
+    return (KEY_PREFIX + str(i)).encode('ascii')
+
+
+def storage_cmd(cmd, k, value, noreply=False):
+    return b''.join([
+        cmd, b' ', k, b' 0 0 ', str(len(value)).encode('ascii'),
+        b' noreply' if noreply else b'', b'\r\n', value, b'\r\n'
+    ])
+
+
+def capture_retrievals(c):
+    for value_size in VALUE_SIZES:
+        value = b'v' * value_size
+        for n_keys in BATCH_SIZES:
+            if value_size * n_keys > 64 * 1024 * 1024:
+                continue
+            keys = [key(i) for i in range(n_keys)]
+            # only the even keys exist, so that every batch mixes hits and misses
+            c.request(b''.join(
+                storage_cmd(b'set', k, value, noreply=True)
+                for k in keys[::2]
+            ))
+            c.request_end(b'get ' + KEY_PREFIX.encode('ascii') + b'sync\r\n')
+            for cmd in (b'get', b'gets'):
+                rv = c.request_end(cmd + b' ' + b' '.join(keys) + b'\r\n')
+                c.save('%s_v%d_n%d' % (cmd.decode('ascii'), value_size, n_keys),
+                       'end', n_keys, rv)
+            c.request(b''.join(b'delete ' + k + b' noreply\r\n' for k in keys))
+
+
+def capture_stats(c):
+    for arg in (b'', b' slabs', b' items', b' settings'):
+        cmd = b'stats' + arg
+        rv = c.request_end(cmd + b'\r\n')
+        if rv.startswith(b'STAT') or rv == b'END\r\n':
+            c.save(cmd.decode('ascii').replace(' ', '_'), 'end', 0, rv)
+
+
+def capture_messages(c):
+    keys = [key(i) for i in range(PIPELINE_SIZE)]
+    value = b'v' * 100
+
+    # STORED / NOT_STORED, half of the keys exist before
+    c.request(b''.join(
+        storage_cmd(b'set', k, value, noreply=True) for k in keys[::2]
+    ))
+    rv = c.request_counting(b''.join(
+        storage_cmd(b'add', k, value) for k in keys
+    ), PIPELINE_SIZE)
+    c.save('add_mixed', 'counting', PIPELINE_SIZE, rv)
+
+    rv = c.request_counting(b''.join(
+        storage_cmd(b'set', k, value) for k in keys
+    ), PIPELINE_SIZE)
+    c.save('set_stored', 'counting', PIPELINE_SIZE, rv)
+
+    rv = c.request_counting(b''.join(
+        b'touch ' + k + b' 0\r\n' for k in keys
+    ), PIPELINE_SIZE)
+    c.save('touch_touched', 'counting', PIPELINE_SIZE, rv)
+
+    # DELETED / NOT_FOUND, half of the keys are gone before
+    c.request(b''.join(b'delete ' + k + b' noreply\r\n' for k in keys[::2]))
+    rv = c.request_counting(b''.join(
+        b'delete ' + k + b'\r\n' for k in keys
+    ), PIPELINE_SIZE)
+    c.save('delete_mixed', 'counting', PIPELINE_SIZE, rv)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--server', default='127.0.0.1:11211',
+                        help='host:port of the memcached to capture')
+    parser.add_argument('--out', default='corpus',
+                        help='directory where the .corpus files are written')
+    args = parser.parse_args()
+
+    host, port = args.server.rsplit(':', 1)
+    if not os.path.isdir(args.out):
+        os.makedirs(args.out)
+    c = Capturer(host, int(port), args.out)
+    try:
+        capture_retrievals(c)
+        capture_stats(c)
+        capture_messages(c)
+    finally:
+        c.close()
+    for path, size in c.files:
+        print('%10d  %s' % (size, path))
+
+
+if __name__ == '__main__':
+    main()
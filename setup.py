@@ -18,7 +18,8 @@ sources = (glob("src/*.cpp") +
 include_dirs = ["include"]
 
 COMPILER_FLAGS = ["-fno-strict-aliasing", "-fno-exceptions", "-fno-rtti",
-                  "-Wall", "-DMC_USE_SMALL_VECTOR", "-O3", "-DNDEBUG"]
+                  "-Wall", "-DMC_USE_SMALL_VECTOR", "-DMC_USE_ZLIB", "-O3",
+                  "-DNDEBUG"]
 
 
 def find_version(*file_paths):
@@ -75,7 +76,8 @@ setup(
     cmdclass={"test": PyTest},
     ext_modules=[
         Extension("libmc._client", sources, include_dirs=include_dirs,
-                  language="c++", extra_compile_args=COMPILER_FLAGS)
+                  libraries=["z"], language="c++",
+                  extra_compile_args=COMPILER_FLAGS)
     ],
     tests_require=[
         "pytest",
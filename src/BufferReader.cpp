@@ -46,7 +46,7 @@ void BufferReader::reset() {
                "This should ONLY be happened on error. "
                "nBytes: %zu:",
                dbPtr, dbPtr->nBytesRef());
-#if MC_LOG_LEVEL >= MC_LOG_LEVEL_WARNING
+#if MC_LOG_LEVEL >= MC_LOG_LEVEL_DEBUG
       utility::fprintBuffer(stderr, dbPtr->at(0), std::min(dbPtr->nBytesRef(), 128UL));
 #endif
     }
@@ -430,6 +430,42 @@ void BufferReader::skipBytes(err_code_t& err, size_t len) {
 }
 
 
+// Consume up to len bytes from the current block without copying them:
+// point data to them and return how many, 0 if there is nothing to read.
+// data is valid until the next write. A block read up this way is recycled
+// for writing, so a value read piece by piece takes a few blocks whatever
+// its size.
+size_t BufferReader::readPiece(size_t len, const char*& data) {
+  if (len == 0 || m_readLeft == 0) {
+    return 0;
+  }
+  DataBlockListIterator it = m_blockReadCursor.iterator;
+  size_t n = std::min(len, it->size() - m_blockReadCursor.offset);
+  data = it->at(m_blockReadCursor.offset);
+  it->release(n);
+  m_readLeft -= n;
+  m_blockReadCursor.offset += n;
+  if (m_blockReadCursor.offset == it->size()) {
+    ++m_blockReadCursor.iterator;
+    m_blockReadCursor.offset = 0;
+    if (it != m_blockWriteIterator && it->reusable()) {
+      recycleBlock(it);
+    }
+  }
+  return n;
+}
+
+
+// move a block nothing refers to anymore after the ones being written
+void BufferReader::recycleBlock(DataBlockListIterator it) {
+  it->reset();
+  m_dataBlockList.splice(m_dataBlockList.end(), m_dataBlockList, it);
+  if (m_blockWriteIterator == m_dataBlockList.end()) {
+    m_blockWriteIterator = it;
+  }
+}
+
+
 size_t BufferReader::getNextPreferedDataBlockSize() {
   size_t tmp = m_nextPreferedDataBlockSize == 0 ?
       DataBlock::minCapacity() :
@@ -1,5 +1,6 @@
 #include <inttypes.h>
 #include <cstdio>
+#include <cstring>
 #include <vector>
 
 #include "BufferWriter.h"
@@ -56,6 +57,15 @@ void BufferWriter::takeNumber(int64_t val) {
 }
 
 
+// for the bytes not to outlive the request, like the ones of takeNumber
+void BufferWriter::takeCopy(const char* const buf, size_t buf_len) {
+  m_unsignedStringList.push_back(new char[buf_len]);
+  char* copy = m_unsignedStringList.back();
+  memcpy(copy, buf, buf_len);
+  takeBuffer(copy, buf_len);
+}
+
+
 #ifdef __APPLE__
 const struct iovec* const BufferWriter::getReadPtr(int &n) {
 #else
@@ -1,4 +1,8 @@
 #include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
 #include <vector>
 
 #include "Export.h"
@@ -9,7 +13,7 @@
 namespace douban {
 namespace mc {
 
-Client::Client() {
+Client::Client() : m_splittingLargeValues(false) {
 }
 
 
@@ -28,6 +32,42 @@ void Client::config(config_options_t opt, int val) {
     case CFG_RETRY_TIMEOUT:
       setRetryTimeout(val);
       break;
+    case CFG_MAX_RETRY_TIMEOUT:
+      setMaxRetryTimeout(val);
+      break;
+    case CFG_MAINTAIN_INTERVAL:
+      setMaintainInterval(val);
+      break;
+    case CFG_KEEPALIVE_IDLE:
+      setKeepaliveIdle(val);
+      break;
+    case CFG_REQUEST_TIMEOUT:
+      setRequestTimeout(val);
+      break;
+    case CFG_COMPRESS_CODEC:
+      setCompressCodec(static_cast<compress_codec_options_t>(val));
+      break;
+    case CFG_COMPRESS_THRESHOLD:
+      setCompressThreshold(val);
+      break;
+    case CFG_SPLIT_LARGE_VALUES:
+      m_splittingLargeValues = val != 0;
+      break;
+    case CFG_BINARY_SAFE_KEYS:
+      setBinarySafeKeys(val != 0);
+      break;
+    case CFG_SEND_WINDOW:
+      setSendWindow(val);
+      break;
+    case CFG_MAX_GET_KEYS:
+      setMaxGetSize(val, static_cast<int>(m_maxGetBytes));
+      break;
+    case CFG_MAX_GET_BYTES:
+      setMaxGetSize(static_cast<int>(m_maxGetKeys), val);
+      break;
+    case CFG_CONNS_PER_SERVER:
+      setConnsPerServer(val);
+      break;
     case CFG_HASH_FUNCTION:
       ConnectionPool::setHashFunction(static_cast<hash_function_options_t>(val));
     default:
@@ -38,22 +78,151 @@ void Client::config(config_options_t opt, int val) {
 
 err_code_t Client::get(const char* const* keys, const size_t* keyLens, size_t nKeys,
                  retrieval_result_t*** results, size_t* nResults) {
+  return retrieve(GET_OP, keys, keyLens, nKeys, 0, results, nResults);
+}
+
+
+err_code_t Client::gets(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                 retrieval_result_t*** results, size_t* nResults) {
+  return retrieve(GETS_OP, keys, keyLens, nKeys, 0, results, nResults);
+}
+
+
+// get and touch: like get/gets, and set the exptime of the keys found
+err_code_t Client::gat(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                       const exptime_t exptime, retrieval_result_t*** results,
+                       size_t* nResults) {
+  return retrieve(GAT_OP, keys, keyLens, nKeys, exptime, results, nResults);
+}
+
+
+err_code_t Client::gats(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                        const exptime_t exptime, retrieval_result_t*** results,
+                        size_t* nResults) {
+  return retrieve(GATS_OP, keys, keyLens, nKeys, exptime, results, nResults);
+}
+
+
+// Like get, but hand the values to sink as they arrive, so a large value is
+// never held in memory as a whole. The results are the values streamed
+// completely, without data blocks. Values are streamed as stored:
+// compressed ones are not decompressed, nor chunked ones joined, a value
+// split by CFG_SPLIT_LARGE_VALUES is streamed as its header, flagged
+// MC_FLAG_CHUNKED, get it with get instead.
+err_code_t Client::getStream(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                             value_sink_t sink, void* ctx,
+                             retrieval_result_t*** results, size_t* nResults) {
+  setValueSink(sink, ctx);
   dispatchRetrieval(GET_OP, keys, keyLens, nKeys);
   err_code_t rv = waitPoll();
+  setValueSink(NULL, NULL);
   collectRetrievalResult(results, nResults);
   return rv;
 }
 
 
-err_code_t Client::gets(const char* const* keys, const size_t* keyLens, size_t nKeys,
-                 retrieval_result_t*** results, size_t* nResults) {
-  dispatchRetrieval(GETS_OP, keys, keyLens, nKeys);
+// the buffers of Client::getInto, and its keys sorted to find them
+typedef struct {
+  const char* const* keys;
+  const size_t* keyLens;
+  char* arena;
+  const size_t* offsets;
+  const size_t* sizes;
+  std::vector<size_t> order;
+} arena_t;
+
+
+static int compareKeys(const char* a, size_t aLen, const char* b, size_t bLen) {
+  int rv = memcmp(a, b, std::min(aLen, bLen));
+  return rv != 0 ? rv : (aLen < bLen ? -1 : (aLen > bLen ? 1 : 0));
+}
+
+
+struct KeyLess {
+  const char* const* keys;
+  const size_t* keyLens;
+  KeyLess(const char* const* keys, const size_t* keyLens) : keys(keys), keyLens(keyLens) {
+  }
+  bool operator()(size_t a, size_t b) const {
+    return compareKeys(keys[a], keyLens[a], keys[b], keyLens[b]) < 0;
+  }
+};
+
+
+static char* pickArenaBuffer(void* ctx, const retrieval_result_t* header) {
+  arena_t* arena = static_cast<arena_t*>(ctx);
+  size_t lo = 0, hi = arena->order.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t i = arena->order[mid];
+    if (compareKeys(arena->keys[i], arena->keyLens[i], header->key, header->key_len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == arena->order.size()) {
+    return NULL;
+  }
+  size_t i = arena->order[lo];
+  if (compareKeys(arena->keys[i], arena->keyLens[i], header->key, header->key_len) != 0 ||
+      arena->sizes[i] < header->bytes) {
+    return NULL;
+  }
+  return arena->arena + arena->offsets[i];
+}
+
+
+// Like get, but read the value of keys[i] straight into the sizes[i] bytes
+// at arena + offsets[i], saving the copies out of the receiving buffers.
+// The results point there, but for the values which don't fit, and for
+// compressed ones which are decompressed into buffers of their own. Chunked
+// values are not joined: a value split by CFG_SPLIT_LARGE_VALUES comes as
+// its header, flagged MC_FLAG_CHUNKED, get it with get instead.
+err_code_t Client::getInto(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                           char* arena, const size_t* offsets, const size_t* sizes,
+                           retrieval_result_t*** results, size_t* nResults) {
+  arena_t ctx;
+  ctx.keys = keys;
+  ctx.keyLens = keyLens;
+  ctx.arena = arena;
+  ctx.offsets = offsets;
+  ctx.sizes = sizes;
+  ctx.order.resize(nKeys);
+  for (size_t i = 0; i < nKeys; ++i) {
+    ctx.order[i] = i;
+  }
+  std::sort(ctx.order.begin(), ctx.order.end(), KeyLess(keys, keyLens));
+  setValueBuffer(pickArenaBuffer, &ctx);
+  dispatchRetrieval(GET_OP, keys, keyLens, nKeys);
   err_code_t rv = waitPoll();
+  setValueBuffer(NULL, NULL);
   collectRetrievalResult(results, nResults);
   return rv;
 }
 
 
+err_code_t Client::retrieve(op_code_t op, const char* const* keys, const size_t* keyLens,
+                            size_t nKeys, const exptime_t exptime,
+                            retrieval_result_t*** results, size_t* nResults) {
+  // the request timeout bounds the round of the chunks too
+  bool bounding = m_splittingLargeValues && m_deadline == 0 && m_requestTimeout > 0;
+  if (bounding) {
+    setDeadline(m_requestTimeout);
+  }
+  dispatchRetrieval(op, keys, keyLens, nKeys, exptime);
+  err_code_t rv = waitPoll();
+  collectRetrievalResult(results, nResults);
+  if (m_splittingLargeValues) {
+    rv = joinChunkedValues(op, keys, keyLens, nKeys, exptime, rv, results, nResults);
+  }
+  if (bounding) {
+    clearDeadline();
+  }
+  return rv;
+}
+
+
 void Client::collectRetrievalResult(retrieval_result_t*** results, size_t* nResults) {
   assert(m_outRetrievalResultPtrs.size() == 0);
   ConnectionPool::collectRetrievalResult(m_outRetrievalResultPtrs);
@@ -69,6 +238,8 @@ void Client::collectRetrievalResult(retrieval_result_t*** results, size_t* nResu
 void Client::destroyRetrievalResult() {
   ConnectionPool::reset();
   m_outRetrievalResultPtrs.clear();
+  m_joinedResults.clear();
+  m_joinedStatuses.clear();
 }
 
 
@@ -88,6 +259,36 @@ void Client::collectMessageResult(message_result_t*** results, size_t* nResults)
 void Client::destroyMessageResult() {
   ConnectionPool::reset();
   m_outMessageResultPtrs.clear();
+  m_joinedMessages.clear();
+  m_joinedStatuses.clear();
+}
+
+
+// A compressed value can't be concatenated to another one, and only set
+// splits large values. exptimes, if not NULL, are of each item instead of
+// exptime.
+err_code_t Client::store(op_code_t op, const char* const* keys, const size_t* key_lens,
+                         const flags_t* flags, const exptime_t exptime,
+                         const exptime_t* exptimes, const cas_unique_t* cas_uniques,
+                         const bool noreply, const char* const* vals,
+                         const size_t* val_lens, size_t nItems,
+                         message_result_t*** results, size_t* nResults) {
+  if (op != APPEND_OP && op != PREPEND_OP) {
+    compressValues(flags, vals, val_lens, nItems);
+  }
+  if (op == SET_OP && m_splittingLargeValues) {
+    for (size_t i = 0; i < nItems; ++i) {
+      if (val_lens[i] > MC_CHUNK_SIZE) {
+        return splitLargeValues(keys, key_lens, flags, exptime, exptimes, noreply, vals,
+                                val_lens, nItems, results, nResults);
+      }
+    }
+  }
+  dispatchStorage(op, keys, key_lens, flags, exptime, exptimes, cas_uniques, noreply, vals,
+                  val_lens, nItems);
+  err_code_t rv = waitPoll();
+  collectMessageResult(results, nResults);
+  return rv;
 }
 
 
@@ -97,11 +298,8 @@ err_code_t Client::M(const char* const* keys, const size_t* key_lens, \
                  const cas_unique_t* cas_uniques, const bool noreply, \
                  const char* const* vals, const size_t* val_lens, \
                  size_t nItems, message_result_t*** results, size_t* nResults) { \
-  dispatchStorage((O), keys, key_lens, flags, exptime, cas_uniques, noreply, vals, \
-                  val_lens, nItems); \
-  err_code_t rv = waitPoll(); \
-  collectMessageResult(results, nResults); \
-  return rv;\
+  return store((O), keys, key_lens, flags, exptime, NULL, cas_uniques, noreply, vals, \
+               val_lens, nItems, results, nResults); \
 }
 
 IMPL_STORAGE_CMD(set, SET_OP)
@@ -112,6 +310,339 @@ IMPL_STORAGE_CMD(prepend, PREPEND_OP)
 IMPL_STORAGE_CMD(cas, CAS_OP)
 #undef IMPL_STORAGE_CMD
 
+
+#define IMPL_STORAGE_MULTI_CMD(M, O) \
+err_code_t Client::M##Multi(const char* const* keys, const size_t* key_lens, \
+                 const flags_t* flags, const exptime_t* exptimes, \
+                 const cas_unique_t* cas_uniques, const bool noreply, \
+                 const char* const* vals, const size_t* val_lens, \
+                 size_t nItems, message_result_t*** results, size_t* nResults) { \
+  return store((O), keys, key_lens, flags, 0, exptimes, cas_uniques, noreply, vals, \
+               val_lens, nItems, results, nResults); \
+}
+
+IMPL_STORAGE_MULTI_CMD(set, SET_OP)
+IMPL_STORAGE_MULTI_CMD(add, ADD_OP)
+IMPL_STORAGE_MULTI_CMD(replace, REPLACE_OP)
+IMPL_STORAGE_MULTI_CMD(cas, CAS_OP)
+#undef IMPL_STORAGE_MULTI_CMD
+
+
+// append the keys "~<len><prefix><key>/<i>" of the nChunks chunks of a key,
+// len of the prefix and the key, as the Python binding stores the chunks
+// under a prefix. A "?" key keeps its "?" ahead of the prefix, as in wireKey.
+// They carry the prefix already, SEE Client::suspendKeyPrefix
+void Client::addChunkKeys(const char* key, size_t keyLen, size_t nChunks) {
+  size_t mark = keyLen > 0 && key[0] == '?' ? 1 : 0;
+  char head[24], tail[24];
+  size_t headLen = snprintf(head, sizeof head, "~%zu", m_keyPrefix.size() + keyLen);
+  for (size_t i = 0; i < nChunks; ++i) {
+    size_t tailLen = snprintf(tail, sizeof tail, "/%zu", i);
+    m_chunkKeyOffsets.push_back(m_chunkKeyBuffer.size());
+    m_chunkKeyLens.push_back(headLen + m_keyPrefix.size() + keyLen + tailLen);
+    m_chunkKeyBuffer.append(head, headLen).append(key, mark).append(m_keyPrefix)
+        .append(key + mark, keyLen - mark).append(tail, tailLen);
+  }
+}
+
+
+// point m_chunkKeys into m_chunkKeyBuffer, once all chunk keys are added
+void Client::fixChunkKeys() {
+  m_chunkKeys.resize(m_chunkKeyOffsets.size());
+  for (size_t i = 0; i < m_chunkKeyOffsets.size(); ++i) {
+    m_chunkKeys[i] = m_chunkKeyBuffer.data() + m_chunkKeyOffsets[i];
+  }
+}
+
+
+// send the keys as is until resumeKeyPrefix, for the chunk keys
+void Client::suspendKeyPrefix(std::string& prefix) {
+  prefix = m_keyPrefix;
+  setKeyPrefix("", 0);
+}
+
+
+void Client::resumeKeyPrefix(const std::string& prefix) {
+  setKeyPrefix(prefix.data(), prefix.size());
+}
+
+
+// Store the values larger than MC_CHUNK_SIZE (once compressed) the way the
+// Python binding does: the chunks of MC_CHUNK_SIZE bytes under the keys
+// "~<len><prefix><key>/<i>", then under the key itself a header of the
+// number of chunks in ascii, flagged MC_FLAG_CHUNKED. The chunks go first,
+// as is, then the small values along with the header of each value with
+// all chunks stored. A value of too many chunks or with a too long key is
+// sent as is, and up to the server to refuse.
+err_code_t Client::splitLargeValues(const char* const* keys, const size_t* key_lens,
+                                    const flags_t* flags, const exptime_t exptime,
+                                    const exptime_t* exptimes, const bool noreply,
+                                    const char* const* vals, const size_t* val_lens,
+                                    size_t nItems, message_result_t*** results,
+                                    size_t* nResults) {
+  std::vector<size_t> nChunks(nItems, 0);
+  m_chunkKeyBuffer.clear();
+  m_chunkKeyOffsets.clear();
+  m_chunkKeyLens.clear();
+  for (size_t i = 0; i < nItems; ++i) {
+    size_t n = (val_lens[i] + MC_CHUNK_SIZE - 1) / MC_CHUNK_SIZE;
+    if (n > 1 && n <= MC_MAX_CHUNKS &&
+        m_keyPrefix.size() + key_lens[i] <= MC_MAX_CHUNKED_KEY_LENGTH) {
+      nChunks[i] = n;
+      addChunkKeys(keys[i], key_lens[i], n);
+    }
+  }
+  fixChunkKeys();
+
+  // the first round: the chunks, item of each is in items
+  std::vector<const char*> roundKeys, roundVals;
+  std::vector<size_t> roundKeyLens, roundValLens, items;
+  std::vector<flags_t> roundFlags;
+  std::vector<exptime_t> roundExptimes;
+  for (size_t i = 0, chunk = 0; i < nItems; ++i) {
+    for (size_t offset = 0; nChunks[i] > 0 && offset < val_lens[i];
+         offset += MC_CHUNK_SIZE, ++chunk) {
+      roundKeys.push_back(m_chunkKeys[chunk]);
+      roundKeyLens.push_back(m_chunkKeyLens[chunk]);
+      roundVals.push_back(vals[i] + offset);
+      roundValLens.push_back(std::min(val_lens[i] - offset, (size_t)MC_CHUNK_SIZE));
+      roundFlags.push_back(flags[i]);
+      roundExptimes.push_back(exptimes == NULL ? exptime : exptimes[i]);
+      items.push_back(i);
+    }
+  }
+  err_code_t rv = RET_OK;
+  key_status_t* statuses = NULL;
+  size_t n = 0;
+  m_joinedStatuses.assign(nItems, KEY_HIT);
+  if (!roundKeys.empty()) {
+    std::string prefix;
+    suspendKeyPrefix(prefix);
+    dispatchStorage(SET_OP, &roundKeys[0], &roundKeyLens[0], &roundFlags[0], 0,
+                    &roundExptimes[0], NULL, noreply, &roundVals[0], &roundValLens[0],
+                    roundKeys.size());
+    rv = waitPoll();
+    resumeKeyPrefix(prefix);
+    ConnectionPool::getKeyStatuses(&statuses, &n);
+    for (size_t i = 0; i < n; ++i) {
+      if (statuses[i] != KEY_HIT && m_joinedStatuses[items[i]] == KEY_HIT) {
+        m_joinedStatuses[items[i]] = statuses[i];
+      }
+    }
+    ConnectionPool::reset();
+  }
+
+  // the second round: the small values, and the headers of the values with
+  // all chunks stored
+  char counts[MC_MAX_CHUNKS + 1][4];
+  roundKeys.clear();
+  roundKeyLens.clear();
+  roundVals.clear();
+  roundValLens.clear();
+  roundFlags.clear();
+  roundExptimes.clear();
+  items.clear();
+  for (size_t i = 0; i < nItems; ++i) {
+    if (nChunks[i] == 0) {
+      roundVals.push_back(vals[i]);
+      roundValLens.push_back(val_lens[i]);
+      roundFlags.push_back(flags[i]);
+    } else if (m_joinedStatuses[i] == KEY_HIT) {
+      roundValLens.push_back(snprintf(counts[nChunks[i]], sizeof counts[0], "%zu",
+                                      nChunks[i]));
+      roundVals.push_back(counts[nChunks[i]]);
+      roundFlags.push_back(flags[i] | MC_FLAG_CHUNKED);
+    } else {
+      continue;
+    }
+    roundKeys.push_back(keys[i]);
+    roundKeyLens.push_back(key_lens[i]);
+    roundExptimes.push_back(exptimes == NULL ? exptime : exptimes[i]);
+    items.push_back(i);
+  }
+  if (!roundKeys.empty()) {
+    dispatchStorage(SET_OP, &roundKeys[0], &roundKeyLens[0], &roundFlags[0], 0,
+                    &roundExptimes[0], NULL, noreply, &roundVals[0], &roundValLens[0],
+                    roundKeys.size());
+    err_code_t rv2 = waitPoll();
+    rv = rv == RET_OK ? rv2 : rv;
+    ConnectionPool::getKeyStatuses(&statuses, &n);
+    for (size_t i = 0; i < n; ++i) {
+      m_joinedStatuses[items[i]] = statuses[i];
+    }
+    std::vector<message_result_t*> messages;
+    ConnectionPool::collectMessageResult(messages);
+    for (std::vector<message_result_t*>::iterator it = messages.begin();
+         it != messages.end(); ++it) {
+      m_joinedMessages.push_back(**it);
+    }
+  }
+
+  assert(m_outMessageResultPtrs.size() == 0);
+  for (std::vector<message_result_t>::iterator it = m_joinedMessages.begin();
+       it != m_joinedMessages.end(); ++it) {
+    m_outMessageResultPtrs.push_back(&(*it));
+  }
+  *nResults = m_outMessageResultPtrs.size();
+  *results = *nResults == 0 ? NULL : &m_outMessageResultPtrs.front();
+  return rv;
+}
+
+
+// the number of chunks in the header of a value split by splitLargeValues,
+// or 0 if r (of a key under a prefix of prefixLen) is not a valid header
+static size_t chunkCount(const retrieval_result_t* r, size_t prefixLen) {
+  if (!(r->flags & MC_FLAG_CHUNKED) || prefixLen + r->key_len > MC_MAX_CHUNKED_KEY_LENGTH) {
+    return 0;
+  }
+  size_t n = 0;
+  for (uint32_t i = 0; i < r->bytes && r->data_block[i] != '\0'; ++i) {
+    if (r->data_block[i] < '0' || r->data_block[i] > '9' || n > MC_MAX_CHUNKS) {
+      return 0;
+    }
+    n = n * 10 + (r->data_block[i] - '0');
+  }
+  return n <= MC_MAX_CHUNKS ? n : 0;
+}
+
+
+// The other half of splitLargeValues. Headers are known only once the first
+// round is back, so fetch the chunks of all of them in one more round,
+// instead of a round per value as the Python binding does, and join each
+// value in place of its header. The deadline of the request, if any, holds
+// for both rounds. A value missing any chunk takes the status of the
+// chunk, a miss if it's not found. The chunks of a value got and touched
+// are touched along.
+err_code_t Client::joinChunkedValues(op_code_t op, const char* const* keys,
+                                     const size_t* keyLens, size_t nKeys,
+                                     const exptime_t exptime, err_code_t rv,
+                                     retrieval_result_t*** results, size_t* nResults) {
+  size_t nJoined = m_outRetrievalResultPtrs.size();
+  std::vector<size_t> nChunks(nJoined, 0);
+  m_chunkKeyBuffer.clear();
+  m_chunkKeyOffsets.clear();
+  m_chunkKeyLens.clear();
+  for (size_t i = 0; i < nJoined; ++i) {
+    retrieval_result_t* r = m_outRetrievalResultPtrs[i];
+    nChunks[i] = chunkCount(r, m_keyPrefix.size());
+    addChunkKeys(r->key, r->key_len, nChunks[i]);
+  }
+  if (m_chunkKeyOffsets.empty()) {
+    return rv;
+  }
+  fixChunkKeys();
+
+  // results of the first round die on reset, keep them
+  key_status_t* statuses = NULL;
+  size_t n = 0;
+  ConnectionPool::getKeyStatuses(&statuses, &n);
+  m_joinedStatuses.assign(statuses, statuses + n);
+  m_joinedResults.resize(nJoined);
+  m_joinedBuffer.clear();
+  std::vector<size_t> keyOffsets(nJoined), dataOffsets(nJoined, std::string::npos);
+  for (size_t i = 0; i < nJoined; ++i) {
+    retrieval_result_t* r = m_outRetrievalResultPtrs[i];
+    m_joinedResults[i] = *r;
+    keyOffsets[i] = m_joinedBuffer.size();
+    m_joinedBuffer.append(r->key, r->key_len);
+    if (nChunks[i] == 0) {
+      dataOffsets[i] = m_joinedBuffer.size();
+      m_joinedBuffer.append(r->data_block, r->bytes);
+    }
+  }
+  m_outRetrievalResultPtrs.clear();
+  ConnectionPool::reset();
+
+  bool touching = op == GAT_OP || op == GATS_OP;
+  std::string prefix;
+  suspendKeyPrefix(prefix);
+  dispatchRetrieval(touching ? GAT_OP : GET_OP, &m_chunkKeys[0], &m_chunkKeyLens[0],
+                    m_chunkKeys.size(), exptime);
+  err_code_t rv2 = waitPoll();
+  resumeKeyPrefix(prefix);
+  key_status_t* chunkStatuses = NULL;
+  ConnectionPool::getKeyStatuses(&chunkStatuses, &n);
+  // chunks of a compressed value are not compressed ones
+  std::vector<retrieval_result_t*> chunkResults;
+  ConnectionPool::collectRetrievalResult(chunkResults, false);
+  std::map<std::string, retrieval_result_t*> chunks;
+  for (std::vector<retrieval_result_t*>::iterator it = chunkResults.begin();
+       it != chunkResults.end(); ++it) {
+    chunks[std::string((*it)->key, (*it)->key_len)] = *it;
+  }
+
+  for (size_t i = 0, chunk = 0; i < nJoined; chunk += nChunks[i], ++i) {
+    if (nChunks[i] == 0) {
+      continue;
+    }
+    retrieval_result_t& joined = m_joinedResults[i];
+    size_t offset = m_joinedBuffer.size();
+    bool complete = true;
+    key_status_t status = KEY_HIT;
+    for (size_t j = chunk; complete && j < chunk + nChunks[i]; ++j) {
+      std::map<std::string, retrieval_result_t*>::iterator it = chunks.find(
+          std::string(m_chunkKeys[j], m_chunkKeyLens[j]));
+      complete = it != chunks.end();
+      if (complete) {
+        m_joinedBuffer.append(it->second->data_block, it->second->bytes);
+      } else {
+        status = j < n && chunkStatuses[j] != KEY_HIT ? chunkStatuses[j] : KEY_MISS;
+      }
+    }
+    if (!complete) {
+      m_joinedBuffer.resize(offset);
+      for (size_t k = 0; k < nKeys && k < m_joinedStatuses.size(); ++k) {
+        if (keyLens[k] == joined.key_len && m_joinedStatuses[k] == KEY_HIT &&
+            memcmp(keys[k], m_joinedBuffer.data() + keyOffsets[i], joined.key_len) == 0) {
+          m_joinedStatuses[k] = status;
+        }
+      }
+      continue;
+    }
+    size_t bytes = m_joinedBuffer.size() - offset;
+    flags_t flags = joined.flags & ~MC_FLAG_CHUNKED;
+    if (flags & MC_FLAG_COMPRESS_MASK) {
+      flags_t decodedFlags = 0;
+      size_t decodedBytes = 0;
+      char* decoded = m_codec.decompress(m_joinedBuffer.data() + offset, bytes, flags,
+                                         decodedBytes, decodedFlags);
+      if (decoded != NULL) {
+        m_joinedBuffer.resize(offset);
+        m_joinedBuffer.append(decoded, decodedBytes);
+        delete[] decoded;
+        bytes = decodedBytes;
+        flags = decodedFlags;
+      }
+    }
+    dataOffsets[i] = offset;
+    joined.bytes = static_cast<uint32_t>(bytes);
+    joined.flags = flags;
+  }
+
+  // m_joinedBuffer is not moving anymore
+  for (size_t i = 0; i < nJoined; ++i) {
+    if (dataOffsets[i] == std::string::npos) {
+      continue;
+    }
+    m_joinedResults[i].key = &m_joinedBuffer[keyOffsets[i]];
+    m_joinedResults[i].data_block = &m_joinedBuffer[dataOffsets[i]];
+    m_outRetrievalResultPtrs.push_back(&m_joinedResults[i]);
+  }
+  *nResults = m_outRetrievalResultPtrs.size();
+  *results = *nResults == 0 ? NULL : &m_outRetrievalResultPtrs.front();
+  return rv == RET_OK ? rv2 : rv;
+}
+
+
+void Client::getKeyStatuses(key_status_t** statuses, size_t* nKeys) {
+  if (m_joinedStatuses.empty()) {
+    ConnectionPool::getKeyStatuses(statuses, nKeys);
+    return;
+  }
+  *statuses = &m_joinedStatuses.front();
+  *nKeys = m_joinedStatuses.size();
+}
+
 err_code_t Client::_delete(const char* const* keys, const size_t* key_lens,
                      const bool noreply, size_t nItems,
                      message_result_t*** results, size_t* nResults) {
@@ -124,8 +655,8 @@ err_code_t Client::_delete(const char* const* keys, const size_t* key_lens,
 
 void Client::collectBroadcastResult(broadcast_result_t** results, size_t* nHosts) {
   assert(m_outBroadcastResultPtrs.size() == 0);
-  *nHosts = m_nConns;
   ConnectionPool::collectBroadcastResult(m_outBroadcastResultPtrs);
+  *nHosts = m_outBroadcastResultPtrs.size();
   *results = &m_outBroadcastResultPtrs.front();
 }
 
@@ -149,7 +680,7 @@ err_code_t Client::version(broadcast_result_t** results, size_t* nHosts) {
 
 
 err_code_t Client::quit() {
-  broadcastCommand(keywords::kQUIT, 4);
+  broadcastCommand(keywords::kQUIT, 4, true);
   err_code_t rv = waitPoll();
   return rv;
 }
@@ -166,7 +697,17 @@ err_code_t Client::stats(broadcast_result_t** results, size_t* nHosts) {
 err_code_t Client::touch(const char* const* keys, const size_t* keyLens,
                    const exptime_t exptime, const bool noreply, size_t nItems,
                    message_result_t*** results, size_t* nResults) {
-  dispatchTouch(keys, keyLens, exptime, noreply, nItems);
+  dispatchTouch(keys, keyLens, exptime, NULL, noreply, nItems);
+  err_code_t rv = waitPoll();
+  collectMessageResult(results, nResults);
+  return rv;
+}
+
+
+err_code_t Client::touchMulti(const char* const* keys, const size_t* keyLens,
+                              const exptime_t* exptimes, const bool noreply, size_t nItems,
+                              message_result_t*** results, size_t* nResults) {
+  dispatchTouch(keys, keyLens, 0, exptimes, noreply, nItems);
   err_code_t rv = waitPoll();
   collectMessageResult(results, nResults);
   return rv;
@@ -206,12 +747,56 @@ err_code_t Client::decr(const char* key, const size_t keyLen, const uint64_t del
 }
 
 
+void Client::collectMultiUnsignedResult(unsigned_result_t*** results, size_t* nResults) {
+  assert(m_outUnsignedResultPtrs.size() == 0);
+  ConnectionPool::collectMultiUnsignedResult(m_outUnsignedResultPtrs);
+  *nResults = m_outUnsignedResultPtrs.size();
+
+  if (*nResults == 0) {
+    *results = NULL;
+  } else {
+    *results = &m_outUnsignedResultPtrs.front();
+  }
+}
+
+
+err_code_t Client::incrMulti(const char* const* keys, const size_t* keyLens,
+                             const uint64_t* deltas, const bool noreply, size_t nItems,
+                             unsigned_result_t*** results, size_t* nResults) {
+  dispatchIncrDecr(INCR_OP, keys, keyLens, deltas, noreply, nItems);
+  err_code_t rv = waitPoll();
+  collectMultiUnsignedResult(results, nResults);
+  return rv;
+}
+
+
+err_code_t Client::decrMulti(const char* const* keys, const size_t* keyLens,
+                             const uint64_t* deltas, const bool noreply, size_t nItems,
+                             unsigned_result_t*** results, size_t* nResults) {
+  dispatchIncrDecr(DECR_OP, keys, keyLens, deltas, noreply, nItems);
+  err_code_t rv = waitPoll();
+  collectMultiUnsignedResult(results, nResults);
+  return rv;
+}
+
+
 void Client::destroyUnsignedResult() {
   ConnectionPool::reset();
   m_outUnsignedResultPtrs.clear();
 }
 
 
+void Client::getMetrics(server_metrics_t** metrics, size_t* nServers) {
+  ConnectionPool::collectMetrics(m_outMetrics);
+  *nServers = m_outMetrics.size();
+  if (*nServers == 0) {
+    *metrics = NULL;
+  } else {
+    *metrics = &m_outMetrics.front();
+  }
+}
+
+
 void Client::_sleep(uint32_t seconds) {
   usleep(seconds * 1000000);
 }
@@ -0,0 +1,293 @@
+#ifdef MC_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MC_USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef MC_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Codec.h"
+
+// favor speed, values are compressed on the request path
+#define MC_ZLIB_COMPRESS_LEVEL Z_DEFAULT_COMPRESSION
+#define MC_ZSTD_COMPRESS_LEVEL 1
+#define MC_LZ4_HEADER_SIZE 4
+
+namespace douban {
+namespace mc {
+
+
+Codec::Codec()
+  : m_codec(OPT_COMPRESS_NONE), m_threshold(MC_DEFAULT_COMPRESS_THRESHOLD),
+    m_cctx(NULL), m_dctx(NULL), m_cdict(NULL), m_ddict(NULL) {
+}
+
+
+Codec::~Codec() {
+  setDictionary(NULL, 0);
+#ifdef MC_USE_ZSTD
+  ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(m_cctx));
+  ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(m_dctx));
+#endif
+}
+
+
+bool Codec::isAvailable(compress_codec_options_t codec) {
+  switch (codec) {
+    case OPT_COMPRESS_NONE:
+      return true;
+#ifdef MC_USE_ZLIB
+    case OPT_COMPRESS_ZLIB:
+      return true;
+#endif
+#ifdef MC_USE_LZ4
+    case OPT_COMPRESS_LZ4:
+      return true;
+#endif
+#ifdef MC_USE_ZSTD
+    case OPT_COMPRESS_ZSTD:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+
+bool Codec::setCodec(compress_codec_options_t codec) {
+  if (!isAvailable(codec)) {
+    log_warn("compression codec %d is not compiled in", codec);
+    return false;
+  }
+  m_codec = codec;
+  return true;
+}
+
+
+void Codec::setThreshold(size_t threshold) {
+  m_threshold = threshold;
+}
+
+
+err_code_t Codec::setDictionary(const char* dict, size_t len) {
+#ifdef MC_USE_ZSTD
+  ZSTD_freeCDict(static_cast<ZSTD_CDict*>(m_cdict));
+  ZSTD_freeDDict(static_cast<ZSTD_DDict*>(m_ddict));
+  m_cdict = m_ddict = NULL;
+  m_dict.clear();
+  if (dict == NULL || len == 0) {
+    return RET_OK;
+  }
+  m_dict.assign(dict, len);
+  m_cdict = ZSTD_createCDict(m_dict.data(), m_dict.size(), MC_ZSTD_COMPRESS_LEVEL);
+  m_ddict = ZSTD_createDDict(m_dict.data(), m_dict.size());
+  if (m_cdict == NULL || m_ddict == NULL) {
+    log_warn("invalid zstd dictionary of %zu bytes", len);
+    setDictionary(NULL, 0);
+    return RET_PROGRAMMING_ERR;
+  }
+  return RET_OK;
+#else
+  if (dict == NULL || len == 0) {
+    return RET_OK;
+  }
+  log_warn("compression dictionaries need zstd, which is not compiled in");
+  return RET_PROGRAMMING_ERR;
+#endif
+}
+
+
+bool Codec::enabled() const {
+  return m_codec != OPT_COMPRESS_NONE;
+}
+
+
+bool Codec::compress(const char* val, size_t len, flags_t flags, std::string& out,
+                     flags_t& outFlags) {
+  if (m_codec == OPT_COMPRESS_NONE || len < m_threshold || len == 0 ||
+      (flags & MC_FLAG_COMPRESS_MASK)) {
+    return false;
+  }
+  size_t offset = out.size();
+  size_t compressedLen = 0;
+  flags_t flag = 0;
+  switch (m_codec) {
+#ifdef MC_USE_ZLIB
+    case OPT_COMPRESS_ZLIB: {
+      uLongf destLen = compressBound(len);
+      out.resize(offset + destLen);
+      if (compress2(reinterpret_cast<Bytef*>(&out[offset]), &destLen,
+                    reinterpret_cast<const Bytef*>(val), len,
+                    MC_ZLIB_COMPRESS_LEVEL) == Z_OK) {
+        compressedLen = destLen;
+      }
+      flag = MC_FLAG_COMPRESS_ZLIB;
+      break;
+    }
+#endif
+#ifdef MC_USE_LZ4
+    case OPT_COMPRESS_LZ4: {
+      if (len > LZ4_MAX_INPUT_SIZE) {
+        break;
+      }
+      int bound = LZ4_compressBound(static_cast<int>(len));
+      out.resize(offset + MC_LZ4_HEADER_SIZE + bound);
+      char* dst = &out[offset];
+      for (int i = 0; i < MC_LZ4_HEADER_SIZE; ++i) {
+        dst[i] = static_cast<char>((len >> (i * 8)) & 0xff);
+      }
+      int n = LZ4_compress_default(val, dst + MC_LZ4_HEADER_SIZE, static_cast<int>(len), bound);
+      if (n > 0) {
+        compressedLen = MC_LZ4_HEADER_SIZE + n;
+      }
+      flag = MC_FLAG_COMPRESS_LZ4;
+      break;
+    }
+#endif
+#ifdef MC_USE_ZSTD
+    case OPT_COMPRESS_ZSTD: {
+      if (m_cctx == NULL) {
+        m_cctx = ZSTD_createCCtx();
+      }
+      size_t bound = ZSTD_compressBound(len);
+      out.resize(offset + bound);
+      ZSTD_CCtx* cctx = static_cast<ZSTD_CCtx*>(m_cctx);
+      size_t n;
+      if (m_cdict != NULL) {
+        n = ZSTD_compress_usingCDict(cctx, &out[offset], bound, val, len,
+                                     static_cast<ZSTD_CDict*>(m_cdict));
+      } else {
+        n = ZSTD_compressCCtx(cctx, &out[offset], bound, val, len, MC_ZSTD_COMPRESS_LEVEL);
+      }
+      if (!ZSTD_isError(n)) {
+        compressedLen = n;
+      }
+      flag = MC_FLAG_COMPRESS_ZSTD;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  if (compressedLen == 0 || compressedLen >= len) {
+    out.resize(offset);
+    return false;
+  }
+  out.resize(offset + compressedLen);
+  outFlags = flags | flag;
+  return true;
+}
+
+
+#ifdef MC_USE_ZLIB
+// a zlib stream doesn't record the uncompressed size, inflate into a growing buffer
+static char* inflateValue(const char* val, size_t len, size_t& outLen) {
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  if (inflateInit(&zs) != Z_OK) {
+    return NULL;
+  }
+  size_t capacity = len * 4;
+  char* buf = new char[capacity];
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(val));
+  zs.avail_in = static_cast<uInt>(len);
+  int rc = Z_OK;
+  while (rc == Z_OK) {
+    if (zs.total_out == capacity) {
+      if (capacity >= MC_MAX_DECOMPRESSED_SIZE) {
+        break;
+      }
+      char* bigger = new char[capacity * 2];
+      memcpy(bigger, buf, capacity);
+      delete[] buf;
+      buf = bigger;
+      capacity *= 2;
+    }
+    zs.next_out = reinterpret_cast<Bytef*>(buf + zs.total_out);
+    zs.avail_out = static_cast<uInt>(capacity - zs.total_out);
+    rc = inflate(&zs, Z_NO_FLUSH);
+  }
+  outLen = zs.total_out;
+  inflateEnd(&zs);
+  if (rc != Z_STREAM_END) {
+    delete[] buf;
+    return NULL;
+  }
+  return buf;
+}
+#endif
+
+
+char* Codec::decompress(const char* val, size_t len, flags_t flags, size_t& outLen,
+                        flags_t& outFlags) {
+  char* buf = NULL;
+  flags_t flag = 0;
+  if (len == 0) {
+    return NULL;
+  }
+#ifdef MC_USE_ZLIB
+  if (flags & MC_FLAG_COMPRESS_ZLIB) {
+    flag = MC_FLAG_COMPRESS_ZLIB;
+    buf = inflateValue(val, len, outLen);
+  }
+#endif
+#ifdef MC_USE_LZ4
+  if (flag == 0 && (flags & MC_FLAG_COMPRESS_LZ4)) {
+    flag = MC_FLAG_COMPRESS_LZ4;
+    outLen = 0;
+    for (int i = 0; len > MC_LZ4_HEADER_SIZE && i < MC_LZ4_HEADER_SIZE; ++i) {
+      outLen |= static_cast<size_t>(static_cast<unsigned char>(val[i])) << (i * 8);
+    }
+    if (outLen > 0 && outLen <= MC_MAX_DECOMPRESSED_SIZE) {
+      buf = new char[outLen];
+      int n = LZ4_decompress_safe(val + MC_LZ4_HEADER_SIZE, buf,
+                                  static_cast<int>(len - MC_LZ4_HEADER_SIZE),
+                                  static_cast<int>(outLen));
+      if (n < 0 || static_cast<size_t>(n) != outLen) {
+        delete[] buf;
+        buf = NULL;
+      }
+    }
+  }
+#endif
+#ifdef MC_USE_ZSTD
+  if (flag == 0 && (flags & MC_FLAG_COMPRESS_ZSTD)) {
+    flag = MC_FLAG_COMPRESS_ZSTD;
+    unsigned long long size = ZSTD_getFrameContentSize(val, len);
+    if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR &&
+        size > 0 && size <= MC_MAX_DECOMPRESSED_SIZE) {
+      if (m_dctx == NULL) {
+        m_dctx = ZSTD_createDCtx();
+      }
+      outLen = static_cast<size_t>(size);
+      buf = new char[outLen];
+      ZSTD_DCtx* dctx = static_cast<ZSTD_DCtx*>(m_dctx);
+      size_t n;
+      if (m_ddict != NULL) {
+        n = ZSTD_decompress_usingDDict(dctx, buf, outLen, val, len,
+                                       static_cast<ZSTD_DDict*>(m_ddict));
+      } else {
+        n = ZSTD_decompressDCtx(dctx, buf, outLen, val, len);
+      }
+      if (ZSTD_isError(n) || n != outLen) {
+        delete[] buf;
+        buf = NULL;
+      }
+    }
+  }
+#endif
+  if (flag == 0) {
+    return NULL;
+  }
+  if (buf == NULL) {
+    log_warn("failed to decompress a value of %zu bytes with flags %u", len, flags);
+    return NULL;
+  }
+  outFlags = flags & ~flag;
+  return buf;
+}
+
+} // namespace mc
+} // namespace douban
@@ -11,6 +11,7 @@
 #include <queue>
 
 #include "Connection.h"
+#include "Utility.h"
 
 using douban::mc::io::BufferWriter;
 using douban::mc::io::BufferReader;
@@ -20,9 +21,18 @@ namespace mc {
 
 Connection::Connection()
     : m_counter(0), m_port(0), m_socketFd(-1),
-      m_alive(false), m_hasAlias(false), m_deadUntil(0),
+      m_alive(false), m_hasAlias(false), m_managed(false),
+      m_health(HEALTH_CLOSED), m_deadUntil(0),
+      m_nConsecutiveFailures(0), m_nWindowRequests(0), m_nWindowErrors(0),
+      m_outcome(RET_OK),
       m_connectTimeout(MC_DEFAULT_CONNECT_TIMEOUT),
-      m_retryTimeout(MC_DEFAULT_RETRY_TIMEOUT) {
+      m_retryTimeout(MC_DEFAULT_RETRY_TIMEOUT),
+      m_maxRetryTimeout(MC_DEFAULT_MAX_RETRY_TIMEOUT),
+      m_keepaliveIdle(MC_DEFAULT_KEEPALIVE_IDLE), m_sendWindow(MC_DEFAULT_SEND_WINDOW),
+      m_traceHook(NULL), m_traceCtx(NULL) {
+  pthread_mutex_init(&m_healthLock, NULL);
+  m_jitterSeed = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(this));
+  resetMetrics();
   m_name[0] = '\0';
   m_host[0] = '\0';
   m_buffer_writer = new BufferWriter();
@@ -38,6 +48,7 @@ Connection::~Connection() {
   this->close();
   delete m_buffer_writer;
   delete m_buffer_reader;
+  pthread_mutex_destroy(&m_healthLock);
 }
 
 int Connection::init(const char* host, uint32_t port, const char* alias) {
@@ -108,10 +119,33 @@ int Connection::connect() {
       goto try_next_ai;
     }
 
+    // let the kernel probe idle connections, so that a silently dropped
+    // peer fails the next request at once instead of timing out
+    if (m_keepaliveIdle > 0) {
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+      int opt_keepidle = m_keepaliveIdle, opt_keepcnt = MC_KEEPALIVE_PROBES;
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &opt_keepidle, sizeof opt_keepidle);
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &opt_keepidle, sizeof opt_keepidle);
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &opt_keepcnt, sizeof opt_keepcnt);
+#elif defined(TCP_KEEPALIVE)
+      int opt_keepidle = m_keepaliveIdle;
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &opt_keepidle, sizeof opt_keepidle);
+#endif
+    }
+
+#ifdef TCP_NOTSENT_LOWAT
+    // writable only once the unsent bytes in the kernel are under a window,
+    // instead of queueing a whole batch into the socket buffer
+    if (m_sendWindow > 0) {
+      int opt_lowat = m_sendWindow;
+      setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &opt_lowat, sizeof opt_lowat);
+    }
+#endif
+
     // make sure the connection is established
     if (connectPoll(fd, ai_ptr) == 0) {
       m_socketFd = fd;
-      m_alive = true;
+      __atomic_store_n(&m_alive, true, __ATOMIC_RELEASE);
       break;
     }
 
@@ -162,39 +196,87 @@ int Connection::connectPoll(int fd, struct addrinfo* ai_ptr) {
 
 void Connection::close() {
   if (m_socketFd > 0) {
-    m_alive = false;
+    __atomic_store_n(&m_alive, false, __ATOMIC_RELEASE);
     ::close(m_socketFd);
     m_socketFd = -1;
   }
 }
 
 bool Connection::tryReconnect() {
+  if (m_managed) {
+    // the background maintainer reconnects, never block the caller
+    return alive();
+  }
+  return reconnect();
+}
+
+
+bool Connection::reconnect() {
+  pthread_mutex_lock(&m_healthLock);
   if (!m_alive) {
-    time_t now;
-    time(&now);
+    int64_t now = utility::getCurrentMonotonicMs();
     if (now >= m_deadUntil) {
+      trace_span_t span;
+      if (m_traceHook != NULL) {
+        span.start_us = utility::getCurrentMonotonicUs();
+      }
       int rv = this->connect();
+      if (m_traceHook != NULL) {
+        span.phase = TRACE_CONNECT;
+        span.server = m_name;
+        span.end_us = utility::getCurrentMonotonicUs();
+        span.n_keys = 0;
+        span.err = rv == 0 ? RET_OK : RET_CONN_POLL_ERR;
+        m_traceHook(m_traceCtx, &span);
+      }
       if (rv == 0) {
-        if (m_deadUntil > 0) {
-          log_info("Connection %s is back to live at %lu", m_name, now);
+        ++m_metrics.connects;
+        if (m_health == HEALTH_OPEN) {
+          // let the next request probe whether the server is really back
+          log_info("Connection %s is reconnected, probing", m_name);
+          m_health = HEALTH_HALF_OPEN;
         }
         m_deadUntil = 0;
       } else {
-        m_deadUntil = now + m_retryTimeout;
+        ++m_metrics.connect_failures;
+        m_health = HEALTH_OPEN;
+        ++m_nConsecutiveFailures;
+        m_deadUntil = now + nextBackoff();
         // log_info("%s is still dead", m_name);
       }
     }
   }
-  return m_alive;
+  bool is_alive = m_alive;
+  pthread_mutex_unlock(&m_healthLock);
+  return is_alive;
 }
 
+
+void Connection::setManaged(bool managed) {
+  m_managed = managed;
+}
+
+
 void Connection::markDead(const char* reason, int delay) {
+  pthread_mutex_lock(&m_healthLock);
   if (m_alive) {
-    time(&m_deadUntil);
-    m_deadUntil += delay; // check after `delay` seconds, default 0
+    recordOutcome(true);
+    int64_t backoff = delay * 1000LL;
+    bool tripped = m_nWindowRequests >= MC_HEALTH_MIN_REQUESTS &&
+        m_nWindowErrors * 100 >= m_nWindowRequests * MC_HEALTH_MAX_ERROR_PERCENT;
+
+    // A single error only resets the connection, it's reconnected at once.
+    // A failed probe or a high error rate backs off exponentially instead.
+    if (m_health == HEALTH_HALF_OPEN || tripped) {
+      ++m_nConsecutiveFailures;
+      backoff = MAX(backoff, nextBackoff());
+      m_nWindowRequests = m_nWindowErrors = 0;
+    }
+    m_health = HEALTH_OPEN;
+    m_deadUntil = utility::getCurrentMonotonicMs() + backoff;
     this->close();
-    log_warn("Connection %s is dead(reason: %s, delay: %d), next check at %lu",
-             m_name, reason, delay, m_deadUntil);
+    log_warn("Connection %s is dead(reason: %s, delay: %d), next check in %ld ms",
+             m_name, reason, delay, static_cast<long>(backoff));
     std::queue<struct iovec>* q = m_parser.getRequestKeys();
     if (!q->empty()) {
       log_warn("%s: first request key: %.*s", m_name,
@@ -202,6 +284,71 @@ void Connection::markDead(const char* reason, int delay) {
                static_cast<char*>(q->front().iov_base));
     }
   }
+  pthread_mutex_unlock(&m_healthLock);
+}
+
+
+// Drop the in-flight request on a deadline miss of the caller. The response
+// stream is out of sync so the socket is closed, but it's the caller giving up
+// rather than the server failing: reconnect at once and leave the breaker alone.
+void Connection::abandon(const char* reason) {
+  pthread_mutex_lock(&m_healthLock);
+  if (m_alive) {
+    this->close();
+    m_deadUntil = 0;
+    ++m_metrics.abandons;
+    log_warn("Connection %s is abandoned(reason: %s)", m_name, reason);
+  }
+  pthread_mutex_unlock(&m_healthLock);
+}
+
+
+void Connection::markAlive() {
+  // On every response: a healthy connection without recent errors only
+  // counts it in the window. Only the caller's thread changes these while
+  // the connection is alive, so the lock is only taken for a transition.
+  if (alive() && __atomic_load_n(&m_health, __ATOMIC_RELAXED) == HEALTH_CLOSED &&
+      m_nConsecutiveFailures == 0 && m_nWindowErrors == 0) {
+    recordOutcome(false);
+    return;
+  }
+  pthread_mutex_lock(&m_healthLock);
+  recordOutcome(false);
+  if (m_health == HEALTH_HALF_OPEN) {
+    log_info("Connection %s is back to live", m_name);
+    m_health = HEALTH_CLOSED;
+  }
+  m_nConsecutiveFailures = 0;
+  pthread_mutex_unlock(&m_healthLock);
+}
+
+
+int64_t Connection::nextBackoff() {
+  // m_retryTimeout * 2 ^ (m_nConsecutiveFailures - 1), capped by m_maxRetryTimeout,
+  // with jitter so that clients don't reconnect to a recovering server in lockstep.
+  int64_t backoff = m_retryTimeout * 1000LL;
+  int64_t cap = MAX(m_maxRetryTimeout * 1000LL, backoff);
+  for (uint32_t i = 1; i < m_nConsecutiveFailures && backoff < cap; ++i) {
+    backoff *= 2;
+  }
+  backoff = MIN(backoff, cap);
+  if (backoff > 1) {
+    backoff -= rand_r(&m_jitterSeed) % (backoff / 2 + 1);
+  }
+  return backoff;
+}
+
+
+void Connection::recordOutcome(bool failed) {
+  if (m_nWindowRequests >= MC_HEALTH_WINDOW_SIZE) {
+    // decay so that the window reflects recent requests
+    m_nWindowRequests /= 2;
+    m_nWindowErrors /= 2;
+  }
+  ++m_nWindowRequests;
+  if (failed) {
+    ++m_nWindowErrors;
+  }
 }
 
 int Connection::socketFd() const {
@@ -224,10 +371,34 @@ void Connection::setParserMode(ParserMode md) {
   m_parser.setMode(md);
 }
 
+void Connection::setValueSink(value_sink_t sink, void* ctx) {
+  m_parser.setValueSink(sink, ctx);
+}
+
+void Connection::setValueBuffer(value_buffer_t buffer, void* ctx) {
+  m_parser.setValueBuffer(buffer, ctx);
+}
+
+void Connection::setKeyPrefixLen(size_t len) {
+  m_parser.setKeyPrefixLen(len);
+}
+
+void Connection::setDecodingKeys(bool enabled) {
+  m_parser.setDecodingKeys(enabled);
+}
+
+void Connection::setEndCount(size_t n) {
+  m_parser.setEndCount(n);
+}
+
 void Connection::takeNumber(int64_t val) {
   m_buffer_writer->takeNumber(val);
 }
 
+void Connection::takeCopy(const char* const buf, size_t buf_len) {
+  m_buffer_writer->takeCopy(buf, buf_len);
+}
+
 ssize_t Connection::send() {
   struct msghdr msg = {};
 
@@ -240,12 +411,35 @@ ssize_t Connection::send() {
     flags = MC_MSG_MORE;
   }
 
+  // no more than m_sendWindow bytes a time, the last iovec cut short for
+  // the call and restored for commitRead
+  struct iovec* cut = NULL;
+  size_t cutLen = 0;
+  if (m_sendWindow > 0) {
+    size_t total = 0;
+    for (size_t i = 0; i < static_cast<size_t>(msg.msg_iovlen); ++i) {
+      total += msg.msg_iov[i].iov_len;
+      if (total > static_cast<size_t>(m_sendWindow)) {
+        cut = &msg.msg_iov[i];
+        cutLen = cut->iov_len;
+        cut->iov_len -= total - m_sendWindow;
+        msg.msg_iovlen = i + 1;
+        flags = MC_MSG_MORE;
+        break;
+      }
+    }
+  }
+
   ssize_t nSent = ::sendmsg(m_socketFd, &msg, flags);
+  if (cut != NULL) {
+    cut->iov_len = cutLen;
+  }
 
   if (nSent == -1) {
     m_buffer_writer->reset();
     return -1;
   } else {
+    m_metrics.bytes_sent += nSent;
     m_buffer_writer->commitRead(nSent);
   }
 
@@ -265,6 +459,7 @@ ssize_t Connection::recv() {
   ssize_t bufferSizeActual = ::recv(m_socketFd, writePtr, bufferSizeAvailable, 0);
   // log_info("%p recv(%lu) %.*s", this, bufferSizeActual, (int)bufferSizeActual, writePtr);
   if (bufferSizeActual > 0) {
+    m_metrics.bytes_received += bufferSizeActual;
     m_buffer_reader->commitWrite(bufferSizeActual);
   }
   return bufferSizeActual;
@@ -274,6 +469,56 @@ void Connection::process(err_code_t& err) {
   return m_parser.process_packets(err);
 }
 
+void Connection::setOutcome(err_code_t err) {
+  m_outcome = err;
+}
+
+err_code_t Connection::outcome() {
+  return m_outcome;
+}
+
+void Connection::countError(err_code_t err) {
+  switch (err) {
+    case RET_SEND_ERR:
+      ++m_metrics.send_errors;
+      break;
+    case RET_RECV_ERR:
+      ++m_metrics.recv_errors;
+      break;
+    case RET_CONN_POLL_ERR:
+      ++m_metrics.conn_poll_errors;
+      break;
+    case RET_POLL_TIMEOUT_ERR:
+      ++m_metrics.poll_timeouts;
+      break;
+    case RET_POLL_ERR:
+      ++m_metrics.poll_errors;
+      break;
+    case RET_MC_SERVER_ERR:
+      ++m_metrics.server_errors;
+      break;
+    case RET_PROGRAMMING_ERR:
+      ++m_metrics.parse_errors;
+      break;
+    default:
+      break;
+  }
+}
+
+// connects are counted by the background maintainer as well
+void Connection::snapshotMetrics(server_metrics_t* out) {
+  pthread_mutex_lock(&m_healthLock);
+  *out = m_metrics;
+  pthread_mutex_unlock(&m_healthLock);
+}
+
+void Connection::resetMetrics() {
+  pthread_mutex_lock(&m_healthLock);
+  memset(&m_metrics, 0, sizeof m_metrics);
+  m_metrics.host = m_name;
+  pthread_mutex_unlock(&m_healthLock);
+}
+
 types::RetrievalResultList* Connection::getRetrievalResults() {
   return m_parser.getRetrievalResults();
 }
@@ -296,6 +541,7 @@ std::queue<struct iovec>* Connection::getRequestKeys() {
 
 void Connection::reset() {
   m_counter = 0;
+  m_outcome = RET_OK;
   m_parser.reset();
   m_buffer_reader->reset();
   m_buffer_writer->reset(); // flush data dispatched but not sent
@@ -305,9 +551,35 @@ void Connection::setRetryTimeout(int timeout) {
   m_retryTimeout = timeout;
 }
 
+void Connection::setMaxRetryTimeout(int timeout) {
+  m_maxRetryTimeout = timeout;
+}
+
 void Connection::setConnectTimeout(int timeout) {
   m_connectTimeout = timeout;
 }
 
+void Connection::setKeepaliveIdle(int idle) {
+  m_keepaliveIdle = idle;
+}
+
+void Connection::setSendWindow(int window) {
+  m_sendWindow = window > 0 ? window : 0;
+#ifdef TCP_NOTSENT_LOWAT
+  // to the live socket too, 0 is back to the system default
+  pthread_mutex_lock(&m_healthLock);
+  if (m_socketFd != -1) {
+    int opt_lowat = m_sendWindow;
+    setsockopt(m_socketFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &opt_lowat, sizeof opt_lowat);
+  }
+  pthread_mutex_unlock(&m_healthLock);
+#endif
+}
+
+void Connection::setTraceHook(trace_hook_t hook, void* ctx) {
+  m_traceHook = hook;
+  m_traceCtx = ctx;
+}
+
 } // namespace mc
 } // namespace douban
@@ -2,6 +2,7 @@
 #include <poll.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <list>
 #include <vector>
 #include <algorithm>
@@ -25,13 +26,28 @@ namespace douban {
 namespace mc {
 
 ConnectionPool::ConnectionPool()
-  : m_nActiveConn(0), m_nInvalidKey(0), m_conns(NULL), m_nConns(0),
-    m_pollTimeout(MC_DEFAULT_POLL_TIMEOUT) {
+  : m_nActiveConn(0), m_nInvalidKey(0), m_keys(NULL), m_keyLens(NULL),
+    m_keysRetrieval(false), m_keysNoreply(false), m_dispatchStart(0),
+    m_conns(NULL), m_nConns(0), m_connsPerServer(MC_DEFAULT_CONNS_PER_SERVER),
+    m_pollTimeout(MC_DEFAULT_POLL_TIMEOUT), m_connectTimeout(MC_DEFAULT_CONNECT_TIMEOUT),
+    m_retryTimeout(MC_DEFAULT_RETRY_TIMEOUT), m_maxRetryTimeout(MC_DEFAULT_MAX_RETRY_TIMEOUT),
+    m_keepaliveIdle(MC_DEFAULT_KEEPALIVE_IDLE),
+    m_sendWindow(MC_DEFAULT_SEND_WINDOW),
+    m_maxGetKeys(MC_DEFAULT_MAX_GET_KEYS), m_maxGetBytes(MC_DEFAULT_MAX_GET_BYTES),
+    m_requestTimeout(MC_DEFAULT_REQUEST_TIMEOUT), m_deadline(0),
+    m_traceHook(NULL), m_traceCtx(NULL), m_binarySafeKeys(false),
+    m_maintainInterval(MC_DEFAULT_MAINTAIN_INTERVAL),
+    m_maintainerRunning(false), m_maintainerStopping(false) {
+  pthread_mutex_init(&m_maintainerLock, NULL);
+  pthread_cond_init(&m_maintainerCond, NULL);
 }
 
 
 ConnectionPool::~ConnectionPool() {
+  stopMaintainer();
   delete[] m_conns;
+  pthread_cond_destroy(&m_maintainerCond);
+  pthread_mutex_destroy(&m_maintainerLock);
 }
 
 
@@ -58,20 +74,87 @@ void ConnectionPool::setHashFunction(hash_function_options_t fn_opt) {
 
 int ConnectionPool::init(const char* const * hosts, const uint32_t* ports, const size_t n,
                          const char* const * aliases) {
+  stopMaintainer();
   delete[] m_conns;
   m_connSelector.reset();
   int rv = 0;
-  m_nConns = n;
+  m_nConns = n * m_connsPerServer;
   m_conns = new Connection[m_nConns];
   for (size_t i = 0; i < m_nConns; i++) {
-    rv += m_conns[i].init(hosts[i], ports[i], aliases == NULL ? NULL : aliases[i]);
+    size_t server = i / m_connsPerServer;
+    int connRv = m_conns[i].init(hosts[server], ports[server],
+                                 aliases == NULL ? NULL : aliases[server]);
+    if (i % m_connsPerServer == 0) {
+      rv += connRv;
+    }
+    configConn(m_conns + i);
+  }
+  m_connSelector.addServers(m_conns, n, m_connsPerServer);
+  if (m_maintainInterval > 0) {
+    startMaintainer();
   }
-  m_connSelector.addServers(m_conns, m_nConns);
   return rv;
 }
 
 
+// Open n (up to MC_MAX_CONNS_PER_SERVER) connections to each server, the
+// keys of a command to a server are spread over them (SEE spreadKey), and
+// the responses are read as they come on each, so that a large batch to a
+// hot server is served by as many memcached worker threads. The client
+// still polls and parses all of them on the calling thread. The keys are
+// hashed to the servers all the same, and the broadcast commands and the
+// metrics are still one per server. The servers are connected again if n
+// changes.
+void ConnectionPool::setConnsPerServer(int n) {
+  size_t connsPerServer = MIN(MAX(n, 1), MC_MAX_CONNS_PER_SERVER);
+  if (connsPerServer == m_connsPerServer) {
+    return;
+  }
+  size_t nServers = m_nConns / m_connsPerServer;
+  std::vector<std::string> hosts(nServers), aliases(nServers);
+  std::vector<uint32_t> ports(nServers);
+  bool hasAlias = false;
+  for (size_t i = 0; i < nServers; ++i) {
+    Connection* conn = m_conns + i * m_connsPerServer;
+    hosts[i] = conn->host();
+    ports[i] = conn->port();
+    if (conn->hasAlias()) {
+      aliases[i] = conn->name();
+      hasAlias = true;
+    }
+  }
+  m_connsPerServer = connsPerServer;
+  if (nServers == 0) {
+    return;
+  }
+  std::vector<const char*> cHosts(nServers), cAliases(nServers);
+  for (size_t i = 0; i < nServers; ++i) {
+    cHosts[i] = hosts[i].c_str();
+    cAliases[i] = aliases[i].empty() ? NULL : aliases[i].c_str();
+  }
+  init(&cHosts.front(), &ports.front(), nServers, hasAlias ? &cAliases.front() : NULL);
+}
+
+
+// apply the settings of the pool to a connection of it
+void ConnectionPool::configConn(Connection* conn) {
+  conn->setConnectTimeout(m_connectTimeout);
+  conn->setRetryTimeout(m_retryTimeout);
+  conn->setMaxRetryTimeout(m_maxRetryTimeout);
+  conn->setKeepaliveIdle(m_keepaliveIdle);
+  conn->setSendWindow(m_sendWindow);
+  conn->setTraceHook(m_traceHook, m_traceCtx);
+  conn->setKeyPrefixLen(m_keyPrefix.size());
+  conn->setDecodingKeys(m_binarySafeKeys);
+}
+
+
 const char* ConnectionPool::getServerAddressByKey(const char* key, size_t keyLen) {
+  char buf[MC_MAX_KEY_LENGTH];
+  key = wireKey(key, keyLen, buf, false);
+  if (key == NULL) {
+    return NULL;
+  }
   bool check_alive = false;
   Connection* conn = m_connSelector.getConn(key, keyLen, check_alive);
   if (conn == NULL) {
@@ -82,6 +165,11 @@ const char* ConnectionPool::getServerAddressByKey(const char* key, size_t keyLen
 
 
 const char* ConnectionPool::getRealtimeServerAddressByKey(const char* key, size_t keyLen) {
+  char buf[MC_MAX_KEY_LENGTH];
+  key = wireKey(key, keyLen, buf, false);
+  if (key == NULL) {
+    return NULL;
+  }
   bool check_alive = true;
   Connection* conn = m_connSelector.getConn(key, keyLen, check_alive);
   if (conn == NULL) {
@@ -104,18 +192,16 @@ void ConnectionPool::disableConsistentFailover() {
 void ConnectionPool::dispatchStorage(op_code_t op,
                                       const char* const* keys, const size_t* keyLens,
                                       const flags_t* flags, const exptime_t exptime,
+                                      const exptime_t* exptimes,
                                       const cas_unique_t* cas_uniques, const bool noreply,
                                       const char* const* vals, const size_t* val_lens,
                                       size_t nItems) {
 
   size_t i = 0, idx = 0;
+  beginKeys(keys, keyLens, nItems, false, noreply);
 
   for (; i < nItems; ++i) {
-    if (!utility::isValidKey(keys[i], keyLens[i])) {
-      m_nInvalidKey += 1;
-      continue;
-    }
-    Connection* conn = m_connSelector.getConn(keys[i], keyLens[i]);
+    Connection* conn = routeKey(keys[i], keyLens[i]);
     if (conn == NULL) {
       continue;
     }
@@ -143,11 +229,11 @@ void ConnectionPool::dispatchStorage(op_code_t op,
         break;
     }
 
-    conn->takeBuffer(keys[i], keyLens[i]);
+    takeKey(conn, keys[i], keyLens[i]);
     conn->takeBuffer(kSPACE, 1);
     conn->takeNumber(flags[i]);
     conn->takeBuffer(kSPACE, 1);
-    conn->takeNumber(exptime);
+    conn->takeNumber(exptimes == NULL ? exptime : exptimes[i]);
     conn->takeBuffer(kSPACE, 1);
     conn->takeNumber(val_lens[i]);
     if (op == CAS_OP) {
@@ -182,21 +268,43 @@ void ConnectionPool::dispatchStorage(op_code_t op,
 
 
 void ConnectionPool::dispatchRetrieval(op_code_t op, const char* const* keys,
-                                  const size_t* keyLens, size_t n_keys) {
+                                  const size_t* keyLens, size_t n_keys,
+                                  const exptime_t exptime) {
   size_t i = 0, idx = 0;
+  beginKeys(keys, keyLens, n_keys, true, false);
+  bool bounded = m_maxGetKeys > 0 || m_maxGetBytes > 0;
+  if (bounded) {
+    m_getKeys.assign(m_nConns, 0);
+    m_getBytes.assign(m_nConns, 0);
+    m_getCommands.assign(m_nConns, 0);
+  }
   for (; i < n_keys; ++i) {
     const char* key = keys[i];
     const size_t len = keyLens[i];
-    if (!utility::isValidKey(key, len)) {
-      m_nInvalidKey += 1;
-      continue;
-    }
-    Connection* conn = m_connSelector.getConn(key, len);
+    size_t wireLen = 0;
+    Connection* conn = routeKey(key, len, &wireLen);
     if (conn == NULL) {
       continue;
     }
     // debug("hash %s => %d (%p)", key, idx % m_nConns, conn);
-    if (++conn->m_counter == 1) {
+    bool starting = ++conn->m_counter == 1;
+    if (bounded) {
+      idx = conn - m_conns;
+      size_t bytes = 1 + wireLen;
+      if (!starting && ((m_maxGetKeys > 0 && m_getKeys[idx] >= m_maxGetKeys) ||
+                        (m_maxGetBytes > 0 && m_getBytes[idx] + bytes > m_maxGetBytes))) {
+        // the command is full, pipeline one more
+        conn->takeBuffer(kCRLF, 2);
+        m_getKeys[idx] = m_getBytes[idx] = 0;
+        starting = true;
+      }
+      if (starting) {
+        ++m_getCommands[idx];
+      }
+      ++m_getKeys[idx];
+      m_getBytes[idx] += bytes;
+    }
+    if (starting) {
       switch (op) {
         case GET_OP:
           conn->takeBuffer(keywords::kGET, 3);
@@ -204,19 +312,30 @@ void ConnectionPool::dispatchRetrieval(op_code_t op, const char* const* keys,
         case GETS_OP:
           conn->takeBuffer(keywords::kGETS, 4);
           break;
+        case GAT_OP:
+          conn->takeBuffer(keywords::kGAT_, 4);
+          conn->takeNumber(exptime);
+          break;
+        case GATS_OP:
+          conn->takeBuffer(keywords::kGATS_, 5);
+          conn->takeNumber(exptime);
+          break;
         default:
           NOT_REACHED();
           break;
       }
     }
     conn->takeBuffer(kSPACE, 1);
-    conn->takeBuffer(key, len);
+    takeKey(conn, key, len);
   }
   for (idx = 0; idx < m_nConns; idx++) {
     Connection* conn = m_conns + idx;
     if (conn->m_counter > 0) {
       conn->takeBuffer(kCRLF, 2);
       conn->setParserMode(MODE_END_STATE);
+      if (bounded) {
+        conn->setEndCount(m_getCommands[idx]);
+      }
       m_nActiveConn += 1;
       m_activeConns.push_back(conn);
       conn->getRetrievalResults()->reserve(conn->m_counter);
@@ -230,18 +349,15 @@ void ConnectionPool::dispatchDeletion(const char* const* keys, const size_t* key
                                      const bool noreply, size_t nItems) {
 
   size_t i = 0, idx = 0;
+  beginKeys(keys, keyLens, nItems, false, noreply);
   for (; i < nItems; ++i) {
-    if (!utility::isValidKey(keys[i], keyLens[i])) {
-      m_nInvalidKey += 1;
-      continue;
-    }
-    Connection* conn = m_connSelector.getConn(keys[i], keyLens[i]);
+    Connection* conn = routeKey(keys[i], keyLens[i]);
     if (conn == NULL) {
       continue;
     }
 
     conn->takeBuffer(keywords::kDELETE_, 7);
-    conn->takeBuffer(keys[i], keyLens[i]);
+    takeKey(conn, keys[i], keyLens[i]);
     if (noreply) {
       conn->takeBuffer(k_NOREPLY, 8);
     } else {
@@ -269,23 +385,20 @@ void ConnectionPool::dispatchDeletion(const char* const* keys, const size_t* key
 
 void ConnectionPool::dispatchTouch(
     const char* const* keys, const size_t* keyLens,
-    const exptime_t exptime, const bool noreply, size_t nItems) {
+    const exptime_t exptime, const exptime_t* exptimes, const bool noreply, size_t nItems) {
 
   size_t i = 0, idx = 0;
+  beginKeys(keys, keyLens, nItems, false, noreply);
   for (; i < nItems; ++i) {
-    if (!utility::isValidKey(keys[i], keyLens[i])) {
-      m_nInvalidKey += 1;
-      continue;
-    }
-    Connection* conn = m_connSelector.getConn(keys[i], keyLens[i]);
+    Connection* conn = routeKey(keys[i], keyLens[i]);
     if (conn == NULL) {
       continue;
     }
 
     conn->takeBuffer(keywords::kTOUCH_, 6);
-    conn->takeBuffer(keys[i], keyLens[i]);
+    takeKey(conn, keys[i], keyLens[i]);
     conn->takeBuffer(kSPACE, 1);
-    conn->takeNumber(exptime);
+    conn->takeNumber(exptimes == NULL ? exptime : exptimes[i]);
     if (noreply) {
       conn->takeBuffer(k_NOREPLY, 8);
     } else {
@@ -313,14 +426,21 @@ void ConnectionPool::dispatchTouch(
 
 void ConnectionPool::dispatchIncrDecr(op_code_t op, const char* key, const size_t keyLen,
                                       const uint64_t delta, const bool noreply) {
-  if (!utility::isValidKey(key, keyLen)) {
+  m_dispatchStart = utility::getCurrentMonotonicUs();
+  char buf[MC_MAX_KEY_LENGTH];
+  size_t fullLen = keyLen;
+  const char* fullKey = wireKey(key, fullLen, buf);
+  if (fullKey == NULL) {
     m_nInvalidKey += 1;
     return;
   }
-  Connection* conn = m_connSelector.getConn(key, keyLen);
+  Connection* conn = m_connSelector.getConn(fullKey, fullLen);
   if (conn == NULL) {
     return;
   }
+  if (m_connsPerServer > 1) {
+    conn = spreadKey(conn, fullKey, fullLen);
+  }
   switch (op) {
     case INCR_OP:
       conn->takeBuffer(keywords::kINCR_, 5);
@@ -332,7 +452,7 @@ void ConnectionPool::dispatchIncrDecr(op_code_t op, const char* key, const size_
       NOT_REACHED();
       break;
   }
-  conn->takeBuffer(key, keyLen);
+  takeKey(conn, key, keyLen);
   conn->takeBuffer(kSPACE, 1);
   conn->takeNumber(delta);
   if (noreply) {
@@ -354,8 +474,60 @@ void ConnectionPool::dispatchIncrDecr(op_code_t op, const char* key, const size_
 }
 
 
-void ConnectionPool::broadcastCommand(const char * const cmd, const size_t cmdLens) {
-  for (size_t idx = 0; idx < m_nConns; ++idx) {
+void ConnectionPool::dispatchIncrDecr(op_code_t op, const char* const* keys,
+                                      const size_t* keyLens, const uint64_t* deltas,
+                                      const bool noreply, size_t nItems) {
+  size_t i = 0, idx = 0;
+  beginKeys(keys, keyLens, nItems, false, noreply);
+  for (; i < nItems; ++i) {
+    Connection* conn = routeKey(keys[i], keyLens[i]);
+    if (conn == NULL) {
+      continue;
+    }
+    switch (op) {
+      case INCR_OP:
+        conn->takeBuffer(keywords::kINCR_, 5);
+        break;
+      case DECR_OP:
+        conn->takeBuffer(keywords::kDECR_, 5);
+        break;
+      default:
+        NOT_REACHED();
+        break;
+    }
+    takeKey(conn, keys[i], keyLens[i]);
+    conn->takeBuffer(kSPACE, 1);
+    conn->takeNumber(deltas[i]);
+    if (noreply) {
+      conn->takeBuffer(k_NOREPLY, 8);
+    } else {
+      conn->addRequestKey(keys[i], keyLens[i]);
+    }
+    ++conn->m_counter;
+    conn->takeBuffer(kCRLF, 2);
+  }
+
+  for (idx = 0; idx < m_nConns; idx++) {
+    Connection* conn = m_conns + idx;
+    if (conn->m_counter > 0) {
+      conn->setParserMode(MODE_COUNTING);
+      m_nActiveConn += 1;
+      m_activeConns.push_back(conn);
+    }
+    // for ignore noreply
+    conn->m_counter = conn->requestKeyCount();
+    if (conn->m_counter > 0) {
+      conn->getUnsignedResults()->reserve(conn->m_counter);
+    }
+  }
+}
+
+
+void ConnectionPool::broadcastCommand(const char * const cmd, const size_t cmdLens,
+                                      bool everyConn) {
+  m_dispatchStart = utility::getCurrentMonotonicUs();
+  size_t step = everyConn ? 1 : m_connsPerServer;
+  for (size_t idx = 0; idx < m_nConns; idx += step) {
     Connection* conn = m_conns + idx;
     if (!conn->alive()) {
       if (!conn->tryReconnect()) {
@@ -372,6 +544,10 @@ void ConnectionPool::broadcastCommand(const char * const cmd, const size_t cmdLe
 }
 
 err_code_t ConnectionPool::waitPoll() {
+  int64_t waitStart = utility::getCurrentMonotonicUs();
+  if (m_traceHook != NULL && m_dispatchStart > 0) {
+    trace(TRACE_ROUTE, NULL, m_dispatchStart, waitStart, m_keyConns.size(), RET_OK);
+  }
   if (m_nActiveConn == 0) {
     if (m_nInvalidKey > 0) {
       return RET_INVALID_KEY_ERR;
@@ -384,6 +560,12 @@ err_code_t ConnectionPool::waitPoll() {
   pollfd_t pollfds[n_fds];
 
   Connection* fd2conn[n_fds];
+  // us, 0 means not yet
+  int64_t sentAt[n_fds];
+  int64_t firstByteAt[n_fds];
+  int64_t doneAt[n_fds];
+  // whether any byte of the request is sent, see abandonAll
+  bool started[n_fds];
 
   pollfd_t* pollfd_ptr = NULL;
   nfds_t fd_idx = 0;
@@ -393,58 +575,74 @@ err_code_t ConnectionPool::waitPoll() {
     Connection* conn = *it;
     pollfd_ptr = &pollfds[fd_idx];
     pollfd_ptr->fd = conn->socketFd();
-    pollfd_ptr->events = POLLOUT;
+    // reading the responses as soon as they come, while still sending
+    pollfd_ptr->events = conn->m_counter > 0 ? POLLOUT | POLLIN : POLLOUT;
     fd2conn[fd_idx] = conn;
+    sentAt[fd_idx] = firstByteAt[fd_idx] = doneAt[fd_idx] = 0;
+    started[fd_idx] = false;
+    server_metrics_t* metrics = conn->metrics();
+    ++metrics->requests;
+    if (m_dispatchStart > 0) {
+      utility::recordLatency(&metrics->dispatch, waitStart - m_dispatchStart);
+    }
+  }
+
+  // m_pollTimeout bounds every single poll, the deadline bounds the whole batch
+  int64_t deadline = m_deadline;
+  if (deadline == 0 && m_requestTimeout > 0) {
+    deadline = utility::getCurrentMonotonicMs() + m_requestTimeout;
   }
 
   err_code_t ret_code = RET_OK;
+  nfds_t sendRound = 0;
   while (m_nActiveConn) {
-    int rv = poll(pollfds, n_fds, m_pollTimeout);
-    if (rv == -1) {
-      markDeadAll(pollfds, keywords::kPOLL_ERROR);
+    int timeout = m_pollTimeout;
+    bool bound_by_deadline = false;
+    if (deadline > 0) {
+      int64_t remain = deadline - utility::getCurrentMonotonicMs();
+      if (remain <= 0) {
+        log_warn("deadline exceeded. (m_nActiveConn: %d)", m_nActiveConn);
+        abandonAll(pollfds, started, keywords::kDEADLINE_EXCEEDED);
+        ret_code = RET_POLL_TIMEOUT_ERR;
+        break;
+      }
+      if (timeout < 0 || remain < timeout) {
+        timeout = static_cast<int>(remain);
+        bound_by_deadline = true;
+      }
+    }
+
+    int rv = poll(pollfds, n_fds, timeout);
+    if (rv == 0 && bound_by_deadline) {
+      continue;
+    } else if (rv == -1) {
+      markDeadAll(pollfds, started, RET_POLL_ERR, keywords::kPOLL_ERROR);
       ret_code = RET_POLL_ERR;
       break;
     } else if (rv == 0) {
       log_warn("poll timeout. (m_nActiveConn: %d)", m_nActiveConn);
       // NOTE: MUST reset all active TCP connections after timeout.
-      markDeadAll(pollfds, keywords::kPOLL_TIMEOUT);
+      markDeadAll(pollfds, started, RET_POLL_TIMEOUT_ERR, keywords::kPOLL_TIMEOUT);
       ret_code = RET_POLL_TIMEOUT_ERR;
       break;
     } else {
       err_code_t err;
+      // receive first: the responses pending are parsed, and the servers
+      // done leave the poll, before more is written to any server
       for (fd_idx = 0; fd_idx < n_fds; fd_idx++) {
         pollfd_ptr = &pollfds[fd_idx];
         Connection* conn = fd2conn[fd_idx];
+        server_metrics_t* metrics = conn->metrics();
+        if (pollfd_ptr->revents == 0) {
+          continue;
+        }
+        ++metrics->poll_wakeups;
 
         if (pollfd_ptr->revents & (POLLERR | POLLHUP | POLLNVAL)) {
-          markDeadConn(conn, keywords::kCONN_POLL_ERROR, pollfd_ptr);
+          markDeadConn(conn, RET_CONN_POLL_ERR, keywords::kCONN_POLL_ERROR, pollfd_ptr);
           ret_code = RET_CONN_POLL_ERR;
           m_nActiveConn -= 1;
-          goto next_fd;
-        }
-
-        // send
-        if (pollfd_ptr->revents & POLLOUT) {
-          // POLLOUT send
-          ssize_t nToSend = conn->send();
-          if (nToSend == -1) {
-            markDeadConn(conn, keywords::kSEND_ERROR, pollfd_ptr);
-            ret_code = RET_SEND_ERR;
-            m_nActiveConn -= 1;
-            goto next_fd;
-          } else {
-            // start to recv if any data is sent
-            pollfd_ptr->events |= POLLIN;
-
-            if (nToSend == 0) {
-              // debug("[%d] all sent", pollfd_ptr->fd);
-              pollfd_ptr->events &= ~POLLOUT;
-              if (conn->m_counter == 0) {
-                // just send, no recv for noreply
-                --this->m_nActiveConn;
-              }
-            }
-          }
+          goto next_recv;
         }
 
         // recv
@@ -452,32 +650,39 @@ err_code_t ConnectionPool::waitPoll() {
           // POLLIN recv
           ssize_t nRecv = conn->recv();
           if (nRecv == -1 || nRecv == 0) {
-            markDeadConn(conn, keywords::kRECV_ERROR, pollfd_ptr);
+            markDeadConn(conn, RET_RECV_ERR, keywords::kRECV_ERROR, pollfd_ptr);
             ret_code = RET_RECV_ERR;
             m_nActiveConn -= 1;
-            goto next_fd;
+            goto next_recv;
+          }
+          if (firstByteAt[fd_idx] == 0) {
+            firstByteAt[fd_idx] = utility::getCurrentMonotonicUs();
+            utility::recordLatency(&metrics->first_byte, firstByteAt[fd_idx] - waitStart);
           }
 
           conn->process(err);
           switch (err) {
             case RET_OK:
               pollfd_ptr->events &= ~POLLIN;
+              doneAt[fd_idx] = utility::getCurrentMonotonicUs();
+              utility::recordLatency(&metrics->complete, doneAt[fd_idx] - waitStart);
+              conn->markAlive();
               --m_nActiveConn;
               break;
             case RET_INCOMPLETE_BUFFER_ERR:
               break;
             case RET_PROGRAMMING_ERR:
-              markDeadConn(conn, keywords::kPROGRAMMING_ERROR, pollfd_ptr);
+              markDeadConn(conn, RET_PROGRAMMING_ERR, keywords::kPROGRAMMING_ERROR, pollfd_ptr);
               ret_code = RET_PROGRAMMING_ERR;
               m_nActiveConn -= 1;
-              goto next_fd;
+              goto next_recv;
               break;
             case RET_MC_SERVER_ERR:
               // soft server error
-              markDeadConn(conn, keywords::kSERVER_ERROR, pollfd_ptr);
+              markDeadConn(conn, RET_MC_SERVER_ERR, keywords::kSERVER_ERROR, pollfd_ptr);
               ret_code = RET_MC_SERVER_ERR;
               m_nActiveConn -= 1;
-              goto next_fd;
+              goto next_recv;
               break;
             default:
               NOT_REACHED();
@@ -485,15 +690,76 @@ err_code_t ConnectionPool::waitPoll() {
           }
         }
 
-next_fd: {}
+next_recv:
+        if (m_traceHook != NULL && doneAt[fd_idx] == 0 &&
+            (pollfd_ptr->events & (POLLOUT | POLLIN)) == 0) {
+          // failed
+          doneAt[fd_idx] = utility::getCurrentMonotonicUs();
+        }
       } // end for
+
+      // then send, from the next server each round, so that the first ones
+      // don't always fill the network ahead of the others
+      for (nfds_t i = 0; i < n_fds; i++) {
+        fd_idx = (sendRound + i) % n_fds;
+        pollfd_ptr = &pollfds[fd_idx];
+        if (!(pollfd_ptr->revents & POLLOUT) || !(pollfd_ptr->events & POLLOUT)) {
+          continue;
+        }
+        Connection* conn = fd2conn[fd_idx];
+        server_metrics_t* metrics = conn->metrics();
+
+        // POLLOUT send
+        uint64_t bytesSent = metrics->bytes_sent;
+        ssize_t nToSend = conn->send();
+        started[fd_idx] = started[fd_idx] || metrics->bytes_sent > bytesSent;
+        if (nToSend == -1) {
+          markDeadConn(conn, RET_SEND_ERR, keywords::kSEND_ERROR, pollfd_ptr);
+          ret_code = RET_SEND_ERR;
+          m_nActiveConn -= 1;
+          if (m_traceHook != NULL) {
+            doneAt[fd_idx] = utility::getCurrentMonotonicUs();
+          }
+          continue;
+        }
+        // start to recv if any data is sent
+        pollfd_ptr->events |= POLLIN;
+
+        if (nToSend == 0) {
+          // debug("[%d] all sent", pollfd_ptr->fd);
+          pollfd_ptr->events &= ~POLLOUT;
+          sentAt[fd_idx] = utility::getCurrentMonotonicUs();
+          utility::recordLatency(&metrics->send, sentAt[fd_idx] - waitStart);
+          if (conn->m_counter == 0) {
+            // just send, no recv for noreply
+            doneAt[fd_idx] = sentAt[fd_idx];
+            utility::recordLatency(&metrics->complete, doneAt[fd_idx] - waitStart);
+            conn->markAlive();
+            --this->m_nActiveConn;
+          }
+        }
+      } // end for
+      ++sendRound;
+    }
+  }
+
+  if (m_traceHook != NULL) {
+    int64_t now = utility::getCurrentMonotonicUs();
+    for (fd_idx = 0; fd_idx < n_fds; fd_idx++) {
+      traceConn(fd2conn[fd_idx], waitStart, sentAt[fd_idx], firstByteAt[fd_idx],
+                doneAt[fd_idx] > 0 ? doneAt[fd_idx] : now);
     }
   }
   return ret_code;
 }
 
 
-void ConnectionPool::collectRetrievalResult(std::vector<retrieval_result_t*>& results) {
+// decompress the values unless decoding is false, as for the chunks of a
+// value compressed before being split, SEE Client::joinChunkedValues
+void ConnectionPool::collectRetrievalResult(std::vector<retrieval_result_t*>& results,
+                                            bool decoding) {
+  int64_t start = m_traceHook != NULL ? utility::getCurrentMonotonicUs() : 0;
+  size_t nResults = results.size();
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
        it != m_activeConns.end(); ++it) {
     types::RetrievalResultList* rst = (*it)->getRetrievalResults();
@@ -505,13 +771,29 @@ void ConnectionPool::collectRetrievalResult(std::vector<retrieval_result_t*>& re
         // of one retrieval result is not complete yet.
         continue;
       }
-      results.push_back(r1.inner());
+      retrieval_result_t* r = r1.inner();
+      if (decoding && r->data_block != NULL && (r->flags & MC_FLAG_COMPRESS_MASK) &&
+          !(r->flags & MC_FLAG_CHUNKED)) {
+        size_t bytes = 0;
+        flags_t flags = 0;
+        char* decoded = m_codec.decompress(r->data_block, r->bytes, r->flags, bytes, flags);
+        if (decoded != NULL) {
+          r1.setDecoded(decoded, static_cast<uint32_t>(bytes), flags);
+        }
+      }
+      results.push_back(r);
     }
   }
+  if (m_traceHook != NULL) {
+    trace(TRACE_COLLECT, NULL, start, utility::getCurrentMonotonicUs(),
+          results.size() - nResults, RET_OK);
+  }
 }
 
 
 void ConnectionPool::collectMessageResult(std::vector<message_result_t*>& results) {
+  int64_t start = m_traceHook != NULL ? utility::getCurrentMonotonicUs() : 0;
+  size_t nResults = results.size();
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
        it != m_activeConns.end(); ++it) {
     types::MessageResultList* rst = (*it)->getMessageResults();
@@ -520,13 +802,17 @@ void ConnectionPool::collectMessageResult(std::vector<message_result_t*>& result
       results.push_back(&(*it2));
     }
   }
+  if (m_traceHook != NULL) {
+    trace(TRACE_COLLECT, NULL, start, utility::getCurrentMonotonicUs(),
+          results.size() - nResults, RET_OK);
+  }
 }
 
 
 void ConnectionPool::collectBroadcastResult(std::vector<broadcast_result_t>& results) {
-  results.resize(m_nConns);
-  for (size_t i = 0; i < m_nConns; ++i) {
-    Connection* conn = m_conns + i;
+  results.resize(m_nConns / m_connsPerServer);
+  for (size_t i = 0; i < results.size(); ++i) {
+    Connection* conn = m_conns + i * m_connsPerServer;
     broadcast_result_t* conn_result = &results[i];
     conn_result->host = const_cast<char*>(conn->name());
     types::LineResultList* rst = conn->getLineResults();
@@ -564,6 +850,24 @@ void ConnectionPool::collectUnsignedResult(std::vector<unsigned_result_t*>& resu
 }
 
 
+// the values of a multi-key incr/decr, the keys not found are not in them
+void ConnectionPool::collectMultiUnsignedResult(std::vector<unsigned_result_t*>& results) {
+  int64_t start = m_traceHook != NULL ? utility::getCurrentMonotonicUs() : 0;
+  size_t nResults = results.size();
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    types::UnsignedResultList* rst = (*it)->getUnsignedResults();
+    for (types::UnsignedResultList::iterator it2 = rst->begin(); it2 != rst->end(); ++it2) {
+      results.push_back(&(*it2));
+    }
+  }
+  if (m_traceHook != NULL) {
+    trace(TRACE_COLLECT, NULL, start, utility::getCurrentMonotonicUs(),
+          results.size() - nResults, RET_OK);
+  }
+}
+
+
 void ConnectionPool::reset() {
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
        it != m_activeConns.end(); ++it) {
@@ -572,6 +876,259 @@ void ConnectionPool::reset() {
   m_nActiveConn = 0;
   m_nInvalidKey = 0;
   m_activeConns.clear();
+  m_dispatchStart = 0;
+  m_keys = NULL;
+  m_keyLens = NULL;
+  m_keyConns.clear();
+  m_keyStatuses.clear();
+}
+
+
+void ConnectionPool::beginKeys(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                               bool retrieval, bool noreply) {
+  m_dispatchStart = utility::getCurrentMonotonicUs();
+  m_keys = keys;
+  m_keyLens = keyLens;
+  m_keysRetrieval = retrieval;
+  m_keysNoreply = noreply;
+  m_keyConns.reserve(nKeys);
+  m_keyStatuses.reserve(nKeys);
+}
+
+
+// route a key of a multi-key command, and remember where it goes. The
+// length of the key as it's sent is stored in wireLen if not NULL.
+Connection* ConnectionPool::routeKey(const char* key, size_t keyLen, size_t* wireLen) {
+  Connection* conn = NULL;
+  char buf[MC_MAX_KEY_LENGTH];
+  key = wireKey(key, keyLen, buf);
+  if (key == NULL) {
+    m_nInvalidKey += 1;
+    m_keyStatuses.push_back(KEY_INVALID_ERR);
+  } else {
+    if (wireLen != NULL) {
+      *wireLen = keyLen;
+    }
+    conn = m_connSelector.getConn(key, keyLen);
+    if (conn != NULL && m_connsPerServer > 1) {
+      conn = spreadKey(conn, key, keyLen);
+    }
+    m_keyStatuses.push_back(conn == NULL ? KEY_DEAD_SERVER_ERR : KEY_HIT);
+  }
+  m_keyConns.push_back(conn);
+  return conn;
+}
+
+
+// the connection of the server of conn that key (as it's sent) goes to, by
+// another hash than the one of the servers, so that a key is always sent on
+// the same connection, and the commands of a batch on a key are in order.
+// conn if that one is dead and can't be reconnected now.
+Connection* ConnectionPool::spreadKey(Connection* conn, const char* key, size_t keyLen) {
+  size_t first = (conn - m_conns) / m_connsPerServer * m_connsPerServer;
+  Connection* spread = m_conns + first + hashkit::hash_fnv1a_32(key, keyLen) % m_connsPerServer;
+  if (spread != conn && !spread->alive() && !spread->tryReconnect()) {
+    return conn;
+  }
+  return spread;
+}
+
+
+// the key as it's hashed and sent: with the prefix, and encoded if it's not
+// a valid key in the binary-safe mode. A "?" key keeps its "?" ahead of
+// both. Assembled in buf of MC_MAX_KEY_LENGTH bytes unless it's the key as
+// is, keyLen is updated, NULL if it's invalid (or only too long if not
+// validating).
+const char* ConnectionPool::wireKey(const char* key, size_t& keyLen, char* buf,
+                                    bool validating) {
+  size_t mark = keyLen > 0 && key[0] == '?' ? 1 : 0;
+  bool encoding = m_binarySafeKeys && needsEncoding(key + mark, keyLen - mark);
+  if (m_keyPrefix.empty() && !encoding) {
+    return !validating || utility::isValidKey(key, keyLen) ? key : NULL;
+  }
+  size_t restLen = keyLen - mark;
+  size_t wireLen = mark + m_keyPrefix.size() +
+                   (encoding ? 1 + utility::base64Length(restLen) : restLen);
+  if (wireLen > MC_MAX_KEY_LENGTH) {
+    log_warn("invalid mc key of length %zu: \"%s%.*s\"", wireLen, m_keyPrefix.c_str(),
+             static_cast<int>(keyLen), key);
+    return NULL;
+  }
+  if (validating && !encoding && !utility::isValidKey(key, keyLen)) {
+    return NULL;
+  }
+  char* p = buf;
+  if (mark) {
+    *p++ = '?';
+  }
+  memcpy(p, m_keyPrefix.data(), m_keyPrefix.size());
+  p += m_keyPrefix.size();
+  if (encoding) {
+    *p++ = MC_ENCODED_KEY_MARKER;
+    utility::base64Encode(key + mark, restLen, p);
+  } else {
+    memcpy(p, key + mark, restLen);
+  }
+  keyLen = wireLen;
+  return buf;
+}
+
+
+// in the binary-safe mode, the keys not valid as they are, and the ones
+// looking encoded already so that they are decoded back to themselves
+bool ConnectionPool::needsEncoding(const char* key, size_t keyLen) {
+  return keyLen > 0 && (key[0] == MC_ENCODED_KEY_MARKER ||
+                        utility::findInvalidKeyByte(key, keyLen) != keyLen);
+}
+
+
+// write the key with the prefix, as iovecs of their own, not copied, but
+// an encoded key, SEE wireKey
+void ConnectionPool::takeKey(Connection* conn, const char* key, size_t keyLen) {
+  size_t mark = keyLen > 0 && key[0] == '?' ? 1 : 0;
+  if (m_binarySafeKeys && needsEncoding(key + mark, keyLen - mark)) {
+    char buf[MC_MAX_KEY_LENGTH];
+    key = wireKey(key, keyLen, buf, false);
+    conn->takeCopy(key, keyLen);
+    return;
+  }
+  if (m_keyPrefix.empty()) {
+    conn->takeBuffer(key, keyLen);
+    return;
+  }
+  if (keyLen > 0 && key[0] == '?') {
+    conn->takeBuffer(key, 1);
+    ++key;
+    --keyLen;
+  }
+  conn->takeBuffer(m_keyPrefix.data(), m_keyPrefix.size());
+  if (keyLen > 0) {
+    conn->takeBuffer(key, keyLen);
+  }
+}
+
+
+// Status of each key of the last get/gets/storage/delete/touch/incr/decr
+// command, in the order of the keys. Like the results, valid until they are
+// destroyed, and the keys passed to the command must be still there.
+//
+// Each connection responds in the order of its keys, so walk the keys with a
+// cursor per connection: a key is a hit if it's next in its connection's
+// results, and is a miss or an error depending on how its connection ended.
+void ConnectionPool::getKeyStatuses(key_status_t** statuses, size_t* nKeys) {
+  *nKeys = m_keyStatuses.size();
+  if (*nKeys == 0) {
+    *statuses = NULL;
+    return;
+  }
+  std::vector<size_t> cursors(m_nConns, 0);
+  std::vector<size_t> unsignedCursors(m_nConns, 0);
+  for (size_t i = 0; i < *nKeys; ++i) {
+    Connection* conn = m_keyConns[i];
+    if (conn == NULL) {
+      continue;
+    }
+    size_t& cursor = cursors[conn - m_conns];
+    if (m_keysRetrieval) {
+      types::RetrievalResultList* rst = conn->getRetrievalResults();
+      if (cursor < rst->size() && (*rst)[cursor].bytesRemain == 0) {
+        retrieval_result_t* r = (*rst)[cursor].inner();
+        if (r->key_len == m_keyLens[i] && memcmp(r->key, m_keys[i], m_keyLens[i]) == 0) {
+          m_keyStatuses[i] = KEY_HIT;
+          ++cursor;
+          continue;
+        }
+      }
+    } else {
+      // a value of incr/decr, SEE ConnectionPool::collectMultiUnsignedResult
+      types::UnsignedResultList* urst = conn->getUnsignedResults();
+      size_t& unsignedCursor = unsignedCursors[conn - m_conns];
+      if (unsignedCursor < urst->size() && (*urst)[unsignedCursor].key == m_keys[i]) {
+        m_keyStatuses[i] = KEY_HIT;
+        ++unsignedCursor;
+        continue;
+      }
+      types::MessageResultList* rst = conn->getMessageResults();
+      if (cursor < rst->size() && (*rst)[cursor].key == m_keys[i]) {
+        switch ((*rst)[cursor].type_) {
+          case MSG_STORED:
+          case MSG_DELETED:
+          case MSG_TOUCHED:
+          case MSG_OK:
+            m_keyStatuses[i] = KEY_HIT;
+            break;
+          default:
+            m_keyStatuses[i] = KEY_MISS;
+            break;
+        }
+        ++cursor;
+        continue;
+      }
+    }
+
+    switch (conn->outcome()) {
+      case RET_OK:
+        m_keyStatuses[i] = m_keysNoreply ? KEY_HIT : KEY_MISS;
+        break;
+      case RET_POLL_TIMEOUT_ERR:
+        m_keyStatuses[i] = KEY_TIMEOUT_ERR;
+        break;
+      default:
+        m_keyStatuses[i] = KEY_SERVER_ERR;
+        break;
+    }
+  }
+  *statuses = &m_keyStatuses.front();
+}
+
+
+static void mergeLatencies(latency_histogram_t* into, const latency_histogram_t& from) {
+  into->count += from.count;
+  into->sum_us += from.sum_us;
+  into->max_us = MAX(into->max_us, from.max_us);
+  for (size_t i = 0; i < MC_LATENCY_BUCKETS; ++i) {
+    into->buckets[i] += from.buckets[i];
+  }
+}
+
+
+// the metrics of a server are the sums of the ones of its connections
+void ConnectionPool::collectMetrics(std::vector<server_metrics_t>& metrics) {
+  metrics.resize(m_nConns / m_connsPerServer);
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    server_metrics_t* into = &metrics[idx / m_connsPerServer];
+    if (idx % m_connsPerServer == 0) {
+      m_conns[idx].snapshotMetrics(into);
+      continue;
+    }
+    server_metrics_t from;
+    m_conns[idx].snapshotMetrics(&from);
+    into->requests += from.requests;
+    into->bytes_sent += from.bytes_sent;
+    into->bytes_received += from.bytes_received;
+    into->poll_wakeups += from.poll_wakeups;
+    into->connects += from.connects;
+    into->connect_failures += from.connect_failures;
+    into->send_errors += from.send_errors;
+    into->recv_errors += from.recv_errors;
+    into->conn_poll_errors += from.conn_poll_errors;
+    into->poll_timeouts += from.poll_timeouts;
+    into->poll_errors += from.poll_errors;
+    into->server_errors += from.server_errors;
+    into->parse_errors += from.parse_errors;
+    into->abandons += from.abandons;
+    mergeLatencies(&into->dispatch, from.dispatch);
+    mergeLatencies(&into->send, from.send);
+    mergeLatencies(&into->first_byte, from.first_byte);
+    mergeLatencies(&into->complete, from.complete);
+  }
+}
+
+
+void ConnectionPool::resetMetrics() {
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    m_conns[idx].resetMetrics();
+  }
 }
 
 
@@ -581,6 +1138,7 @@ void ConnectionPool::setPollTimeout(int timeout) {
 
 
 void ConnectionPool::setConnectTimeout(int timeout) {
+  m_connectTimeout = timeout;
   for (size_t idx = 0; idx < m_nConns; ++idx) {
     Connection* conn = m_conns + idx;
     conn->setConnectTimeout(timeout);
@@ -589,6 +1147,7 @@ void ConnectionPool::setConnectTimeout(int timeout) {
 
 
 void ConnectionPool::setRetryTimeout(int timeout) {
+  m_retryTimeout = timeout;
   for (size_t idx = 0; idx < m_nConns; ++idx) {
     Connection* conn = m_conns + idx;
     conn->setRetryTimeout(timeout);
@@ -596,23 +1155,343 @@ void ConnectionPool::setRetryTimeout(int timeout) {
 }
 
 
-void ConnectionPool::markDeadAll(pollfd_t* pollfds, const char* reason) {
+void ConnectionPool::setMaxRetryTimeout(int timeout) {
+  m_maxRetryTimeout = timeout;
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    Connection* conn = m_conns + idx;
+    conn->setMaxRetryTimeout(timeout);
+  }
+}
+
+
+void ConnectionPool::setRequestTimeout(int timeout) {
+  m_requestTimeout = timeout;
+}
 
+
+// Requests issued from now on must complete within timeout ms, the servers
+// that miss it are abandoned and the results of the others are returned.
+// Overrides CFG_REQUEST_TIMEOUT until clearDeadline is called.
+void ConnectionPool::setDeadline(int timeout) {
+  m_deadline = utility::getCurrentMonotonicMs() + MAX(timeout, 0);
+}
+
+
+void ConnectionPool::clearDeadline() {
+  m_deadline = 0;
+}
+
+
+// Every span of a request is handed to hook with ctx: routing the keys,
+// connecting, sending to, waiting for and parsing the response of each
+// server, and collecting the results. The hook is called synchronously
+// (by the maintainer thread for background connecting), so it must be
+// cheap and never call into the client. Without a hook nothing is timed.
+void ConnectionPool::setTraceHook(trace_hook_t hook, void* ctx) {
+  bool maintaining = m_maintainerRunning;
+  stopMaintainer();
+  m_traceHook = hook;
+  m_traceCtx = ctx;
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    m_conns[idx].setTraceHook(hook, ctx);
+  }
+  if (maintaining) {
+    startMaintainer();
+  }
+}
+
+
+// stream the values of the following retrievals to sink, NULL to stop
+void ConnectionPool::setValueSink(value_sink_t sink, void* ctx) {
+  for (size_t i = 0; i < m_nConns; ++i) {
+    m_conns[i].setValueSink(sink, ctx);
+  }
+}
+
+
+// read the values of the following retrievals into the buffers buffer picks,
+// NULL to stop
+void ConnectionPool::setValueBuffer(value_buffer_t buffer, void* ctx) {
+  for (size_t i = 0; i < m_nConns; ++i) {
+    m_conns[i].setValueBuffer(buffer, ctx);
+  }
+}
+
+
+void ConnectionPool::setCompressCodec(compress_codec_options_t codec) {
+  m_codec.setCodec(codec);
+}
+
+
+void ConnectionPool::setCompressThreshold(int threshold) {
+  m_codec.setThreshold(threshold > 0 ? threshold : 0);
+}
+
+
+err_code_t ConnectionPool::setCompressDictionary(const char* dict, size_t len) {
+  return m_codec.setDictionary(dict, len);
+}
+
+
+// prepend prefix to the keys of the following commands on the wire, and
+// strip it from the keys of the values, so that callers only see their own
+// keys. Routing is by the prefixed keys, empty to stop.
+err_code_t ConnectionPool::setKeyPrefix(const char* prefix, size_t len) {
+  if (len > 0 && (len >= MC_MAX_KEY_LENGTH || !utility::isValidKey(prefix, len))) {
+    return RET_INVALID_KEY_ERR;
+  }
+  m_keyPrefix.assign(prefix, len);
+  for (size_t i = 0; i < m_nConns; ++i) {
+    m_conns[i].setKeyPrefixLen(len);
+  }
+  return RET_OK;
+}
+
+
+// send the keys with bytes not allowed in the text protocol, and the ones
+// starting with MC_ENCODED_KEY_MARKER, as the marker and their base64url
+// (of no more than 186 bytes), and decode the keys of the values back,
+// instead of failing them as invalid. Keys too long stay invalid, as a
+// hashed key couldn't be mapped back to the caller's.
+void ConnectionPool::setBinarySafeKeys(bool enabled) {
+  m_binarySafeKeys = enabled;
+  for (size_t i = 0; i < m_nConns; ++i) {
+    m_conns[i].setDecodingKeys(enabled);
+  }
+}
+
+
+// point flags, vals and val_lens to copies where the values worth it are
+// compressed, valid until the next storage command
+void ConnectionPool::compressValues(const flags_t*& flags, const char* const*& vals,
+                                    const size_t*& val_lens, size_t nItems) {
+  if (!m_codec.enabled()) {
+    return;
+  }
+  m_compressBuffer.clear();
+  m_compressedVals.assign(vals, vals + nItems);
+  m_compressedLens.assign(val_lens, val_lens + nItems);
+  m_compressedFlags.assign(flags, flags + nItems);
+  std::vector<size_t> offsets(nItems, std::string::npos);
+  for (size_t i = 0; i < nItems; ++i) {
+    size_t offset = m_compressBuffer.size();
+    if (m_codec.compress(vals[i], val_lens[i], flags[i], m_compressBuffer,
+                         m_compressedFlags[i])) {
+      offsets[i] = offset;
+      m_compressedLens[i] = m_compressBuffer.size() - offset;
+    }
+  }
+  if (m_compressBuffer.empty()) {
+    return;
+  }
+  // m_compressBuffer is not moving anymore
+  for (size_t i = 0; i < nItems; ++i) {
+    if (offsets[i] != std::string::npos) {
+      m_compressedVals[i] = m_compressBuffer.data() + offsets[i];
+    }
+  }
+  flags = &m_compressedFlags[0];
+  vals = &m_compressedVals[0];
+  val_lens = &m_compressedLens[0];
+}
+
+
+void ConnectionPool::trace(trace_phase_t phase, const char* server, int64_t start,
+                           int64_t end, size_t nKeys, err_code_t err) {
+  trace_span_t span;
+  span.phase = phase;
+  span.server = server;
+  span.start_us = start;
+  span.end_us = end;
+  span.n_keys = nKeys;
+  span.err = err;
+  m_traceHook(m_traceCtx, &span);
+}
+
+
+// spans of a server in waitPoll, the phase it failed in carries the error
+void ConnectionPool::traceConn(Connection* conn, int64_t waitStart, int64_t sentAt,
+                               int64_t firstByteAt, int64_t doneAt) {
+  size_t nKeys = conn->m_counter;
+  err_code_t err = conn->outcome();
+  trace(TRACE_SEND, conn->name(), waitStart, sentAt > 0 ? sentAt : doneAt, nKeys,
+        sentAt > 0 ? RET_OK : err);
+  if (sentAt == 0 || nKeys == 0) {
+    return;
+  }
+  trace(TRACE_WAIT, conn->name(), sentAt, firstByteAt > 0 ? firstByteAt : doneAt, nKeys,
+        firstByteAt > 0 ? RET_OK : err);
+  if (firstByteAt == 0) {
+    return;
+  }
+  trace(TRACE_PARSE, conn->name(), firstByteAt, doneAt, nKeys, err);
+}
+
+
+void ConnectionPool::setKeepaliveIdle(int idle) {
+  m_keepaliveIdle = idle;
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    Connection* conn = m_conns + idx;
+    conn->setKeepaliveIdle(idle);
+  }
+}
+
+
+// Split the keys of a retrieval to a server into commands of no more than
+// maxKeys keys and maxBytes bytes of keys (with the spaces and the prefix),
+// pipelined in the same round trip, so that a huge batch doesn't make a
+// single command that holds a memcached worker, or buffers, all the way.
+// A key longer than maxBytes goes in a command of its own. 0 for no bound.
+void ConnectionPool::setMaxGetSize(int maxKeys, int maxBytes) {
+  m_maxGetKeys = maxKeys > 0 ? maxKeys : 0;
+  m_maxGetBytes = maxBytes > 0 ? maxBytes : 0;
+}
+
+
+// With a positive window (bytes), a server is written at most window bytes
+// per poll round, and its connection is only writable once the kernel holds
+// less than window bytes not sent yet (TCP_NOTSENT_LOWAT, where available),
+// so a large batch doesn't sit in the socket buffers ahead of the reads.
+// The bytes sent but not acknowledged yet are up to TCP, not bounded here.
+void ConnectionPool::setSendWindow(int window) {
+  m_sendWindow = window > 0 ? window : 0;
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    Connection* conn = m_conns + idx;
+    conn->setSendWindow(m_sendWindow);
+  }
+}
+
+
+// With a positive interval (ms), a background thread connects and reconnects
+// the servers every interval, and routing a key only checks whether its
+// connection is alive. Otherwise (the default) a dead connection is
+// reconnected inline when a key is routed to it.
+void ConnectionPool::setMaintainInterval(int interval) {
+  stopMaintainer();
+  m_maintainInterval = interval;
+  if (m_maintainInterval > 0) {
+    startMaintainer();
+  }
+}
+
+
+void ConnectionPool::startMaintainer() {
+  assert(!m_maintainerRunning);
+  if (m_nConns == 0) {
+    return; // started in ConnectionPool::init
+  }
+  // connect synchronously once, so that the first requests find live servers
+  maintain();
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    m_conns[idx].setManaged(true);
+  }
+  m_maintainerStopping = false;
+  if (pthread_create(&m_maintainer, NULL, &ConnectionPool::maintainerLoop, this) != 0) {
+    log_err("failed to start the connection maintainer: %s", strerror(errno));
+    for (size_t idx = 0; idx < m_nConns; ++idx) {
+      m_conns[idx].setManaged(false);
+    }
+    return;
+  }
+  m_maintainerRunning = true;
+}
+
+
+void ConnectionPool::stopMaintainer() {
+  if (!m_maintainerRunning) {
+    return;
+  }
+  pthread_mutex_lock(&m_maintainerLock);
+  m_maintainerStopping = true;
+  pthread_cond_signal(&m_maintainerCond);
+  pthread_mutex_unlock(&m_maintainerLock);
+  pthread_join(m_maintainer, NULL);
+  m_maintainerRunning = false;
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    m_conns[idx].setManaged(false);
+  }
+}
+
+
+void ConnectionPool::maintain() {
+  for (size_t idx = 0; idx < m_nConns; ++idx) {
+    Connection* conn = m_conns + idx;
+    if (!conn->alive()) {
+      conn->reconnect();
+    }
+  }
+}
+
+
+void* ConnectionPool::maintainerLoop(void* pool) {
+  ConnectionPool* self = static_cast<ConnectionPool*>(pool);
+  pthread_mutex_lock(&self->m_maintainerLock);
+  while (!self->m_maintainerStopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    int64_t nsec = deadline.tv_nsec + (self->m_maintainInterval % 1000) * 1000000LL;
+    deadline.tv_sec += self->m_maintainInterval / 1000 + nsec / 1000000000LL;
+    deadline.tv_nsec = nsec % 1000000000LL;
+    pthread_cond_timedwait(&self->m_maintainerCond, &self->m_maintainerLock, &deadline);
+    if (self->m_maintainerStopping) {
+      break;
+    }
+    pthread_mutex_unlock(&self->m_maintainerLock);
+    self->maintain();
+    pthread_mutex_lock(&self->m_maintainerLock);
+  }
+  pthread_mutex_unlock(&self->m_maintainerLock);
+  return NULL;
+}
+
+
+// The connections on which nothing has been sent yet (started[i] is false)
+// fail the request too, but are still in sync and kept.
+void ConnectionPool::markDeadAll(pollfd_t* pollfds, const bool* started, err_code_t err,
+                                 const char* reason) {
+
+  nfds_t fd_idx = 0;
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+      it != m_activeConns.end();
+      ++it, ++fd_idx) {
+    Connection* conn = *it;
+    pollfd_t* pollfd_ptr = &pollfds[fd_idx];
+    if (pollfd_ptr->events & (POLLOUT | POLLIN)) {
+      if (started[fd_idx]) {
+        conn->markDead(reason);
+      }
+      conn->setOutcome(err);
+      conn->countError(err);
+    }
+  }
+}
+
+
+// Unlike markDeadAll, only give up the connections still waited for, and
+// keep those on which nothing has been sent yet.
+void ConnectionPool::abandonAll(pollfd_t* pollfds, const bool* started, const char* reason) {
   nfds_t fd_idx = 0;
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
       it != m_activeConns.end();
       ++it, ++fd_idx) {
     Connection* conn = *it;
     pollfd_t* pollfd_ptr = &pollfds[fd_idx];
+    if ((pollfd_ptr->events & (POLLOUT | POLLIN)) && started[fd_idx]) {
+      conn->abandon(reason);
+    }
     if (pollfd_ptr->events & (POLLOUT | POLLIN)) {
-      conn->markDead(reason);
+      conn->setOutcome(RET_POLL_TIMEOUT_ERR);
     }
+    pollfd_ptr->events = 0;
   }
 }
 
 
-void ConnectionPool::markDeadConn(Connection* conn, const char* reason, pollfd_t* fd_ptr) {
+void ConnectionPool::markDeadConn(Connection* conn, err_code_t err, const char* reason,
+                                  pollfd_t* fd_ptr) {
   conn->markDead(reason);
+  conn->setOutcome(err);
+  conn->countError(err);
   fd_ptr->events = ~POLLOUT & ~POLLIN;
   fd_ptr->fd = conn->socketFd();
 }
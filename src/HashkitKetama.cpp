@@ -40,12 +40,12 @@ void KetamaSelector::reset() {
   m_nServers = 0;
 }
 
-void KetamaSelector::addServers(Connection* conns, size_t nConns) {
+void KetamaSelector::addServers(Connection* conns, size_t nConns, size_t stride) {
 
   // from: libmemcached/libmemcached/hosts.cc +303
   char sort_host[MC_NI_MAXHOST + 1 + MC_NI_MAXSERV + 1 + MC_NI_MAXSERV]= "";
   for (size_t i = 0; i < nConns; i++) {
-    Connection* conn = &conns[i];
+    Connection* conn = &conns[i * stride];
     int sort_host_len = 0;
     for (size_t pointer_idx= 0; pointer_idx < s_pointerPerServer / s_pointerPerHash;
          pointer_idx++) {
@@ -0,0 +1,226 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <cstdio>
+#include "Common.h"
+#include "Logger.h"
+#include "Utility.h"
+
+namespace douban {
+namespace mc {
+namespace logging {
+
+int g_level = MC_LOG_LEVEL_ERROR;
+
+typedef struct {
+  int level;
+  const char* file;
+  unsigned int line;
+  uint32_t nSuppressed; // of the same call site before this message
+  char msg[MC_LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+typedef struct {
+  const char* file;
+  unsigned int line;
+  int64_t second;
+  uint32_t count;
+  uint32_t nSuppressed;
+} rate_slot_t;
+
+
+// the ring is filled by producers under s_lock and drained by the logger
+// thread, which calls the sink without s_lock on the entry at s_tail
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_idle = PTHREAD_COND_INITIALIZER;
+static log_entry_t s_ring[MC_LOG_RING_SIZE];
+static uint64_t s_head = 0;
+static uint64_t s_tail = 0;
+static rate_slot_t s_slots[MC_LOG_RATE_SLOTS];
+static uint64_t s_nDropped = 0; // updated atomically, also without s_lock
+static bool s_writerStarted = false;
+static bool s_atforkRegistered = false;
+static bool s_sinking = false;
+static log_sink_t s_sink = NULL;
+static void* s_sinkCtx = NULL;
+
+
+static const char* levelName(int level) {
+  switch (level) {
+    case MC_LOG_LEVEL_ERROR:
+      return "ERROR";
+    case MC_LOG_LEVEL_WARNING:
+      return "WARN";
+    case MC_LOG_LEVEL_INFO:
+      return "INFO";
+    default:
+      return "DEBUG";
+  }
+}
+
+
+static void emit(log_sink_t sink, void* ctx, int level, const char* file, unsigned int line,
+                 const char* msg) {
+  if (sink == NULL) {
+    fprintf(stderr, "[" PROJECT_NAME "] [%s] [%s:%u] %s\n", levelName(level), file, line, msg);
+    return;
+  }
+  sink(ctx, level, file, line, msg);
+}
+
+
+static void* writerLoop(void*) {
+  char summary[128];
+  pthread_mutex_lock(&s_lock);
+  for (;;) {
+    while (s_head == s_tail) {
+      pthread_cond_wait(&s_queued, &s_lock);
+    }
+    log_sink_t sink = s_sink;
+    void* ctx = s_sinkCtx;
+    log_entry_t* entry = &s_ring[s_tail % MC_LOG_RING_SIZE];
+    s_sinking = true;
+    pthread_mutex_unlock(&s_lock);
+
+    uint64_t nDropped = __atomic_exchange_n(&s_nDropped, 0, __ATOMIC_RELAXED);
+    if (nDropped > 0) {
+      snprintf(summary, sizeof summary, "%llu log messages dropped",
+               static_cast<unsigned long long>(nDropped));
+      emit(sink, ctx, MC_LOG_LEVEL_WARNING, __FILE__, __LINE__, summary);
+    }
+    if (entry->nSuppressed > 0) {
+      size_t len = strlen(entry->msg);
+      snprintf(entry->msg + len, sizeof entry->msg - len,
+               " (%u similar messages suppressed)", entry->nSuppressed);
+    }
+    emit(sink, ctx, entry->level, entry->file, entry->line, entry->msg);
+
+    pthread_mutex_lock(&s_lock);
+    s_tail++;
+    s_sinking = false;
+    pthread_cond_broadcast(&s_idle);
+  }
+  return NULL;
+}
+
+
+// the logger thread doesn't survive fork, start another one on demand
+static void resetAfterFork() {
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+  pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+  s_lock = lock;
+  s_queued = queued;
+  s_idle = idle;
+  s_writerStarted = false;
+  s_sinking = false;
+}
+
+
+// with s_lock held
+static bool startWriter() {
+  if (!s_atforkRegistered) {
+    pthread_atfork(NULL, NULL, resetAfterFork);
+    s_atforkRegistered = true;
+  }
+  pthread_t writer;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  s_writerStarted = pthread_create(&writer, &attr, writerLoop, NULL) == 0;
+  pthread_attr_destroy(&attr);
+  return s_writerStarted;
+}
+
+
+// with s_lock held, return NULL if the call site has logged too much
+static rate_slot_t* acquireSlot(const char* file, unsigned int line) {
+  size_t h = (reinterpret_cast<size_t>(file) >> 3) * 31 + line;
+  rate_slot_t* slot = &s_slots[h % MC_LOG_RATE_SLOTS];
+  int64_t second = utility::getCurrentMonotonicMs() / 1000;
+  if (slot->file != file || slot->line != line) {
+    // taken over by another call site, which is rare
+    __atomic_add_fetch(&s_nDropped, slot->nSuppressed, __ATOMIC_RELAXED);
+    slot->file = file;
+    slot->line = line;
+    slot->second = second;
+    slot->count = 0;
+    slot->nSuppressed = 0;
+  } else if (slot->second != second) {
+    slot->second = second;
+    slot->count = 0;
+  }
+  if (slot->count >= MC_LOG_RATE_LIMIT) {
+    slot->nSuppressed++;
+    return NULL;
+  }
+  slot->count++;
+  return slot;
+}
+
+
+void log(int level, const char* file, unsigned int line, const char* format, ...) {
+  if (pthread_mutex_trylock(&s_lock) != 0) {
+    __atomic_add_fetch(&s_nDropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  rate_slot_t* slot = acquireSlot(file, line);
+  if (slot == NULL) {
+    pthread_mutex_unlock(&s_lock);
+    return;
+  }
+  if (s_head - s_tail >= MC_LOG_RING_SIZE || (!s_writerStarted && !startWriter())) {
+    __atomic_add_fetch(&s_nDropped, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&s_lock);
+    return;
+  }
+
+  log_entry_t* entry = &s_ring[s_head % MC_LOG_RING_SIZE];
+  entry->level = level;
+  entry->file = file;
+  entry->line = line;
+  entry->nSuppressed = slot->nSuppressed;
+  slot->nSuppressed = 0;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(entry->msg, sizeof entry->msg, format, args);
+  va_end(args);
+  s_head++;
+  pthread_cond_signal(&s_queued);
+  pthread_mutex_unlock(&s_lock);
+}
+
+
+void setSink(log_sink_t sink, void* ctx) {
+  pthread_mutex_lock(&s_lock);
+  // the previous ctx may be released once returned
+  while (s_sinking) {
+    pthread_cond_wait(&s_idle, &s_lock);
+  }
+  s_sink = sink;
+  s_sinkCtx = ctx;
+  pthread_mutex_unlock(&s_lock);
+}
+
+
+void setLevel(int level) {
+  __atomic_store_n(&g_level, level, __ATOMIC_RELAXED);
+}
+
+
+int level() {
+  return __atomic_load_n(&g_level, __ATOMIC_RELAXED);
+}
+
+
+void flush() {
+  pthread_mutex_lock(&s_lock);
+  while (s_writerStarted && (s_head != s_tail || s_sinking)) {
+    pthread_cond_wait(&s_idle, &s_lock);
+  }
+  pthread_mutex_unlock(&s_lock);
+}
+
+} // namespace logging
+} // namespace mc
+} // namespace douban
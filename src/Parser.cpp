@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "Parser.h"
 #include "Keywords.h"
 
@@ -14,13 +16,17 @@ namespace mc {
 
 PacketParser::PacketParser(BufferReader* reader)
   : m_buffer_reader(NULL), m_state(FSM_START), m_mode(MODE_UNDEFINED),
-    m_expectedResultCount(0), mt_kvPtr(NULL) {
+    m_expectedResultCount(0), m_nEnds(1), m_valueSink(NULL), m_valueSinkCtx(NULL),
+    m_valueBuffer(NULL), m_valueBufferCtx(NULL), m_keyPrefixLen(0), m_decodingKeys(false),
+    mt_kvPtr(NULL) {
   m_buffer_reader = reader;
 }
 
 PacketParser::PacketParser()
   : m_buffer_reader(NULL), m_state(FSM_START), m_mode(MODE_UNDEFINED),
-    m_expectedResultCount(0), mt_kvPtr(NULL) {
+    m_expectedResultCount(0), m_nEnds(1), m_valueSink(NULL), m_valueSinkCtx(NULL),
+    m_valueBuffer(NULL), m_valueBufferCtx(NULL), m_keyPrefixLen(0), m_decodingKeys(false),
+    mt_kvPtr(NULL) {
 }
 
 
@@ -57,6 +63,63 @@ void PacketParser::processLineResult(err_code_t& err) {
 }
 
 
+// Hand the bytes of the value to the sink, or copy them to the buffer of the
+// caller, as they arrive, instead of buffering the whole value.
+void PacketParser::streamValue(err_code_t& err) {
+  err = RET_OK;
+  retrieval_result_t* header = mt_kvPtr->inner();
+  size_t readLeft = m_buffer_reader->readLeft();
+  if (readLeft < mt_kvPtr->bytesRemain + 2) {
+    m_buffer_reader->setNextPreferedDataBlockSize(
+        std::min(mt_kvPtr->bytesRemain + 2 - readLeft, static_cast<size_t>(MC_SINK_BLOCK_SIZE)));
+  }
+  while (mt_kvPtr->bytesRemain > 0) {
+    const char* data = NULL;
+    size_t n = m_buffer_reader->readPiece(mt_kvPtr->bytesRemain, data);
+    if (n == 0) {
+      err = RET_INCOMPLETE_BUFFER_ERR;
+      return;
+    }
+    size_t offset = mt_kvPtr->bytes - mt_kvPtr->bytesRemain;
+    if (header->data_block != NULL) {
+      memcpy(header->data_block + offset, data, n);
+    } else {
+      m_valueSink(m_valueSinkCtx, header, offset, data, n);
+    }
+    mt_kvPtr->bytesRemain -= n;
+  }
+}
+
+
+void PacketParser::setValueSink(value_sink_t sink, void* ctx) {
+  m_valueSink = sink;
+  m_valueSinkCtx = ctx;
+}
+
+
+// one END for each of the retrieval commands pipelined, SEE
+// ConnectionPool::setMaxGetSize
+void PacketParser::setEndCount(size_t n) {
+  m_nEnds = n > 0 ? n : 1;
+}
+
+
+void PacketParser::setKeyPrefixLen(size_t len) {
+  m_keyPrefixLen = static_cast<uint8_t>(len);
+}
+
+
+void PacketParser::setDecodingKeys(bool enabled) {
+  m_decodingKeys = enabled;
+}
+
+
+void PacketParser::setValueBuffer(value_buffer_t buffer, void* ctx) {
+  m_valueBuffer = buffer;
+  m_valueBufferCtx = ctx;
+}
+
+
 void PacketParser::setBufferReader(BufferReader* reader) {
   m_buffer_reader = reader;
 }
@@ -122,6 +185,8 @@ void PacketParser::process_packets(err_code_t& err) {
           if (err != RET_OK) {
             return;
           }
+          mt_kvPtr->prefix_len = mt_kvPtr->key_len > m_keyPrefixLen ? m_keyPrefixLen : 0;
+          mt_kvPtr->decoding_key = m_decodingKeys;
           SKIP_BYTES(1);  // " "
           m_state = FSM_GET_KEY;
         }
@@ -169,9 +234,20 @@ void PacketParser::process_packets(err_code_t& err) {
           if (mt_kvPtr->bytesRemain == mt_kvPtr->bytes + 1) {
             SKIP_BYTES(1);
             --mt_kvPtr->bytesRemain;
+            if (m_valueSink != NULL && mt_kvPtr->bytes == 0) {
+              m_valueSink(m_valueSinkCtx, mt_kvPtr->inner(), 0, NULL, 0);
+            } else if (m_valueBuffer != NULL) {
+              mt_kvPtr->setExternal(m_valueBuffer(m_valueBufferCtx, mt_kvPtr->inner()));
+            }
           }
 
-          if (mt_kvPtr->bytesRemain == mt_kvPtr->bytes) {
+          if (m_valueSink != NULL ||
+              (m_valueBuffer != NULL && mt_kvPtr->inner()->data_block != NULL)) {
+            streamValue(err);
+            if (err != RET_OK) {
+              return;
+            }
+          } else if (mt_kvPtr->bytesRemain == mt_kvPtr->bytes) {
             mt_kvPtr->data_block.clear();
             if (m_buffer_reader->readLeft() < mt_kvPtr->bytes + 2) {
               m_buffer_reader->setNextPreferedDataBlockSize(mt_kvPtr->bytes + 2 - m_buffer_reader->readLeft());
@@ -318,7 +394,13 @@ int PacketParser::start_state(err_code_t& err) {
         } else if (c2 == 'N') {
           // END
           EXPECT_BYTES("END\r\n", 5);
-          m_state = FSM_END;
+          if (m_nEnds > 1) {
+            // of a command, more to come
+            --m_nEnds;
+            m_state = FSM_START;
+          } else {
+            m_state = FSM_END;
+          }
         } else if (c2 == 'X') {
           // EXISTS
           EXPECT_BYTES("EXISTS\r\n", 8);
@@ -460,6 +542,7 @@ void PacketParser::reset() {
   m_state = FSM_START;
   m_mode = MODE_UNDEFINED;
   m_expectedResultCount = 0;
+  m_nEnds = 1;
 }
 
 
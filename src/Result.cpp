@@ -1,5 +1,6 @@
 #include "Result.h"
 #include "Common.h"
+#include "Utility.h"
 
 namespace douban {
 namespace mc {
@@ -12,8 +13,12 @@ RetrievalResult::RetrievalResult() {
   this->bytesRemain = this->bytes + 1;
   this->flags = 0;
   this->key_len = 0;
+  this->prefix_len = 0;
+  this->decoding_key = false;
   m_inner.key = NULL;
   m_inner.data_block = NULL;
+  m_decoded = NULL;
+  m_external = NULL;
 }
 
 RetrievalResult::RetrievalResult(const RetrievalResult& other) {
@@ -25,16 +30,27 @@ RetrievalResult::RetrievalResult(const RetrievalResult& other) {
   this->bytes = other.bytes;
   this->flags = other.flags;
   this->key_len = other.key_len;
+  this->prefix_len = other.prefix_len;
+  this->decoding_key = other.decoding_key;
   this->m_inner.key = NULL;
   this->m_inner.data_block = NULL;
+  this->m_decoded = NULL;
+  this->m_external = other.m_external;
+  if (other.m_decoded != NULL) {
+    this->m_decoded = new char[other.bytes];
+    memcpy(this->m_decoded, other.m_decoded, other.bytes);
+    this->m_inner.data_block = this->m_decoded;
+  }
 }
 
 
 RetrievalResult::~RetrievalResult() {
-  if (key.size() > 1) { // copy happened
-    delete[] m_inner.key;
+  if (key.size() > 1 && m_inner.key != NULL) { // copy happened
+    delete[] (m_inner.key - prefix_len);
   }
-  if (data_block.size() > 1) {
+  if (m_decoded != NULL) {
+    delete[] m_decoded;
+  } else if (data_block.size() > 1) {
     delete[] m_inner.data_block;
   }
   freeTokenData(key);
@@ -43,19 +59,61 @@ RetrievalResult::~RetrievalResult() {
 
 retrieval_result_t* RetrievalResult::inner() {
   if (m_inner.key == NULL) {
-    m_inner.key = parseTokenData(this->key, this->key_len);
+    char* key = parseTokenData(this->key, this->key_len);
+    // "?" + prefix + key is returned as "?" + key
+    if (this->prefix_len > 0 && key[0] == '?') {
+      key[this->prefix_len] = '?';
+    }
+    m_inner.key = key + this->prefix_len;
+    m_inner.key_len = this->key_len - this->prefix_len; // 1B
+    if (this->decoding_key) {
+      decodeKey();
+    }
   }
-  if (m_inner.data_block == NULL) {
+  // a value streamed to a sink has no data block, SEE PacketParser::streamValue
+  if (m_inner.data_block == NULL && m_external != NULL) {
+    m_inner.data_block = m_external;
+  } else if (m_inner.data_block == NULL && !this->data_block.empty()) {
     m_inner.data_block = parseTokenData(this->data_block, this->bytes);
   }
   m_inner.cas_unique = this->cas_unique; // 8B
   m_inner.bytes = this->bytes; // 4B
   m_inner.flags = this->flags;  // 2B
-  m_inner.key_len = this->key_len; // 1B
   return &m_inner;
 }
 
 
+// decode a key encoded by ConnectionPool::wireKey in place, after its "?"
+void RetrievalResult::decodeKey() {
+  size_t mark = m_inner.key_len > 0 && m_inner.key[0] == '?' ? 1 : 0;
+  char* encoded = m_inner.key + mark;
+  size_t len = m_inner.key_len - mark;
+  size_t decodedLen = 0;
+  if (len > 0 && encoded[0] == MC_ENCODED_KEY_MARKER &&
+      utility::base64Decode(encoded + 1, len - 1, encoded, decodedLen)) {
+    m_inner.key_len = static_cast<uint8_t>(mark + decodedLen);
+  }
+}
+
+void RetrievalResult::setExternal(char* data) {
+  m_external = data;
+  m_inner.data_block = data;
+}
+
+
+void RetrievalResult::setDecoded(char* data, uint32_t bytes, flags_t flags) {
+  if (m_decoded != NULL) {
+    delete[] m_decoded;
+  } else if (data_block.size() > 1) {
+    delete[] m_inner.data_block;
+  }
+  m_decoded = data;
+  m_inner.data_block = data;
+  m_inner.bytes = this->bytes = bytes;
+  m_inner.flags = this->flags = flags;
+}
+
+
 LineResult::LineResult() {
   this->m_inner = NULL;
   this->line_len = 0;
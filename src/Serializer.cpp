@@ -0,0 +1,455 @@
+#include <cstring>
+
+#include "Serializer.h"
+#include "Utility.h"
+
+#define MC_MAX_SERIALIZERS 32
+#define MC_FLAG_NOT_SERIALIZER (MC_FLAG_COMPRESS_MASK | MC_FLAG_CHUNKED)
+
+namespace douban {
+namespace mc {
+namespace serializer {
+
+
+static value_node_t makeNode(value_type_t type) {
+  value_node_t node;
+  memset(&node, 0, sizeof node);
+  node.type = type;
+  return node;
+}
+
+
+static bool serializeRaw(const value_node_t* nodes, size_t nNodes, std::string& out) {
+  if (nNodes != 1 || (nodes[0].type != VALUE_BIN && nodes[0].type != VALUE_STR)) {
+    return false;
+  }
+  if (nodes[0].size > 0) {
+    out.append(nodes[0].data, nodes[0].size);
+  }
+  return true;
+}
+
+
+static bool deserializeRaw(const char* val, size_t len, std::vector<value_node_t>& nodes) {
+  if (len > UINT32_MAX) {
+    return false;
+  }
+  value_node_t node = makeNode(VALUE_BIN);
+  node.size = static_cast<uint32_t>(len);
+  node.data = val;
+  nodes.push_back(node);
+  return true;
+}
+
+
+static bool serializeInteger(const value_node_t* nodes, size_t nNodes, std::string& out) {
+  char buf[24];
+  if (nNodes != 1) {
+    return false;
+  }
+  if (nodes[0].type == VALUE_INT) {
+    out.append(buf, utility::int64ToCharArray(nodes[0].integer, buf));
+  } else if (nodes[0].type == VALUE_UINT) {
+    char* end = ::rapidjson::internal::u64toa(static_cast<uint64_t>(nodes[0].integer), buf);
+    out.append(buf, end - buf);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+// a decimal of int64 or uint64
+static bool parseInteger(const char* val, size_t len, value_node_t& node) {
+  bool negative = len > 0 && val[0] == '-';
+  size_t i = negative ? 1 : 0;
+  if (i == len) {
+    return false;
+  }
+  uint64_t n = 0;
+  for (; i < len; ++i) {
+    if (val[i] < '0' || val[i] > '9') {
+      return false;
+    }
+    uint64_t digit = val[i] - '0';
+    if (n > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    n = n * 10 + digit;
+  }
+  if (negative) {
+    if (n > static_cast<uint64_t>(INT64_MAX) + 1) {
+      return false;
+    }
+    node.type = VALUE_INT;
+    node.integer = static_cast<int64_t>(0 - n);
+  } else {
+    node.type = n > static_cast<uint64_t>(INT64_MAX) ? VALUE_UINT : VALUE_INT;
+    node.integer = static_cast<int64_t>(n);
+  }
+  return true;
+}
+
+
+static bool deserializeInteger(const char* val, size_t len, std::vector<value_node_t>& nodes) {
+  value_node_t node = makeNode(VALUE_INT);
+  if (!parseInteger(val, len, node)) {
+    return false;
+  }
+  nodes.push_back(node);
+  return true;
+}
+
+
+static bool serializeBool(const value_node_t* nodes, size_t nNodes, std::string& out) {
+  if (nNodes != 1 || nodes[0].type != VALUE_BOOL) {
+    return false;
+  }
+  out.push_back(nodes[0].integer ? '1' : '0');
+  return true;
+}
+
+
+// any int, as the Python binding reads it
+static bool deserializeBool(const char* val, size_t len, std::vector<value_node_t>& nodes) {
+  value_node_t node = makeNode(VALUE_BOOL);
+  if (!parseInteger(val, len, node)) {
+    return false;
+  }
+  node.type = VALUE_BOOL;
+  node.integer = node.integer != 0;
+  nodes.push_back(node);
+  return true;
+}
+
+
+static void putBigEndian(std::string& out, uint8_t code, uint64_t v, int n) {
+  out.push_back(static_cast<char>(code));
+  for (int i = n - 1; i >= 0; --i) {
+    out.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+  }
+}
+
+
+static void putInteger(std::string& out, int64_t v) {
+  if (v >= 0) {
+    uint64_t u = static_cast<uint64_t>(v);
+    if (u <= 0x7f) {
+      out.push_back(static_cast<char>(u));
+    } else if (u <= 0xff) {
+      putBigEndian(out, 0xcc, u, 1);
+    } else if (u <= 0xffff) {
+      putBigEndian(out, 0xcd, u, 2);
+    } else if (u <= 0xffffffff) {
+      putBigEndian(out, 0xce, u, 4);
+    } else {
+      putBigEndian(out, 0xcf, u, 8);
+    }
+  } else if (v >= -32) {
+    out.push_back(static_cast<char>(v));
+  } else if (v >= INT8_MIN) {
+    putBigEndian(out, 0xd0, static_cast<uint64_t>(v), 1);
+  } else if (v >= INT16_MIN) {
+    putBigEndian(out, 0xd1, static_cast<uint64_t>(v), 2);
+  } else if (v >= INT32_MIN) {
+    putBigEndian(out, 0xd2, static_cast<uint64_t>(v), 4);
+  } else {
+    putBigEndian(out, 0xd3, static_cast<uint64_t>(v), 8);
+  }
+}
+
+
+// the header of a str, bin, array or map of size, in the smallest format,
+// a 0 code for a format the type doesn't have
+static void putSize(std::string& out, uint32_t size, uint8_t fixCode, uint32_t fixMax,
+                    uint8_t code8, uint8_t code16, uint8_t code32) {
+  if (fixCode != 0 && size <= fixMax) {
+    out.push_back(static_cast<char>(fixCode | size));
+  } else if (code8 != 0 && size <= 0xff) {
+    putBigEndian(out, code8, size, 1);
+  } else if (size <= 0xffff) {
+    putBigEndian(out, code16, size, 2);
+  } else {
+    putBigEndian(out, code32, size, 4);
+  }
+}
+
+
+static bool serializeMsgpack(const value_node_t* nodes, size_t nNodes, std::string& out) {
+  size_t offset = out.size();
+  // the values still to be written, the root then the items of containers
+  uint64_t pending = 1;
+  for (size_t i = 0; i < nNodes; ++i) {
+    const value_node_t& node = nodes[i];
+    if (pending == 0) {
+      out.resize(offset);
+      return false;
+    }
+    --pending;
+    switch (node.type) {
+      case VALUE_NIL:
+        out.push_back('\xc0');
+        break;
+      case VALUE_BOOL:
+        out.push_back(node.integer ? '\xc3' : '\xc2');
+        break;
+      case VALUE_INT:
+        putInteger(out, node.integer);
+        break;
+      case VALUE_UINT:
+        putBigEndian(out, 0xcf, static_cast<uint64_t>(node.integer), 8);
+        break;
+      case VALUE_FLOAT: {
+        uint64_t bits;
+        memcpy(&bits, &node.real, sizeof bits);
+        putBigEndian(out, 0xcb, bits, 8);
+        break;
+      }
+      case VALUE_STR:
+      case VALUE_BIN:
+        if (node.type == VALUE_STR) {
+          putSize(out, node.size, 0xa0, 0x1f, 0xd9, 0xda, 0xdb);
+        } else {
+          putSize(out, node.size, 0, 0, 0xc4, 0xc5, 0xc6);
+        }
+        if (node.size > 0) {
+          out.append(node.data, node.size);
+        }
+        break;
+      case VALUE_ARRAY:
+        putSize(out, node.size, 0x90, 0x0f, 0, 0xdc, 0xdd);
+        pending += node.size;
+        break;
+      case VALUE_MAP:
+        putSize(out, node.size, 0x80, 0x0f, 0, 0xde, 0xdf);
+        pending += 2 * static_cast<uint64_t>(node.size);
+        break;
+      default:
+        out.resize(offset);
+        return false;
+    }
+  }
+  if (pending != 0) {
+    out.resize(offset);
+    return false;
+  }
+  return true;
+}
+
+
+static bool readBigEndian(const uint8_t*& p, const uint8_t* end, int n, uint64_t& v) {
+  if (end - p < n) {
+    return false;
+  }
+  v = 0;
+  for (int i = 0; i < n; ++i) {
+    v = (v << 8) | *p++;
+  }
+  return true;
+}
+
+
+// sign-extend the n-byte two's complement v
+static int64_t toSigned(uint64_t v, int n) {
+  int shift = 64 - n * 8;
+  return static_cast<int64_t>(v << shift) >> shift;
+}
+
+
+// every value is stored as its own node, there is no recursion, so that
+// neither a deep nor a huge document can overflow the stack
+static bool parseMsgpack(const uint8_t* p, const uint8_t* end,
+                         std::vector<value_node_t>& nodes) {
+  uint64_t pending = 1;
+  while (pending > 0) {
+    // each value takes a byte at least
+    if (pending > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    --pending;
+    uint8_t code = *p++;
+    value_node_t node = makeNode(VALUE_NIL);
+    uint64_t v = 0;
+    int sizeBytes = 0;
+    if (code <= 0x7f) {
+      node.type = VALUE_INT;
+      node.integer = code;
+    } else if (code >= 0xe0) {
+      node.type = VALUE_INT;
+      node.integer = static_cast<int8_t>(code);
+    } else if (code <= 0x8f) {
+      node.type = VALUE_MAP;
+      v = code & 0x0f;
+    } else if (code <= 0x9f) {
+      node.type = VALUE_ARRAY;
+      v = code & 0x0f;
+    } else if (code <= 0xbf) {
+      node.type = VALUE_STR;
+      v = code & 0x1f;
+    } else {
+      switch (code) {
+        case 0xc0:
+          break;
+        case 0xc2:
+        case 0xc3:
+          node.type = VALUE_BOOL;
+          node.integer = code == 0xc3;
+          break;
+        case 0xc4: case 0xc5: case 0xc6:
+          node.type = VALUE_BIN;
+          sizeBytes = 1 << (code - 0xc4);
+          break;
+        case 0xca: {
+          if (!readBigEndian(p, end, 4, v)) {
+            return false;
+          }
+          uint32_t bits = static_cast<uint32_t>(v);
+          float f;
+          memcpy(&f, &bits, sizeof f);
+          node.type = VALUE_FLOAT;
+          node.real = f;
+          break;
+        }
+        case 0xcb:
+          if (!readBigEndian(p, end, 8, v)) {
+            return false;
+          }
+          node.type = VALUE_FLOAT;
+          memcpy(&node.real, &v, sizeof node.real);
+          break;
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+          if (!readBigEndian(p, end, 1 << (code - 0xcc), v)) {
+            return false;
+          }
+          node.type = v > static_cast<uint64_t>(INT64_MAX) ? VALUE_UINT : VALUE_INT;
+          node.integer = static_cast<int64_t>(v);
+          break;
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+          if (!readBigEndian(p, end, 1 << (code - 0xd0), v)) {
+            return false;
+          }
+          node.type = VALUE_INT;
+          node.integer = toSigned(v, 1 << (code - 0xd0));
+          break;
+        case 0xd9: case 0xda: case 0xdb:
+          node.type = VALUE_STR;
+          sizeBytes = 1 << (code - 0xd9);
+          break;
+        case 0xdc: case 0xdd:
+          node.type = VALUE_ARRAY;
+          sizeBytes = 2 << (code - 0xdc);
+          break;
+        case 0xde: case 0xdf:
+          node.type = VALUE_MAP;
+          sizeBytes = 2 << (code - 0xde);
+          break;
+        default:
+          // never used (0xc1) or an extension
+          return false;
+      }
+    }
+    if (sizeBytes > 0 && !readBigEndian(p, end, sizeBytes, v)) {
+      return false;
+    }
+    switch (node.type) {
+      case VALUE_STR:
+      case VALUE_BIN:
+        if (v > static_cast<uint64_t>(end - p)) {
+          return false;
+        }
+        node.size = static_cast<uint32_t>(v);
+        node.data = reinterpret_cast<const char*>(p);
+        p += v;
+        break;
+      case VALUE_ARRAY:
+        node.size = static_cast<uint32_t>(v);
+        pending += v;
+        break;
+      case VALUE_MAP:
+        node.size = static_cast<uint32_t>(v);
+        pending += 2 * v;
+        break;
+      default:
+        break;
+    }
+    nodes.push_back(node);
+  }
+  return p == end;
+}
+
+
+static bool deserializeMsgpack(const char* val, size_t len, std::vector<value_node_t>& nodes) {
+  size_t nNodes = nodes.size();
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(val);
+  if (!parseMsgpack(p, p + len, nodes)) {
+    nodes.resize(nNodes);
+    return false;
+  }
+  return true;
+}
+
+
+// in the order the Python binding checks the flags
+static serializer_t g_serializers[MC_MAX_SERIALIZERS] = {
+  {0, "raw", serializeRaw, deserializeRaw},
+  {MC_FLAG_BOOL, "bool", serializeBool, deserializeBool},
+  {MC_FLAG_INTEGER, "integer", serializeInteger, deserializeInteger},
+  {MC_FLAG_LONG, "long", serializeInteger, deserializeInteger},
+  {MC_FLAG_MARSHAL, "marshal", NULL, NULL},
+  {MC_FLAG_PICKLE, "pickle", NULL, NULL},
+  {MC_FLAG_MSGPACK, "msgpack", serializeMsgpack, deserializeMsgpack},
+};
+static size_t g_nSerializers = 7;
+
+
+const serializer_t* find(flags_t flags) {
+  flags &= ~MC_FLAG_NOT_SERIALIZER;
+  if (flags == 0) {
+    return &g_serializers[0];
+  }
+  for (size_t i = 1; i < g_nSerializers; ++i) {
+    if (flags & g_serializers[i].flag) {
+      return &g_serializers[i];
+    }
+  }
+  return NULL;
+}
+
+
+bool add(const serializer_t& serializer) {
+  flags_t flag = serializer.flag;
+  if (flag == 0 || (flag & (flag - 1)) != 0 || (flag & MC_FLAG_NOT_SERIALIZER)) {
+    log_warn("serializer %s must be of a single flag bit, not %u", serializer.name, flag);
+    return false;
+  }
+  for (size_t i = 1; i < g_nSerializers; ++i) {
+    if (g_serializers[i].flag == flag) {
+      log_warn("flag %u is of serializer %s already", flag, g_serializers[i].name);
+      return false;
+    }
+  }
+  if (g_nSerializers == MC_MAX_SERIALIZERS) {
+    return false;
+  }
+  g_serializers[g_nSerializers++] = serializer;
+  return true;
+}
+
+
+bool serialize(flags_t flag, const value_node_t* nodes, size_t nNodes, std::string& out) {
+  const serializer_t* s = find(flag);
+  return s != NULL && s->serialize != NULL && s->serialize(nodes, nNodes, out);
+}
+
+
+bool deserialize(const char* val, size_t len, flags_t flags, std::vector<value_node_t>& nodes) {
+  if (flags & MC_FLAG_NOT_SERIALIZER) {
+    return false;
+  }
+  const serializer_t* s = find(flags);
+  return s != NULL && s->deserialize != NULL && s->deserialize(val, len, nodes);
+}
+
+} // namespace serializer
+} // namespace mc
+} // namespace douban
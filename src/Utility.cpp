@@ -1,6 +1,10 @@
 #include "Utility.h"
 #include "Common.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace douban {
 namespace mc {
 namespace utility {
@@ -16,25 +20,125 @@ bool isValidKey(const char* key, const size_t keylen) {
   if (keylen > MC_MAX_KEY_LENGTH) {
     HANDLE_BAD_MC_KEY();
   }
+  if (findInvalidKeyByte(key, keylen) != keylen) {
+    HANDLE_BAD_MC_KEY();
+  }
+  return true;
+}
+
+
+static inline bool isInvalidKeyByte(char c) {
+  switch (c) {
+    case ' ':
+    case '\r':
+    case '\n':
+    case 0:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+// 16 bytes a time with SSE2, the baseline of x86-64
+size_t findInvalidKeyByte(const char* key, const size_t keylen) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i nul = _mm_setzero_si128();
+  for (; i + 16 <= keylen; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + i));
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, cr)),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, nul)));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < keylen; ++i) {
+    if (isInvalidKeyByte(key[i])) {
+      return i;
+    }
+  }
+  return keylen;
+}
+
+
+static const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+
+size_t base64Encode(const char* src, size_t len, char* out) {
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+  char* p = out;
+  size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+    *p++ = kBase64Chars[v >> 18];
+    *p++ = kBase64Chars[(v >> 12) & 0x3f];
+    *p++ = kBase64Chars[(v >> 6) & 0x3f];
+    *p++ = kBase64Chars[v & 0x3f];
+  }
+  if (i < len) {
+    uint32_t v = in[i] << 16;
+    if (i + 1 < len) {
+      v |= in[i + 1] << 8;
+    }
+    *p++ = kBase64Chars[v >> 18];
+    *p++ = kBase64Chars[(v >> 12) & 0x3f];
+    if (i + 1 < len) {
+      *p++ = kBase64Chars[(v >> 6) & 0x3f];
+    }
+  }
+  return p - out;
+}
+
 
-  for (size_t i = 0; i < keylen; i++) {
-    switch (key[i]) {
-      case ' ':
-        HANDLE_BAD_MC_KEY();
-        break;
-      case '\r':
-        HANDLE_BAD_MC_KEY();
-        break;
-      case '\n':
-        HANDLE_BAD_MC_KEY();
-        break;
-      case 0:
-        HANDLE_BAD_MC_KEY();
-        break;
-      default:
-        break;
+static inline int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  } else if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  } else if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  } else if (c == '-') {
+    return 62;
+  } else if (c == '_') {
+    return 63;
+  }
+  return -1;
+}
+
+
+bool base64Decode(const char* src, size_t len, char* out, size_t& outLen) {
+  if (len % 4 == 1) {
+    return false;
+  }
+  char* p = out;
+  for (size_t i = 0; i < len; i += 4) {
+    size_t n = len - i < 4 ? len - i : 4;
+    uint32_t v = 0;
+    for (size_t j = 0; j < 4; ++j) {
+      int d = j < n ? base64Value(src[i + j]) : 0;
+      if (d < 0) {
+        return false;
+      }
+      v = (v << 6) | d;
+    }
+    // all of src[i, i + 4) is read before writing out[0, 3) of it
+    *p++ = static_cast<char>(v >> 16);
+    if (n > 2) {
+      *p++ = static_cast<char>(v >> 8);
+    }
+    if (n > 3) {
+      *p++ = static_cast<char>(v);
     }
   }
+  outLen = p - out;
   return true;
 }
 
@@ -1,5 +1,7 @@
 #include "c_client.h"
 #include "Client.h"
+#include "Serializer.h"
+#include "Utility.h"
 
 
 using douban::mc::Client;
@@ -28,6 +30,18 @@ void client_config(void* client, config_options_t opt, int val) {
 }
 
 
+void client_set_deadline(void* client, int timeout) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->setDeadline(timeout);
+}
+
+
+void client_clear_deadline(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->clearDeadline();
+}
+
+
 void client_destroy(void* client) {
   douban::mc::Client* c = static_cast<Client*>(client);
   delete c;
@@ -68,6 +82,33 @@ IMPL_RETRIEVAL_CMD(get)
 IMPL_RETRIEVAL_CMD(gets)
 #undef IMPL_RETRIEVAL_CMD
 
+#define IMPL_TOUCHING_RETRIEVAL_CMD(M) \
+int client_##M(void* client, const char* const* keys, const size_t* key_lens, \
+               size_t n_keys, const exptime_t exptime, \
+               retrieval_result_t*** results, size_t* n_results) { \
+  douban::mc::Client* c = static_cast<Client*>(client); \
+  return c->M(keys, key_lens, n_keys, exptime, results, n_results); \
+}
+IMPL_TOUCHING_RETRIEVAL_CMD(gat)
+IMPL_TOUCHING_RETRIEVAL_CMD(gats)
+#undef IMPL_TOUCHING_RETRIEVAL_CMD
+
+
+int client_get_stream(void* client, const char* const* keys, const size_t* key_lens,
+                      size_t n_keys, value_sink_t sink, void* ctx,
+                      retrieval_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->getStream(keys, key_lens, n_keys, sink, ctx, results, n_results);
+}
+
+
+int client_get_into(void* client, const char* const* keys, const size_t* key_lens,
+                    size_t n_keys, char* arena, const size_t* offsets, const size_t* sizes,
+                    retrieval_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->getInto(keys, key_lens, n_keys, arena, offsets, sizes, results, n_results);
+}
+
 
 void client_destroy_retrieval_result(void* client) {
   douban::mc::Client* c = static_cast<Client*>(client);
@@ -95,6 +136,24 @@ IMPL_STORAGE_CMD(cas)
 #undef IMPL_STORAGE_CMD
 
 
+#define IMPL_STORAGE_MULTI_CMD(M) \
+int client_##M##_multi(void* client, const char* const* keys, const size_t* key_lens, \
+                       const flags_t* flags, const exptime_t* exptimes, \
+                       const cas_unique_t* cas_uniques, const bool noreply, \
+                       const char* const* vals, const size_t* val_lens, \
+                       size_t nItems, message_result_t*** results, size_t* n_results) { \
+  douban::mc::Client* c = static_cast<Client*>(client); \
+  return c->M##Multi(keys, key_lens, flags, exptimes, cas_uniques, \
+                     noreply, vals, val_lens, nItems, results, n_results); \
+}
+
+IMPL_STORAGE_MULTI_CMD(set)
+IMPL_STORAGE_MULTI_CMD(add)
+IMPL_STORAGE_MULTI_CMD(replace)
+IMPL_STORAGE_MULTI_CMD(cas)
+#undef IMPL_STORAGE_MULTI_CMD
+
+
 int client_touch(void* client, const char* const* keys, const size_t* key_lens,
                  const exptime_t exptime, const bool noreply, size_t n_items,
                  message_result_t*** results, size_t* n_results) {
@@ -103,12 +162,26 @@ int client_touch(void* client, const char* const* keys, const size_t* key_lens,
 }
 
 
+int client_touch_multi(void* client, const char* const* keys, const size_t* key_lens,
+                       const exptime_t* exptimes, const bool noreply, size_t n_items,
+                       message_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->touchMulti(keys, key_lens, exptimes, noreply, n_items, results, n_results);
+}
+
+
 void client_destroy_message_result(void* client) {
   douban::mc::Client* c = static_cast<Client*>(client);
   return c->destroyMessageResult();
 }
 
 
+void client_get_key_statuses(void* client, key_status_t** statuses, size_t* n_keys) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->getKeyStatuses(statuses, n_keys);
+}
+
+
 int client_delete(void*client, const char* const* keys, const size_t* key_lens,
                   const bool noreply, size_t n_items,
                   message_result_t*** results, size_t* n_results) {
@@ -132,6 +205,22 @@ int client_decr(void* client, const char* key, const size_t keyLen,
   return c->decr(key, keyLen, delta, noreply, results, n_results);
 }
 
+
+int client_incr_multi(void* client, const char* const* keys, const size_t* key_lens,
+                      const uint64_t* deltas, const bool noreply, size_t n_items,
+                      unsigned_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->incrMulti(keys, key_lens, deltas, noreply, n_items, results, n_results);
+}
+
+
+int client_decr_multi(void* client, const char* const* keys, const size_t* key_lens,
+                      const uint64_t* deltas, const bool noreply, size_t n_items,
+                      unsigned_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->decrMulti(keys, key_lens, deltas, noreply, n_items, results, n_results);
+}
+
 void client_destroy_unsigned_result(void* client) {
   douban::mc::Client* c = static_cast<Client*>(client);
   return c->destroyUnsignedResult();
@@ -142,7 +231,85 @@ int client_stats(void* client, broadcast_result_t** results, size_t* n_servers)
   return c->stats(results, n_servers);
 }
 
+void client_get_metrics(void* client, server_metrics_t** metrics, size_t* n_servers) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->getMetrics(metrics, n_servers);
+}
+
+void client_reset_metrics(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->resetMetrics();
+}
+
+void client_set_trace_hook(void* client, trace_hook_t hook, void* ctx) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  c->setTraceHook(hook, ctx);
+}
+
+int client_set_compress_dict(void* client, const char* dict, size_t len) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->setCompressDictionary(dict, len);
+}
+
+int client_set_key_prefix(void* client, const char* prefix, size_t len) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->setKeyPrefix(prefix, len);
+}
+
 int client_quit(void* client) {
   douban::mc::Client* c = static_cast<Client*>(client);
   return c->quit();
 }
+
+void mc_set_log_sink(log_sink_t sink, void* ctx) {
+  douban::mc::logging::setSink(sink, ctx);
+}
+
+void mc_set_log_level(int level) {
+  douban::mc::logging::setLevel(level);
+}
+
+void mc_flush_log() {
+  douban::mc::logging::flush();
+}
+
+int64_t mc_monotonic_us() {
+  return douban::mc::utility::getCurrentMonotonicUs();
+}
+
+bool mc_compress_codec_available(compress_codec_options_t codec) {
+  return douban::mc::Codec::isAvailable(codec);
+}
+
+
+const char* mc_serializer_name(flags_t flags) {
+  const douban::mc::serializer::serializer_t* s = douban::mc::serializer::find(flags);
+  return s == NULL ? NULL : s->name;
+}
+
+
+bool mc_serialize(flags_t flag, const value_node_t* nodes, size_t n_nodes,
+                  char** out, size_t* out_len) {
+  std::string buf;
+  if (!douban::mc::serializer::serialize(flag, nodes, n_nodes, buf)) {
+    return false;
+  }
+  *out = static_cast<char*>(malloc(buf.size() > 0 ? buf.size() : 1));
+  memcpy(*out, buf.data(), buf.size());
+  *out_len = buf.size();
+  return true;
+}
+
+
+bool mc_deserialize(const char* val, size_t len, flags_t flags,
+                    value_node_t** nodes, size_t* n_nodes) {
+  std::vector<value_node_t> buf;
+  if (!douban::mc::serializer::deserialize(val, len, flags, buf)) {
+    return false;
+  }
+  *nodes = static_cast<value_node_t*>(malloc((buf.size() > 0 ? buf.size() : 1) *
+                                             sizeof(value_node_t)));
+  memcpy(*nodes, buf.data(), buf.size() * sizeof(value_node_t));
+  *n_nodes = buf.size();
+  return true;
+}
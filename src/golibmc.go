@@ -2,12 +2,18 @@ package golibmc
 
 /*
 #cgo CFLAGS: -I ./../include
-#cgo CXXFLAGS: -I ./../include
+#cgo CXXFLAGS: -I ./../include -DMC_USE_ZLIB
+#cgo LDFLAGS: -lz
 #include "c_client.h"
+
+extern void goLogSink(void* ctx, int level, char* file, unsigned int line, char* msg);
+extern void goTraceHook(void* ctx, trace_span_t* span);
 */
 import "C"
 import (
 	"errors"
+	"math"
+	"reflect"
 	"runtime"
 	"strconv"
 	"strings"
@@ -18,11 +24,54 @@ import (
 
 // Configure options
 const (
-	PollTimeout    = C.CFG_POLL_TIMEOUT
-	ConnectTimeout = C.CFG_CONNECT_TIMEOUT
-	RetryTimeout   = C.CFG_RETRY_TIMEOUT
+	PollTimeout      = C.CFG_POLL_TIMEOUT
+	ConnectTimeout   = C.CFG_CONNECT_TIMEOUT
+	RetryTimeout     = C.CFG_RETRY_TIMEOUT
+	MaxRetryTimeout  = C.CFG_MAX_RETRY_TIMEOUT
+	MaintainInterval = C.CFG_MAINTAIN_INTERVAL
+	KeepaliveIdle    = C.CFG_KEEPALIVE_IDLE
+	RequestTimeout   = C.CFG_REQUEST_TIMEOUT
+)
+
+// Log levels, SEE SetLogger
+const (
+	LogError   = C.MC_LOG_LEVEL_ERROR
+	LogWarning = C.MC_LOG_LEVEL_WARNING
+	LogInfo    = C.MC_LOG_LEVEL_INFO
+	LogDebug   = C.MC_LOG_LEVEL_DEBUG
+)
+
+// Trace phases, SEE Span
+const (
+	TraceRoute   = C.TRACE_ROUTE
+	TraceConnect = C.TRACE_CONNECT
+	TraceSend    = C.TRACE_SEND
+	TraceWait    = C.TRACE_WAIT
+	TraceParse   = C.TRACE_PARSE
+	TraceCollect = C.TRACE_COLLECT
+)
+
+// Compression codecs, SEE ConfigCompression
+const (
+	CompressNone = C.OPT_COMPRESS_NONE
+	CompressZlib = C.OPT_COMPRESS_ZLIB
+	CompressLZ4  = C.OPT_COMPRESS_LZ4
+	CompressZstd = C.OPT_COMPRESS_ZSTD
 )
 
+// Serialization flags of a value, those of the Python binding, SEE Marshal
+const (
+	FlagPickle  = C.MC_FLAG_PICKLE
+	FlagInteger = C.MC_FLAG_INTEGER
+	FlagLong    = C.MC_FLAG_LONG
+	FlagBool    = C.MC_FLAG_BOOL
+	FlagMarshal = C.MC_FLAG_MARSHAL
+	FlagMsgpack = C.MC_FLAG_MSGPACK
+)
+
+// FlagChunked marks the header of a value split by ConfigSplitLargeValues
+const FlagChunked = C.MC_FLAG_CHUNKED
+
 // Hash functions
 const (
 	HashMD5 = iota
@@ -73,6 +122,19 @@ var (
 	// Keys must be at maximum 250 bytes long, ASCII, and not
 	// contain whitespace or control characters.
 	ErrMalformedKey = errors.New("malformed: key is too long or contains invalid characters")
+
+	// ErrCodecUnavailable means that the compression codec or dictionary
+	// is not compiled in libmc, SEE ConfigCompression.
+	ErrCodecUnavailable = errors.New("libmc: compression codec is not available")
+
+	// ErrBufferTooSmall means that the buffer passed to GetMultiInto
+	// can't hold a record of each key.
+	ErrBufferTooSmall = errors.New("libmc: buffer too small")
+
+	// ErrUnsupportedValue means that Marshal can't serialize a value, or
+	// that Unmarshal can't deserialize one: malformed, or pickled or
+	// marshaled by Python.
+	ErrUnsupportedValue = errors.New("libmc: unsupported value")
 )
 
 func networkError(msg string) error {
@@ -90,6 +152,18 @@ type Client struct {
 	noreply     bool
 	disableLock bool
 	lk          sync.Mutex
+
+	coalesce bool
+	flightLk sync.Mutex
+	flights  map[string]*flight
+}
+
+// flight is an in-flight retrieval whose result is shared by every
+// caller asking for the same key while it is on the wire.
+type flight struct {
+	wg   sync.WaitGroup
+	item *Item
+	err  error
 }
 
 // Item is an item to be got or stored in a memcached server.
@@ -198,6 +272,13 @@ func New(servers []string, noreply bool, prefix string, hashFunc int, failover b
 	)
 
 	client.configHashFunction(int(hashFunctionMapping[hashFunc]))
+	if len(prefix) > 0 {
+		// sent ahead of the keys and stripped from the keys of the results
+		// by the core, a key too long with it is invalid
+		cPrefix := C.CString(prefix)
+		C.client_set_key_prefix(client._imp, cPrefix, C.size_t(len(prefix)))
+		C.free(unsafe.Pointer(cPrefix))
+	}
 	client.servers = servers
 	client.prefix = prefix
 	client.noreply = noreply
@@ -219,6 +300,9 @@ func SimpleNew(servers []string) (client *Client) {
 }
 
 func finalizer(client *Client) {
+	tracers.Lock()
+	delete(tracers.m, client._imp)
+	tracers.Unlock()
 	C.client_destroy(client._imp)
 }
 
@@ -245,29 +329,129 @@ func (client *Client) configHashFunction(val int) {
 //	PollTimeout
 //	ConnectTimeout
 //	RetryTimeout
+//	MaxRetryTimeout
+//	MaintainInterval
+//	KeepaliveIdle
+//	RequestTimeout
 //
 // timeout should of type time.Duration
 func (client *Client) ConfigTimeout(cCfgKey C.config_options_t, timeout time.Duration) {
 	client.lock()
 	defer client.unlock()
 	var cTimeout C.int
-	if cCfgKey == C.CFG_RETRY_TIMEOUT {
+	if cCfgKey == C.CFG_RETRY_TIMEOUT || cCfgKey == C.CFG_MAX_RETRY_TIMEOUT ||
+		cCfgKey == C.CFG_KEEPALIVE_IDLE {
 		cTimeout = C.int(timeout / time.Second)
+	} else if cCfgKey == C.CFG_MAINTAIN_INTERVAL || cCfgKey == C.CFG_REQUEST_TIMEOUT {
+		cTimeout = C.int(timeout / time.Millisecond)
 	} else {
 		cTimeout = C.int(timeout / time.Microsecond)
 	}
 	C.client_config(client._imp, cCfgKey, cTimeout)
 }
 
+// ConfigCompression compresses the values of at least threshold bytes
+// with codec when storing them. Compressed values are decompressed on
+// retrieval whatever the codec of the client. zlib is always built in, the
+// other codecs only if libmc is built with them, e.g. with
+// CGO_CXXFLAGS=-DMC_USE_ZSTD and CGO_LDFLAGS=-lzstd for Zstandard, and
+// ErrCodecUnavailable is returned otherwise.
+func (client *Client) ConfigCompression(codec int, threshold int) error {
+	if !bool(C.mc_compress_codec_available(C.compress_codec_options_t(codec))) {
+		return ErrCodecUnavailable
+	}
+	client.lock()
+	defer client.unlock()
+	C.client_config(client._imp, C.CFG_COMPRESS_CODEC, C.int(codec))
+	C.client_config(client._imp, C.CFG_COMPRESS_THRESHOLD, C.int(threshold))
+	return nil
+}
+
+// SetCompressionDictionary sets a Zstandard dictionary trained on the
+// values (e.g. by `zstd --train`), which shrinks small values like JSON
+// much better. Every client reading them needs the same dictionary. A nil
+// dict clears it.
+func (client *Client) SetCompressionDictionary(dict []byte) error {
+	client.lock()
+	defer client.unlock()
+	var cDict *C.char
+	if len(dict) > 0 {
+		cDict = (*C.char)(unsafe.Pointer(&dict[0]))
+	}
+	if C.client_set_compress_dict(client._imp, cDict, C.size_t(len(dict))) != 0 {
+		return ErrCodecUnavailable
+	}
+	return nil
+}
+
+// ConfigSplitLargeValues stores the values larger than 1,000,000 bytes
+// as chunks of it, and joins them back on retrieval, in the format of
+// do_split of the Python binding. Memcached refuses items over 1MB by
+// default, and large values stored by Python can only be read with it.
+func (client *Client) ConfigSplitLargeValues(enabled bool) {
+	client.lock()
+	defer client.unlock()
+	var val C.int
+	if enabled {
+		val = 1
+	}
+	C.client_config(client._imp, C.CFG_SPLIT_LARGE_VALUES, val)
+}
+
+// ConfigBinarySafeKeys sends the keys with spaces, line breaks or NUL
+// bytes, and the ones starting with "%", as "%" and their base64url, and
+// gives the results back under the keys asked for, instead of failing
+// them with ErrMalformedKey. Such keys are stored under the encoded ones.
+func (client *Client) ConfigBinarySafeKeys(enabled bool) {
+	client.lock()
+	defer client.unlock()
+	var val C.int
+	if enabled {
+		val = 1
+	}
+	C.client_config(client._imp, C.CFG_BINARY_SAFE_KEYS, val)
+}
+
+// ConfigSendWindow writes at most window bytes to a server per poll round,
+// and, where TCP_NOTSENT_LOWAT is available, only writes a connection again
+// once less than window bytes are still unsent in its socket buffer, so that
+// large SetMulti batches to many servers interleave with reading the
+// responses. The bytes sent but not yet acknowledged are not bounded. 0,
+// the default, is unbounded.
+func (client *Client) ConfigSendWindow(window int) {
+	client.lock()
+	defer client.unlock()
+	C.client_config(client._imp, C.CFG_SEND_WINDOW, C.int(window))
+}
+
+// ConfigMaxGetSize splits the keys of GetMulti to a server into commands
+// of at most maxKeys keys and maxBytes bytes of keys as sent, pipelined in
+// the same round trip. 0, the default, is unbounded.
+func (client *Client) ConfigMaxGetSize(maxKeys int, maxBytes int) {
+	client.lock()
+	defer client.unlock()
+	C.client_config(client._imp, C.CFG_MAX_GET_KEYS, C.int(maxKeys))
+	C.client_config(client._imp, C.CFG_MAX_GET_BYTES, C.int(maxBytes))
+}
+
+// ConfigConnsPerServer opens n connections to each server, up to 64, and
+// spreads the keys of a batch to a server over them, so that a large
+// GetMulti to a server is served by several memcached worker threads.
+// The responses are all still parsed on the calling goroutine. The servers
+// are reconnected if n changes. 1 is the default.
+func (client *Client) ConfigConnsPerServer(n int) {
+	client.lock()
+	defer client.unlock()
+	C.client_config(client._imp, C.CFG_CONNS_PER_SERVER, C.int(n))
+}
+
 // GetServerAddressByKey will return the address of the memcached
 // server where a key is stored (assume all memcached servers are
 // accessiable and wonot establish any connections. )
 func (client *Client) GetServerAddressByKey(key string) string {
-	rawKey := client.addPrefix(key)
-
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	cServerAddr := C.client_get_server_address_by_key(client._imp, cKey, cKeyLen)
 	return C.GoString(cServerAddr)
 }
@@ -277,11 +461,9 @@ func (client *Client) GetServerAddressByKey(key string) string {
 // corresponding memcached server and may failover accordingly. )
 // if no server is avaiable, an empty string will be returned.
 func (client *Client) GetRealtimeServerAddressByKey(key string) string {
-	rawKey := client.addPrefix(key)
-
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	cServerAddr := C.client_get_realtime_server_address_by_key(client._imp, cKey, cKeyLen)
 	if cServerAddr != nil {
 		return C.GoString(cServerAddr)
@@ -289,31 +471,85 @@ func (client *Client) GetRealtimeServerAddressByKey(key string) string {
 	return ""
 }
 
-func (client *Client) removePrefix(key string) string {
-	if len(client.prefix) == 0 {
-		return key
-	}
-	if strings.HasPrefix(key, "?") {
-		return strings.Join([]string{"?", strings.Replace(key[1:], client.prefix, "", 1)}, "")
+// maxCBytes bounds the C memory viewed as a Go slice, SEE cBytes
+const maxCBytes = 1<<31 - 1
+
+// cBytes views n bytes of C memory at p as a Go slice, without copying
+func cBytes(p unsafe.Pointer, n int) []byte {
+	return (*[maxCBytes]byte)(p)[:n:n]
+}
+
+// cBatch packs the keys or values of a batch into a single C buffer,
+// instead of a C.CString for each, to be passed to the client_* functions
+// as ptrs and lens. It must be freed once the call returns.
+type cBatch struct {
+	buf    unsafe.Pointer
+	arena  []byte
+	offset int
+	ptrs   []*C.char
+	lens   []C.size_t
+}
+
+func newCBatch(n int, size int) *cBatch {
+	// one more byte, so that there's somewhere to point at for empty ones
+	buf := C.malloc(C.size_t(size + 1))
+	return &cBatch{
+		buf:   buf,
+		arena: cBytes(buf, size+1),
+		ptrs:  make([]*C.char, n),
+		lens:  make([]C.size_t, n),
 	}
-	return strings.Replace(key, client.prefix, "", 1)
 }
 
-func (client *Client) addPrefix(key string) string {
-	if len(client.prefix) == 0 {
-		return key
+func (b *cBatch) begin(i int) {
+	b.ptrs[i] = (*C.char)(unsafe.Pointer(&b.arena[b.offset]))
+}
+
+func (b *cBatch) appendString(i int, s string) {
+	n := copy(b.arena[b.offset:], s)
+	b.offset += n
+	b.lens[i] += C.size_t(n)
+}
+
+func (b *cBatch) appendBytes(i int, v []byte) {
+	n := copy(b.arena[b.offset:], v)
+	b.offset += n
+	b.lens[i] += C.size_t(n)
+}
+
+func (b *cBatch) free() {
+	C.free(b.buf)
+}
+
+// packKeys packs the keys, the core adds the prefix, SEE New
+func (client *Client) packKeys(keys []string) *cBatch {
+	size := 0
+	for _, key := range keys {
+		size += len(key)
+	}
+	b := newCBatch(len(keys), size)
+	for i, key := range keys {
+		b.begin(i)
+		b.appendString(i, key)
 	}
-	if strings.HasPrefix(key, "?") {
-		return strings.Join([]string{"?", client.prefix, key[1:]}, "")
+	return b
+}
+
+// keyIndex maps the keys of a batch to their indexes, to find the keys of
+// the results without a new string for each
+func (client *Client) keyIndex(keys []string) map[string]int {
+	index := make(map[string]int, len(keys))
+	for i, key := range keys {
+		index[key] = i
 	}
-	return strings.Join([]string{client.prefix, key}, "")
+	return index
 }
 
 func (client *Client) store(cmd string, item *Item) error {
 	client.lock()
 	defer client.unlock()
 
-	key := client.addPrefix(item.Key)
+	key := item.Key
 
 	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
@@ -412,56 +648,51 @@ func (client *Client) Set(item *Item) error {
 	return client.store("set", item)
 }
 
-// SetMulti will set multi values at once
+// SetMulti will set multi values at once, each with its own Expiration
 func (client *Client) SetMulti(items []*Item) (failedKeys []string, err error) {
 	client.lock()
 	defer client.unlock()
 
 	nItems := len(items)
-	cKeys := make([]*C.char, nItems)
-	cKeyLens := make([]C.size_t, nItems)
-	cValues := make([]*C.char, nItems)
-	cValueSizes := make([]C.size_t, nItems)
+	if nItems == 0 {
+		return []string{}, nil
+	}
+	keys := make([]string, nItems)
+	valuesSize := 0
+	for i, item := range items {
+		keys[i] = item.Key
+		valuesSize += len(item.Value)
+	}
+	cKeys := client.packKeys(keys)
+	defer cKeys.free()
+	cValues := newCBatch(nItems, valuesSize)
+	defer cValues.free()
 	cFlagsList := make([]C.flags_t, nItems)
+	cExptimes := make([]C.exptime_t, nItems)
 
 	for i, item := range items {
-		rawKey := client.addPrefix(item.Key)
-
-		cKey := C.CString(rawKey)
-		defer C.free(unsafe.Pointer(cKey))
-		cKeys[i] = cKey
-
-		cKeyLen := C.size_t(len(rawKey))
-		cKeyLens[i] = cKeyLen
-
-		cVal := C.CString(string(item.Value))
-		defer C.free(unsafe.Pointer(cVal))
-		cValues[i] = cVal
-
-		cValueSize := C.size_t(len(item.Value))
-		cValueSizes[i] = cValueSize
-
-		cFlags := C.flags_t(item.Flags)
-		cFlagsList[i] = cFlags
+		cValues.begin(i)
+		cValues.appendBytes(i, item.Value)
+		cFlagsList[i] = C.flags_t(item.Flags)
+		cExptimes[i] = C.exptime_t(item.Expiration)
 	}
 
-	cExptime := C.exptime_t(items[0].Expiration)
 	cNoreply := C.bool(client.noreply)
 	cNItems := C.size_t(nItems)
 
 	var results **C.message_result_t
 	var n C.size_t
 
-	errCode := C.client_set(
+	errCode := C.client_set_multi(
 		client._imp,
-		(**C.char)(&cKeys[0]),
-		(*C.size_t)(&cKeyLens[0]),
+		(**C.char)(&cKeys.ptrs[0]),
+		(*C.size_t)(&cKeys.lens[0]),
 		(*C.flags_t)(&cFlagsList[0]),
-		cExptime,
+		(*C.exptime_t)(&cExptimes[0]),
 		nil,
 		cNoreply,
-		(**C.char)(&cValues[0]),
-		(*C.size_t)(&cValueSizes[0]),
+		(**C.char)(&cValues.ptrs[0]),
+		(*C.size_t)(&cValues.lens[0]),
 		cNItems,
 		&results, &n,
 	)
@@ -477,25 +708,25 @@ func (client *Client) SetMulti(items []*Item) (failedKeys []string, err error) {
 	}
 
 	sr := unsafe.Sizeof(*results)
-	storedKeySet := make(map[string]struct{})
+	index := client.keyIndex(keys)
+	stored := make([]bool, nItems)
 	for i := 0; i < int(n); i++ {
 		if (*results).type_ == C.MSG_STORED {
-			storedKey := C.GoStringN((*results).key, C.int((*results).key_len))
-			storedKeySet[storedKey] = struct{}{}
+			storedKey := cBytes(unsafe.Pointer((*results).key), int((*results).key_len))
+			if j, ok := index[string(storedKey)]; ok {
+				stored[j] = true
+			}
 		}
 
 		results = (**C.message_result_t)(
 			unsafe.Pointer(uintptr(unsafe.Pointer(results)) + sr),
 		)
 	}
-	failedKeys = make([]string, len(items)-len(storedKeySet))
-	i := 0
-	for _, item := range items {
-		if _, contains := storedKeySet[item.Key]; contains {
-			continue
+	failedKeys = []string{}
+	for i, item := range items {
+		if !stored[i] {
+			failedKeys = append(failedKeys, item.Key)
 		}
-		failedKeys[i] = client.removePrefix(item.Key)
-		i++
 	}
 	return failedKeys, err
 }
@@ -510,11 +741,9 @@ func (client *Client) Delete(key string) error {
 	client.lock()
 	defer client.unlock()
 
-	rawKey := client.addPrefix(key)
-
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	cNoreply := C.bool(client.noreply)
 
 	var rst **C.message_result_t
@@ -547,17 +776,7 @@ func (client *Client) DeleteMulti(keys []string) (failedKeys []string, err error
 	client.lock()
 	defer client.unlock()
 
-	var rawKeys []string
-	if len(client.prefix) == 0 {
-		rawKeys = keys
-	} else {
-		rawKeys = make([]string, len(keys))
-		for i, key := range keys {
-			rawKeys[i] = client.addPrefix(key)
-		}
-	}
-
-	nKeys := len(rawKeys)
+	nKeys := len(keys)
 	cNKeys := C.size_t(nKeys)
 	cKeys := make([]*C.char, nKeys)
 	cKeyLens := make([]C.size_t, nKeys)
@@ -566,7 +785,7 @@ func (client *Client) DeleteMulti(keys []string) (failedKeys []string, err error
 	var results **C.message_result_t
 	var n C.size_t
 
-	for i, key := range rawKeys {
+	for i, key := range keys {
 		cKey := C.CString(key)
 		defer C.free(unsafe.Pointer(cKey))
 		cKeys[i] = cKey
@@ -609,14 +828,14 @@ func (client *Client) DeleteMulti(keys []string) (failedKeys []string, err error
 		)
 	}
 	err = networkError(errorMessage[errCode])
-	failedKeys = make([]string, len(rawKeys)-len(deletedKeySet))
+	failedKeys = make([]string, len(keys)-len(deletedKeySet))
 
 	i := 0
-	for _, key := range rawKeys {
+	for _, key := range keys {
 		if _, contains := deletedKeySet[key]; contains {
 			continue
 		}
-		failedKeys[i] = client.removePrefix(key)
+		failedKeys[i] = key
 		i++
 	}
 	return
@@ -626,11 +845,9 @@ func (client *Client) getOrGets(cmd string, key string) (item *Item, err error)
 	client.lock()
 	defer client.unlock()
 
-	rawKey := client.addPrefix(key)
-
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	var rst **C.retrieval_result_t
 	var n C.size_t
 
@@ -672,6 +889,9 @@ func (client *Client) getOrGets(cmd string, key string) (item *Item, err error)
 
 // Get is a retrieval command. It will return Item or nil
 func (client *Client) Get(key string) (*Item, error) {
+	if client.coalesce {
+		return client.coalescedGet(key)
+	}
 	return client.getOrGets("get", key)
 }
 
@@ -682,36 +902,57 @@ func (client *Client) Gets(key string) (*Item, error) {
 
 // GetMulti will return a map of multi values
 func (client *Client) GetMulti(keys []string) (rv map[string]*Item, err error) {
-	client.lock()
-	defer client.unlock()
+	if client.coalesce {
+		return client.coalescedGetMulti(keys)
+	}
+	return client.getMulti(keys, time.Time{}, nil)
+}
+
+// GetMultiWithDeadline is like GetMulti, but gives up the servers which
+// haven't responded at deadline, and returns the items got from the others
+// along with the error.
+func (client *Client) GetMultiWithDeadline(keys []string, deadline time.Time) (rv map[string]*Item, err error) {
+	return client.getMulti(keys, deadline, nil)
+}
+
+// GetMultiWithFailedKeys is like GetMulti, but also returns the keys which
+// are not got because of an error (malformed key, dead or failing server,
+// timeout), as opposed to the cache misses.
+func (client *Client) GetMultiWithFailedKeys(keys []string) (rv map[string]*Item, failedKeys []string, err error) {
+	rv, err = client.getMulti(keys, time.Time{}, &failedKeys)
+	return
+}
 
+func (client *Client) getMulti(keys []string, deadline time.Time, failedKeys *[]string) (rv map[string]*Item, err error) {
 	nKeys := len(keys)
-	var rawKeys []string
-	if len(client.prefix) == 0 {
-		rawKeys = keys
-	} else {
-		rawKeys = make([]string, len(keys))
-		for i, key := range keys {
-			rawKeys[i] = client.addPrefix(key)
-		}
+	if nKeys == 0 {
+		return
 	}
 
-	cKeys := make([]*C.char, nKeys)
-	cKeyLens := make([]C.size_t, nKeys)
-	cNKeys := C.size_t(nKeys)
+	client.lock()
+	defer client.unlock()
 
-	for i, rawKey := range rawKeys {
-		cKey := C.CString(rawKey)
-		defer C.free(unsafe.Pointer(cKey))
-		cKeyLen := C.size_t(len(rawKey))
-		cKeys[i] = cKey
-		cKeyLens[i] = cKeyLen
+	if !deadline.IsZero() {
+		// in ms as a C int, a deadline beyond that is as good as none
+		timeout := deadline.Sub(time.Now()) / time.Millisecond
+		if timeout > math.MaxInt32 {
+			timeout = math.MaxInt32
+		} else if timeout < 0 {
+			timeout = 0
+		}
+		C.client_set_deadline(client._imp, C.int(timeout))
+		defer C.client_clear_deadline(client._imp)
 	}
 
+	cKeys := client.packKeys(keys)
+	defer cKeys.free()
+
 	var rst **C.retrieval_result_t
 	var n C.size_t
 
-	errCode := C.client_get(client._imp, &cKeys[0], &cKeyLens[0], cNKeys, &rst, &n)
+	errCode := C.client_get(
+		client._imp, &cKeys.ptrs[0], &cKeys.lens[0], C.size_t(nKeys), &rst, &n,
+	)
 	defer C.client_destroy_retrieval_result(client._imp)
 
 	switch errCode {
@@ -727,6 +968,100 @@ func (client *Client) GetMulti(keys []string) (rv map[string]*Item, err error) {
 		err = ErrCacheMiss
 	}
 
+	if failedKeys != nil && (err != nil || len(keys) != int(n)) {
+		var statuses *C.key_status_t
+		var nStatuses C.size_t
+		C.client_get_key_statuses(client._imp, &statuses, &nStatuses)
+		ss := unsafe.Sizeof(*statuses)
+		for i := 0; i < int(nStatuses); i++ {
+			if *statuses != C.KEY_HIT && *statuses != C.KEY_MISS {
+				*failedKeys = append(*failedKeys, keys[i])
+			}
+			statuses = (*C.key_status_t)(unsafe.Pointer(uintptr(unsafe.Pointer(statuses)) + ss))
+		}
+	}
+
+	if int(n) == 0 {
+		return
+	}
+
+	// the values are copied into one arena, and the keys are the ones
+	// passed in, found by keyIndex
+	results := (*[maxCBytes / unsafe.Sizeof(*rst)]*C.retrieval_result_t)(unsafe.Pointer(rst))[:n:n]
+	arenaSize := 0
+	for _, r := range results {
+		arenaSize += int(r.bytes)
+	}
+	arena := make([]byte, arenaSize)
+	index := client.keyIndex(keys)
+	items := make([]Item, len(results))
+	rv = make(map[string]*Item, len(results))
+	offset := 0
+	for i, r := range results {
+		bytes := int(r.bytes)
+		copy(arena[offset:], cBytes(unsafe.Pointer(r.data_block), bytes))
+		j, ok := index[string(cBytes(unsafe.Pointer(r.key), int(r.key_len)))]
+		if ok {
+			key := keys[j]
+			items[i] = Item{Key: key, Value: arena[offset : offset+bytes : offset+bytes], Flags: uint32(r.flags)}
+			rv[key] = &items[i]
+		}
+		offset += bytes
+	}
+
+	return
+}
+
+// GetMultiInto is like GetMulti, but reads the value of keys[i] straight
+// into buf[i*size:(i+1)*size], without copying it into a new slice. The
+// Value of an item is a slice of buf then, unless the value is larger than
+// size or compressed. buf must not be used by others until GetMultiInto
+// returns. Values split by ConfigSplitLargeValues are not joined, such an
+// item is the header of the value, flagged FlagChunked, get it with
+// GetMulti instead.
+func (client *Client) GetMultiInto(keys []string, buf []byte, size int) (rv map[string]*Item, err error) {
+	nKeys := len(keys)
+	if nKeys == 0 {
+		return nil, nil
+	}
+	if size <= 0 || len(buf) < nKeys*size {
+		return nil, ErrBufferTooSmall
+	}
+
+	client.lock()
+	defer client.unlock()
+
+	cKeys := client.packKeys(keys)
+	defer cKeys.free()
+	cOffsets := make([]C.size_t, nKeys)
+	cSizes := make([]C.size_t, nKeys)
+	for i := range keys {
+		cOffsets[i] = C.size_t(i * size)
+		cSizes[i] = C.size_t(size)
+	}
+
+	var rst **C.retrieval_result_t
+	var n C.size_t
+	arena := unsafe.Pointer(&buf[0])
+	errCode := C.client_get_into(
+		client._imp, &cKeys.ptrs[0], &cKeys.lens[0], C.size_t(nKeys), (*C.char)(arena),
+		&cOffsets[0], &cSizes[0], &rst, &n,
+	)
+	defer C.client_destroy_retrieval_result(client._imp)
+
+	switch errCode {
+	case 0:
+		err = nil
+	case C.RET_INVALID_KEY_ERR:
+		err = ErrMalformedKey
+	default:
+		err = networkError(errorMessage[errCode])
+	}
+
+	if err == nil && nKeys != int(n) {
+		err = ErrCacheMiss
+	}
+
 	if int(n) == 0 {
 		return
 	}
@@ -734,27 +1069,144 @@ func (client *Client) GetMulti(keys []string) (rv map[string]*Item, err error) {
 	sr := unsafe.Sizeof(*rst)
 	rv = make(map[string]*Item, int(n))
 	for i := 0; i < int(n); i++ {
-		rawKey := C.GoStringN((*rst).key, C.int((*rst).key_len))
-		dataBlock := C.GoBytes(unsafe.Pointer((*rst).data_block), C.int((*rst).bytes))
-		flags := uint32((*rst).flags)
-		key := client.removePrefix(rawKey)
-		rv[key] = &Item{Key: key, Value: dataBlock, Flags: flags}
+		key := C.GoStringN((*rst).key, C.int((*rst).key_len))
+		bytes := int((*rst).bytes)
+		offset := int(uintptr(unsafe.Pointer((*rst).data_block)) - uintptr(arena))
+		var value []byte
+		if offset >= 0 && offset+bytes <= len(buf) && bytes <= size {
+			value = buf[offset : offset+bytes : offset+bytes]
+		} else {
+			value = C.GoBytes(unsafe.Pointer((*rst).data_block), C.int(bytes))
+		}
+		rv[key] = &Item{Key: key, Value: value, Flags: uint32((*rst).flags)}
 		rst = (**C.retrieval_result_t)(unsafe.Pointer(uintptr(unsafe.Pointer(rst)) + sr))
 	}
 
 	return
 }
 
+// EnableRequestCoalescing makes concurrent Get/GetMulti calls for the
+// same key share one network fetch and its result: the first caller
+// fetches, later callers wait for it instead of issuing their own
+// request. This prevents thundering herds on hot keys (e.g. after a
+// flush). Items returned to the waiters share the same Value slice,
+// which must not be modified. It should be called before the client is
+// shared between goroutines.
+func (client *Client) EnableRequestCoalescing() {
+	client.flightLk.Lock()
+	defer client.flightLk.Unlock()
+	if client.flights == nil {
+		client.flights = make(map[string]*flight)
+	}
+	client.coalesce = true
+}
+
+// DisableRequestCoalescing turns request coalescing off (default).
+func (client *Client) DisableRequestCoalescing() {
+	client.flightLk.Lock()
+	defer client.flightLk.Unlock()
+	client.coalesce = false
+}
+
+// join returns the in-flight call for key and whether the caller owns
+// it (i.e. has to fetch and then finish it).
+func (client *Client) join(key string) (f *flight, owner bool) {
+	if f, ok := client.flights[key]; ok {
+		return f, false
+	}
+	f = new(flight)
+	f.wg.Add(1)
+	client.flights[key] = f
+	return f, true
+}
+
+func (client *Client) finish(key string, f *flight, item *Item, err error) {
+	client.flightLk.Lock()
+	delete(client.flights, key)
+	client.flightLk.Unlock()
+	f.item = item
+	f.err = err
+	f.wg.Done()
+}
+
+func (f *flight) result() (*Item, error) {
+	f.wg.Wait()
+	if f.item == nil {
+		return nil, f.err
+	}
+	item := *f.item
+	return &item, f.err
+}
+
+func (client *Client) coalescedGet(key string) (*Item, error) {
+	client.flightLk.Lock()
+	f, owner := client.join(key)
+	client.flightLk.Unlock()
+
+	if owner {
+		item, err := client.getOrGets("get", key)
+		client.finish(key, f, item, err)
+	}
+	return f.result()
+}
+
+func (client *Client) coalescedGetMulti(keys []string) (rv map[string]*Item, err error) {
+	owned := make([]string, 0, len(keys))
+	flights := make(map[string]*flight, len(keys))
+
+	client.flightLk.Lock()
+	for _, key := range keys {
+		if _, ok := flights[key]; ok {
+			continue
+		}
+		f, owner := client.join(key)
+		flights[key] = f
+		if owner {
+			owned = append(owned, key)
+		}
+	}
+	client.flightLk.Unlock()
+
+	if len(owned) > 0 {
+		var failedKeys []string
+		got, fetchErr := client.getMulti(owned, time.Time{}, &failedKeys)
+		failed := make(map[string]bool, len(failedKeys))
+		for _, key := range failedKeys {
+			failed[key] = true
+		}
+		for _, key := range owned {
+			item := got[key]
+			var keyErr error
+			if item == nil {
+				keyErr = ErrCacheMiss
+				if failed[key] {
+					keyErr = fetchErr
+				}
+			}
+			client.finish(key, flights[key], item, keyErr)
+		}
+	}
+
+	rv = make(map[string]*Item, len(flights))
+	for key, f := range flights {
+		item, keyErr := f.result()
+		if item != nil {
+			rv[key] = item
+		} else if err == nil || err == ErrCacheMiss {
+			err = keyErr
+		}
+	}
+	return
+}
+
 // Touch command
 func (client *Client) Touch(key string, expiration int64) error {
 	client.lock()
 	defer client.unlock()
 
-	rawKey := client.addPrefix(key)
-
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	cExptime := C.exptime_t(expiration)
 	cNoreply := C.bool(client.noreply)
 
@@ -787,10 +1239,9 @@ func (client *Client) incrOrDecr(cmd string, key string, delta uint64) (uint64,
 	client.lock()
 	defer client.unlock()
 
-	rawKey := client.addPrefix(key)
-	cKey := C.CString(rawKey)
+	cKey := C.CString(key)
 	defer C.free(unsafe.Pointer(cKey))
-	cKeyLen := C.size_t(len(rawKey))
+	cKeyLen := C.size_t(len(key))
 	cDelta := C.uint64_t(delta)
 	cNoreply := C.bool(client.noreply)
 
@@ -841,6 +1292,85 @@ func (client *Client) Decr(key string, delta uint64) (uint64, error) {
 	return client.incrOrDecr("decr", key, delta)
 }
 
+func (client *Client) incrOrDecrMulti(cmd string, keys []string, delta uint64) (rv map[string]uint64, err error) {
+	client.lock()
+	defer client.unlock()
+
+	nKeys := len(keys)
+	if nKeys == 0 {
+		return
+	}
+	cKeys := make([]*C.char, nKeys)
+	cKeyLens := make([]C.size_t, nKeys)
+	cDeltas := make([]C.uint64_t, nKeys)
+	for i, key := range keys {
+		cKey := C.CString(key)
+		defer C.free(unsafe.Pointer(cKey))
+		cKeys[i] = cKey
+		cKeyLens[i] = C.size_t(len(key))
+		cDeltas[i] = C.uint64_t(delta)
+	}
+	cNoreply := C.bool(client.noreply)
+
+	var rst **C.unsigned_result_t
+	var n C.size_t
+
+	var errCode C.int
+	switch cmd {
+	case "incr":
+		errCode = C.client_incr_multi(
+			client._imp, &cKeys[0], &cKeyLens[0], &cDeltas[0], cNoreply,
+			C.size_t(nKeys), &rst, &n,
+		)
+	case "decr":
+		errCode = C.client_decr_multi(
+			client._imp, &cKeys[0], &cKeyLens[0], &cDeltas[0], cNoreply,
+			C.size_t(nKeys), &rst, &n,
+		)
+	}
+	defer C.client_destroy_unsigned_result(client._imp)
+
+	switch errCode {
+	case 0:
+		err = nil
+	case C.RET_INVALID_KEY_ERR:
+		err = ErrMalformedKey
+	default:
+		err = networkError(errorMessage[errCode])
+	}
+
+	if client.noreply {
+		return
+	}
+	if err == nil && nKeys != int(n) {
+		err = ErrCacheMiss
+	}
+	if int(n) == 0 {
+		return
+	}
+
+	sr := unsafe.Sizeof(*rst)
+	rv = make(map[string]uint64, int(n))
+	for i := 0; i < int(n); i++ {
+		key := C.GoStringN((*rst).key, C.int((*rst).key_len))
+		rv[key] = uint64((*rst).value)
+		rst = (**C.unsigned_result_t)(unsafe.Pointer(uintptr(unsafe.Pointer(rst)) + sr))
+	}
+	return
+}
+
+// IncrMulti will increase the values in keys by delta, pipelining the
+// commands to each server. The returned map has the values of the keys found,
+// and err is ErrCacheMiss if some are not.
+func (client *Client) IncrMulti(keys []string, delta uint64) (map[string]uint64, error) {
+	return client.incrOrDecrMulti("incr", keys, delta)
+}
+
+// DecrMulti will decrease the values in keys by delta, like IncrMulti
+func (client *Client) DecrMulti(keys []string, delta uint64) (map[string]uint64, error) {
+	return client.incrOrDecrMulti("decr", keys, delta)
+}
+
 // Version will return a map reflecting versions of each memcached server
 func (client *Client) Version() (map[string]string, error) {
 	client.lock()
@@ -919,6 +1449,166 @@ func (client *Client) Stats() (map[string](map[string]string), error) {
 	return rv, nil
 }
 
+// LatencyHistogram counts latencies in log2 buckets of microseconds:
+// Buckets[0] counts [0, 2) us, Buckets[i] counts [2^i, 2^(i+1)) us, and
+// the last one everything above.
+type LatencyHistogram struct {
+	Count   uint64
+	Sum     time.Duration
+	Max     time.Duration
+	Buckets []uint64
+}
+
+// ServerMetrics are the counters of a server since the client is created
+// or ResetMetrics is called. Dispatch is measured from the first dispatch
+// to the start of waiting for the servers, the other latencies from the
+// start of waiting.
+type ServerMetrics struct {
+	Requests        uint64
+	BytesSent       uint64
+	BytesReceived   uint64
+	PollWakeups     uint64
+	Connects        uint64
+	ConnectFailures uint64
+	SendErrors      uint64
+	RecvErrors      uint64
+	ConnPollErrors  uint64
+	PollTimeouts    uint64
+	PollErrors      uint64
+	ServerErrors    uint64
+	ParseErrors     uint64
+	Abandons        uint64
+	Dispatch        LatencyHistogram
+	Send            LatencyHistogram
+	FirstByte       LatencyHistogram
+	Complete        LatencyHistogram
+}
+
+func newLatencyHistogram(h *C.latency_histogram_t) LatencyHistogram {
+	buckets := make([]uint64, C.MC_LATENCY_BUCKETS)
+	for i := range buckets {
+		buckets[i] = uint64(h.buckets[i])
+	}
+	return LatencyHistogram{
+		Count:   uint64(h.count),
+		Sum:     time.Duration(h.sum_us) * time.Microsecond,
+		Max:     time.Duration(h.max_us) * time.Microsecond,
+		Buckets: buckets,
+	}
+}
+
+// Metrics returns the client side metrics of each server, keyed by server
+// name. Unlike Stats, no request is sent.
+func (client *Client) Metrics() map[string]ServerMetrics {
+	client.lock()
+	defer client.unlock()
+
+	var rst *C.server_metrics_t
+	var n C.size_t
+	C.client_get_metrics(client._imp, &rst, &n)
+
+	rv := make(map[string]ServerMetrics, int(n))
+	sr := unsafe.Sizeof(*rst)
+	for i := 0; i < int(n); i++ {
+		rv[C.GoString(rst.host)] = ServerMetrics{
+			Requests:        uint64(rst.requests),
+			BytesSent:       uint64(rst.bytes_sent),
+			BytesReceived:   uint64(rst.bytes_received),
+			PollWakeups:     uint64(rst.poll_wakeups),
+			Connects:        uint64(rst.connects),
+			ConnectFailures: uint64(rst.connect_failures),
+			SendErrors:      uint64(rst.send_errors),
+			RecvErrors:      uint64(rst.recv_errors),
+			ConnPollErrors:  uint64(rst.conn_poll_errors),
+			PollTimeouts:    uint64(rst.poll_timeouts),
+			PollErrors:      uint64(rst.poll_errors),
+			ServerErrors:    uint64(rst.server_errors),
+			ParseErrors:     uint64(rst.parse_errors),
+			Abandons:        uint64(rst.abandons),
+			Dispatch:        newLatencyHistogram(&rst.dispatch),
+			Send:            newLatencyHistogram(&rst.send),
+			FirstByte:       newLatencyHistogram(&rst.first_byte),
+			Complete:        newLatencyHistogram(&rst.complete),
+		}
+		rst = (*C.server_metrics_t)(unsafe.Pointer(uintptr(unsafe.Pointer(rst)) + sr))
+	}
+	return rv
+}
+
+// ResetMetrics zeroes the metrics returned by Metrics
+func (client *Client) ResetMetrics() {
+	client.lock()
+	defer client.unlock()
+	C.client_reset_metrics(client._imp)
+}
+
+// Span is a phase of a request: routing the keys, connecting, sending to,
+// waiting for and parsing the response of a server, or collecting the
+// results. Err is set on the phase in which a server failed.
+type Span struct {
+	Phase  int
+	Server string // empty unless the span is of a single server
+	Start  time.Time
+	End    time.Time
+	Keys   int
+	Err    error
+}
+
+// Tracer receives the spans of the requests of a client. It's called
+// synchronously, possibly with the client locked, so it must be cheap and
+// never call the client.
+type Tracer func(span *Span)
+
+var tracers = struct {
+	sync.RWMutex
+	m map[unsafe.Pointer]Tracer
+}{m: make(map[unsafe.Pointer]Tracer)}
+
+// SetTracer hands the spans of the requests to fn, nil disables tracing.
+func (client *Client) SetTracer(fn Tracer) {
+	client.lock()
+	defer client.unlock()
+
+	tracers.Lock()
+	if fn == nil {
+		delete(tracers.m, client._imp)
+	} else {
+		tracers.m[client._imp] = fn
+	}
+	tracers.Unlock()
+	if fn == nil {
+		C.client_set_trace_hook(client._imp, nil, nil)
+	} else {
+		C.client_set_trace_hook(client._imp, C.trace_hook_t(C.goTraceHook), client._imp)
+	}
+}
+
+//export goTraceHook
+func goTraceHook(ctx unsafe.Pointer, span *C.trace_span_t) {
+	tracers.RLock()
+	fn := tracers.m[ctx]
+	tracers.RUnlock()
+	if fn == nil {
+		return
+	}
+	// spans are timed by CLOCK_MONOTONIC, translate to the wall clock
+	now := time.Now()
+	nowUs := int64(C.mc_monotonic_us())
+	rv := Span{
+		Phase: int(span.phase),
+		Start: now.Add(-time.Duration(nowUs-int64(span.start_us)) * time.Microsecond),
+		End:   now.Add(-time.Duration(nowUs-int64(span.end_us)) * time.Microsecond),
+		Keys:  int(span.n_keys),
+	}
+	if span.server != nil {
+		rv.Server = C.GoString(span.server)
+	}
+	if span.err != C.RET_OK {
+		rv.Err = networkError(errorMessage[C.int(span.err)])
+	}
+	fn(&rv)
+}
+
 // Quit will close the sockets to each memcached server
 func (client *Client) Quit() error {
 	client.lock()
@@ -932,3 +1622,269 @@ func (client *Client) Quit() error {
 	}
 	return networkError(errorMessage[errCode])
 }
+
+// Logger receives the log messages of libmc. It's called from a dedicated
+// logger thread one message at a time, the messages beyond the rate limit
+// or the capacity of the queue are dropped instead of blocking a request.
+type Logger func(level int, file string, line int, msg string)
+
+var logger struct {
+	sync.RWMutex
+	fn Logger
+}
+
+// SetLogger replaces the log sink shared by all the clients, the messages
+// above level are dropped. A nil Logger restores writing to stderr.
+func SetLogger(fn Logger, level int) {
+	logger.Lock()
+	logger.fn = fn
+	logger.Unlock()
+	if fn == nil {
+		C.mc_set_log_sink(nil, nil)
+	} else {
+		C.mc_set_log_sink(C.log_sink_t(C.goLogSink), nil)
+	}
+	C.mc_set_log_level(C.int(level))
+}
+
+// FlushLog waits until the queued log messages are handed to the Logger
+func FlushLog() {
+	C.mc_flush_log()
+}
+
+//export goLogSink
+func goLogSink(ctx unsafe.Pointer, level C.int, file *C.char, line C.uint, msg *C.char) {
+	logger.RLock()
+	fn := logger.fn
+	logger.RUnlock()
+	if fn != nil {
+		fn(int(level), C.GoString(file), int(line), C.GoString(msg))
+	}
+}
+
+// maxValueDepth bounds the nesting of a value serialized by Marshal, which
+// catches cyclic ones as well
+const maxValueDepth = 512
+
+// valueNodes walks a Go value into the value nodes of libmc, the data of
+// str and bin nodes go to a single buffer, SEE value_node_t
+type valueNodes struct {
+	nodes []C.value_node_t
+	data  []byte
+	// the index in nodes of each str and bin, whose data is at integer in
+	// data until it's copied to C
+	dataNodes []int
+}
+
+func (w *valueNodes) appendData(typ C.value_type_t, b []byte) error {
+	if uint64(len(b)) > math.MaxUint32 {
+		return ErrUnsupportedValue
+	}
+	w.dataNodes = append(w.dataNodes, len(w.nodes))
+	w.nodes = append(w.nodes, C.value_node_t{
+		_type: typ, size: C.uint32_t(len(b)), integer: C.int64_t(len(w.data)),
+	})
+	w.data = append(w.data, b...)
+	return nil
+}
+
+func (w *valueNodes) walk(v reflect.Value, depth int) error {
+	if depth > maxValueDepth {
+		return ErrUnsupportedValue
+	}
+	node := C.value_node_t{_type: C.VALUE_NIL}
+	switch v.Kind() {
+	case reflect.Invalid:
+	case reflect.Ptr, reflect.Interface:
+		if !v.IsNil() {
+			return w.walk(v.Elem(), depth+1)
+		}
+	case reflect.Bool:
+		node._type = C.VALUE_BOOL
+		if v.Bool() {
+			node.integer = 1
+		}
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		node._type = C.VALUE_INT
+		node.integer = C.int64_t(v.Int())
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64,
+		reflect.Uintptr:
+		node._type = C.VALUE_INT
+		if v.Uint() > math.MaxInt64 {
+			node._type = C.VALUE_UINT
+		}
+		node.integer = C.int64_t(v.Uint())
+	case reflect.Float32, reflect.Float64:
+		node._type = C.VALUE_FLOAT
+		node.real = C.double(v.Float())
+	case reflect.String:
+		return w.appendData(C.VALUE_STR, []byte(v.String()))
+	case reflect.Slice, reflect.Array:
+		if v.Kind() == reflect.Slice && v.Type().Elem().Kind() == reflect.Uint8 {
+			return w.appendData(C.VALUE_BIN, v.Bytes())
+		}
+		if uint64(v.Len()) > math.MaxUint32 {
+			return ErrUnsupportedValue
+		}
+		w.nodes = append(w.nodes, C.value_node_t{_type: C.VALUE_ARRAY, size: C.uint32_t(v.Len())})
+		for i := 0; i < v.Len(); i++ {
+			if err := w.walk(v.Index(i), depth+1); err != nil {
+				return err
+			}
+		}
+		return nil
+	case reflect.Map:
+		if uint64(v.Len()) > math.MaxUint32 {
+			return ErrUnsupportedValue
+		}
+		w.nodes = append(w.nodes, C.value_node_t{_type: C.VALUE_MAP, size: C.uint32_t(v.Len())})
+		for _, key := range v.MapKeys() {
+			if err := w.walk(key, depth+1); err != nil {
+				return err
+			}
+			if err := w.walk(v.MapIndex(key), depth+1); err != nil {
+				return err
+			}
+		}
+		return nil
+	default:
+		return ErrUnsupportedValue
+	}
+	w.nodes = append(w.nodes, node)
+	return nil
+}
+
+// Marshal serializes v the way the Python binding does, for the values to
+// be shared with it: []byte as is, bool and integers as FlagBool and
+// FlagInteger, and anything else made of nil, numbers, strings, slices and
+// maps as FlagMsgpack (the Python client with msgpack=True). Set the
+// returned flags to Item.Flags.
+func Marshal(v interface{}) ([]byte, uint32, error) {
+	var flag C.flags_t = FlagMsgpack
+	switch v.(type) {
+	case []byte:
+		flag = 0
+	case bool:
+		flag = FlagBool
+	case int, int8, int16, int32, int64, uint, uint8, uint16, uint32, uint64:
+		flag = FlagInteger
+	}
+	var w valueNodes
+	if err := w.walk(reflect.ValueOf(v), 0); err != nil {
+		return nil, 0, err
+	}
+	if len(w.data) > 0 {
+		data := C.CBytes(w.data)
+		defer C.free(data)
+		for _, i := range w.dataNodes {
+			node := &w.nodes[i]
+			node.data = (*C.char)(unsafe.Pointer(uintptr(data) + uintptr(node.integer)))
+			node.integer = 0
+		}
+	}
+	var out *C.char
+	var outLen C.size_t
+	if !C.mc_serialize(flag, &w.nodes[0], C.size_t(len(w.nodes)), &out, &outLen) {
+		return nil, 0, ErrUnsupportedValue
+	}
+	defer C.free(unsafe.Pointer(out))
+	return C.GoBytes(unsafe.Pointer(out), C.int(outLen)), uint32(flag), nil
+}
+
+// Unmarshal deserializes a value of flags serialized by Marshal or by the
+// Python binding (except pickled or marshaled ones): []byte, bool, int64
+// (uint64 above math.MaxInt64), float64, string, []interface{}, and
+// map[string]interface{}, or map[interface{}]interface{} if some keys
+// are not strings.
+func Unmarshal(value []byte, flags uint32) (interface{}, error) {
+	var base *C.char
+	if len(value) > 0 {
+		base = (*C.char)(unsafe.Pointer(&value[0]))
+	}
+	var nodes *C.value_node_t
+	var nNodes C.size_t
+	if !C.mc_deserialize(base, C.size_t(len(value)), C.flags_t(flags), &nodes, &nNodes) {
+		return nil, ErrUnsupportedValue
+	}
+	defer C.free(unsafe.Pointer(nodes))
+	all := (*[maxCBytes / C.sizeof_value_node_t]C.value_node_t)(unsafe.Pointer(nodes))[:nNodes:nNodes]
+	i := 0
+	v, ok := readValue(all, &i, value, uintptr(unsafe.Pointer(base)))
+	if !ok {
+		return nil, ErrUnsupportedValue
+	}
+	return v, nil
+}
+
+// readValue reads the value at nodes[*i] and its items, the data of a
+// node is at its offset from base in value. Bin map keys are read as
+// strings, it fails on an array or map key.
+func readValue(nodes []C.value_node_t, i *int, value []byte, base uintptr) (interface{}, bool) {
+	node := nodes[*i]
+	*i++
+	switch node._type {
+	case C.VALUE_BOOL:
+		return node.integer != 0, true
+	case C.VALUE_INT:
+		return int64(node.integer), true
+	case C.VALUE_UINT:
+		return uint64(node.integer), true
+	case C.VALUE_FLOAT:
+		return float64(node.real), true
+	case C.VALUE_STR, C.VALUE_BIN:
+		var b []byte
+		if node.size > 0 {
+			offset := uintptr(unsafe.Pointer(node.data)) - base
+			b = value[offset : offset+uintptr(node.size)]
+		}
+		if node._type == C.VALUE_STR {
+			return string(b), true
+		}
+		return append([]byte{}, b...), true
+	case C.VALUE_ARRAY:
+		items := make([]interface{}, node.size)
+		for j := range items {
+			item, ok := readValue(nodes, i, value, base)
+			if !ok {
+				return nil, false
+			}
+			items[j] = item
+		}
+		return items, true
+	case C.VALUE_MAP:
+		keys := make([]interface{}, node.size)
+		vals := make([]interface{}, node.size)
+		allStrings := true
+		for j := range keys {
+			key, ok := readValue(nodes, i, value, base)
+			if !ok {
+				return nil, false
+			}
+			switch k := key.(type) {
+			case []byte:
+				key = string(k)
+			case []interface{}, map[string]interface{}, map[interface{}]interface{}:
+				return nil, false
+			}
+			_, isString := key.(string)
+			allStrings = allStrings && isString
+			keys[j] = key
+			if vals[j], ok = readValue(nodes, i, value, base); !ok {
+				return nil, false
+			}
+		}
+		if allStrings {
+			m := make(map[string]interface{}, len(keys))
+			for j, key := range keys {
+				m[key.(string)] = vals[j]
+			}
+			return m, true
+		}
+		m := make(map[interface{}]interface{}, len(keys))
+		for j, key := range keys {
+			m[key] = vals[j]
+		}
+		return m, true
+	}
+	return nil, true
+}
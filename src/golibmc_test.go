@@ -1,10 +1,13 @@
 package golibmc
 
+import "bytes"
 import "fmt"
+import "reflect"
 import "time"
 import "strings"
 import "testing"
 import "strconv"
+import "sync"
 
 const LocalMC = "localhost:21211"
 const ErrorSet = "Error on Set"
@@ -87,41 +90,55 @@ func testStats(mc *Client, t *testing.T) {
 }
 
 func TestPrefix(t *testing.T) {
-	c1 := Client{}
 	testPrefix := "prefix"
-	c2 := Client{prefix: testPrefix}
-	key := "foo"
-
-	if x := c1.addPrefix(key); x != key {
-		t.Error(x)
+	mc := newSimplePrefixClient(2, testPrefix)
+	raw := newSimpleClient(2)
+
+	keys := []string{
+		"foo",
+		"?foo",
+		"forever" + testPrefix + "/young",
+		"forever/young/" + testPrefix,
+	}
+	for _, key := range keys {
+		if err := mc.Set(&Item{Key: key, Value: []byte(key)}); err != nil {
+			t.Fatal(key, err)
+		}
 	}
-	if x := c1.removePrefix(key); x != key {
-		t.Error(x)
+	items, err := mc.GetMulti(append(keys, "missing"))
+	if err != ErrCacheMiss || len(items) != len(keys) {
+		t.Fatal(items, err)
 	}
-
-	key2 := strings.Join([]string{key, c2.prefix}, "")
-	for _, key := range []string{key, key2} {
-
-		prefixedKey := c2.addPrefix(key)
-		if x := strings.Join([]string{c2.prefix, key}, ""); x != prefixedKey {
-			t.Error(x)
+	for _, key := range keys {
+		if item := items[key]; item == nil || item.Key != key || string(item.Value) != key {
+			t.Error(key, item)
 		}
-		if x := c2.removePrefix(prefixedKey); x != key {
-			t.Error(x)
+		rawKey := testPrefix + key
+		if key[0] == '?' {
+			rawKey = "?" + testPrefix + key[1:]
+		}
+		if item, err := raw.Get(rawKey); err != nil || string(item.Value) != key {
+			t.Error(rawKey, item, err)
+		}
+		if x := mc.GetServerAddressByKey(key); x != raw.GetServerAddressByKey(rawKey) {
+			t.Error(key, x)
 		}
 	}
-
-	keyTmpls := []string{
-		"%sforever/young",
-		"forever%s/young",
-		"forever/young/%s",
+	if _, err := raw.Get("foo"); err != ErrCacheMiss {
+		t.Error(err)
 	}
 
-	for _, keyTmpl := range keyTmpls {
-		key := fmt.Sprintf(keyTmpl, c2.prefix)
-		if x := c2.removePrefix(c2.addPrefix(key)); key != x {
-			t.Error(x)
-		}
+	if err := mc.Set(&Item{Key: "counter", Value: []byte("1")}); err != nil {
+		t.Fatal(err)
+	}
+	if rv, err := mc.IncrMulti([]string{"counter"}, 2); err != nil || rv["counter"] != 3 {
+		t.Error(rv, err)
+	}
+	if _, err := mc.Get(strings.Repeat("k", 250)); err != ErrMalformedKey {
+		t.Error(err)
+	}
+	if failed, err := mc.DeleteMulti(append(keys, "counter")); err != nil || len(failed) != 0 {
+		t.Error(failed, err)
 	}
 }
 
@@ -320,6 +337,15 @@ func testSetMultiNGetMulti(mc *Client, t *testing.T) {
 	if !(len(itemsMap) == 0 && err == ErrCacheMiss) {
 		t.Error(err)
 	}
+
+	// Each item expires on its own, a negative Expiration right away
+	items[0].Expiration = -1
+	mc.SetMulti(items)
+	itemsMap, _ = mc.GetMulti(keys)
+	if _, ok := itemsMap[keys[0]]; ok || itemsMap[keys[1]] == nil {
+		t.Errorf("per-item expiration: %v", itemsMap)
+	}
+	mc.DeleteMulti(keys)
 }
 
 func TestIncrNDecr(t *testing.T) {
@@ -354,6 +380,29 @@ func testIncrNDecr(mc *Client, t *testing.T) {
 	}
 }
 
+func TestIncrNDecrMulti(t *testing.T) {
+	testNormalCommand(t, testIncrNDecrMulti)
+}
+
+func testIncrNDecrMulti(mc *Client, t *testing.T) {
+	keys := []string{"test_incr_multi_1", "test_incr_multi_2", "test_incr_multi_3"}
+	mc.DeleteMulti(keys)
+	mc.Set(&Item{Key: keys[0], Value: []byte("99")})
+	mc.Set(&Item{Key: keys[1], Value: []byte("200")})
+
+	vals, err := mc.IncrMulti(keys, 1)
+	if err != ErrCacheMiss || len(vals) != 2 || vals[keys[0]] != 100 || vals[keys[1]] != 201 {
+		t.Errorf("IncrMulti: %v %v", vals, err)
+	}
+
+	vals, err = mc.DecrMulti(keys[:2], 10)
+	if err != nil || len(vals) != 2 || vals[keys[0]] != 90 || vals[keys[1]] != 191 {
+		t.Errorf("DecrMulti: %v %v", vals, err)
+	}
+
+	mc.DeleteMulti(keys)
+}
+
 func TestLargeValue(t *testing.T) {
 	testNormalCommand(t, testLargeValue)
 }
@@ -837,6 +886,184 @@ func testQuit(mc, mc2 *Client, t *testing.T) {
 	}
 }
 
+func TestRequestCoalescing(t *testing.T) {
+	mc := newSimpleClient(2)
+	mc.EnableRequestCoalescing()
+	key := "test_coalescing"
+	value := "herd"
+	if err := mc.Set(&Item{Key: key, Value: []byte(value)}); err != nil {
+		t.Error(ErrorSet)
+	}
+
+	var wg sync.WaitGroup
+	nGoroutines := 32
+	errs := make(chan error, 2*nGoroutines)
+	for i := 0; i < nGoroutines; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			item, err := mc.Get(key)
+			if err != nil || string(item.Value) != value {
+				errs <- err
+			}
+			items, err := mc.GetMulti([]string{key, key, "test_coalescing_miss"})
+			if err != ErrCacheMiss || len(items) != 1 || string(items[key].Value) != value {
+				errs <- err
+			}
+		}()
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		t.Error(err)
+	}
+
+	if len(mc.flights) != 0 {
+		t.Errorf("%d flights left", len(mc.flights))
+	}
+	mc.DisableRequestCoalescing()
+	if _, err := mc.Get("test_coalescing_miss"); err != ErrCacheMiss {
+		t.Error(err)
+	}
+}
+
+func TestGetMultiWithDeadline(t *testing.T) {
+	mc := newSimpleClient(4)
+	keys := []string{"test_deadline_1", "test_deadline_2", "test_deadline_3"}
+	for _, key := range keys {
+		if err := mc.Set(&Item{Key: key, Value: []byte(key)}); err != nil {
+			t.Error(ErrorSet)
+		}
+	}
+
+	items, err := mc.GetMultiWithDeadline(keys, time.Now().Add(time.Second))
+	if err != nil || len(items) != len(keys) {
+		t.Error(err)
+	}
+
+	items, err = mc.GetMultiWithDeadline(keys, time.Now().Add(-time.Second))
+	if err == nil || len(items) != 0 {
+		t.Errorf("%v %v", items, err)
+	}
+
+	// beyond a C int of ms
+	items, err = mc.GetMultiWithDeadline(keys, time.Now().Add(30*24*time.Hour))
+	if err != nil || len(items) != len(keys) {
+		t.Error(err)
+	}
+
+	// the deadline doesn't outlive the call
+	items, err = mc.GetMulti(keys)
+	if err != nil || len(items) != len(keys) {
+		t.Error(err)
+	}
+}
+
+func TestGetMultiWithFailedKeys(t *testing.T) {
+	mc := newSimpleClient(4)
+	key := "test_failed_keys"
+	if err := mc.Set(&Item{Key: key, Value: []byte(key)}); err != nil {
+		t.Error(ErrorSet)
+	}
+	invalidKey := "test failed keys"
+	items, failedKeys, err := mc.GetMultiWithFailedKeys(
+		[]string{key, "test_failed_keys_miss", invalidKey})
+	if err != ErrCacheMiss || len(items) != 1 || items[key] == nil {
+		t.Errorf("%v %v", items, err)
+	}
+	if len(failedKeys) != 1 || failedKeys[0] != invalidKey {
+		t.Errorf("%v", failedKeys)
+	}
+}
+
+func TestMetrics(t *testing.T) {
+	mc := newSimpleClient(1)
+	mc.ResetMetrics()
+	mc.Get("test_metrics")
+	mc.Get("test_metrics")
+	metrics := mc.Metrics()
+	if len(metrics) != 1 {
+		t.Fatalf("%v", metrics)
+	}
+	for _, m := range metrics {
+		if m.Requests != 2 || m.Complete.Count != 2 || m.BytesSent == 0 ||
+			len(m.Complete.Buckets) == 0 {
+			t.Errorf("%+v", m)
+		}
+	}
+	mc.ResetMetrics()
+	for _, m := range mc.Metrics() {
+		if m.Requests != 0 {
+			t.Errorf("%+v", m)
+		}
+	}
+}
+
+func TestSetLogger(t *testing.T) {
+	var mu sync.Mutex
+	var logged []string
+	SetLogger(func(level int, file string, line int, msg string) {
+		mu.Lock()
+		defer mu.Unlock()
+		if level <= LogWarning {
+			logged = append(logged, msg)
+		}
+	}, LogWarning)
+	defer SetLogger(nil, LogError)
+
+	mc := newSimplePrefixClient(1, "")
+	if _, err := mc.Get("invalid key"); err != ErrMalformedKey {
+		t.Errorf("%v", err)
+	}
+	FlushLog()
+	mu.Lock()
+	defer mu.Unlock()
+	found := false
+	for _, msg := range logged {
+		found = found || strings.Contains(msg, "invalid mc key")
+	}
+	if !found {
+		t.Errorf("%v", logged)
+	}
+}
+
+func TestSetTracer(t *testing.T) {
+	mc := newSimplePrefixClient(2, "")
+	var spans []Span
+	mc.SetTracer(func(span *Span) {
+		spans = append(spans, *span)
+	})
+	keys := []string{"foo", "bar", "baz", "qux"}
+	if _, err := mc.GetMulti(keys); err != nil && err != ErrCacheMiss {
+		t.Fatal(err)
+	}
+	phases := make(map[int]int)
+	nKeys := 0
+	for _, span := range spans {
+		phases[span.Phase]++
+		if span.End.Before(span.Start) || span.Err != nil {
+			t.Errorf("%+v", span)
+		}
+		if span.Phase == TraceSend {
+			nKeys += span.Keys
+			if span.Server == "" {
+				t.Errorf("%+v", span)
+			}
+		}
+	}
+	if phases[TraceRoute] != 1 || phases[TraceCollect] != 1 || nKeys != len(keys) ||
+		phases[TraceSend] != phases[TraceParse] {
+		t.Errorf("%v", phases)
+	}
+
+	mc.SetTracer(nil)
+	spans = nil
+	mc.GetMulti(keys)
+	if len(spans) != 0 {
+		t.Errorf("%v", spans)
+	}
+}
+
 func BenchmarkSetAndGet(b *testing.B) {
 	mc := newSimplePrefixClient(1, "")
 	key := "google"
@@ -852,3 +1079,242 @@ func BenchmarkSetAndGet(b *testing.B) {
 		mc.Get(key)
 	}
 }
+
+func BenchmarkSetMultiAndGetMulti(b *testing.B) {
+	mc := newSimplePrefixClient(2, "")
+	items := make([]*Item, 100)
+	keys := make([]string, len(items))
+	for i := range items {
+		keys[i] = fmt.Sprintf("bench_multi_%d", i)
+		items[i] = &Item{Key: keys[i], Value: []byte(strings.Repeat("v", 100))}
+	}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		mc.SetMulti(items)
+		mc.GetMulti(keys)
+	}
+}
+
+func TestConfigCompression(t *testing.T) {
+	mc := newSimpleClient(1)
+	if err := mc.ConfigCompression(CompressNone, 0); err != nil {
+		t.Fatal(err)
+	}
+	value := []byte(strings.Repeat("compressible ", 1000))
+	for _, codec := range []int{CompressZlib, CompressLZ4, CompressZstd} {
+		if err := mc.ConfigCompression(codec, 100); err == ErrCodecUnavailable && codec != CompressZlib {
+			continue
+		} else if err != nil {
+			t.Fatal(err)
+		}
+		key := "test_compression"
+		if err := mc.Set(&Item{Key: key, Value: value, Flags: 1}); err != nil {
+			t.Fatal(err)
+		}
+		item, err := mc.Get(key)
+		if err != nil || item.Flags != 1 || !bytes.Equal(item.Value, value) {
+			t.Errorf("codec %d: %v %v", codec, item, err)
+		}
+	}
+	if err := mc.SetCompressionDictionary(nil); err != nil {
+		t.Error(err)
+	}
+}
+
+func TestMarshal(t *testing.T) {
+	doc := map[string]interface{}{
+		"id":   1024,
+		"tags": []interface{}{"a", -33, 3.5, nil, true},
+		"big":  uint64(1<<64 - 1),
+		"raw":  []byte{0, 0xff},
+	}
+	value, flags, err := Marshal(doc)
+	if err != nil || flags != FlagMsgpack || value[0] != 0x84 {
+		t.Fatal(value, flags, err)
+	}
+	decoded, err := Unmarshal(value, flags)
+	expected := map[string]interface{}{
+		"id":   int64(1024),
+		"tags": []interface{}{"a", int64(-33), 3.5, nil, true},
+		"big":  uint64(1<<64 - 1),
+		"raw":  []byte{0, 0xff},
+	}
+	if err != nil || !reflect.DeepEqual(decoded, expected) {
+		t.Errorf("%v %v", decoded, err)
+	}
+	value, _, _ = Marshal([]interface{}{1, "a"})
+	if string(value) != "\x92\x01\xa1a" {
+		t.Errorf("%q", value)
+	}
+
+	for _, v := range []interface{}{[]byte("douban"), true, int64(-42)} {
+		value, flags, err = Marshal(v)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if decoded, err = Unmarshal(value, flags); err != nil || !reflect.DeepEqual(decoded, v) {
+			t.Errorf("%v: %v %v", v, decoded, err)
+		}
+	}
+	if value, _, _ = Marshal(1024); string(value) != "1024" {
+		t.Errorf("%q", value)
+	}
+
+	cyclic := []interface{}{nil}
+	cyclic[0] = cyclic
+	for _, v := range []interface{}{cyclic, struct{}{}, make(chan int)} {
+		if _, _, err = Marshal(v); err != ErrUnsupportedValue {
+			t.Errorf("%T: %v", v, err)
+		}
+	}
+	for _, flags := range []uint32{FlagPickle, FlagMarshal} {
+		if _, err = Unmarshal([]byte("x"), flags); err != ErrUnsupportedValue {
+			t.Error(err)
+		}
+	}
+	// a map key
+	if _, err = Unmarshal([]byte("\x81\x90\x01"), FlagMsgpack); err != ErrUnsupportedValue {
+		t.Error(err)
+	}
+	if _, err = Unmarshal(value[:2], FlagMsgpack); err != ErrUnsupportedValue {
+		t.Error(err)
+	}
+
+	mc := newSimpleClient(1)
+	value, flags, _ = Marshal(doc)
+	if err = mc.Set(&Item{Key: "test_marshal", Value: value, Flags: flags}); err != nil {
+		t.Fatal(err)
+	}
+	item, err := mc.Get("test_marshal")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if decoded, err = Unmarshal(item.Value, item.Flags); !reflect.DeepEqual(decoded, expected) {
+		t.Errorf("%v %v", decoded, err)
+	}
+}
+
+func TestConfigSplitLargeValues(t *testing.T) {
+	mc := newSimpleClient(1)
+	mc.ConfigSplitLargeValues(true)
+	value := bytes.Repeat([]byte("0123456789"), 250001)
+	key := "test_split_large_values"
+	if err := mc.Set(&Item{Key: key, Value: value, Flags: 1}); err != nil {
+		t.Fatal(err)
+	}
+	item, err := mc.Get(key)
+	if err != nil || item.Flags != 1 || !bytes.Equal(item.Value, value) {
+		t.Errorf("joined: %v", err)
+	}
+	items, err := mc.GetMulti([]string{key, "~23" + key + "/2"})
+	if err != nil || len(items) != 2 || len(items["~23"+key+"/2"].Value) != 500010 {
+		t.Errorf("chunks: %v", err)
+	}
+	mc.Delete(key)
+}
+
+func TestConfigBinarySafeKeys(t *testing.T) {
+	mc := newSimplePrefixClient(2, "binary:")
+	mc.ConfigBinarySafeKeys(true)
+	keys := []string{"key1 0\r\nset injected 0 3600 3", "?\x00", "%25", "plain"}
+	for _, key := range keys {
+		if err := mc.Set(&Item{Key: key, Value: []byte(key)}); err != nil {
+			t.Fatal(key, err)
+		}
+	}
+	items, err := mc.GetMulti(keys)
+	if err != nil || len(items) != len(keys) {
+		t.Fatal(items, err)
+	}
+	for _, key := range keys {
+		if item := items[key]; item == nil || string(item.Value) != key {
+			t.Error(key, item)
+		}
+	}
+	if _, err := mc.Get(strings.Repeat(" ", 187)); err != ErrMalformedKey {
+		t.Error(err)
+	}
+
+	raw := newSimpleClient(2)
+	if item, err := raw.Get("?binary:%AA"); err != nil || string(item.Value) != "?\x00" {
+		t.Error(item, err)
+	}
+	if _, err := raw.Get("injected"); err != ErrCacheMiss {
+		t.Error(err)
+	}
+	mc.DeleteMulti(keys)
+}
+
+func TestConfigMaxGetSize(t *testing.T) {
+	mc := newSimpleClient(2)
+	mc.ConfigMaxGetSize(3, 16)
+	keys := make([]string, 20)
+	items := make([]*Item, len(keys))
+	for i := range keys {
+		keys[i] = fmt.Sprintf("test_max_get_size_%d", i)
+		items[i] = &Item{Key: keys[i], Value: []byte(keys[i])}
+	}
+	if failed, err := mc.SetMulti(items); err != nil {
+		t.Fatal(failed, err)
+	}
+	rv, err := mc.GetMulti(keys)
+	if err != nil || len(rv) != len(keys) {
+		t.Fatal(len(rv), err)
+	}
+	for _, key := range keys {
+		if string(rv[key].Value) != key {
+			t.Error(key, rv[key])
+		}
+	}
+	mc.DeleteMulti(keys)
+}
+
+func TestConfigConnsPerServer(t *testing.T) {
+	mc := newSimpleClient(2)
+	mc.ConfigConnsPerServer(4)
+	keys := make([]string, 50)
+	items := make([]*Item, len(keys))
+	for i := range keys {
+		keys[i] = fmt.Sprintf("test_conns_per_server_%d", i)
+		items[i] = &Item{Key: keys[i], Value: []byte(keys[i])}
+	}
+	if failed, err := mc.SetMulti(items); err != nil {
+		t.Fatal(failed, err)
+	}
+	rv, err := mc.GetMulti(keys)
+	if err != nil || len(rv) != len(keys) {
+		t.Fatal(len(rv), err)
+	}
+	for _, key := range keys {
+		if string(rv[key].Value) != key {
+			t.Error(key, rv[key])
+		}
+	}
+	if versions, err := mc.Version(); err != nil || len(versions) != 2 {
+		t.Error(versions, err)
+	}
+	mc.DeleteMulti(keys)
+}
+
+func TestGetMultiInto(t *testing.T) {
+	mc := newSimpleClient(1)
+	mc.Set(&Item{Key: "test_into_1", Value: []byte("0123456789abcdef")})
+	mc.Set(&Item{Key: "test_into_2", Value: []byte("0123456789abcdefg")})
+	keys := []string{"test_into_1", "test_into_2", "test_into_missing"}
+	buf := make([]byte, 16*len(keys))
+	if _, err := mc.GetMultiInto(keys, buf[:16], 16); err != ErrBufferTooSmall {
+		t.Errorf("expected ErrBufferTooSmall: %v", err)
+	}
+	items, err := mc.GetMultiInto(keys, buf, 16)
+	if err != ErrCacheMiss || len(items) != 2 {
+		t.Fatalf("%v %v", items, err)
+	}
+	if string(items[keys[0]].Value) != "0123456789abcdef" ||
+		&items[keys[0]].Value[0] != &buf[0] {
+		t.Errorf("not read into buf: %v", items[keys[0]])
+	}
+	if string(items[keys[1]].Value) != "0123456789abcdefg" {
+		t.Errorf("oversized: %v", items[keys[1]])
+	}
+	mc.DeleteMulti(keys)
+}
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Client.h"
+#include "benchmark.h"
+#include "fake_server.h"
+
+using douban::mc::Client;
+using douban::mc::benchmark::FakeServer;
+using douban::mc::benchmark::State;
+
+
+// a client of nServers fake servers replying values of valueSize bytes
+class FakeCluster {
+ public:
+  FakeCluster(size_t nServers, size_t valueSize) : m_ok(true) {
+    std::vector<const char*> hosts;
+    std::vector<uint32_t> ports;
+    for (size_t i = 0; i < nServers; ++i) {
+      FakeServer* server = new FakeServer(valueSize);
+      m_servers.push_back(server);
+      m_ok = m_ok && server->start() > 0;
+      hosts.push_back("127.0.0.1");
+      ports.push_back(server->port());
+    }
+    m_client.config(CFG_POLL_TIMEOUT, 1000);
+    m_client.init(&hosts[0], &ports[0], nServers);
+  }
+
+  ~FakeCluster() {
+    m_client.quit();
+    for (std::vector<FakeServer*>::iterator it = m_servers.begin(); it != m_servers.end();
+         ++it) {
+      delete *it;
+    }
+  }
+
+  bool ok() {
+    return m_ok;
+  }
+
+  Client* client() {
+    return &m_client;
+  }
+
+ protected:
+  bool m_ok;
+  std::vector<FakeServer*> m_servers;
+  Client m_client;
+};
+
+
+static void genKeys(size_t n, std::vector<std::string>& keys,
+                    std::vector<const char*>& keyPtrs, std::vector<size_t>& keyLens) {
+  char key[32];
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(key, sizeof key, "key:%zu", i);
+    keys.push_back(key);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    keyPtrs.push_back(keys[i].c_str());
+    keyLens.push_back(keys[i].size());
+  }
+}
+
+
+static void BM_ClientGet(State& state) {
+  FakeCluster cluster(1, state.arg());
+  if (!cluster.ok()) {
+    state.skipWithError("failed to start the fake server");
+    return;
+  }
+  Client* client = cluster.client();
+  const char* key = "key";
+  size_t keyLen = 3;
+  retrieval_result_t** results = NULL;
+  size_t nResults = 0;
+  while (state.keepRunning()) {
+    if (client->get(&key, &keyLen, 1, &results, &nResults) != RET_OK || nResults != 1) {
+      state.skipWithError("get failed");
+    }
+    client->destroyRetrievalResult();
+  }
+  state.setBytesProcessed(state.iterations() * state.arg());
+  state.setItemsProcessed(state.iterations());
+}
+MC_BENCHMARK_ARGS(BM_ClientGet, 10, 1000, 100000);
+
+
+static void BM_ClientSet(State& state) {
+  FakeCluster cluster(1, 0);
+  if (!cluster.ok()) {
+    state.skipWithError("failed to start the fake server");
+    return;
+  }
+  Client* client = cluster.client();
+  std::string value(state.arg(), 'v');
+  const char* key = "key";
+  size_t keyLen = 3;
+  const char* val = value.data();
+  size_t valLen = value.size();
+  flags_t flags = 0;
+  message_result_t** results = NULL;
+  size_t nResults = 0;
+  while (state.keepRunning()) {
+    if (client->set(&key, &keyLen, &flags, 0, NULL, false, &val, &valLen, 1,
+                    &results, &nResults) != RET_OK || nResults != 1) {
+      state.skipWithError("set failed");
+    }
+    client->destroyMessageResult();
+  }
+  state.setBytesProcessed(state.iterations() * state.arg());
+  state.setItemsProcessed(state.iterations());
+}
+MC_BENCHMARK_ARGS(BM_ClientSet, 10, 1000, 100000);
+
+
+// 100 keys of 100 bytes values spread over arg servers
+static void BM_ClientGetMulti(State& state) {
+  const size_t nKeys = 100, valueSize = 100;
+  FakeCluster cluster(state.arg(), valueSize);
+  if (!cluster.ok()) {
+    state.skipWithError("failed to start the fake server");
+    return;
+  }
+  Client* client = cluster.client();
+  std::vector<std::string> keys;
+  std::vector<const char*> keyPtrs;
+  std::vector<size_t> keyLens;
+  genKeys(nKeys, keys, keyPtrs, keyLens);
+  retrieval_result_t** results = NULL;
+  size_t nResults = 0;
+  while (state.keepRunning()) {
+    if (client->get(&keyPtrs[0], &keyLens[0], nKeys, &results, &nResults) != RET_OK ||
+        nResults != nKeys) {
+      state.skipWithError("get_multi failed");
+    }
+    client->destroyRetrievalResult();
+  }
+  state.setBytesProcessed(state.iterations() * nKeys * valueSize);
+  state.setItemsProcessed(state.iterations() * nKeys);
+}
+MC_BENCHMARK_ARGS(BM_ClientGetMulti, 1, 4, 16);
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "BufferReader.h"
+#include "BufferWriter.h"
+#include "Parser.h"
+#include "benchmark.h"
+
+using douban::mc::PacketParser;
+using douban::mc::benchmark::State;
+using douban::mc::io::BufferReader;
+using douban::mc::io::BufferWriter;
+using douban::mc::io::TokenData;
+using douban::mc::io::freeTokenData;
+
+
+static const size_t N_KEYS = 100;
+
+
+// the response of a get of N_KEYS keys, all hits
+static std::vector<char> getResponse(size_t valueSize) {
+  std::string rv, value(valueSize, 'v');
+  char header[64];
+  for (size_t i = 0; i < N_KEYS; ++i) {
+    snprintf(header, sizeof header, "VALUE key:%zu 0 %zu\r\n", i, valueSize);
+    rv.append(header).append(value).append("\r\n");
+  }
+  rv.append("END\r\n");
+  return std::vector<char>(rv.begin(), rv.end());
+}
+
+
+// parse a response received in chunks of the size recv usually gets
+static void BM_ParseGetResponse(State& state) {
+  std::vector<char> response = getResponse(state.arg());
+  const size_t chunkSize = 16384;
+  BufferReader reader;
+  PacketParser parser;
+  parser.setBufferReader(&reader);
+  err_code_t err = RET_OK;
+  while (state.keepRunning()) {
+    parser.setMode(douban::mc::MODE_END_STATE);
+    for (size_t pos = 0; pos < response.size(); pos += chunkSize) {
+      size_t len = std::min(chunkSize, response.size() - pos);
+      reader.write(&response[pos], len);
+      parser.process_packets(err);
+    }
+    if (err != RET_OK || parser.getRetrievalResults()->size() != N_KEYS) {
+      state.skipWithError("unexpected parsing result");
+    }
+    parser.reset();
+    reader.reset();
+  }
+  state.setBytesProcessed(state.iterations() * response.size());
+  state.setItemsProcessed(state.iterations() * N_KEYS);
+}
+MC_BENCHMARK_ARGS(BM_ParseGetResponse, 10, 1000, 100000);
+
+
+static void BM_ParseStorageResponse(State& state) {
+  std::string response;
+  for (size_t i = 0; i < N_KEYS; ++i) {
+    response.append("STORED\r\n");
+  }
+  std::vector<char> buf(response.begin(), response.end());
+  BufferReader reader;
+  PacketParser parser;
+  parser.setBufferReader(&reader);
+  err_code_t err = RET_OK;
+  while (state.keepRunning()) {
+    parser.setMode(douban::mc::MODE_COUNTING);
+    for (size_t i = 0; i < N_KEYS; ++i) {
+      parser.addRequestKey("key", 3);
+    }
+    reader.write(&buf[0], buf.size());
+    parser.process_packets(err);
+    if (err != RET_OK || parser.getMessageResults()->size() != N_KEYS) {
+      state.skipWithError("unexpected parsing result");
+    }
+    parser.reset();
+    reader.reset();
+  }
+  state.setBytesProcessed(state.iterations() * buf.size());
+  state.setItemsProcessed(state.iterations() * N_KEYS);
+}
+MC_BENCHMARK(BM_ParseStorageResponse);
+
+
+static void BM_BufferReaderReadUntil(State& state) {
+  std::vector<char> response = getResponse(state.arg());
+  BufferReader reader;
+  err_code_t err = RET_OK;
+  size_t nLines = 0;
+  while (state.keepRunning()) {
+    reader.write(&response[0], response.size());
+    for (;;) {
+      TokenData td;
+      reader.readUntil(err, '\n', td);
+      if (err != RET_OK) {
+        break;
+      }
+      reader.skipBytes(err, 1);
+      freeTokenData(td);
+      ++nLines;
+    }
+    reader.reset();
+  }
+  if (nLines != state.iterations() * (N_KEYS * 2 + 1)) {
+    state.skipWithError("unexpected number of lines");
+  }
+  state.setBytesProcessed(state.iterations() * response.size());
+}
+MC_BENCHMARK_ARGS(BM_BufferReaderReadUntil, 10, 1000);
+
+
+// build the iovecs of "get key:0 key:1 ...\r\n", as dispatchRetrieval does
+static void BM_BufferWriterGetCommand(State& state) {
+  std::vector<std::string> keys;
+  char key[32];
+  for (size_t i = 0; i < N_KEYS; ++i) {
+    snprintf(key, sizeof key, "key:%zu", i);
+    keys.push_back(key);
+  }
+  BufferWriter writer;
+  size_t nBytes = 0;
+  while (state.keepRunning()) {
+    writer.takeBuffer("get", 3);
+    for (std::vector<std::string>::iterator it = keys.begin(); it != keys.end(); ++it) {
+      writer.takeBuffer(" ", 1);
+      writer.takeBuffer(it->data(), it->size());
+    }
+    writer.takeBuffer("\r\n", 2);
+#ifdef __APPLE__
+    int n = 0;
+#else
+    size_t n = 0;
+#endif
+    const struct iovec* iov = writer.getReadPtr(n);
+    size_t len = 0;
+    for (size_t i = 0; i < static_cast<size_t>(n); ++i) {
+      len += iov[i].iov_len;
+    }
+    writer.commitRead(len);
+    nBytes += len;
+    writer.reset();
+  }
+  state.setBytesProcessed(nBytes);
+  state.setItemsProcessed(state.iterations() * N_KEYS);
+}
+MC_BENCHMARK(BM_BufferWriterGetCommand);
@@ -0,0 +1,162 @@
+#include <dirent.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "BufferReader.h"
+#include "Parser.h"
+#include "benchmark.h"
+
+using douban::mc::PacketParser;
+using douban::mc::benchmark::State;
+using douban::mc::io::BufferReader;
+using douban::mc::io::DataBlock;
+
+
+// A response captured by misc/capture_corpus.py: the header line
+// "libmc-corpus <end|counting> <count>\n" followed by the raw bytes.
+typedef struct {
+  std::string name;
+  douban::mc::ParserMode mode;
+  size_t count;
+  std::vector<char> data;
+} corpus_entry_t;
+
+
+static bool loadEntry(const std::string& path, corpus_entry_t& entry) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  char mode[16];
+  unsigned long count = 0;
+  bool ok = fscanf(fp, "libmc-corpus %15s %lu", mode, &count) == 2 && fgetc(fp) == '\n';
+  if (ok) {
+    entry.mode = strcmp(mode, "counting") == 0 ? douban::mc::MODE_COUNTING
+                                               : douban::mc::MODE_END_STATE;
+    entry.count = count;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+      entry.data.insert(entry.data.end(), buf, buf + n);
+    }
+    ok = !entry.data.empty();
+  }
+  fclose(fp);
+  return ok;
+}
+
+
+// the corpus in $MC_BENCHMARK_CORPUS, loaded once
+static const std::vector<corpus_entry_t>& corpus() {
+  static std::vector<corpus_entry_t> entries;
+  static bool loaded = false;
+  if (loaded) {
+    return entries;
+  }
+  loaded = true;
+  const char* dir = getenv("MC_BENCHMARK_CORPUS");
+  DIR* dp = dir == NULL ? NULL : opendir(dir);
+  if (dp == NULL) {
+    return entries;
+  }
+  std::vector<std::string> paths;
+  const char suffix[] = ".corpus";
+  const size_t suffixLen = sizeof suffix - 1;
+  for (struct dirent* ent = readdir(dp); ent != NULL; ent = readdir(dp)) {
+    size_t len = strlen(ent->d_name);
+    if (len > suffixLen && strcmp(ent->d_name + len - suffixLen, suffix) == 0) {
+      paths.push_back(std::string(dir) + "/" + ent->d_name);
+    }
+  }
+  closedir(dp);
+  std::sort(paths.begin(), paths.end());
+  for (std::vector<std::string>::iterator it = paths.begin(); it != paths.end(); ++it) {
+    corpus_entry_t entry;
+    entry.name = *it;
+    if (loadEntry(*it, entry)) {
+      entries.push_back(entry);
+    } else {
+      fprintf(stderr, "skip malformed corpus file %s\n", it->c_str());
+    }
+  }
+  return entries;
+}
+
+
+// feed every entry of the corpus in chunks of chunkSize bytes (0 for whole
+// responses), return false on any parsing error
+static bool replayCorpus(const std::vector<corpus_entry_t>& entries, size_t chunkSize,
+                         BufferReader& reader, PacketParser& parser) {
+  bool ok = true;
+  for (std::vector<corpus_entry_t>::const_iterator it = entries.begin();
+       it != entries.end(); ++it) {
+    const std::vector<char>& data = it->data;
+    size_t step = chunkSize == 0 ? data.size() : chunkSize;
+    err_code_t err = RET_OK;
+    parser.setMode(it->mode);
+    if (it->mode == douban::mc::MODE_COUNTING) {
+      for (size_t i = 0; i < it->count; ++i) {
+        parser.addRequestKey("key", 3);
+      }
+    }
+    for (size_t pos = 0; pos < data.size(); pos += step) {
+      reader.write(const_cast<char*>(&data[pos]), std::min(step, data.size() - pos));
+      parser.process_packets(err);
+      if (err != RET_OK && err != RET_INCOMPLETE_BUFFER_ERR) {
+        break;
+      }
+    }
+    ok = ok && err == RET_OK;
+    parser.reset();
+    reader.reset();
+  }
+  return ok;
+}
+
+
+static void benchmarkCorpus(State& state, size_t chunkSize) {
+  const std::vector<corpus_entry_t>& entries = corpus();
+  if (entries.empty()) {
+    state.skipWithError("no corpus, capture one with misc/capture_corpus.py and "
+                        "set MC_BENCHMARK_CORPUS");
+    return;
+  }
+  size_t nBytes = 0, nItems = 0;
+  for (std::vector<corpus_entry_t>::const_iterator it = entries.begin();
+       it != entries.end(); ++it) {
+    nBytes += it->data.size();
+    nItems += it->count;
+  }
+  BufferReader reader;
+  PacketParser parser;
+  parser.setBufferReader(&reader);
+  while (state.keepRunning()) {
+    if (!replayCorpus(entries, chunkSize, reader, parser)) {
+      state.skipWithError("failed to parse the corpus");
+    }
+  }
+  state.setBytesProcessed(state.iterations() * nBytes);
+  state.setItemsProcessed(state.iterations() * nItems);
+}
+
+
+// replay the corpus received in chunks of arg bytes, 0 for whole responses
+static void BM_ParseCorpus(State& state) {
+  benchmarkCorpus(state, state.arg());
+}
+MC_BENCHMARK_ARGS(BM_ParseCorpus, 0, 64, 1448, 16384, 65536);
+
+
+// replay the corpus in 16K chunks into DataBlocks of arg bytes, to measure
+// the cost of tokens fragmented across blocks
+static void BM_ParseCorpusBlockSize(State& state) {
+  size_t oldCapacity = DataBlock::minCapacity();
+  DataBlock::setMinCapacity(state.arg());
+  benchmarkCorpus(state, 16384);
+  DataBlock::setMinCapacity(oldCapacity);
+}
+MC_BENCHMARK_ARGS(BM_ParseCorpusBlockSize, 1024, 8192, 65536, 1048576);
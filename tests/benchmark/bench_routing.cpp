@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Connection.h"
+#include "hashkit/hashkit.h"
+#include "hashkit/ketama.h"
+#include "benchmark.h"
+
+using douban::mc::Connection;
+using douban::mc::benchmark::State;
+using douban::mc::hashkit::KetamaSelector;
+using douban::mc::hashkit::hash_function_t;
+
+
+static std::vector<std::string> genKeys(size_t n, size_t len) {
+  std::vector<std::string> keys;
+  char prefix[32];
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(prefix, sizeof prefix, "key:%zu:", i);
+    std::string key(prefix);
+    key.resize(std::max(len, key.size()), 'k');
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+
+static void benchmarkHash(State& state, hash_function_t fn) {
+  std::vector<std::string> keys = genKeys(1024, state.arg());
+  uint32_t sum = 0;
+  size_t i = 0;
+  while (state.keepRunning()) {
+    const std::string& key = keys[i++ & 1023];
+    sum += fn(key.data(), key.size());
+  }
+  if (sum == 0) {
+    state.skipWithError("all hashes are zero");
+  }
+  state.setBytesProcessed(state.iterations() * state.arg());
+}
+
+
+static void BM_HashMd5(State& state) {
+  benchmarkHash(state, douban::mc::hashkit::hash_md5);
+}
+MC_BENCHMARK_ARGS(BM_HashMd5, 8, 64, 250);
+
+static void BM_HashFnv1_32(State& state) {
+  benchmarkHash(state, douban::mc::hashkit::hash_fnv1_32);
+}
+MC_BENCHMARK_ARGS(BM_HashFnv1_32, 8, 64, 250);
+
+static void BM_HashFnv1a_32(State& state) {
+  benchmarkHash(state, douban::mc::hashkit::hash_fnv1a_32);
+}
+MC_BENCHMARK_ARGS(BM_HashFnv1a_32, 8, 64, 250);
+
+static void BM_HashCrc32(State& state) {
+  benchmarkHash(state, douban::mc::hashkit::hash_crc_32);
+}
+MC_BENCHMARK_ARGS(BM_HashCrc32, 8, 64, 250);
+
+
+// route a key among arg servers, without connecting them
+static void BM_KetamaGetServer(State& state) {
+  size_t nServers = state.arg();
+  Connection* conns = new Connection[nServers];
+  char host[32];
+  for (size_t i = 0; i < nServers; ++i) {
+    snprintf(host, sizeof host, "10.0.%zu.%zu", i / 256, i % 256);
+    conns[i].init(host, 11211);
+  }
+  KetamaSelector selector;
+  selector.addServers(conns, nServers);
+  std::vector<std::string> keys = genKeys(1024, 16);
+  size_t i = 0;
+  int sum = 0;
+  while (state.keepRunning()) {
+    const std::string& key = keys[i++ & 1023];
+    sum += selector.getServer(key.data(), key.size(), false);
+  }
+  if (sum < 0) {
+    state.skipWithError("no server is found");
+  }
+  state.setItemsProcessed(state.iterations());
+  delete[] conns;
+}
+MC_BENCHMARK_ARGS(BM_KetamaGetServer, 1, 10, 100);
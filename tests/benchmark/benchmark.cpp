@@ -0,0 +1,215 @@
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+namespace douban {
+namespace mc {
+namespace benchmark {
+
+typedef struct {
+  std::string name;
+  benchmark_fn_t fn;
+  std::vector<int64_t> args;
+} benchmark_t;
+
+
+// constructed on first use, registrations run during static initialization
+static std::vector<benchmark_t>& registry() {
+  static std::vector<benchmark_t> benchmarks;
+  return benchmarks;
+}
+
+
+int64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+State::State(uint64_t maxIterations, int64_t arg)
+  : m_maxIterations(maxIterations), m_iterations(0), m_arg(arg), m_start(0), m_elapsed(0),
+    m_running(false), m_bytesProcessed(0), m_itemsProcessed(0), m_error(NULL) {
+}
+
+
+bool State::keepRunning() {
+  if (!m_running) {
+    if (m_iterations > 0 || m_error != NULL) {
+      return false;
+    }
+    m_running = true;
+    m_start = nowNs();
+  }
+  if (m_iterations < m_maxIterations && m_error == NULL) {
+    ++m_iterations;
+    return true;
+  }
+  m_elapsed += nowNs() - m_start;
+  m_running = false;
+  return false;
+}
+
+
+uint64_t State::iterations() const {
+  return m_iterations;
+}
+
+
+int64_t State::arg() const {
+  return m_arg;
+}
+
+
+void State::pauseTiming() {
+  m_elapsed += nowNs() - m_start;
+}
+
+
+void State::resumeTiming() {
+  m_start = nowNs();
+}
+
+
+void State::setBytesProcessed(uint64_t n) {
+  m_bytesProcessed = n;
+}
+
+
+void State::setItemsProcessed(uint64_t n) {
+  m_itemsProcessed = n;
+}
+
+
+void State::skipWithError(const char* msg) {
+  m_error = msg;
+}
+
+
+int64_t State::elapsedNs() const {
+  return m_elapsed;
+}
+
+
+uint64_t State::bytesProcessed() const {
+  return m_bytesProcessed;
+}
+
+
+uint64_t State::itemsProcessed() const {
+  return m_itemsProcessed;
+}
+
+
+const char* State::error() const {
+  return m_error;
+}
+
+
+Registration::Registration(const char* name, benchmark_fn_t fn, const int64_t* args,
+                           size_t nArgs) {
+  benchmark_t benchmark;
+  benchmark.name = name;
+  benchmark.fn = fn;
+  benchmark.args.assign(args, args + nArgs);
+  registry().push_back(benchmark);
+}
+
+
+static void formatRate(char* buf, size_t size, double perSecond, const char* unit) {
+  const char* prefixes[] = {"", "k", "M", "G", "T"};
+  size_t i = 0;
+  while (perSecond >= 1000 && i < 4) {
+    perSecond /= 1000;
+    ++i;
+  }
+  snprintf(buf, size, "%.1f%s%s/s", perSecond, prefixes[i], unit);
+}
+
+
+static void run(const benchmark_t& benchmark, const std::string& name, int64_t arg,
+                double minTime) {
+  const int64_t minNs = static_cast<int64_t>(minTime * 1e9);
+  uint64_t n = 1;
+  for (;;) {
+    State state(n, arg);
+    benchmark.fn(state);
+    if (state.error() != NULL) {
+      printf("%-48s ERROR: %s\n", name.c_str(), state.error());
+      return;
+    }
+    int64_t elapsed = state.elapsedNs();
+    if (elapsed >= minNs || n >= 1000000000) {
+      double nsPerIter = static_cast<double>(elapsed) / static_cast<double>(n);
+      char bytes[32] = "", items[32] = "";
+      if (state.bytesProcessed() > 0) {
+        formatRate(bytes, sizeof bytes, state.bytesProcessed() * 1e9 / elapsed, "B");
+      }
+      if (state.itemsProcessed() > 0) {
+        formatRate(items, sizeof items, state.itemsProcessed() * 1e9 / elapsed, "");
+      }
+      printf("%-48s %14.1f ns %12llu %14s %14s\n", name.c_str(), nsPerIter,
+             static_cast<unsigned long long>(n), bytes, items);
+      fflush(stdout);
+      return;
+    }
+    // aim at 1.4x the minimum time, growing at most 10x at a time
+    double multiplier = elapsed > 0 ? minNs * 1.4 / elapsed : 10;
+    multiplier = multiplier > 10 ? 10 : (multiplier < 2 ? 2 : multiplier);
+    n = static_cast<uint64_t>(n * multiplier);
+  }
+}
+
+
+// Usage: mc_benchmark [--filter=SUBSTRING] [--min_time=SECONDS]
+int runBenchmarks(int argc, char** argv) {
+  const char* filter = "";
+  double minTime = 0.5;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else if (strncmp(argv[i], "--min_time=", 11) == 0) {
+      minTime = atof(argv[i] + 11);
+    } else {
+      fprintf(stderr, "Usage: %s [--filter=SUBSTRING] [--min_time=SECONDS]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("%-48s %17s %12s %14s %14s\n", "Benchmark", "Time", "Iterations", "Bytes", "Items");
+  std::vector<benchmark_t>& benchmarks = registry();
+  for (std::vector<benchmark_t>::iterator it = benchmarks.begin(); it != benchmarks.end();
+       ++it) {
+    std::vector<int64_t> args = it->args;
+    if (args.empty()) {
+      args.push_back(0);
+    }
+    for (std::vector<int64_t>::iterator arg = args.begin(); arg != args.end(); ++arg) {
+      std::string name = it->name;
+      if (!it->args.empty()) {
+        char suffix[32];
+        snprintf(suffix, sizeof suffix, "/%lld", static_cast<long long>(*arg));
+        name += suffix;
+      }
+      if (name.find(filter) == std::string::npos) {
+        continue;
+      }
+      run(*it, name, *arg, minTime);
+    }
+  }
+  return 0;
+}
+
+} // namespace benchmark
+} // namespace mc
+} // namespace douban
+
+
+int main(int argc, char** argv) {
+  return douban::mc::benchmark::runBenchmarks(argc, argv);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// A minimal harness in the style of Google Benchmark:
+//
+//   static void BM_Foo(State& state) {
+//     while (state.keepRunning()) {
+//       foo(state.arg());
+//     }
+//     state.setBytesProcessed(state.iterations() * n);
+//   }
+//   MC_BENCHMARK_ARGS(BM_Foo, 16, 1024);
+//
+// Each benchmark is run with a growing number of iterations until it takes
+// at least --min_time seconds, then the time per iteration is reported.
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace douban {
+namespace mc {
+namespace benchmark {
+
+class State {
+ public:
+  State(uint64_t maxIterations, int64_t arg);
+  bool keepRunning();
+  uint64_t iterations() const;
+  int64_t arg() const;
+  // exclude setup inside the loop from the timing
+  void pauseTiming();
+  void resumeTiming();
+  void setBytesProcessed(uint64_t n);
+  void setItemsProcessed(uint64_t n);
+  void skipWithError(const char* msg);
+
+  int64_t elapsedNs() const;
+  uint64_t bytesProcessed() const;
+  uint64_t itemsProcessed() const;
+  const char* error() const;
+
+ protected:
+  uint64_t m_maxIterations;
+  uint64_t m_iterations;
+  int64_t m_arg;
+  int64_t m_start;
+  int64_t m_elapsed;
+  bool m_running;
+  uint64_t m_bytesProcessed;
+  uint64_t m_itemsProcessed;
+  const char* m_error;
+};
+
+
+typedef void (*benchmark_fn_t)(State& state);
+
+class Registration {
+ public:
+  Registration(const char* name, benchmark_fn_t fn, const int64_t* args = NULL,
+               size_t nArgs = 0);
+};
+
+int64_t nowNs();
+int runBenchmarks(int argc, char** argv);
+
+} // namespace benchmark
+} // namespace mc
+} // namespace douban
+
+
+#define MC_BENCHMARK(FN) \
+  static ::douban::mc::benchmark::Registration _mc_benchmark_##FN(#FN, FN)
+
+#define MC_BENCHMARK_ARGS(FN, ...) \
+  static const int64_t _mc_benchmark_args_##FN[] = {__VA_ARGS__}; \
+  static ::douban::mc::benchmark::Registration _mc_benchmark_##FN( \
+    #FN, FN, _mc_benchmark_args_##FN, \
+    sizeof _mc_benchmark_args_##FN / sizeof _mc_benchmark_args_##FN[0])
@@ -0,0 +1,240 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "fake_server.h"
+
+namespace douban {
+namespace mc {
+namespace benchmark {
+
+typedef struct {
+  FakeServer* server;
+  int fd;
+} connection_arg_t;
+
+
+FakeServer::FakeServer(size_t valueSize)
+  : m_value(valueSize, 'v'), m_listenFd(-1), m_port(0), m_started(false) {
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+
+FakeServer::~FakeServer() {
+  stop();
+  pthread_mutex_destroy(&m_lock);
+}
+
+
+int FakeServer::start() {
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (m_listenFd == -1 ||
+      bind(m_listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) != 0 ||
+      listen(m_listenFd, 128) != 0 ||
+      getsockname(m_listenFd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen) != 0 ||
+      pthread_create(&m_acceptor, NULL, acceptLoop, this) != 0) {
+    if (m_listenFd != -1) {
+      close(m_listenFd);
+      m_listenFd = -1;
+    }
+    return -1;
+  }
+  m_started = true;
+  m_port = ntohs(addr.sin_port);
+  return static_cast<int>(m_port);
+}
+
+
+void FakeServer::stop() {
+  if (!m_started) {
+    return;
+  }
+  m_started = false;
+  shutdown(m_listenFd, SHUT_RDWR);
+  pthread_join(m_acceptor, NULL);
+  close(m_listenFd);
+  m_listenFd = -1;
+
+  pthread_mutex_lock(&m_lock);
+  for (std::vector<int>::iterator it = m_connFds.begin(); it != m_connFds.end(); ++it) {
+    shutdown(*it, SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&m_lock);
+  for (std::vector<pthread_t>::iterator it = m_connThreads.begin();
+       it != m_connThreads.end(); ++it) {
+    pthread_join(*it, NULL);
+  }
+  for (std::vector<int>::iterator it = m_connFds.begin(); it != m_connFds.end(); ++it) {
+    close(*it);
+  }
+  m_connFds.clear();
+  m_connThreads.clear();
+}
+
+
+uint32_t FakeServer::port() const {
+  return m_port;
+}
+
+
+void* FakeServer::acceptLoop(void* server) {
+  FakeServer* self = static_cast<FakeServer*>(server);
+  for (;;) {
+    int fd = accept(self->m_listenFd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    int opt_nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt_nodelay, sizeof opt_nodelay);
+    connection_arg_t* arg = new connection_arg_t;
+    arg->server = self;
+    arg->fd = fd;
+    pthread_t thread;
+    pthread_mutex_lock(&self->m_lock);
+    if (pthread_create(&thread, NULL, serveLoop, arg) == 0) {
+      self->m_connFds.push_back(fd);
+      self->m_connThreads.push_back(thread);
+    } else {
+      close(fd);
+      delete arg;
+    }
+    pthread_mutex_unlock(&self->m_lock);
+  }
+  return NULL;
+}
+
+
+void* FakeServer::serveLoop(void* conn) {
+  connection_arg_t* arg = static_cast<connection_arg_t*>(conn);
+  arg->server->serve(arg->fd);
+  delete arg;
+  return NULL;
+}
+
+
+void FakeServer::serve(int fd) {
+  std::string input, output;
+  char buf[65536];
+  for (;;) {
+    ssize_t n = recv(fd, buf, sizeof buf, 0);
+    if (n <= 0) {
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    input.append(buf, n);
+    bool quit = respond(input, output);
+    size_t nSent = 0;
+    while (nSent < output.size()) {
+      n = send(fd, output.data() + nSent, output.size() - nSent, MSG_NOSIGNAL);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      nSent += n;
+    }
+    output.clear();
+    if (quit) {
+      shutdown(fd, SHUT_RDWR);
+      return;
+    }
+  }
+}
+
+
+// consume the complete commands in input, return true on quit
+bool FakeServer::respond(std::string& input, std::string& output) {
+  size_t pos = 0;
+  char header[64];
+  for (;;) {
+    size_t eol = input.find("\r\n", pos);
+    if (eol == std::string::npos) {
+      break;
+    }
+    std::vector<std::string> tokens;
+    for (size_t start = pos; start < eol;) {
+      size_t end = input.find(' ', start);
+      if (end == std::string::npos || end > eol) {
+        end = eol;
+      }
+      if (end > start) {
+        tokens.push_back(input.substr(start, end - start));
+      }
+      start = end + 1;
+    }
+    if (tokens.empty()) {
+      pos = eol + 2;
+      continue;
+    }
+
+    const std::string& cmd = tokens[0];
+    bool noreply = tokens.back() == "noreply";
+    if (cmd == "get" || cmd == "gets") {
+      for (size_t i = 1; i < tokens.size(); ++i) {
+        if (cmd == "gets") {
+          snprintf(header, sizeof header, " 0 %zu 1\r\n", m_value.size());
+        } else {
+          snprintf(header, sizeof header, " 0 %zu\r\n", m_value.size());
+        }
+        output.append("VALUE ").append(tokens[i]).append(header);
+        output.append(m_value).append("\r\n");
+      }
+      output.append("END\r\n");
+    } else if (cmd == "set" || cmd == "add" || cmd == "replace" || cmd == "append" ||
+               cmd == "prepend" || cmd == "cas") {
+      size_t nBytes = tokens.size() > 4 ? strtoul(tokens[4].c_str(), NULL, 10) : 0;
+      if (input.size() < eol + 2 + nBytes + 2) {
+        break; // wait for the data block
+      }
+      pos = eol + 2 + nBytes + 2;
+      if (!noreply) {
+        output.append("STORED\r\n");
+      }
+      continue;
+    } else if (cmd == "delete") {
+      if (!noreply) {
+        output.append("DELETED\r\n");
+      }
+    } else if (cmd == "touch") {
+      if (!noreply) {
+        output.append("TOUCHED\r\n");
+      }
+    } else if (cmd == "incr" || cmd == "decr") {
+      if (!noreply) {
+        output.append("1\r\n");
+      }
+    } else if (cmd == "version") {
+      output.append("VERSION 1.4.99\r\n");
+    } else if (cmd == "quit") {
+      input.erase(0, eol + 2);
+      return true;
+    } else {
+      output.append("ERROR\r\n");
+    }
+    pos = eol + 2;
+  }
+  input.erase(0, pos);
+  return false;
+}
+
+} // namespace benchmark
+} // namespace mc
+} // namespace douban
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace douban {
+namespace mc {
+namespace benchmark {
+
+// A memcached speaking the text protocol on an ephemeral loopback port,
+// without storage: every retrieved key is a hit replaying the same canned
+// value, storage commands are swallowed. It measures the client, not a
+// server, so that benchmarks need no external services.
+class FakeServer {
+ public:
+  explicit FakeServer(size_t valueSize);
+  ~FakeServer();
+  // return the port, or -1 on failure
+  int start();
+  void stop();
+  uint32_t port() const;
+
+ protected:
+  static void* acceptLoop(void* server);
+  static void* serveLoop(void* conn);
+  void serve(int fd);
+  bool respond(std::string& input, std::string& output);
+
+  std::string m_value;
+  int m_listenFd;
+  uint32_t m_port;
+  pthread_t m_acceptor;
+  bool m_started;
+  pthread_mutex_t m_lock; // guards the ones below
+  std::vector<int> m_connFds;
+  std::vector<pthread_t> m_connThreads;
+};
+
+} // namespace benchmark
+} // namespace mc
+} // namespace douban
@@ -0,0 +1,586 @@
+// mc_loadgen: drive memcached servers with a mix of gets and sets through
+// Client, and report throughput and latency percentiles.
+//
+//   mc_loadgen --servers=127.0.0.1:11211 --threads=4 --ratio=1:10 --batch=10
+//   mc_loadgen --fake=4 --key-dist=zipf --rate=50000
+//
+// In closed loop (the default) every thread sends its next request as soon
+// as the previous one returns. With --rate the requests are scheduled at a
+// fixed total rate instead, and latencies are measured from the scheduled
+// time, so that a stalled server is not hidden by the requests it delayed.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Client.h"
+#include "Utility.h"
+#include "fake_server.h"
+
+using douban::mc::Client;
+using douban::mc::benchmark::FakeServer;
+using douban::mc::utility::getCurrentMonotonicUs;
+
+
+// log-linear buckets of microseconds, 32 per power of two, so that a
+// percentile is off by less than 3%
+class Histogram {
+ public:
+  Histogram() : m_count(0), m_sum(0), m_max(0), m_buckets(N_BUCKETS, 0) {
+  }
+
+  void record(int64_t us) {
+    uint64_t v = us > 0 ? static_cast<uint64_t>(us) : 0;
+    size_t idx = v;
+    if (v >= N_SUB) {
+      int msb = 63 - __builtin_clzll(v);
+      idx = (msb - SUB_BITS + 1) * N_SUB + ((v >> (msb - SUB_BITS)) & (N_SUB - 1));
+    }
+    if (idx >= N_BUCKETS) {
+      idx = N_BUCKETS - 1;
+    }
+    ++m_buckets[idx];
+    ++m_count;
+    m_sum += v;
+    if (v > m_max) {
+      m_max = v;
+    }
+  }
+
+  void merge(const Histogram& other) {
+    for (size_t i = 0; i < N_BUCKETS; ++i) {
+      m_buckets[i] += other.m_buckets[i];
+    }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    if (other.m_max > m_max) {
+      m_max = other.m_max;
+    }
+  }
+
+  // the upper bound of the bucket holding the p-th percentile
+  uint64_t percentile(double p) const {
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100 * m_count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < N_BUCKETS; ++i) {
+      seen += m_buckets[i];
+      if (seen >= rank && seen > 0) {
+        uint64_t upper = i < N_SUB ? i : upperBound(i);
+        return upper < m_max ? upper : m_max;
+      }
+    }
+    return m_max;
+  }
+
+  uint64_t count() const {
+    return m_count;
+  }
+
+  double mean() const {
+    return m_count == 0 ? 0 : static_cast<double>(m_sum) / m_count;
+  }
+
+  uint64_t max() const {
+    return m_max;
+  }
+
+ protected:
+  static const int SUB_BITS = 5;
+  static const size_t N_SUB = 1 << SUB_BITS;
+  static const size_t N_BUCKETS = (40 - SUB_BITS + 1) * N_SUB;
+
+  static uint64_t upperBound(size_t idx) {
+    int msb = static_cast<int>(idx / N_SUB) + SUB_BITS - 1;
+    uint64_t sub = idx % N_SUB;
+    return ((N_SUB + sub + 1) << (msb - SUB_BITS)) - 1;
+  }
+
+  uint64_t m_count;
+  uint64_t m_sum;
+  uint64_t m_max;
+  std::vector<uint64_t> m_buckets;
+};
+
+
+// xorshift64*, one per thread
+class Random {
+ public:
+  explicit Random(uint64_t seed) : m_state(seed * 0x9E3779B97F4A7C15ULL + 1) {
+  }
+
+  uint64_t next() {
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * 0x2545F4914F6CDD1DULL;
+  }
+
+  // uniform in [0, 1)
+  double nextDouble() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  // uniform in [lo, hi]
+  uint64_t nextRange(uint64_t lo, uint64_t hi) {
+    return lo + next() % (hi - lo + 1);
+  }
+
+ protected:
+  uint64_t m_state;
+};
+
+
+// Zipfian ranks in [0, n), rank 0 being the hottest, as in
+// "Quickly Generating Billion-Record Synthetic Databases" (Gray et al.)
+class Zipf {
+ public:
+  Zipf(uint64_t n, double theta) : m_n(n) {
+    double zetan = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      zetan += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    double zeta2 = 1 + 1 / std::pow(2.0, theta);
+    m_zetan = zetan;
+    m_alpha = 1 / (1 - theta);
+    m_eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    m_half = 1 + std::pow(0.5, theta);
+  }
+
+  uint64_t next(Random& rnd) const {
+    double u = rnd.nextDouble();
+    double uz = u * m_zetan;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < m_half) {
+      return 1;
+    }
+    uint64_t rank = static_cast<uint64_t>(m_n * std::pow(m_eta * u - m_eta + 1, m_alpha));
+    return rank < m_n ? rank : m_n - 1;
+  }
+
+ protected:
+  uint64_t m_n;
+  double m_zetan;
+  double m_alpha;
+  double m_eta;
+  double m_half;
+};
+
+
+typedef struct {
+  std::vector<std::string> hosts;
+  std::vector<uint32_t> ports;
+  size_t nFake;
+  size_t nThreads;
+  double duration; // seconds
+  uint64_t nKeys;
+  std::string keyPrefix;
+  bool zipf;
+  double zipfTheta;
+  size_t minValueSize;
+  size_t maxValueSize;
+  unsigned setRatio;
+  unsigned getRatio;
+  size_t batch;
+  double rate; // requests per second of all threads, 0 for closed loop
+  int pollTimeout;
+  int connectTimeout;
+  bool prefill;
+} options_t;
+
+
+class OpStats {
+ public:
+  OpStats() : requests(0), keys(0), hits(0), misses(0), errors(0) {
+  }
+
+  void merge(const OpStats& other) {
+    requests += other.requests;
+    keys += other.keys;
+    hits += other.hits;
+    misses += other.misses;
+    errors += other.errors;
+    latency.merge(other.latency);
+  }
+
+  uint64_t requests;
+  uint64_t keys;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t errors;
+  Histogram latency;
+};
+
+
+typedef struct {
+  const options_t* options;
+  const Zipf* zipf;
+  size_t idx;
+  int64_t start;
+  int64_t end;
+  OpStats gets;
+  OpStats sets;
+} worker_t;
+
+
+static void initClient(Client& client, const options_t& options) {
+  std::vector<const char*> hosts;
+  for (std::vector<std::string>::const_iterator it = options.hosts.begin();
+       it != options.hosts.end(); ++it) {
+    hosts.push_back(it->c_str());
+  }
+  client.config(CFG_POLL_TIMEOUT, options.pollTimeout);
+  client.config(CFG_CONNECT_TIMEOUT, options.connectTimeout);
+  // connections are established lazily by the first requests
+  client.init(&hosts[0], &options.ports[0], hosts.size());
+}
+
+
+static void formatKey(const options_t& options, uint64_t id, std::string& key) {
+  char suffix[24];
+  int len = douban::mc::utility::int64ToCharArray(static_cast<int64_t>(id), suffix);
+  key.assign(options.keyPrefix).append(suffix, len);
+}
+
+
+static uint64_t nextKey(worker_t* worker, Random& rnd) {
+  if (worker->zipf != NULL) {
+    return worker->zipf->next(rnd);
+  }
+  return rnd.nextRange(0, worker->options->nKeys - 1);
+}
+
+
+static void* runWorker(void* arg) {
+  worker_t* worker = static_cast<worker_t*>(arg);
+  const options_t& options = *worker->options;
+  Random rnd(worker->idx + 1);
+  Client client;
+  initClient(client, options);
+
+  std::string value(options.maxValueSize, 'v');
+  std::vector<std::string> keys(options.batch);
+  std::vector<const char*> keyPtrs(options.batch);
+  std::vector<size_t> keyLens(options.batch);
+  flags_t flags = 0;
+  const char* val = value.data();
+  size_t valLen = 0;
+  retrieval_result_t** rResults = NULL;
+  message_result_t** mResults = NULL;
+  size_t nResults = 0;
+
+  int64_t interval = 0, scheduled = worker->start;
+  if (options.rate > 0) {
+    interval = static_cast<int64_t>(options.nThreads * 1e6 / options.rate);
+    // spread the threads over one interval
+    scheduled += interval * worker->idx / options.nThreads;
+  }
+  const unsigned nRatio = options.setRatio + options.getRatio;
+
+  for (;;) {
+    int64_t now = getCurrentMonotonicUs();
+    if (interval > 0) {
+      if (scheduled > now) {
+        usleep(static_cast<useconds_t>(scheduled - now));
+        now = getCurrentMonotonicUs();
+      }
+    } else if (now < worker->start) {
+      usleep(static_cast<useconds_t>(worker->start - now));
+      continue;
+    } else {
+      scheduled = now;
+    }
+    if (scheduled >= worker->end) {
+      break;
+    }
+
+    bool isSet = rnd.nextRange(1, nRatio) <= options.setRatio;
+    size_t n = isSet ? 1 : options.batch;
+    for (size_t i = 0; i < n; ++i) {
+      formatKey(options, nextKey(worker, rnd), keys[i]);
+      keyPtrs[i] = keys[i].c_str();
+      keyLens[i] = keys[i].size();
+    }
+
+    err_code_t err;
+    OpStats* stats;
+    if (isSet) {
+      stats = &worker->sets;
+      valLen = rnd.nextRange(options.minValueSize, options.maxValueSize);
+      err = client.set(&keyPtrs[0], &keyLens[0], &flags, 0, NULL, false, &val, &valLen,
+                       1, &mResults, &nResults);
+      client.destroyMessageResult();
+    } else {
+      stats = &worker->gets;
+      err = client.get(&keyPtrs[0], &keyLens[0], n, &rResults, &nResults);
+      stats->hits += nResults;
+      stats->misses += n - nResults;
+      client.destroyRetrievalResult();
+    }
+    stats->latency.record(getCurrentMonotonicUs() - scheduled);
+    ++stats->requests;
+    stats->keys += n;
+    if (err != RET_OK) {
+      ++stats->errors;
+    }
+    scheduled += interval;
+  }
+  client.quit();
+  return NULL;
+}
+
+
+// set every key once, so that gets against an empty memcached hit
+static void prefill(const options_t& options) {
+  Client client;
+  initClient(client, options);
+  Random rnd(0);
+  std::string value(options.maxValueSize, 'v');
+  const size_t batch = 100;
+  std::vector<std::string> keys(batch);
+  std::vector<const char*> keyPtrs(batch), vals(batch, value.data());
+  std::vector<size_t> keyLens(batch), valLens(batch);
+  std::vector<flags_t> flags(batch, 0);
+  message_result_t** results = NULL;
+  size_t nResults = 0;
+  for (uint64_t id = 0; id < options.nKeys; id += batch) {
+    size_t n = 0;
+    for (; n < batch && id + n < options.nKeys; ++n) {
+      formatKey(options, id + n, keys[n]);
+      keyPtrs[n] = keys[n].c_str();
+      keyLens[n] = keys[n].size();
+      valLens[n] = rnd.nextRange(options.minValueSize, options.maxValueSize);
+    }
+    client.set(&keyPtrs[0], &keyLens[0], &flags[0], 0, NULL, true, &vals[0], &valLens[0],
+               n, &results, &nResults);
+    client.destroyMessageResult();
+  }
+  client.quit();
+}
+
+
+static void printStats(const char* name, const OpStats& stats, double seconds) {
+  printf("%-6s %12llu %12.0f %12.0f %8llu %8.0f %8llu %8llu %8llu %8llu %8llu\n", name,
+         static_cast<unsigned long long>(stats.requests), stats.requests / seconds,
+         stats.keys / seconds, static_cast<unsigned long long>(stats.errors),
+         stats.latency.mean(),
+         static_cast<unsigned long long>(stats.latency.percentile(50)),
+         static_cast<unsigned long long>(stats.latency.percentile(90)),
+         static_cast<unsigned long long>(stats.latency.percentile(99)),
+         static_cast<unsigned long long>(stats.latency.percentile(99.9)),
+         static_cast<unsigned long long>(stats.latency.max()));
+}
+
+
+static bool parseServers(const char* arg, options_t& options) {
+  std::string servers(arg);
+  size_t pos = 0;
+  while (pos < servers.size()) {
+    size_t end = servers.find(',', pos);
+    if (end == std::string::npos) {
+      end = servers.size();
+    }
+    std::string server = servers.substr(pos, end - pos);
+    size_t colon = server.rfind(':');
+    if (colon == std::string::npos) {
+      options.hosts.push_back(server);
+      options.ports.push_back(11211);
+    } else {
+      options.hosts.push_back(server.substr(0, colon));
+      options.ports.push_back(strtoul(server.c_str() + colon + 1, NULL, 10));
+    }
+    pos = end + 1;
+  }
+  return !options.hosts.empty();
+}
+
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --servers=HOST:PORT,...  memcached servers (default 127.0.0.1:11211)\n"
+          "  --fake=N                 start N in-process fake servers instead\n"
+          "  --threads=N              client threads, one Client each (default 1)\n"
+          "  --duration=SECONDS       (default 10)\n"
+          "  --keys=N                 size of the key space (default 100000)\n"
+          "  --key-prefix=PREFIX      (default \"loadgen:\")\n"
+          "  --key-dist=uniform|zipf  (default uniform)\n"
+          "  --zipf-theta=THETA       skew of zipf in (0, 1) (default 0.99)\n"
+          "  --value-size=N|MIN-MAX   fixed or uniformly distributed (default 100)\n"
+          "  --ratio=SET:GET          (default 1:10)\n"
+          "  --batch=N                keys of a get (default 1)\n"
+          "  --rate=N                 requests per second of all threads, open loop\n"
+          "                           (default 0, closed loop)\n"
+          "  --poll-timeout=MS        (default 300)\n"
+          "  --connect-timeout=MS     (default 10)\n"
+          "  --prefill                set every key before the run\n",
+          prog);
+}
+
+
+static bool parseOptions(int argc, char* argv[], options_t& options) {
+  options.nFake = 0;
+  options.nThreads = 1;
+  options.duration = 10;
+  options.nKeys = 100000;
+  options.keyPrefix = "loadgen:";
+  options.zipf = false;
+  options.zipfTheta = 0.99;
+  options.minValueSize = options.maxValueSize = 100;
+  options.setRatio = 1;
+  options.getRatio = 10;
+  options.batch = 1;
+  options.rate = 0;
+  options.pollTimeout = 300;
+  options.connectTimeout = 10;
+  options.prefill = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* eq = strchr(arg, '=');
+    std::string name = eq == NULL ? std::string(arg) : std::string(arg, eq - arg);
+    const char* val = eq == NULL ? "" : eq + 1;
+    if (name == "--servers") {
+      if (!parseServers(val, options)) {
+        return false;
+      }
+    } else if (name == "--fake") {
+      options.nFake = strtoul(val, NULL, 10);
+    } else if (name == "--threads") {
+      options.nThreads = strtoul(val, NULL, 10);
+    } else if (name == "--duration") {
+      options.duration = atof(val);
+    } else if (name == "--keys") {
+      options.nKeys = strtoull(val, NULL, 10);
+    } else if (name == "--key-prefix") {
+      options.keyPrefix = val;
+    } else if (name == "--key-dist") {
+      if (strcmp(val, "zipf") == 0) {
+        options.zipf = true;
+      } else if (strcmp(val, "uniform") != 0) {
+        return false;
+      }
+    } else if (name == "--zipf-theta") {
+      options.zipfTheta = atof(val);
+    } else if (name == "--value-size") {
+      char* end = NULL;
+      options.minValueSize = options.maxValueSize = strtoul(val, &end, 10);
+      if (*end == '-') {
+        options.maxValueSize = strtoul(end + 1, NULL, 10);
+      }
+    } else if (name == "--ratio") {
+      if (sscanf(val, "%u:%u", &options.setRatio, &options.getRatio) != 2) {
+        return false;
+      }
+    } else if (name == "--batch") {
+      options.batch = strtoul(val, NULL, 10);
+    } else if (name == "--rate") {
+      options.rate = atof(val);
+    } else if (name == "--poll-timeout") {
+      options.pollTimeout = atoi(val);
+    } else if (name == "--connect-timeout") {
+      options.connectTimeout = atoi(val);
+    } else if (name == "--prefill") {
+      options.prefill = true;
+    } else {
+      return false;
+    }
+  }
+  if (options.hosts.empty() && options.nFake == 0) {
+    options.hosts.push_back("127.0.0.1");
+    options.ports.push_back(11211);
+  }
+  return options.nThreads > 0 && options.duration > 0 && options.nKeys > 0 &&
+         options.batch > 0 && options.minValueSize <= options.maxValueSize &&
+         options.setRatio + options.getRatio > 0 && options.rate >= 0 &&
+         (!options.zipf || (options.zipfTheta > 0 && options.zipfTheta < 1));
+}
+
+
+int main(int argc, char* argv[]) {
+  options_t options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<FakeServer*> fakeServers;
+  if (options.nFake > 0) {
+    options.hosts.clear();
+    options.ports.clear();
+    for (size_t i = 0; i < options.nFake; ++i) {
+      FakeServer* server = new FakeServer((options.minValueSize + options.maxValueSize) / 2);
+      fakeServers.push_back(server);
+      if (server->start() < 0) {
+        fprintf(stderr, "failed to start the fake server\n");
+        return 1;
+      }
+      options.hosts.push_back("127.0.0.1");
+      options.ports.push_back(server->port());
+    }
+  }
+
+  if (options.prefill) {
+    prefill(options);
+  }
+  Zipf* zipf = options.zipf ? new Zipf(options.nKeys, options.zipfTheta) : NULL;
+
+  printf("%zu servers, %zu threads, %llu keys (%s), values of %zu-%zu bytes, "
+         "set:get %u:%u, batch %zu, ",
+         options.hosts.size(), options.nThreads,
+         static_cast<unsigned long long>(options.nKeys), options.zipf ? "zipf" : "uniform",
+         options.minValueSize, options.maxValueSize, options.setRatio, options.getRatio,
+         options.batch);
+  if (options.rate > 0) {
+    printf("open loop at %.0f/s\n", options.rate);
+  } else {
+    printf("closed loop\n");
+  }
+
+  std::vector<worker_t> workers(options.nThreads);
+  std::vector<pthread_t> threads(options.nThreads);
+  int64_t start = getCurrentMonotonicUs() + 100000; // let every thread connect
+  int64_t end = start + static_cast<int64_t>(options.duration * 1e6);
+  for (size_t i = 0; i < options.nThreads; ++i) {
+    worker_t& worker = workers[i];
+    worker.options = &options;
+    worker.zipf = zipf;
+    worker.idx = i;
+    worker.start = start;
+    worker.end = end;
+    pthread_create(&threads[i], NULL, runWorker, &worker);
+  }
+  OpStats gets, sets, total;
+  for (size_t i = 0; i < options.nThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    gets.merge(workers[i].gets);
+    sets.merge(workers[i].sets);
+  }
+  int64_t elapsed = getCurrentMonotonicUs() - start;
+  double seconds = (elapsed < end - start ? end - start : elapsed) / 1e6;
+  total.merge(gets);
+  total.merge(sets);
+
+  printf("%-6s %12s %12s %12s %8s %8s %8s %8s %8s %8s %8s\n", "", "requests", "requests/s",
+         "keys/s", "errors", "avg(us)", "p50", "p90", "p99", "p99.9", "max");
+  printStats("get", gets, seconds);
+  printStats("set", sets, seconds);
+  printStats("total", total, seconds);
+  if (gets.keys > 0) {
+    printf("get hit ratio %.2f%%\n", 100.0 * gets.hits / gets.keys);
+  }
+
+  delete zipf;
+  for (std::vector<FakeServer*>::iterator it = fakeServers.begin(); it != fakeServers.end();
+       ++it) {
+    delete *it;
+  }
+  return 0;
+}
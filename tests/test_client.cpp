@@ -1,4 +1,5 @@
 #include "Client.h"
+#include "Codec.h"
 #include "Result.h"
 #include "test_common.h"
 
@@ -6,6 +7,7 @@
 #include "gtest/gtest.h"
 
 using douban::mc::Client;
+using douban::mc::Codec;
 using douban::mc::io::DataBlock;
 using douban::mc::tests::newClient;
 
@@ -279,6 +281,64 @@ TEST(test_client, test_touch) {
 }
 
 
+TEST(test_client, per_item_exptimes) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    retrieval_result_t **r_results = NULL;
+    message_result_t **m_results = NULL;
+    key_status_t* statuses = NULL;
+    size_t nResults = 0, nKeys = 0;
+
+    const char* keys[] = {"foo", "tuiche", "buzai"};
+    size_t key_lens[] = {3, 6, 5};
+    flags_t flags[] = {0, 0, 0};
+    const char* vals[] = {"value of foo", "value of tuiche", "value of buzai"};
+    size_t val_lens[] = {12, 15, 14};
+    // a negative exptime expires a key right away
+    exptime_t exptimes[] = {0, -1, 0};
+
+    ASSERT_EQ(client->setMulti(keys, key_lens, flags, exptimes, NULL, 0, vals, val_lens, 3,
+                               &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 3);
+    client->destroyMessageResult();
+    client->get(keys, key_lens, 3, &r_results, &nResults);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 3);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_MISS);
+    ASSERT_EQ(statuses[2], KEY_HIT);
+    client->destroyRetrievalResult();
+
+    const char* touch_keys[] = {keys[0], keys[2]};
+    size_t touch_key_lens[] = {key_lens[0], key_lens[2]};
+    exptime_t touch_exptimes[] = {-1, 0};
+    client->touchMulti(touch_keys, touch_key_lens, touch_exptimes, 0, 2, &m_results, &nResults);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; i++) {
+      ASSERT_EQ(m_results[i]->type_, MSG_TOUCHED);
+    }
+    client->destroyMessageResult();
+    client->get(keys, key_lens, 3, &r_results, &nResults);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(std::string(r_results[0]->key, r_results[0]->key_len), "buzai");
+    client->destroyRetrievalResult();
+
+    ASSERT_EQ(client->gats(keys, key_lens, 3, -1, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(std::string(r_results[0]->data_block, r_results[0]->bytes), vals[2]);
+    ASSERT_NE(r_results[0]->cas_unique, 0);
+    client->destroyRetrievalResult();
+    client->gat(keys, key_lens, 3, 0, &r_results, &nResults);
+    ASSERT_EQ(nResults, 0);
+    client->destroyRetrievalResult();
+
+    delete client;
+  }
+}
+
+
 TEST(test_client, test_incr_decr) {
   Client* client = newClient(1);
   if (client == NULL) {
@@ -338,6 +398,61 @@ TEST(test_client, test_incr_decr) {
 }
 
 
+TEST(test_client, incr_decr_multi) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    const char* keys[] = {
+      "foo", "invalid key", "tuiche", "buzai"
+    };
+    size_t key_lens[] = {3, 11, 6, 5};
+    flags_t flags[] = {0, 0};
+    const char* vals[] = {"99", "101"};
+    size_t val_lens[] = {2, 3};
+    uint64_t deltas[] = {1, 1, 10, 1};
+
+    message_result_t **m_results = NULL;
+    unsigned_result_t **u_results = NULL;
+    key_status_t* statuses = NULL;
+    size_t nResults = 0, nKeys = 0;
+
+    client->_delete(keys, key_lens, 0, 4, &m_results, &nResults);
+    client->destroyMessageResult();
+    const char* set_keys[] = {keys[0], keys[2]};
+    size_t set_key_lens[] = {key_lens[0], key_lens[2]};
+    client->set(set_keys, set_key_lens, flags, 0, NULL, 0, vals, val_lens, 2,
+                &m_results, &nResults);
+    client->destroyMessageResult();
+
+    ASSERT_EQ(client->incrMulti(keys, key_lens, deltas, 0, 4, &u_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; ++i) {
+      std::string key(u_results[i]->key, u_results[i]->key_len);
+      ASSERT_EQ(u_results[i]->value, key == "foo" ? 100 : 111);
+    }
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 4);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_INVALID_ERR);
+    ASSERT_EQ(statuses[2], KEY_HIT);
+    ASSERT_EQ(statuses[3], KEY_MISS);
+    client->destroyUnsignedResult();
+
+    ASSERT_EQ(client->decrMulti(keys, key_lens, deltas, 0, 4, &u_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; ++i) {
+      ASSERT_EQ(u_results[i]->value, 99 + 2 * (u_results[i]->key_len == 6));
+    }
+    client->destroyUnsignedResult();
+
+    client->_delete(keys, key_lens, 0, 4, &m_results, &nResults);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
 TEST(client, noreply) {
   Client* client = newClient(1);
   if (client == NULL) {
@@ -359,3 +474,841 @@ TEST(client, noreply) {
     delete client;
   }
 }
+
+
+TEST(test_client, key_statuses) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    retrieval_result_t **r_results = NULL;
+    message_result_t **m_results = NULL;
+    key_status_t* statuses = NULL;
+    size_t nResults = 0, nKeys = 0;
+    flags_t flags[] = {0, 0};
+    exptime_t exptime = 0;
+
+    const char* keys[] = {
+      "foo", "invalid key", "tuiche", "buzai"
+    };
+    size_t key_lens[] = {3, 11, 6, 5};
+    const char* vals[] = {"value of foo", "value of tuiche"};
+    size_t val_lens[] = {12, 15};
+
+    const char* set_keys[] = {keys[0], keys[2]};
+    size_t set_key_lens[] = {key_lens[0], key_lens[2]};
+    client->set(set_keys, set_key_lens, flags, exptime, NULL, 0, vals, val_lens, 2,
+                &m_results, &nResults);
+    client->destroyMessageResult();
+    client->_delete(&keys[3], &key_lens[3], 0, 1, &m_results, &nResults);
+    client->destroyMessageResult();
+
+    client->get(keys, key_lens, 4, &r_results, &nResults);
+    ASSERT_EQ(nResults, 2);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 4);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_INVALID_ERR);
+    ASSERT_EQ(statuses[2], KEY_HIT);
+    ASSERT_EQ(statuses[3], KEY_MISS);
+    client->destroyRetrievalResult();
+
+    // cleared along with the results
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 0);
+
+    client->add(set_keys, set_key_lens, flags, exptime, NULL, 0, vals, val_lens, 2,
+                &m_results, &nResults);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 2);
+    ASSERT_EQ(statuses[0], KEY_MISS);
+    ASSERT_EQ(statuses[1], KEY_MISS);
+    client->destroyMessageResult();
+
+    client->_delete(keys, key_lens, 0, 4, &m_results, &nResults);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 4);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_INVALID_ERR);
+    ASSERT_EQ(statuses[2], KEY_HIT);
+    ASSERT_EQ(statuses[3], KEY_MISS);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
+TEST(test_client, key_statuses_dead_server) {
+  // nothing is listening on port 1
+  const char* hosts[] = {"127.0.0.1"};
+  const uint32_t ports[] = {1};
+  Client client;
+  client.init(hosts, ports, 1);
+  const char* keys[] = {"foo"};
+  size_t key_lens[] = {3};
+  retrieval_result_t **r_results = NULL;
+  key_status_t* statuses = NULL;
+  size_t nResults = 0, nKeys = 0;
+  client.get(keys, key_lens, 1, &r_results, &nResults);
+  client.getKeyStatuses(&statuses, &nKeys);
+  ASSERT_EQ(nKeys, 1);
+  ASSERT_EQ(statuses[0], KEY_DEAD_SERVER_ERR);
+  client.destroyRetrievalResult();
+}
+
+
+TEST(test_client, metrics) {
+  Client* client = newClient(1);
+  if (client == NULL) {
+    hint();
+  } else {
+    client->resetMetrics();
+    const char* keys[] = {"foo"};
+    size_t key_lens[] = {3};
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    for (int i = 0; i < 3; i++) {
+      client->get(keys, key_lens, 1, &r_results, &nResults);
+      client->destroyRetrievalResult();
+    }
+
+    server_metrics_t* metrics = NULL;
+    size_t nServers = 0;
+    client->getMetrics(&metrics, &nServers);
+    ASSERT_EQ(nServers, 1);
+    ASSERT_STREQ(metrics[0].host, "alfa");
+    ASSERT_EQ(metrics[0].requests, 3);
+    ASSERT_EQ(metrics[0].bytes_sent, 3 * strlen("get foo\r\n"));
+    ASSERT_GE(metrics[0].bytes_received, 3 * strlen("END\r\n"));
+    ASSERT_EQ(metrics[0].dispatch.count, 3);
+    ASSERT_EQ(metrics[0].send.count, 3);
+    ASSERT_EQ(metrics[0].first_byte.count, 3);
+    ASSERT_EQ(metrics[0].complete.count, 3);
+    uint64_t nBucketed = 0;
+    for (size_t i = 0; i < MC_LATENCY_BUCKETS; i++) {
+      nBucketed += metrics[0].complete.buckets[i];
+    }
+    ASSERT_EQ(nBucketed, 3);
+    ASSERT_GE(metrics[0].complete.sum_us, metrics[0].complete.max_us);
+    ASSERT_EQ(metrics[0].server_errors, 0);
+
+    client->resetMetrics();
+    client->getMetrics(&metrics, &nServers);
+    ASSERT_EQ(metrics[0].requests, 0);
+    delete client;
+  }
+}
+
+
+static void collectSpan(void* ctx, const trace_span_t* span) {
+  std::vector<trace_span_t>* spans = static_cast<std::vector<trace_span_t>*>(ctx);
+  spans->push_back(*span);
+}
+
+
+TEST(test_client, trace_hook) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    std::vector<trace_span_t> spans;
+    client->setTraceHook(collectSpan, &spans);
+    const char* keys[] = {"foo", "bar", "baz", "qux"};
+    size_t key_lens[] = {3, 3, 3, 3};
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->get(keys, key_lens, 4, &r_results, &nResults), RET_OK);
+    client->destroyRetrievalResult();
+
+    size_t nSpans[TRACE_COLLECT + 1] = {0};
+    size_t nServerKeys = 0;
+    for (std::vector<trace_span_t>::iterator it = spans.begin(); it != spans.end(); ++it) {
+      ASSERT_LE(it->start_us, it->end_us);
+      ASSERT_EQ(it->err, RET_OK);
+      ++nSpans[it->phase];
+      if (it->phase == TRACE_ROUTE) {
+        ASSERT_EQ(it->n_keys, 4);
+        ASSERT_TRUE(it->server == NULL);
+      } else if (it->phase == TRACE_SEND) {
+        ASSERT_TRUE(it->server != NULL);
+        nServerKeys += it->n_keys;
+      }
+    }
+    ASSERT_EQ(nSpans[TRACE_ROUTE], 1);
+    ASSERT_EQ(nSpans[TRACE_SEND], nSpans[TRACE_WAIT]);
+    ASSERT_EQ(nSpans[TRACE_SEND], nSpans[TRACE_PARSE]);
+    ASSERT_GE(nSpans[TRACE_SEND], 1);
+    ASSERT_EQ(nServerKeys, 4);
+    ASSERT_EQ(nSpans[TRACE_COLLECT], 1);
+
+    // no tracing once the hook is removed
+    client->setTraceHook(NULL, NULL);
+    spans.clear();
+    client->get(keys, key_lens, 4, &r_results, &nResults);
+    client->destroyRetrievalResult();
+    ASSERT_TRUE(spans.empty());
+    delete client;
+  }
+}
+
+
+TEST(test_client, compression) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    compress_codec_options_t codec = Codec::isAvailable(OPT_COMPRESS_LZ4) ? OPT_COMPRESS_LZ4
+                                                                          : OPT_COMPRESS_ZLIB;
+    if (!Codec::isAvailable(codec)) {
+      delete client;
+      return;
+    }
+    client->config(CFG_COMPRESS_CODEC, codec);
+    client->config(CFG_COMPRESS_THRESHOLD, 100);
+    std::string large(4000, 'x'), small("small");
+    const char* keys[] = {"compressed", "plain"};
+    size_t key_lens[] = {10, 5};
+    const char* vals[] = {large.data(), small.data()};
+    size_t val_lens[] = {large.size(), small.size()};
+    flags_t flags[] = {1, 1};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 2,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+    server_metrics_t* metrics = NULL;
+    size_t nServers = 0;
+    client->getMetrics(&metrics, &nServers);
+    uint64_t bytesSent = 0;
+    for (size_t i = 0; i < nServers; ++i) {
+      bytesSent += metrics[i].bytes_sent;
+    }
+    ASSERT_LT(bytesSent, large.size());
+
+    // a client without compression still decodes
+    Client* reader = newClient(2);
+    ASSERT_EQ(reader->get(keys, key_lens, 2, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; ++i) {
+      size_t idx = r_results[i]->key_len == key_lens[0] ? 0 : 1;
+      ASSERT_EQ(r_results[i]->flags, 1);
+      ASSERT_EQ(r_results[i]->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->data_block, vals[idx], val_lens[idx]);
+    }
+    reader->destroyRetrievalResult();
+    delete reader;
+
+    client->_delete(keys, key_lens, false, 2, &m_results, &nResults);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
+TEST(test_client, split_large_values) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    client->config(CFG_SPLIT_LARGE_VALUES, 1);
+    std::string large(2 * MC_CHUNK_SIZE + 10, 'x'), small("small");
+    for (size_t i = 0; i < large.size(); i += 1000) {
+      large[i] = static_cast<char>('a' + i % 26);
+    }
+    const char* keys[] = {"large", "small", "missing"};
+    size_t key_lens[] = {5, 5, 7};
+    const char* vals[] = {large.data(), small.data()};
+    size_t val_lens[] = {large.size(), small.size()};
+    flags_t flags[] = {1, 1};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0, nKeys = 0;
+    key_status_t* statuses = NULL;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 2,
+                          &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 2);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_HIT);
+    client->destroyMessageResult();
+
+    ASSERT_EQ(client->get(keys, key_lens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; ++i) {
+      size_t idx = r_results[i]->key_len == key_lens[0] &&
+                   memcmp(r_results[i]->key, keys[0], key_lens[0]) == 0 ? 0 : 1;
+      ASSERT_EQ(r_results[i]->flags, 1);
+      ASSERT_EQ(r_results[i]->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->data_block, vals[idx], val_lens[idx]);
+    }
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 3);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_HIT);
+    ASSERT_EQ(statuses[2], KEY_MISS);
+    client->destroyRetrievalResult();
+
+    // the wire format of the Python binding
+    Client* reader = newClient(2);
+    const char* chunkKeys[] = {"large", "~5large/0", "~5large/2"};
+    size_t chunkKeyLens[] = {5, 9, 9};
+    ASSERT_EQ(reader->get(chunkKeys, chunkKeyLens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 3);
+    for (size_t i = 0; i < nResults; ++i) {
+      if (r_results[i]->key_len == 5) {
+        ASSERT_EQ(r_results[i]->flags, 1 | MC_FLAG_CHUNKED);
+        ASSERT_N_STREQ(r_results[i]->data_block, "3", 1);
+      } else if (r_results[i]->key[8] == '0') {
+        ASSERT_EQ(r_results[i]->bytes, MC_CHUNK_SIZE);
+      } else {
+        ASSERT_EQ(r_results[i]->bytes, 10);
+        ASSERT_N_STREQ(r_results[i]->data_block, large.data() + 2 * MC_CHUNK_SIZE, 10);
+      }
+    }
+    reader->destroyRetrievalResult();
+
+    // a value missing a chunk is a miss
+    ASSERT_EQ(reader->_delete(chunkKeys + 2, chunkKeyLens + 2, false, 1, &m_results,
+                              &nResults), RET_OK);
+    reader->destroyMessageResult();
+    delete reader;
+    ASSERT_EQ(client->gets(keys, key_lens, 2, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(r_results[0]->bytes, small.size());
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 2);
+    ASSERT_EQ(statuses[0], KEY_MISS);
+    ASSERT_EQ(statuses[1], KEY_HIT);
+    client->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, 2, &m_results, &nResults);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
+static void appendPiece(void* ctx, const retrieval_result_t* header, size_t offset,
+                        const char* data, size_t len) {
+  std::string* value = static_cast<std::string*>(ctx);
+  ASSERT_EQ(offset, value->size());
+  ASSERT_LE(offset + len, header->bytes);
+  value->append(data, len);
+}
+
+
+TEST(test_client, split_large_values_prefixed) {
+  Client* client = newClient(2);
+  Client* raw = newClient(2);
+  if (client == NULL || raw == NULL) {
+    hint();
+  } else {
+    client->config(CFG_SPLIT_LARGE_VALUES, 1);
+    ASSERT_EQ(client->setKeyPrefix("app:", 4), RET_OK);
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+
+    // stored by the Python binding of before, the prefix in the chunk keys
+    std::string large(MC_CHUNK_SIZE + 3, 'y');
+    const char* legacyKeys[] = {"app:legacy", "~10app:legacy/0", "~10app:legacy/1"};
+    size_t legacyKeyLens[] = {10, 15, 15};
+    const char* legacyVals[] = {"2", large.data(), large.data() + MC_CHUNK_SIZE};
+    size_t legacyValLens[] = {1, MC_CHUNK_SIZE, 3};
+    flags_t legacyFlags[] = {MC_FLAG_CHUNKED, 0, 0};
+    ASSERT_EQ(raw->set(legacyKeys, legacyKeyLens, legacyFlags, 0, NULL, false, legacyVals,
+                       legacyValLens, 3, &m_results, &nResults), RET_OK);
+    raw->destroyMessageResult();
+
+    const char* keys[] = {"legacy"};
+    size_t key_lens[] = {6};
+    ASSERT_EQ(client->get(keys, key_lens, 1, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(r_results[0]->key_len, 6);
+    ASSERT_EQ(r_results[0]->bytes, large.size());
+    ASSERT_N_STREQ(r_results[0]->data_block, large.data(), large.size());
+    client->destroyRetrievalResult();
+
+    // and stored the same way
+    const char* newKeys[] = {"fresh", "small"};
+    size_t newKeyLens[] = {5, 5};
+    const char* newVals[] = {large.data(), "small"};
+    size_t newValLens[] = {large.size(), 5};
+    flags_t newFlags[] = {0, 0};
+    ASSERT_EQ(client->set(newKeys, newKeyLens, newFlags, 0, NULL, false, newVals, newValLens,
+                          2, &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    client->destroyMessageResult();
+    const char* wireKeys[] = {"app:fresh", "~9app:fresh/1", "app:small"};
+    size_t wireKeyLens[] = {9, 13, 9};
+    ASSERT_EQ(raw->get(wireKeys, wireKeyLens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 3);
+    raw->destroyRetrievalResult();
+
+    // a "?" key keeps its "?" ahead of the prefix in the chunk keys too
+    const char* markedKeys[] = {"?marked"};
+    size_t markedKeyLens[] = {7};
+    ASSERT_EQ(client->set(markedKeys, markedKeyLens, newFlags, 0, NULL, false, newVals,
+                          newValLens, 1, &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+    const char* markedWireKeys[] = {"?app:marked", "~11?app:marked/0", "~11?app:marked/1"};
+    size_t markedWireKeyLens[] = {11, 16, 16};
+    ASSERT_EQ(raw->get(markedWireKeys, markedWireKeyLens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 3);
+    raw->destroyRetrievalResult();
+    ASSERT_EQ(client->get(markedKeys, markedKeyLens, 1, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(r_results[0]->key_len, 7);
+    ASSERT_N_STREQ(r_results[0]->key, "?marked", 7);
+    ASSERT_EQ(r_results[0]->bytes, large.size());
+    client->destroyRetrievalResult();
+    raw->_delete(markedWireKeys, markedWireKeyLens, false, 3, &m_results, &nResults);
+    raw->destroyMessageResult();
+
+    ASSERT_EQ(raw->_delete(legacyKeys, legacyKeyLens, false, 3, &m_results, &nResults),
+              RET_OK);
+    raw->destroyMessageResult();
+    client->_delete(newKeys, newKeyLens, false, 2, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+  delete raw;
+}
+
+TEST(test_client, get_stream) {
+  Client* client = newClient(1);
+  if (client == NULL) {
+    hint();
+  } else {
+    std::string large(500000, 'x');
+    for (size_t i = 0; i < large.size(); i += 1000) {
+      large[i] = static_cast<char>('a' + i % 26);
+    }
+    const char* keys[] = {"stream", "missing"};
+    size_t key_lens[] = {6, 7};
+    const char* vals[] = {large.data()};
+    size_t val_lens[] = {large.size()};
+    flags_t flags[] = {3};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 1,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+
+    std::string value;
+    ASSERT_EQ(client->getStream(keys, key_lens, 2, appendPiece, &value, &r_results,
+                                &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(r_results[0]->bytes, large.size());
+    ASSERT_EQ(r_results[0]->flags, 3);
+    ASSERT_TRUE(r_results[0]->data_block == NULL);
+    ASSERT_TRUE(value == large);
+    client->destroyRetrievalResult();
+
+    // back to buffering
+    ASSERT_EQ(client->get(keys, key_lens, 1, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_N_STREQ(r_results[0]->data_block, large.data(), large.size());
+    client->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, 1, &m_results, &nResults);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
+TEST(test_client, get_into) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    const char* keys[] = {"record1", "record2", "oversized", "missing"};
+    size_t key_lens[] = {7, 7, 9, 7};
+    const char* vals[] = {"0123456789abcdef", "fedcba9876543210", "0123456789abcdefg"};
+    size_t val_lens[] = {16, 16, 17};
+    flags_t flags[] = {0, 0, 0};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 3,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+
+    char arena[64];
+    size_t offsets[] = {0, 16, 32, 48};
+    size_t sizes[] = {16, 16, 16, 16};
+    memset(arena, '-', sizeof arena);
+    ASSERT_EQ(client->getInto(keys, key_lens, 4, arena, offsets, sizes, &r_results,
+                              &nResults), RET_OK);
+    ASSERT_EQ(nResults, 3);
+    for (size_t i = 0; i < nResults; ++i) {
+      retrieval_result_t* r = r_results[i];
+      size_t idx = r->key[0] == 'o' ? 2 : r->key[6] - '1';
+      ASSERT_EQ(r->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(r->data_block, vals[idx], val_lens[idx]);
+      if (idx == 2) {
+        ASSERT_TRUE(r->data_block < arena || r->data_block >= arena + sizeof arena);
+      } else {
+        ASSERT_TRUE(r->data_block == arena + offsets[idx]);
+      }
+    }
+    ASSERT_N_STREQ(arena + 32, "--------------------------------", 32);
+    client->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, 3, &m_results, &nResults);
+    client->destroyMessageResult();
+    delete client;
+  }
+}
+
+
+TEST(test_client, key_prefix) {
+  Client* client = newClient(2);
+  Client* raw = newClient(2);
+  if (client == NULL || raw == NULL) {
+    hint();
+  } else {
+    ASSERT_EQ(client->setKeyPrefix("bad prefix", 10), RET_INVALID_KEY_ERR);
+    ASSERT_EQ(client->setKeyPrefix("app:", 4), RET_OK);
+    const char* keys[] = {"user", "?realtime", "missing"};
+    size_t key_lens[] = {4, 9, 7};
+    const char* vals[] = {"1", "2"};
+    size_t val_lens[] = {1, 1};
+    flags_t flags[] = {0, 0};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 2,
+                          &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    client->destroyMessageResult();
+    ASSERT_STREQ(client->getServerAddressByKey("user", 4),
+                 raw->getServerAddressByKey("app:user", 8));
+
+    // the keys come back as they were asked for
+    ASSERT_EQ(client->get(keys, key_lens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; ++i) {
+      size_t idx = r_results[i]->key[0] == '?' ? 1 : 0;
+      ASSERT_EQ(r_results[i]->key_len, key_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->key, keys[idx], key_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->data_block, vals[idx], 1);
+    }
+    key_status_t* statuses = NULL;
+    size_t nKeys = 0;
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(nKeys, 3);
+    ASSERT_EQ(statuses[0], KEY_HIT);
+    ASSERT_EQ(statuses[1], KEY_HIT);
+    ASSERT_EQ(statuses[2], KEY_MISS);
+    client->destroyRetrievalResult();
+
+    // stored under the prefix, "?" ahead of it
+    const char* raw_keys[] = {"app:user", "?app:realtime", "user"};
+    size_t raw_key_lens[] = {8, 13, 4};
+    ASSERT_EQ(raw->get(raw_keys, raw_key_lens, 3, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 2);
+    raw->destroyRetrievalResult();
+
+    // too long once prefixed
+    std::string longKey(248, 'k');
+    const char* long_keys[] = {longKey.c_str()};
+    size_t long_key_lens[] = {longKey.size()};
+    ASSERT_EQ(client->get(long_keys, long_key_lens, 1, &r_results, &nResults),
+              RET_INVALID_KEY_ERR);
+    ASSERT_EQ(nResults, 0);
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(statuses[0], KEY_INVALID_ERR);
+    client->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, 2, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+  delete raw;
+}
+
+
+TEST(test_client, binary_safe_keys) {
+  Client* client = newClient(2);
+  Client* raw = newClient(2);
+  if (client == NULL || raw == NULL) {
+    hint();
+  } else {
+    client->config(CFG_BINARY_SAFE_KEYS, 1);
+    std::string longKey(187, '\n');
+    const char* keys[] = {"with space", "?line\r\nbreak", "%marked", "plain", longKey.c_str()};
+    size_t key_lens[] = {10, 12, 7, 5, longKey.size()};
+    const char* vals[] = {"1", "2", "3", "4", "5"};
+    size_t val_lens[] = {1, 1, 1, 1, 1};
+    flags_t flags[] = {0, 0, 0, 0, 0};
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 5,
+                          &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 4);
+    key_status_t* statuses = NULL;
+    size_t nKeys = 0;
+    // too long to encode
+    client->getKeyStatuses(&statuses, &nKeys);
+    ASSERT_EQ(statuses[4], KEY_INVALID_ERR);
+    client->destroyMessageResult();
+
+    ASSERT_EQ(client->get(keys, key_lens, 4, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 4);
+    for (size_t i = 0; i < nResults; ++i) {
+      size_t idx = r_results[i]->data_block[0] - '1';
+      ASSERT_EQ(r_results[i]->key_len, key_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->key, keys[idx], key_lens[idx]);
+    }
+    client->getKeyStatuses(&statuses, &nKeys);
+    for (size_t i = 0; i < nKeys; ++i) {
+      ASSERT_EQ(statuses[i], KEY_HIT);
+    }
+    client->destroyRetrievalResult();
+
+    // the marker and base64url, after the "?"
+    const char* raw_keys[] = {"%d2l0aCBzcGFjZQ", "?%bGluZQ0KYnJlYWs", "%JW1hcmtlZA", "plain"};
+    size_t raw_key_lens[] = {15, 17, 11, 5};
+    ASSERT_EQ(raw->get(raw_keys, raw_key_lens, 4, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, 4);
+    raw->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, 4, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+  delete raw;
+}
+
+
+TEST(test_client, send_window) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    // cut through the middle of the values, the keys and the commands
+    client->config(CFG_SEND_WINDOW, 777);
+    const size_t n = 20;
+    std::string vals_[n];
+    char keys_[n][16];
+    const char* keys[n];
+    size_t key_lens[n];
+    const char* vals[n];
+    size_t val_lens[n];
+    flags_t flags[n];
+    for (size_t i = 0; i < n; ++i) {
+      key_lens[i] = snprintf(keys_[i], sizeof keys_[i], "window%zu", i);
+      keys[i] = keys_[i];
+      vals_[i].assign(1000 * i + 3, static_cast<char>('a' + i));
+      vals[i] = vals_[i].data();
+      val_lens[i] = vals_[i].size();
+      flags[i] = 0;
+    }
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, vals, val_lens, n,
+                          &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, n);
+    client->destroyMessageResult();
+
+    ASSERT_EQ(client->get(keys, key_lens, n, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, n);
+    for (size_t i = 0; i < nResults; ++i) {
+      size_t idx = r_results[i]->data_block[0] - 'a';
+      ASSERT_EQ(r_results[i]->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(r_results[i]->data_block, vals[idx], val_lens[idx]);
+    }
+    client->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, false, n, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+}
+
+
+TEST(test_client, max_get_size) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    const size_t n = 30;
+    char keys_[n][16];
+    const char* keys[n];
+    size_t key_lens[n];
+    flags_t flags[n];
+    for (size_t i = 0; i < n; ++i) {
+      key_lens[i] = snprintf(keys_[i], sizeof keys_[i], "split%zu", i);
+      keys[i] = keys_[i];
+      flags[i] = 0;
+    }
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    // the odd keys missing
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, keys, key_lens, n,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+    client->_delete(keys + 1, key_lens + 1, false, 1, &m_results, &nResults);
+    client->destroyMessageResult();
+    for (size_t i = 3; i < n; i += 2) {
+      client->_delete(keys + i, key_lens + i, false, 1, &m_results, &nResults);
+      client->destroyMessageResult();
+    }
+
+    int bounds[][2] = {{3, 0}, {0, 20}, {4, 1}, {1, 0}};
+    for (size_t b = 0; b < sizeof bounds / sizeof bounds[0]; ++b) {
+      client->config(CFG_MAX_GET_KEYS, bounds[b][0]);
+      client->config(CFG_MAX_GET_BYTES, bounds[b][1]);
+      ASSERT_EQ(client->gets(keys, key_lens, n, &r_results, &nResults), RET_OK);
+      ASSERT_EQ(nResults, n / 2);
+      for (size_t i = 0; i < nResults; ++i) {
+        ASSERT_EQ(r_results[i]->bytes, r_results[i]->key_len);
+        ASSERT_N_STREQ(r_results[i]->data_block, r_results[i]->key, r_results[i]->key_len);
+      }
+      key_status_t* statuses = NULL;
+      size_t nKeys = 0;
+      client->getKeyStatuses(&statuses, &nKeys);
+      ASSERT_EQ(nKeys, n);
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(statuses[i], i % 2 == 0 ? KEY_HIT : KEY_MISS);
+      }
+      client->destroyRetrievalResult();
+    }
+
+    client->_delete(keys, key_lens, false, n, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+}
+
+
+TEST(test_client, max_get_bytes_encoded_keys) {
+  Client* client = newClient(1);
+  if (client == NULL) {
+    hint();
+  } else {
+    client->config(CFG_BINARY_SAFE_KEYS, 1);
+    // 12 bytes each, 1 + 16 encoded
+    const size_t n = 4;
+    const size_t wireLen = 17;
+    char keys_[n][12];
+    const char* keys[n];
+    size_t key_lens[n];
+    flags_t flags[n];
+    for (size_t i = 0; i < n; ++i) {
+      memset(keys_[i], ' ', sizeof keys_[i]);
+      keys_[i][0] = static_cast<char>('a' + i);
+      keys[i] = keys_[i];
+      key_lens[i] = sizeof keys_[i];
+      flags[i] = 0;
+    }
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    size_t nResults = 0;
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, keys, key_lens, n,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+
+    // 2 keys as they are given, but only 1 as they are sent
+    client->config(CFG_MAX_GET_BYTES, 2 * (1 + sizeof keys_[0]));
+    std::vector<server_metrics_t> metrics;
+    client->collectMetrics(metrics);
+    uint64_t bytesSent = metrics[0].bytes_sent;
+    ASSERT_EQ(client->get(keys, key_lens, n, &r_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, n);
+    client->destroyRetrievalResult();
+    client->collectMetrics(metrics);
+    // "get" and "\r\n" of a command per key
+    ASSERT_EQ(metrics[0].bytes_sent - bytesSent, n * (5 + 1 + wireLen));
+
+    client->_delete(keys, key_lens, false, n, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+}
+
+
+TEST(test_client, conns_per_server) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    const size_t n = 60;
+    char keys_[n][16];
+    const char* keys[n];
+    size_t key_lens[n];
+    flags_t flags[n];
+    for (size_t i = 0; i < n; ++i) {
+      key_lens[i] = snprintf(keys_[i], sizeof keys_[i], "spread%zu", i);
+      keys[i] = keys_[i];
+      flags[i] = 0;
+    }
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    broadcast_result_t* b_results = NULL;
+    server_metrics_t* metrics = NULL;
+    size_t nResults = 0, nHosts = 0;
+    client->config(CFG_CONNS_PER_SERVER, 3);
+    ASSERT_EQ(client->set(keys, key_lens, flags, 0, NULL, false, keys, key_lens, n,
+                          &m_results, &nResults), RET_OK);
+    ASSERT_EQ(nResults, n);
+    client->destroyMessageResult();
+    const char* counter = "spread_counter";
+    size_t counterLen = strlen(counter);
+    const char* zero = "0";
+    size_t zeroLen = 1;
+    ASSERT_EQ(client->set(&counter, &counterLen, flags, 0, NULL, false, &zero, &zeroLen, 1,
+                          &m_results, &nResults), RET_OK);
+    client->destroyMessageResult();
+
+    int connsPerServer[] = {3, 1};
+    for (size_t c = 0; c < 2; ++c) {
+      client->config(CFG_CONNS_PER_SERVER, connsPerServer[c]);
+      client->resetMetrics();
+      ASSERT_EQ(client->get(keys, key_lens, n, &r_results, &nResults), RET_OK);
+      ASSERT_EQ(nResults, n);
+      for (size_t i = 0; i < nResults; ++i) {
+        ASSERT_N_STREQ(r_results[i]->data_block, r_results[i]->key, r_results[i]->key_len);
+      }
+      key_status_t* statuses = NULL;
+      size_t nKeys = 0;
+      client->getKeyStatuses(&statuses, &nKeys);
+      ASSERT_EQ(nKeys, n);
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(statuses[i], KEY_HIT);
+      }
+      client->destroyRetrievalResult();
+
+      // a batch to a server on each of its connections, counted as the server's
+      client->getMetrics(&metrics, &nHosts);
+      ASSERT_EQ(nHosts, 2);
+      for (size_t i = 0; i < nHosts; ++i) {
+        ASSERT_EQ(metrics[i].requests, static_cast<uint64_t>(connsPerServer[c]));
+      }
+      ASSERT_EQ(client->version(&b_results, &nHosts), RET_OK);
+      ASSERT_EQ(nHosts, 2);
+      client->destroyBroadcastResult();
+
+      // a single-key command is spread the same
+      unsigned_result_t* u_results = NULL;
+      ASSERT_EQ(client->incr(counter, counterLen, 1, false, &u_results, &nResults), RET_OK);
+      ASSERT_EQ(nResults, 1);
+      ASSERT_EQ(u_results->value, c + 1);
+      client->destroyUnsignedResult();
+    }
+
+    client->_delete(keys, key_lens, false, n, &m_results, &nResults);
+    client->destroyMessageResult();
+    client->_delete(&counter, &counterLen, false, 1, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+}
@@ -1,11 +1,15 @@
 # coding: utf-8
 
 import sys
+import socket
 import unittest
 from libmc import (
-    Client, encode_value, decode_value,
+    Client, encode_value, decode_value, set_logger, flush_log,
     MC_RETURN_OK, MC_RETURN_INVALID_KEY_ERR,
-    MC_RETURN_MC_SERVER_ERR
+    MC_RETURN_MC_SERVER_ERR, MC_RETURN_POLL_TIMEOUT_ERR,
+    MC_KEY_HIT, MC_KEY_MISS, MC_KEY_INVALID_ERR, MC_KEY_DEAD_SERVER_ERR,
+    MC_TRACE_ROUTE, MC_TRACE_SEND, MC_TRACE_PARSE, MC_TRACE_COLLECT,
+    MC_LOG_WARNING, MC_BINARY_SAFE_KEYS, MC_CONNS_PER_SERVER
 )
 
 from builtins import int
@@ -13,6 +17,7 @@ from past.builtins import basestring
 
 
 # defined in _client.pyx
+_FLAG_COMPRESS = 1 << 4
 _FLAG_DOUBAN_CHUNKED = 1 << 12
 _DOUBAN_CHUNK_SIZE = 1000000
 
@@ -55,6 +60,35 @@ class MiscCase(unittest.TestCase):
             if isinstance(d, DiveMaster):
               assert d is not new_d
 
+    def test_msgpack_value(self):
+        doc = {'id': 1024, 'tags': ['a', -33, 3.5, None, True],
+               'big': (1 << 64) - 1, 'raw': b'\x00\xff', 'nested': [[{}], []]}
+        buf, flags = encode_value(doc, 0, msgpack=True)
+        assert flags == 1 << 6
+        assert buf[:1] == b'\x85'
+        assert decode_value(buf, flags) == doc
+        assert decode_value(*encode_value(('douban', 0), 0, msgpack=True)) == ['douban', 0]
+        # not for MessagePack
+        assert encode_value(DiveMaster(1), 0, msgpack=True)[1] != 1 << 6
+        assert encode_value({'big': 1 << 64}, 0, msgpack=True)[1] != 1 << 6
+        recursive = []
+        recursive.append(recursive)
+        assert encode_value(recursive, 0, msgpack=True)[1] != 1 << 6
+        assert decode_value(buf[:-1], flags) is None
+
+    def test_set_logger(self):
+        logged = []
+        set_logger(lambda level, file, line, msg: logged.append((level, msg)),
+                   MC_LOG_WARNING)
+        try:
+            mc = Client(['localhost:21211'])
+            assert mc.get('invalid key') is None
+            flush_log()
+            assert any('invalid mc key' in msg for _, msg in logged), logged
+            assert all(level <= MC_LOG_WARNING for level, _ in logged)
+        finally:
+            set_logger(None)
+
 
 class SingleServerCase(unittest.TestCase):
     def setUp(self):
@@ -107,6 +141,17 @@ class SingleServerCase(unittest.TestCase):
         assert mc.incr('wazi', 1) is None
         assert mc.decr('wazi', 1) is None
 
+    def test_incr_decr_multi(self):
+        mc = self.mc
+        keys = ['wazi', 'duola', 'xixi']
+        mc.delete_multi(keys)
+        mc.set('wazi', 99)
+        mc.set('duola', 200)
+        assert mc.incr_multi(keys, 1) == {'wazi': 100, 'duola': 201}
+        assert mc.decr_multi(keys[:2], 10) == {'wazi': 90, 'duola': 191}
+        mc.delete_multi(keys)
+        assert mc.incr_multi(keys) == {}
+
     def test_cas(self):
         mc = self.mc
         mc.delete('bilinda')
@@ -159,6 +204,98 @@ class SingleServerCase(unittest.TestCase):
         assert mc.set(key_xl, val)
         assert mc.get(key_xl) == val
 
+    def test_per_key_exptime(self):
+        mc = self.mc
+        # a negative expiration time expires a key right away
+        assert mc.set_multi({'foo': 1, 'tuiche': 2, 'buzai': 3}, time={'tuiche': -1})
+        assert mc.get_multi(['foo', 'tuiche', 'buzai']) == {'foo': 1, 'buzai': 3}
+        assert mc.touch_multi(['foo', 'buzai'], {'foo': -1, 'buzai': 30})
+        assert mc.get_multi(['foo', 'buzai']) == {'buzai': 3}
+        is_succeed, failed_keys = mc.touch_multi(['foo', 'buzai'], 30, return_failure=True)
+        assert not is_succeed and len(failed_keys) == 1
+        assert mc.gat_multi(['foo', 'buzai'], -1) == {'buzai': 3}
+        assert mc.gat('buzai', 30) is None
+
+    def test_compressed_multi(self):
+        mc = self.compressed_mc
+        dct = {'foo': b'b' * 4096, 'tuiche': {'a': 'i' * 4096}, 'buzai': b'small'}
+        assert mc.set_multi(dct)
+        assert mc.get_multi(list(dct.keys())) == dct
+        assert self.mc.get_multi(list(dct.keys())) == dct
+
+        rv = mc.get_multi(list(dct.keys()), as_memoryview=True)
+        assert isinstance(rv['foo'], memoryview) and rv['foo'].readonly
+        assert rv['foo'].tobytes() == dct['foo']
+        assert rv['buzai'].tobytes() == dct['buzai']
+        assert rv['tuiche'] == dct['tuiche']
+
+    def test_core_compression(self):
+        mc = self.compressed_mc
+        assert mc.core_compression
+        assert not self.mc.core_compression
+        val = b'c' * 4096
+        assert mc.set_multi({'core_compressed': val})
+
+        # stored as a zlib stream
+        host, port = mc.get_host_by_key('core_compressed').rsplit(':', 1)
+        sock = socket.create_connection((host, int(port)))
+        try:
+            sock.sendall(b'get core_compressed\r\n')
+            resp = b''
+            while not resp.endswith(b'END\r\n'):
+                resp += sock.recv(8192)
+        finally:
+            sock.close()
+        _, _, flags, length = resp.split(b'\r\n', 1)[0].split()
+        assert int(flags) & _FLAG_COMPRESS
+        assert int(length) < len(val)
+
+        # decompressed by the core, not by decode_value
+        assert self.mc.get_raw('core_compressed') == (val, 0)
+        assert mc.get_multi(['core_compressed']) == {'core_compressed': val}
+
+    def test_prefix(self):
+        mc = Client(self.mc.servers, prefix='app:')
+        dct = {'foo': 'biu', '?tuiche': 8964}
+        assert mc.set_multi(dct)
+        assert mc.get_multi(list(dct.keys()) + ['missing']) == dct
+        assert self.mc.get_multi(['app:foo', '?app:tuiche']) == {
+            'app:foo': 'biu', '?app:tuiche': 8964}
+        assert mc.get_host_by_key('foo') == self.mc.get_host_by_key('app:foo')
+        assert mc.incr_multi(['?tuiche']) == {'?tuiche': 8965}
+        assert mc.delete_multi(list(dct.keys()))
+        assert self.mc.get('app:foo') is None
+
+    def test_prefix_split(self):
+        mc = Client(self.mc.servers, prefix='app:')
+        large = b'x' * 1000001
+        # the chunks as prefixed keys, the layout before the core prefixed
+        assert self.mc.set_raw('~10app:legacy/0', large[:1000000], 0, 0)
+        assert self.mc.set_raw('~10app:legacy/1', large[1000000:], 0, 0)
+        assert self.mc.set_raw('app:legacy', b'2', 0, _FLAG_DOUBAN_CHUNKED)
+        assert mc.get_raw('legacy') == (large, 0)
+        assert mc.set_raw('fresh', large, 0, 0)
+        assert self.mc.get_raw('~9app:fresh/1') == (b'x', 0)
+        assert self.mc.delete_multi(['app:legacy', 'app:fresh'])
+
+    def test_binary_safe_keys(self):
+        mc = Client(self.mc.servers)
+        mc.config(MC_BINARY_SAFE_KEYS, 1)
+        dct = {'with space': 1, '?\x00': 2, '%25': 3}
+        assert mc.set_multi(dct)
+        assert mc.get_multi(list(dct.keys())) == dct
+        assert self.mc.get('%d2l0aCBzcGFjZQ') == 1
+        assert mc.delete_multi(list(dct.keys()))
+
+    def test_conns_per_server(self):
+        mc = Client(self.mc.servers)
+        mc.config(MC_CONNS_PER_SERVER, 4)
+        dct = dict(('conns_per_server_%d' % i, i) for i in range(100))
+        assert mc.set_multi(dct)
+        assert mc.get_multi(list(dct.keys())) == dct
+        assert len(mc.version()) == len(self.mc.servers)
+        assert mc.delete_multi(list(dct.keys()))
+
     def test_noreply(self):
         mc = self.noreply_mc
         assert mc.set('foo', 'bar')
@@ -285,7 +422,65 @@ class ErrorCodeTestCase(unittest.TestCase):
         self.mc.get('invalid key')
         assert self.mc.get_last_error() == MC_RETURN_INVALID_KEY_ERR
 
+    def test_deadline(self):
+        self.mc.set('foo', 'bar')
+        with self.mc.deadline(1):
+            assert self.mc.get_multi(['foo']) == {'foo': 'bar'}
+        with self.mc.deadline(-1):
+            assert self.mc.get_multi(['foo']) == {}
+            assert self.mc.get_last_error() == MC_RETURN_POLL_TIMEOUT_ERR
+        assert self.mc.get('foo') == 'bar'
+
     def test_mc_server_err(self):
         mc = Client(["not_exist_host:11211"])
         mc.get('valid_key')
         assert mc.get_last_error() == MC_RETURN_MC_SERVER_ERR
+
+    def test_metrics(self):
+        self.mc.reset_metrics()
+        self.mc.get('foo')
+        self.mc.get('foo')
+        metrics = self.mc.get_metrics()
+        assert list(metrics.keys()) == ['127.0.0.1:21211']
+        m = metrics['127.0.0.1:21211']
+        assert m['requests'] == 2
+        assert m['complete']['count'] == 2
+        assert sum(m['complete']['buckets']) == 2
+        self.mc.reset_metrics()
+        assert self.mc.get_metrics()['127.0.0.1:21211']['requests'] == 0
+
+    def test_set_tracer(self):
+        spans = []
+        self.mc.set_tracer(spans.append)
+        keys = ['foo', 'bar', 'baz', 'qux']
+        self.mc.get_multi(keys)
+        self.mc.set_tracer(None)
+        phases = [span['phase'] for span in spans]
+        assert phases.count(MC_TRACE_ROUTE) == 1
+        assert phases.count(MC_TRACE_COLLECT) == 1
+        assert phases.count(MC_TRACE_SEND) == phases.count(MC_TRACE_PARSE) >= 1
+        sends = [span for span in spans if span['phase'] == MC_TRACE_SEND]
+        assert sum(span['n_keys'] for span in sends) == len(keys)
+        assert all(span['server'] for span in sends)
+        assert all(span['start'] <= span['end'] and span['error'] is None
+                   for span in spans)
+
+        del spans[:]
+        self.mc.get_multi(keys)
+        assert spans == []
+
+    def test_get_multi_with_status(self):
+        self.mc.set('foo', 'bar')
+        self.mc.delete('foo_miss')
+        rv, statuses = self.mc.get_multi_with_status(['foo', 'foo_miss', 'invalid key'])
+        assert rv == {'foo': 'bar'}
+        assert statuses == {
+            'foo': MC_KEY_HIT,
+            'foo_miss': MC_KEY_MISS,
+            'invalid key': MC_KEY_INVALID_ERR,
+        }
+
+        mc = Client(["not_exist_host:11211"])
+        rv, statuses = mc.get_multi_with_status(['foo'])
+        assert rv == {}
+        assert statuses == {'foo': MC_KEY_DEAD_SERVER_ERR}
@@ -0,0 +1,143 @@
+#include "Codec.h"
+
+#include <string>
+#include "gtest/gtest.h"
+
+using douban::mc::Codec;
+
+
+static const compress_codec_options_t CODECS[] = {
+  OPT_COMPRESS_ZLIB, OPT_COMPRESS_LZ4, OPT_COMPRESS_ZSTD
+};
+static const flags_t CODEC_FLAGS[] = {
+  MC_FLAG_COMPRESS_ZLIB, MC_FLAG_COMPRESS_LZ4, MC_FLAG_COMPRESS_ZSTD
+};
+static const size_t N_CODECS = sizeof CODECS / sizeof CODECS[0];
+
+
+static std::string jsonValue(int i) {
+  char buf[128];
+  snprintf(buf, sizeof buf, "{\"id\": %d, \"name\": \"user %d\", \"active\": true}, ", i, i);
+  std::string rv("[");
+  for (int j = 0; j < 64; ++j) {
+    rv.append(buf);
+  }
+  return rv.append("{}]");
+}
+
+
+TEST(test_codec, round_trip) {
+  std::string val = jsonValue(1);
+  for (size_t i = 0; i < N_CODECS; ++i) {
+    Codec codec;
+    if (!Codec::isAvailable(CODECS[i])) {
+      ASSERT_FALSE(codec.setCodec(CODECS[i]));
+      ASSERT_FALSE(codec.enabled());
+      continue;
+    }
+    ASSERT_TRUE(codec.setCodec(CODECS[i]));
+    std::string out("prefix");
+    flags_t flags = 0;
+    ASSERT_TRUE(codec.compress(val.data(), val.size(), 1, out, flags));
+    ASSERT_EQ(flags, 1 | CODEC_FLAGS[i]);
+    ASSERT_LT(out.size(), val.size());
+    ASSERT_EQ(out.substr(0, 6), "prefix");
+
+    size_t len = 0;
+    flags_t decodedFlags = 0;
+    char* decoded = codec.decompress(out.data() + 6, out.size() - 6, flags, len, decodedFlags);
+    ASSERT_TRUE(decoded != NULL);
+    ASSERT_EQ(decodedFlags, 1);
+    ASSERT_EQ(std::string(decoded, len), val);
+    delete[] decoded;
+
+    // any client decodes whatever codec it's set to
+    Codec reader;
+    decoded = reader.decompress(out.data() + 6, out.size() - 6, flags, len, decodedFlags);
+    ASSERT_TRUE(decoded != NULL);
+    ASSERT_EQ(std::string(decoded, len), val);
+    delete[] decoded;
+  }
+}
+
+
+TEST(test_codec, skip) {
+  std::string small("small"), random, out;
+  uint32_t x = 2463534242u;
+  for (int i = 0; i < 4096; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random.push_back(static_cast<char>(x));
+  }
+  std::string val = jsonValue(1);
+  flags_t flags = 0;
+  Codec codec;
+  ASSERT_FALSE(codec.compress(val.data(), val.size(), 0, out, flags));
+  for (size_t i = 0; i < N_CODECS; ++i) {
+    if (!codec.setCodec(CODECS[i])) {
+      continue;
+    }
+    codec.setThreshold(10);
+    ASSERT_FALSE(codec.compress(small.data(), small.size(), 0, out, flags));
+    // compressed by the caller already
+    ASSERT_FALSE(codec.compress(val.data(), val.size(), MC_FLAG_COMPRESS_ZLIB, out, flags));
+    // not shrinking
+    ASSERT_FALSE(codec.compress(random.data(), random.size(), 0, out, flags));
+    ASSERT_TRUE(out.empty());
+    codec.setThreshold(val.size() + 1);
+    ASSERT_FALSE(codec.compress(val.data(), val.size(), 0, out, flags));
+  }
+}
+
+
+TEST(test_codec, corrupted) {
+  std::string val = jsonValue(1);
+  for (size_t i = 0; i < N_CODECS; ++i) {
+    Codec codec;
+    if (!codec.setCodec(CODECS[i])) {
+      continue;
+    }
+    std::string out;
+    flags_t flags = 0;
+    ASSERT_TRUE(codec.compress(val.data(), val.size(), 0, out, flags));
+    size_t len = 0;
+    flags_t decodedFlags = 0;
+    ASSERT_TRUE(codec.decompress(out.data(), out.size() / 2, flags, len, decodedFlags) == NULL);
+    ASSERT_TRUE(codec.decompress(val.data(), val.size(), flags, len, decodedFlags) == NULL);
+  }
+  Codec codec;
+  size_t len = 0;
+  flags_t decodedFlags = 0;
+  ASSERT_TRUE(codec.decompress(val.data(), val.size(), 0, len, decodedFlags) == NULL);
+}
+
+
+TEST(test_codec, dictionary) {
+  Codec codec;
+  if (!codec.setCodec(OPT_COMPRESS_ZSTD)) {
+    ASSERT_NE(codec.setDictionary("dict", 4), RET_OK);
+    return;
+  }
+  // a raw content dictionary, as good as a trained one for this test
+  std::string dict = jsonValue(0);
+  std::string val("{\"id\": 7, \"name\": \"user 7\", \"active\": true}");
+  codec.setThreshold(0);
+  std::string plain, withDict;
+  flags_t flags = 0;
+  codec.compress(val.data(), val.size(), 0, plain, flags);
+  ASSERT_EQ(codec.setDictionary(dict.data(), dict.size()), RET_OK);
+  ASSERT_TRUE(codec.compress(val.data(), val.size(), 0, withDict, flags));
+  ASSERT_LT(withDict.size(), plain.size() == 0 ? val.size() : plain.size());
+
+  size_t len = 0;
+  flags_t decodedFlags = 0;
+  char* decoded = codec.decompress(withDict.data(), withDict.size(), flags, len, decodedFlags);
+  ASSERT_TRUE(decoded != NULL);
+  ASSERT_EQ(std::string(decoded, len), val);
+  delete[] decoded;
+
+  ASSERT_EQ(codec.setDictionary(NULL, 0), RET_OK);
+  ASSERT_TRUE(codec.decompress(withDict.data(), withDict.size(), flags, len,
+                               decodedFlags) == NULL);
+}
@@ -0,0 +1,353 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "Client.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include "Utility.h"
+#include "gtest/gtest.h"
+
+using douban::mc::Client;
+using douban::mc::Connection;
+using douban::mc::ConnectionPool;
+using douban::mc::HEALTH_CLOSED;
+using douban::mc::HEALTH_OPEN;
+using douban::mc::HEALTH_HALF_OPEN;
+using douban::mc::utility::getCurrentMonotonicMs;
+
+
+class ExpirableConnection : public Connection {
+ public:
+  void expire() {
+    m_deadUntil = 0;
+  }
+};
+
+
+// listen on an ephemeral port of the loopback interface, return the port
+static int listenLoopback(int* fd) {
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  *fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (*fd == -1 ||
+      bind(*fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) != 0 ||
+      listen(*fd, 128) != 0 ||
+      getsockname(*fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen) != 0) {
+    return -1;
+  }
+  return ntohs(addr.sin_port);
+}
+
+
+TEST(test_connection, exponential_backoff) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+  close(fd);  // nobody is listening now, connecting is refused
+
+  ExpirableConnection conn;
+  conn.init("127.0.0.1", port);
+  conn.setRetryTimeout(1);
+  conn.setMaxRetryTimeout(4);
+  ASSERT_EQ(conn.health(), HEALTH_CLOSED);
+
+  int64_t expectedMax[] = {1000, 2000, 4000, 4000};
+  for (size_t i = 0; i < sizeof expectedMax / sizeof expectedMax[0]; i++) {
+    int64_t now = getCurrentMonotonicMs();
+    ASSERT_FALSE(conn.tryReconnect());
+    ASSERT_EQ(conn.health(), HEALTH_OPEN);
+    int64_t backoff = conn.deadUntil() - now;
+    ASSERT_GE(backoff, expectedMax[i] / 2);
+    ASSERT_LE(backoff, expectedMax[i] + 1);
+
+    // no connect attempt before the dead line
+    int64_t deadUntil = conn.deadUntil();
+    ASSERT_FALSE(conn.tryReconnect());
+    ASSERT_EQ(conn.deadUntil(), deadUntil);
+    conn.expire();
+  }
+}
+
+
+TEST(test_connection, half_open_probe) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+
+  ExpirableConnection conn;
+  conn.init("127.0.0.1", port);
+  conn.setRetryTimeout(1);
+  ASSERT_TRUE(conn.tryReconnect());
+  ASSERT_EQ(conn.health(), HEALTH_CLOSED);
+
+  // a single error resets the connection, which is reconnected at once
+  conn.markDead("test");
+  ASSERT_EQ(conn.health(), HEALTH_OPEN);
+  ASSERT_LE(conn.deadUntil(), getCurrentMonotonicMs());
+  ASSERT_TRUE(conn.tryReconnect());
+  ASSERT_EQ(conn.health(), HEALTH_HALF_OPEN);
+
+  // the probe fails: back off
+  conn.markDead("test");
+  ASSERT_EQ(conn.health(), HEALTH_OPEN);
+  ASSERT_GT(conn.deadUntil(), getCurrentMonotonicMs());
+  ASSERT_FALSE(conn.tryReconnect());
+
+  // the probe succeeds: closed again
+  conn.expire();
+  ASSERT_TRUE(conn.tryReconnect());
+  ASSERT_EQ(conn.health(), HEALTH_HALF_OPEN);
+  conn.markAlive();
+  ASSERT_EQ(conn.health(), HEALTH_CLOSED);
+  close(fd);
+}
+
+
+TEST(test_connection, error_rate_tripping) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+
+  ExpirableConnection conn;
+  conn.init("127.0.0.1", port);
+  conn.setRetryTimeout(1);
+
+  // keep failing every other request
+  bool tripped = false;
+  for (int i = 0; i < MC_HEALTH_WINDOW_SIZE && !tripped; i++) {
+    ASSERT_TRUE(conn.tryReconnect());
+    conn.markAlive();
+    conn.markDead("test");
+    tripped = conn.deadUntil() > getCurrentMonotonicMs();
+  }
+  ASSERT_TRUE(tripped);
+  ASSERT_FALSE(conn.tryReconnect());
+  close(fd);
+}
+
+
+TEST(test_connection, managed_reconnect) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+
+  ExpirableConnection conn;
+  conn.init("127.0.0.1", port);
+  conn.setManaged(true);
+  // routing never connects a managed connection
+  ASSERT_FALSE(conn.tryReconnect());
+  ASSERT_FALSE(conn.alive());
+  ASSERT_TRUE(conn.reconnect());
+  ASSERT_TRUE(conn.tryReconnect());
+
+  conn.markDead("test");
+  ASSERT_FALSE(conn.tryReconnect());
+  conn.setManaged(false);
+  ASSERT_TRUE(conn.tryReconnect());
+  close(fd);
+}
+
+
+TEST(test_connection, background_maintainer) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+  close(fd);
+
+  const char* hosts[] = {"127.0.0.1"};
+  uint32_t ports[] = {static_cast<uint32_t>(port)};
+  ConnectionPool pool;
+  pool.init(hosts, ports, 1);
+  pool.setRetryTimeout(0);
+  pool.setMaintainInterval(10);
+  ASSERT_TRUE(pool.getRealtimeServerAddressByKey("foo", 3) == NULL);
+
+  // the server is back, the maintainer connects it in background
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  int opt_reuse = 1;
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt_reuse, sizeof opt_reuse);
+  ASSERT_EQ(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr), 0);
+  ASSERT_EQ(listen(fd, 128), 0);
+
+  bool connected = false;
+  for (int i = 0; i < 100 && !connected; i++) {
+    usleep(10000);
+    connected = pool.getRealtimeServerAddressByKey("foo", 3) != NULL;
+  }
+  ASSERT_TRUE(connected);
+  pool.setMaintainInterval(0);
+  close(fd);
+}
+
+
+TEST(test_connection, deadline) {
+  // a server accepting connections but never responding
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+
+  const char* hosts[] = {"127.0.0.1"};
+  uint32_t ports[] = {static_cast<uint32_t>(port)};
+  Client client;
+  client.init(hosts, ports, 1);
+  client.config(CFG_POLL_TIMEOUT, 1000);
+
+  const char* keys[] = {"foo"};
+  size_t keyLens[] = {3};
+  retrieval_result_t** results = NULL;
+  size_t nResults = 0;
+  for (int i = 0; i < MC_HEALTH_WINDOW_SIZE; i++) {
+    int64_t start = getCurrentMonotonicMs();
+    client.setDeadline(20);
+    ASSERT_EQ(client.get(keys, keyLens, 1, &results, &nResults), RET_POLL_TIMEOUT_ERR);
+    ASSERT_EQ(nResults, 0);
+    client.destroyRetrievalResult();
+    ASSERT_LT(getCurrentMonotonicMs() - start, 500);
+
+    // the caller giving up doesn't make the server dead
+    ASSERT_TRUE(client.getRealtimeServerAddressByKey("foo", 3) != NULL);
+  }
+  client.clearDeadline();
+  close(fd);
+}
+
+
+TEST(test_connection, deadline_send_window) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+
+  const char* hosts[] = {"127.0.0.1"};
+  uint32_t ports[] = {static_cast<uint32_t>(port)};
+  Client client;
+  client.init(hosts, ports, 1);
+  client.config(CFG_POLL_TIMEOUT, 1000);
+  client.config(CFG_SEND_WINDOW, 16);
+
+  const size_t nKeys = 64;
+  char keyBuf[nKeys][8];
+  const char* keys[nKeys];
+  size_t keyLens[nKeys];
+  for (size_t i = 0; i < nKeys; ++i) {
+    keyLens[i] = snprintf(keyBuf[i], sizeof keyBuf[i], "key%zu", i);
+    keys[i] = keyBuf[i];
+  }
+  retrieval_result_t** results = NULL;
+  size_t nResults = 0;
+  std::vector<server_metrics_t> metrics;
+
+  // missed before a byte is sent, the connection is still in sync and kept
+  client.setDeadline(0);
+  ASSERT_EQ(client.get(keys, keyLens, nKeys, &results, &nResults), RET_POLL_TIMEOUT_ERR);
+  client.destroyRetrievalResult();
+  client.collectMetrics(metrics);
+  ASSERT_EQ(metrics[0].connects, 1);
+  ASSERT_EQ(metrics[0].abandons, 0);
+
+  // missed halfway, the connection is given up
+  client.setDeadline(20);
+  ASSERT_EQ(client.get(keys, keyLens, nKeys, &results, &nResults), RET_POLL_TIMEOUT_ERR);
+  client.destroyRetrievalResult();
+  client.collectMetrics(metrics);
+  ASSERT_EQ(metrics[0].abandons, 1);
+  ASSERT_GT(metrics[0].bytes_sent, 0);
+
+  client.clearDeadline();
+  close(fd);
+}
+
+
+// a server answering the requests on a connection with responses in turn,
+// a request at a time, and no more once they run out
+typedef struct {
+  int fd;
+  const char* const* responses;
+  size_t nResponses;
+} script_t;
+
+
+static void* serveScript(void* arg) {
+  script_t* script = static_cast<script_t*>(arg);
+  int conn = accept(script->fd, NULL, NULL);
+  char buf[4096];
+  for (size_t i = 0; conn != -1 && i < script->nResponses; ++i) {
+    if (recv(conn, buf, sizeof buf, 0) <= 0) {
+      break;
+    }
+    send(conn, script->responses[i], strlen(script->responses[i]), 0);
+  }
+  // until the client hangs up
+  while (conn != -1 && recv(conn, buf, sizeof buf, 0) > 0) {
+  }
+  if (conn != -1) {
+    close(conn);
+  }
+  return NULL;
+}
+
+
+TEST(test_connection, chunked_value_rounds) {
+  int fd = -1;
+  int port = listenLoopback(&fd);
+  ASSERT_GT(port, 0);
+  const char* responses[] = {
+    "VALUE large 4096 1\r\n2\r\nEND\r\n",
+    "VALUE ~5large/0 0 3\r\nabc\r\nVALUE ~5large/1 0 2\r\nde\r\nEND\r\n",
+    "VALUE large 4096 1\r\n2\r\nEND\r\n",
+  };
+  script_t script = {fd, responses, 3};
+  pthread_t server;
+  ASSERT_EQ(pthread_create(&server, NULL, serveScript, &script), 0);
+
+  const char* hosts[] = {"127.0.0.1"};
+  uint32_t ports[] = {static_cast<uint32_t>(port)};
+  Client* client = new Client();
+  client->init(hosts, ports, 1);
+  client->config(CFG_SPLIT_LARGE_VALUES, 1);
+  client->config(CFG_POLL_TIMEOUT, 1000);
+  const char* keys[] = {"large"};
+  size_t keyLens[] = {5};
+  retrieval_result_t** results = NULL;
+  size_t nResults = 0, nKeys = 0;
+  key_status_t* statuses = NULL;
+  server_metrics_t* metrics = NULL;
+  size_t nServers = 0;
+
+  // the chunks are fetched in a second round trip once the header is in
+  ASSERT_EQ(client->get(keys, keyLens, 1, &results, &nResults), RET_OK);
+  ASSERT_EQ(nResults, 1);
+  ASSERT_EQ(results[0]->bytes, 5);
+  ASSERT_EQ(memcmp(results[0]->data_block, "abcde", 5), 0);
+  client->getKeyStatuses(&statuses, &nKeys);
+  ASSERT_EQ(nKeys, 1);
+  ASSERT_EQ(statuses[0], KEY_HIT);
+  client->destroyRetrievalResult();
+  client->getMetrics(&metrics, &nServers);
+  ASSERT_EQ(metrics[0].requests, 2);
+
+  // the request timeout holds for both rounds, the chunks never come
+  client->config(CFG_REQUEST_TIMEOUT, 50);
+  int64_t start = getCurrentMonotonicMs();
+  ASSERT_EQ(client->get(keys, keyLens, 1, &results, &nResults), RET_POLL_TIMEOUT_ERR);
+  ASSERT_EQ(nResults, 0);
+  ASSERT_LT(getCurrentMonotonicMs() - start, 500);
+  client->getKeyStatuses(&statuses, &nKeys);
+  ASSERT_EQ(nKeys, 1);
+  ASSERT_EQ(statuses[0], KEY_TIMEOUT_ERR);
+  client->destroyRetrievalResult();
+
+  delete client;
+  pthread_join(server, NULL);
+  close(fd);
+}
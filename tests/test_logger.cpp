@@ -0,0 +1,117 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "Logger.h"
+#include "Utility.h"
+#include "gtest/gtest.h"
+
+using douban::mc::logging::flush;
+using douban::mc::logging::setLevel;
+using douban::mc::logging::setSink;
+
+
+typedef struct {
+  int level;
+  std::string msg;
+} logged_t;
+
+
+static void collect(void* ctx, int level, const char* file, unsigned int line,
+                    const char* msg) {
+  std::vector<logged_t>* logged = static_cast<std::vector<logged_t>*>(ctx);
+  logged_t item;
+  item.level = level;
+  item.msg = msg;
+  logged->push_back(item);
+}
+
+
+// the logger thread may report messages dropped on contention
+static size_t countLogged(const std::vector<logged_t>& logged, const char* pattern) {
+  size_t n = 0;
+  for (std::vector<logged_t>::const_iterator it = logged.begin(); it != logged.end(); ++it) {
+    if (it->msg.find(pattern) != std::string::npos) {
+      n++;
+    }
+  }
+  return n;
+}
+
+
+TEST(test_logger, sink_and_level) {
+  std::vector<logged_t> logged;
+  setSink(collect, &logged);
+  setLevel(MC_LOG_LEVEL_WARNING);
+
+  log_info("ignored");
+  log_warn("warned %d", 42);
+  flush();
+  ASSERT_EQ(logged.size(), 1);
+  ASSERT_EQ(logged[0].level, MC_LOG_LEVEL_WARNING);
+  ASSERT_TRUE(logged[0].msg.find("warned 42") != std::string::npos);
+
+  setLevel(MC_LOG_LEVEL_ERROR);
+  log_warn("ignored");
+  flush();
+  ASSERT_EQ(logged.size(), 1);
+  setSink(NULL, NULL);
+}
+
+
+TEST(test_logger, rate_limit) {
+  std::vector<logged_t> logged;
+  setSink(collect, &logged);
+  setLevel(MC_LOG_LEVEL_WARNING);
+
+  // invalid keys of a flood are reported only MC_LOG_RATE_LIMIT times
+  int64_t start = douban::mc::utility::getCurrentMonotonicMs();
+  for (int i = 0; i < 1000; i++) {
+    douban::mc::utility::isValidKey("invalid key", 11);
+  }
+  flush();
+  int64_t elapsed = douban::mc::utility::getCurrentMonotonicMs() - start;
+  size_t nLogged = countLogged(logged, "invalid mc key");
+  ASSERT_GE(nLogged, 1);
+  if (elapsed < 1000) {
+    ASSERT_LE(nLogged, MC_LOG_RATE_LIMIT * 2);
+  }
+
+  // the suppressed ones are counted along the next message of the call site
+  logged.clear();
+  usleep(1100 * 1000);
+  douban::mc::utility::isValidKey("invalid key", 11);
+  flush();
+  ASSERT_EQ(countLogged(logged, "similar messages suppressed"), 1);
+
+  setLevel(MC_LOG_LEVEL_ERROR);
+  setSink(NULL, NULL);
+}
+
+
+static void* logMany(void*) {
+  for (int i = 0; i < 1000; i++) {
+    log_err("error %d", i);
+  }
+  return NULL;
+}
+
+
+TEST(test_logger, never_blocks) {
+  std::vector<logged_t> logged;
+  setSink(collect, &logged);
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, logMany, NULL);
+  }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  flush();
+  size_t nLogged = countLogged(logged, "error");
+  ASSERT_GE(nLogged, 1);
+  ASSERT_LE(nLogged, MC_LOG_RATE_LIMIT * 2);
+  setSink(NULL, NULL);
+}
@@ -2,7 +2,9 @@
 #include "Result.h"
 #include "BufferReader.h"
 #include "Parser.h"
+#include <algorithm>
 #include <cstring>
+#include <string>
 #include "gtest/gtest.h"
 
 using douban::mc::types::RetrievalResult;
@@ -39,6 +41,25 @@ TEST(test_parser, empty_result) {
 }
 
 
+TEST(test_parser, pipelined_ends) {
+  err_code_t err;
+  BufferReader reader;
+  PacketParser parser;
+  parser.setMode(douban::mc::MODE_END_STATE);
+  parser.setEndCount(3);
+  parser.setBufferReader(&reader);
+  const char* input_buffer[] = {
+    "VALUE a 0 1\r\n1\r\nEND\r\n", "EN", "D\r\nVALUE b 0 1\r\n2\r\n", "END\r\n"
+  };
+  for (size_t i = 0; i < 4; ++i) {
+    reader.write(const_cast<char*>(input_buffer[i]), strlen(input_buffer[i]));
+    parser.process_packets(err);
+    ASSERT_EQ(err, i < 3 ? RET_INCOMPLETE_BUFFER_ERR : RET_OK);
+  }
+  ASSERT_EQ(parser.getRetrievalResults()->size(), 2);
+}
+
+
 TEST(test_parser, multi_results) {
   err_code_t err;
   DataBlock::setMinCapacity(10);
@@ -90,3 +111,60 @@ TEST(test_parser, multi_results) {
 }
 
 // TODO test MODE_COUNTING
+
+
+typedef struct {
+  std::string keys;
+  std::string values;
+  size_t nPieces;
+} sink_state_t;
+
+
+static void collectPiece(void* ctx, const retrieval_result_t* header, size_t offset,
+                         const char* data, size_t len) {
+  sink_state_t* state = static_cast<sink_state_t*>(ctx);
+  if (offset == 0) {
+    state->keys.append(header->key, header->key_len).append(" ");
+  }
+  state->values.append(data, len);
+  if (offset + len == header->bytes) {
+    state->values.append("|");
+  }
+  ++state->nPieces;
+}
+
+
+TEST(test_parser, value_sink) {
+  err_code_t err;
+  DataBlock::setMinCapacity(10);
+  BufferReader reader;
+  PacketParser parser;
+  parser.setMode(douban::mc::MODE_END_STATE);
+  parser.setBufferReader(&reader);
+  sink_state_t state;
+  state.nPieces = 0;
+  parser.setValueSink(collectPiece, &state);
+
+  std::string input("VALUE foo 0 26\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+                    "VALUE empty 1 0\r\n\r\nVALUE bar 0 4\r\n1234\r\nEND\r\n");
+  for (size_t pos = 0; pos < input.size(); pos += 3) {
+    reader.write(&input[pos], std::min<size_t>(3, input.size() - pos));
+    parser.process_packets(err);
+    if (err != RET_INCOMPLETE_BUFFER_ERR) {
+      break;
+    }
+  }
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(state.keys, "foo empty bar ");
+  ASSERT_EQ(state.values, "abcdefghijklmnopqrstuvwxyz||1234|");
+  ASSERT_GT(state.nPieces, 3);
+  // the value blocks are recycled as it's read
+  ASSERT_LT(reader.nDataBlock(), input.size() / 10);
+
+  ASSERT_EQ(parser.getRetrievalResults()->size(), 3);
+  retrieval_result_t* r = (*parser.getRetrievalResults())[0].inner();
+  ASSERT_EQ(r->bytes, 26);
+  ASSERT_TRUE(r->data_block == NULL);
+  parser.reset();
+  reader.reset();
+}
@@ -0,0 +1,152 @@
+#include "Serializer.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+namespace serializer = douban::mc::serializer;
+using serializer::serializer_t;
+
+
+static value_node_t node(value_type_t type, int64_t integer = 0, const char* data = NULL) {
+  value_node_t rv;
+  memset(&rv, 0, sizeof rv);
+  rv.type = type;
+  rv.integer = integer;
+  if (data != NULL) {
+    rv.data = data;
+    rv.size = static_cast<uint32_t>(strlen(data));
+  } else if (type == VALUE_ARRAY || type == VALUE_MAP) {
+    rv.size = static_cast<uint32_t>(integer);
+    rv.integer = 0;
+  }
+  return rv;
+}
+
+
+TEST(test_serializer, find) {
+  ASSERT_STREQ(serializer::find(0)->name, "raw");
+  ASSERT_STREQ(serializer::find(MC_FLAG_COMPRESS_ZLIB)->name, "raw");
+  ASSERT_STREQ(serializer::find(MC_FLAG_PICKLE | MC_FLAG_COMPRESS_ZLIB)->name, "pickle");
+  ASSERT_STREQ(serializer::find(MC_FLAG_MSGPACK)->name, "msgpack");
+  ASSERT_TRUE(serializer::find(1 << 20) == NULL);
+
+  std::vector<value_node_t> nodes;
+  // Python only
+  ASSERT_FALSE(serializer::deserialize("x", 1, MC_FLAG_PICKLE, nodes));
+  ASSERT_FALSE(serializer::deserialize("1", 1, MC_FLAG_INTEGER | MC_FLAG_COMPRESS_ZLIB, nodes));
+  ASSERT_TRUE(nodes.empty());
+
+  serializer_t custom = {1 << 20, "custom", NULL, NULL};
+  ASSERT_TRUE(serializer::add(custom));
+  ASSERT_STREQ(serializer::find(1 << 20)->name, "custom");
+  ASSERT_FALSE(serializer::add(custom));
+  custom.flag = MC_FLAG_CHUNKED;
+  ASSERT_FALSE(serializer::add(custom));
+  custom.flag = (1 << 21) | (1 << 22);
+  ASSERT_FALSE(serializer::add(custom));
+}
+
+
+TEST(test_serializer, scalars) {
+  std::string out;
+  std::vector<value_node_t> nodes;
+  value_node_t v = node(VALUE_INT, -1234567890123LL);
+  ASSERT_TRUE(serializer::serialize(MC_FLAG_INTEGER, &v, 1, out));
+  ASSERT_EQ(out, "-1234567890123");
+  ASSERT_TRUE(serializer::deserialize(out.data(), out.size(), MC_FLAG_LONG, nodes));
+  ASSERT_EQ(nodes[0].type, VALUE_INT);
+  ASSERT_EQ(nodes[0].integer, -1234567890123LL);
+
+  nodes.clear();
+  ASSERT_TRUE(serializer::deserialize("18446744073709551615", 20, MC_FLAG_INTEGER, nodes));
+  ASSERT_EQ(nodes[0].type, VALUE_UINT);
+  ASSERT_EQ(static_cast<uint64_t>(nodes[0].integer), UINT64_MAX);
+  ASSERT_FALSE(serializer::deserialize("18446744073709551616", 20, MC_FLAG_INTEGER, nodes));
+  ASSERT_FALSE(serializer::deserialize("12a", 3, MC_FLAG_INTEGER, nodes));
+  ASSERT_FALSE(serializer::deserialize("-", 1, MC_FLAG_INTEGER, nodes));
+
+  nodes.clear();
+  out.clear();
+  v = node(VALUE_BOOL, 1);
+  ASSERT_TRUE(serializer::serialize(MC_FLAG_BOOL, &v, 1, out));
+  ASSERT_EQ(out, "1");
+  ASSERT_TRUE(serializer::deserialize("0", 1, MC_FLAG_BOOL, nodes));
+  ASSERT_EQ(nodes[0].type, VALUE_BOOL);
+  ASSERT_EQ(nodes[0].integer, 0);
+  ASSERT_FALSE(serializer::serialize(MC_FLAG_INTEGER, &v, 1, out));
+
+  nodes.clear();
+  out.clear();
+  v = node(VALUE_BIN, 0, "douban");
+  ASSERT_TRUE(serializer::serialize(0, &v, 1, out));
+  ASSERT_EQ(out, "douban");
+  ASSERT_TRUE(serializer::deserialize(out.data(), out.size(), 0, nodes));
+  ASSERT_EQ(nodes[0].type, VALUE_BIN);
+  ASSERT_EQ(std::string(nodes[0].data, nodes[0].size), "douban");
+}
+
+
+TEST(test_serializer, msgpack) {
+  // {"id": 1024, "tags": ["a", -33, 3.5, nil, true], "big": 2^64-1}
+  value_node_t doc[] = {
+    node(VALUE_MAP, 3),
+    node(VALUE_STR, 0, "id"), node(VALUE_INT, 1024),
+    node(VALUE_STR, 0, "tags"), node(VALUE_ARRAY, 5),
+    node(VALUE_STR, 0, "a"), node(VALUE_INT, -33), node(VALUE_FLOAT),
+    node(VALUE_NIL), node(VALUE_BOOL, 1),
+    node(VALUE_STR, 0, "big"), node(VALUE_UINT, -1),
+  };
+  doc[7].real = 3.5;
+  const size_t nDoc = sizeof doc / sizeof doc[0];
+  std::string out("x");
+  ASSERT_TRUE(serializer::serialize(MC_FLAG_MSGPACK, doc, nDoc, out));
+  const char expected[] =
+      "x\x83\xa2id\xcd\x04\x00\xa4tags\x95\xa1" "a\xd0\xdf\xcb\x40\x0c\x00\x00\x00\x00\x00\x00"
+      "\xc0\xc3\xa3" "big\xcf\xff\xff\xff\xff\xff\xff\xff\xff";
+  ASSERT_EQ(out, std::string(expected, sizeof expected - 1));
+
+  std::vector<value_node_t> nodes;
+  ASSERT_TRUE(serializer::deserialize(out.data() + 1, out.size() - 1, MC_FLAG_MSGPACK, nodes));
+  ASSERT_EQ(nodes.size(), nDoc);
+  for (size_t i = 0; i < nDoc; ++i) {
+    ASSERT_EQ(nodes[i].type, doc[i].type);
+    ASSERT_EQ(nodes[i].size, doc[i].size);
+    ASSERT_EQ(nodes[i].integer, doc[i].integer);
+    ASSERT_EQ(nodes[i].real, doc[i].real);
+    if (doc[i].data != NULL) {
+      ASSERT_EQ(std::string(nodes[i].data, nodes[i].size), doc[i].data);
+    }
+  }
+
+  // missing or extra nodes
+  ASSERT_FALSE(serializer::serialize(MC_FLAG_MSGPACK, doc, nDoc - 1, out));
+  ASSERT_FALSE(serializer::serialize(MC_FLAG_MSGPACK, doc, 1, out));
+  value_node_t two[] = {node(VALUE_NIL), node(VALUE_NIL)};
+  ASSERT_FALSE(serializer::serialize(MC_FLAG_MSGPACK, two, 2, out));
+}
+
+
+TEST(test_serializer, malformed_msgpack) {
+  std::string doc("\x92\xa3" "abc\x01", 6);
+  std::vector<value_node_t> nodes;
+  for (size_t len = 0; len < doc.size(); ++len) {
+    ASSERT_FALSE(serializer::deserialize(doc.data(), len, MC_FLAG_MSGPACK, nodes));
+    ASSERT_TRUE(nodes.empty());
+  }
+  ASSERT_TRUE(serializer::deserialize(doc.data(), doc.size(), MC_FLAG_MSGPACK, nodes));
+  // trailing bytes
+  ASSERT_FALSE(serializer::deserialize("\x01\x02", 2, MC_FLAG_MSGPACK, nodes));
+  // an extension
+  ASSERT_FALSE(serializer::deserialize("\xd4\x01\x00", 3, MC_FLAG_MSGPACK, nodes));
+  // an array32 of 2^32-1 items in a few bytes
+  ASSERT_FALSE(serializer::deserialize("\xdd\xff\xff\xff\xff\x01", 6, MC_FLAG_MSGPACK, nodes));
+
+  // as deep as it gets, without recursion
+  std::string deep(1 << 20, '\x91');
+  deep.push_back('\xc0');
+  nodes.clear();
+  ASSERT_TRUE(serializer::deserialize(deep.data(), deep.size(), MC_FLAG_MSGPACK, nodes));
+  ASSERT_EQ(nodes.size(), deep.size());
+}
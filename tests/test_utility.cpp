@@ -0,0 +1,66 @@
+#include "Utility.h"
+
+#include <cstring>
+#include <string>
+#include "gtest/gtest.h"
+
+using douban::mc::utility::isValidKey;
+using douban::mc::utility::findInvalidKeyByte;
+using douban::mc::utility::base64Length;
+using douban::mc::utility::base64Encode;
+using douban::mc::utility::base64Decode;
+
+
+TEST(test_utility, invalid_key_bytes) {
+  const char invalid[] = {' ', '\r', '\n', '\0'};
+  // every offset of a block and of the tail after it
+  for (size_t len = 1; len <= 40; ++len) {
+    std::string key(len, 'k');
+    ASSERT_EQ(findInvalidKeyByte(key.data(), len), len);
+    ASSERT_TRUE(isValidKey(key.data(), len));
+    for (size_t i = 0; i < len; ++i) {
+      for (size_t j = 0; j < sizeof invalid; ++j) {
+        std::string bad(key);
+        bad[i] = invalid[j];
+        ASSERT_EQ(findInvalidKeyByte(bad.data(), len), i);
+        bad[len - 1] = invalid[j];
+        ASSERT_EQ(findInvalidKeyByte(bad.data(), len), i);
+      }
+    }
+  }
+  std::string key("\t\x01\x7f\xff?~%");
+  ASSERT_EQ(findInvalidKeyByte(key.data(), key.size()), key.size());
+  std::string longKey(MC_MAX_KEY_LENGTH + 1, 'k');
+  ASSERT_FALSE(isValidKey(longKey.data(), longKey.size()));
+  ASSERT_TRUE(isValidKey(longKey.data(), MC_MAX_KEY_LENGTH));
+}
+
+
+TEST(test_utility, base64) {
+  std::string raw;
+  for (int i = 0; i < 256; ++i) {
+    raw.push_back(static_cast<char>(i));
+  }
+  char encoded[512];
+  for (size_t len = 0; len < 8; ++len) {
+    size_t n = base64Encode(raw.data() + 250, len, encoded);
+    ASSERT_EQ(n, base64Length(len));
+  }
+  size_t n = base64Encode(raw.data(), raw.size(), encoded);
+  ASSERT_EQ(n, base64Length(raw.size()));
+  ASSERT_EQ(findInvalidKeyByte(encoded, n), n);
+  ASSERT_EQ(std::string(encoded, 4), "AAEC");
+  ASSERT_EQ(std::string(encoded + n - 6, 6), "_P3-_w");
+
+  // in place, as RetrievalResult decodes the keys
+  char decoded[512];
+  memcpy(decoded + 1, encoded, n);
+  size_t decodedLen = 0;
+  ASSERT_TRUE(base64Decode(decoded + 1, n, decoded, decodedLen));
+  ASSERT_EQ(std::string(decoded, decodedLen), raw);
+
+  ASSERT_TRUE(base64Decode("a2V5", 4, decoded, decodedLen));
+  ASSERT_EQ(std::string(decoded, decodedLen), "key");
+  ASSERT_FALSE(base64Decode("a2V5a", 5, decoded, decodedLen));
+  ASSERT_FALSE(base64Decode("a2+5", 4, decoded, decodedLen));
+}